@@ -0,0 +1,185 @@
+# ******************************************************************************
+# Copyright 2017-2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+"""
+Gradient allreduce bucketing benchmark of the HeTr CPU (MLSL) transformer.
+
+Trains a deep MLP with a bias per layer, data parallel over several processes on
+this host, on synthetic data, and reports the training step time for every
+gradient bucket size. Bucket size 0 issues one allreduce per gradient tensor; the
+many small bias gradients then each cost one latency bound collective.
+
+Every bucket size runs in its own process with HETR_ALLREDUCE_BUCKET_BYTES set,
+since the HeTr servers read it when they are launched.
+
+Usage (from the repository root, with MLSL and mpirun available):
+
+    python -m examples.benchmarks.allreduce_bucketing --processes 2 \\
+        --bucket_bytes 0 65536 4194304 --layers 16 --hidden 512 -z 64 -t 50
+
+"""
+from __future__ import division, print_function
+from collections import OrderedDict
+from contextlib import closing
+import json
+import os
+import subprocess
+import sys
+
+from monotonic import monotonic
+import numpy as np
+import ngraph as ng
+import ngraph.transformers as ngt
+from ngraph.frontends.neon import NgraphArgparser, ArrayIterator
+from ngraph.frontends.neon import Sequential, Affine, KaimingInit, Rectlin, Softmax
+from ngraph.frontends.neon import GradientDescentMomentum, ax
+
+RESULT_PREFIX = 'ALLREDUCE_BUCKETING_RESULT '
+NUM_FEATURES = 784
+NUM_CLASSES = 10
+
+
+def run_config(args):
+    """
+    Runs training steps for the bucket size in the environment and prints the result.
+    """
+    np.random.seed(args.rng_seed if args.rng_seed is not None else 0)
+    data = {'image': {'data': np.random.uniform(-1, 1, (args.batch_size, NUM_FEATURES)),
+                      'axes': ('N', 'F')},
+            'label': {'data': np.random.randint(0, NUM_CLASSES, args.batch_size)
+                      .astype(np.int32), 'axes': ('N',)}}
+    train_set = ArrayIterator(data, batch_size=args.batch_size)
+    inputs = train_set.make_placeholders()
+    batch = next(iter(train_set))
+    ax.Y.length = NUM_CLASSES
+
+    device_ids = tuple(str(i) for i in range(args.processes))
+    with ng.metadata(device_id=device_ids, parallel=ax.N):
+        init = KaimingInit()
+        layers = [Affine(nout=args.hidden, weight_init=init, bias_init=init,
+                         activation=Rectlin()) for _ in range(args.layers)]
+        layers.append(Affine(axes=ax.Y, weight_init=init, bias_init=init,
+                             activation=Softmax()))
+        model = Sequential(layers)
+        train_prob = model(inputs['image'])
+        train_loss = ng.cross_entropy_multi(train_prob,
+                                            ng.one_hot(inputs['label'], axis=ax.Y))
+        optimizer = GradientDescentMomentum(0.01, 0.9)
+        batch_cost = ng.sequential([optimizer(train_loss), ng.mean(train_loss, out_axes=())])
+
+    with closing(ngt.make_transformer_factory('hetr', device='cpu')()) as transformer:
+        function = transformer.computation(batch_cost, inputs['image'], inputs['label'])
+        for _ in range(args.warmup + 1):
+            function(batch['image'], batch['label'])
+        times = []
+        for _ in range(args.num_iterations):
+            start = monotonic()
+            function(batch['image'], batch['label'])
+            times.append(monotonic() - start)
+    times = np.array(times) * 1000.0
+
+    result = OrderedDict([
+        ('bucket_bytes', int(os.environ['HETR_ALLREDUCE_BUCKET_BYTES'])),
+        ('processes', args.processes),
+        ('gradients', 2 * (args.layers + 1)),
+        ('mean_ms', times.mean()),
+        ('p50_ms', np.percentile(times, 50)),
+        ('p90_ms', np.percentile(times, 90)),
+        ('samples_per_s', args.batch_size / (times.mean() / 1000.0))])
+    print(RESULT_PREFIX + json.dumps(result))
+
+
+def launch_config(args, bucket_bytes):
+    repo_root = os.path.dirname(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+    env = dict(os.environ)
+    env['HETR_ALLREDUCE_BUCKET_BYTES'] = str(bucket_bytes)
+    env['PYTHONPATH'] = os.pathsep.join(filter(None, [repo_root, env.get('PYTHONPATH')]))
+    command = [sys.executable, '-m', 'examples.benchmarks.allreduce_bucketing', '--run_config',
+               '--processes', str(args.processes), '--layers', str(args.layers),
+               '--hidden', str(args.hidden), '-z', str(args.batch_size),
+               '-t', str(args.num_iterations), '--warmup', str(args.warmup)]
+    if args.rng_seed is not None:
+        command += ['-r', str(args.rng_seed)]
+    process = subprocess.Popen(command, env=env, cwd=repo_root, stdout=subprocess.PIPE,
+                               universal_newlines=True)
+    output, _ = process.communicate()
+    for line in output.splitlines():
+        if line.startswith(RESULT_PREFIX):
+            return json.loads(line[len(RESULT_PREFIX):], object_pairs_hook=OrderedDict)
+    print("Bucket size {} failed (exit status {})".format(bucket_bytes, process.returncode))
+    return None
+
+
+def print_results(results):
+    header = ('Bucket bytes', 'Processes', 'Gradients', 'Mean ms', 'p50 ms', 'p90 ms',
+              'Samples/s', 'Speedup')
+    formatter = '| {:^12} ' * len(header) + '|'
+    head_str = formatter.format(*header)
+    sep = '-' * len(head_str)
+    print(sep)
+    print(head_str)
+    print(sep)
+    base = next((r for r in results if r['bucket_bytes'] == 0), results[0])
+    for r in results:
+        print(formatter.format(r['bucket_bytes'], r['processes'], r['gradients'],
+                               '{:.2f}'.format(r['mean_ms']), '{:.2f}'.format(r['p50_ms']),
+                               '{:.2f}'.format(r['p90_ms']),
+                               '{:.1f}'.format(r['samples_per_s']),
+                               '{:.2f}x'.format(base['mean_ms'] / r['mean_ms'])))
+    print(sep)
+
+
+def main():
+    parser = NgraphArgparser(description=__doc__)
+    parser.add_argument('--processes', type=int, default=2,
+                        help='data parallel processes on this host')
+    parser.add_argument('--bucket_bytes', type=int, nargs='+',
+                        default=[0, 64 * 1024, 1024 * 1024, 4 * 1024 * 1024],
+                        help='bucket sizes to run, 0 for one allreduce per gradient')
+    parser.add_argument('--layers', type=int, default=16, help='hidden layers of the MLP')
+    parser.add_argument('--hidden', type=int, default=512, help='units per hidden layer')
+    parser.add_argument('--warmup', type=int, default=5,
+                        help='untimed steps before timing')
+    parser.add_argument('--results', default='allreduce_bucketing.json',
+                        help='JSON file to write the results to')
+    parser.add_argument('--run_config', action='store_true',
+                        help='internal: run the bucket size of the environment in this process')
+    parser.set_defaults(batch_size=64, num_iterations=50)
+    args = parser.parse_args()
+
+    if args.run_config:
+        run_config(args)
+        return
+
+    results = []
+    for bucket_bytes in args.bucket_bytes:
+        print("Running with {} byte buckets on {} processes".format(bucket_bytes,
+                                                                   args.processes))
+        result = launch_config(args, bucket_bytes)
+        if result is not None:
+            results.append(result)
+    if not results:
+        return
+
+    print_results(results)
+    with open(args.results, 'w') as f:
+        json.dump(OrderedDict([('batch_size', args.batch_size),
+                               ('iterations', args.num_iterations),
+                               ('results', results)]), f, indent=2)
+    print("Results written to {}".format(args.results))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,383 @@
+# ******************************************************************************
+# Copyright 2017-2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+"""
+End-to-end throughput and thread scaling benchmark of the CPU transformer.
+
+Builds ResNet-50, VGG-16, a two layer LSTM word language model and an MLP with
+the neon frontend on synthetic data and times training and inference steps.
+For every model, mode and thread count it reports samples/s, p50/p99 step
+latency, compile time, peak memory and the time per step spent in MKL-DNN
+kernels, layout reorders, numpy ops and Python overhead, followed by the
+scaling of throughput with the thread count.
+
+Every (model, mode, threads) configuration runs in its own process, pinned to
+that many cores with OMP_NUM_THREADS set, since OpenMP and MKL-DNN size their
+thread pools at start-up and peak memory is per process.
+
+Usage (from the repository root):
+
+    python -m examples.benchmarks.cpu_throughput --models resnet50 mlp \\
+        --modes train inference --threads 1 2 4 max -z 32 -t 50 --results out.json
+
+"""
+from __future__ import division, print_function
+from collections import OrderedDict
+from contextlib import closing
+import json
+import multiprocessing
+import os
+import resource
+import subprocess
+import sys
+
+from monotonic import monotonic
+import numpy as np
+import ngraph as ng
+import ngraph.transformers as ngt
+from ngraph.frontends.neon import NgraphArgparser, ArrayIterator, SequentialArrayIterator
+from ngraph.frontends.neon import Layer, Sequential, Affine, Convolution, Pooling
+from ngraph.frontends.neon import LookupTable, LSTM, Preprocess
+from ngraph.frontends.neon import GaussianInit, UniformInit, KaimingInit
+from ngraph.frontends.neon import Rectlin, Softmax, Tanh, Logistic
+from ngraph.frontends.neon import GradientDescentMomentum, RMSProp
+from ngraph.frontends.neon import ax
+from ngraph.transformers.passes.mkldnnpasses import MklReorderOp
+from examples.resnet.resnet import BuildResnet, num_i1k_resmods
+
+MODELS = ('resnet50', 'vgg16', 'lstm_lm', 'mlp')
+MODES = ('train', 'inference')
+CATEGORIES = ('mkl_kernel', 'reorder', 'numpy_op', 'python_overhead')
+RESULT_PREFIX = 'CPU_THROUGHPUT_RESULT '
+
+# Word language model sizes (PTB medium)
+LM_VOCAB = 10000
+LM_EMBED = 650
+LM_HIDDEN = 650
+LM_TIME_STEPS = 35
+
+
+def image_data(batch_size, channels, height, width, num_classes):
+    data = {'image': {'data': np.random.uniform(-1, 1, (batch_size, channels, height, width)),
+                      'axes': ('N', 'C', 'H', 'W')},
+            'label': {'data': np.random.randint(0, num_classes, batch_size).astype(np.int32),
+                      'axes': ('N',)}}
+    train_set = ArrayIterator(data, batch_size=batch_size)
+    ax.Y.length = num_classes
+    return train_set.make_placeholders(), next(iter(train_set))
+
+
+def vgg16():
+    init = GaussianInit(std=0.01)
+    layers = []
+    for num_convs, num_filters in ((2, 64), (2, 128), (3, 256), (3, 512), (3, 512)):
+        for _ in range(num_convs):
+            layers.append(Convolution((3, 3, num_filters), filter_init=init,
+                                      bias_init=init, activation=Rectlin(), padding=1))
+        layers.append(Pooling((2, 2), strides=2))
+    layers += [Affine(nout=4096, weight_init=init, bias_init=init, activation=Rectlin()),
+               Affine(nout=4096, weight_init=init, bias_init=init, activation=Rectlin()),
+               Affine(axes=ax.Y, weight_init=init, bias_init=init, activation=Softmax())]
+    return Sequential(layers)
+
+
+def mlp():
+    init = KaimingInit()
+    return Sequential([Preprocess(functor=lambda x: x / 255.),
+                       Affine(nout=1024, weight_init=init, activation=Rectlin()),
+                       Affine(nout=1024, weight_init=init, activation=Rectlin()),
+                       Affine(nout=1024, weight_init=init, activation=Rectlin()),
+                       Affine(axes=ax.Y, weight_init=init, activation=Softmax())])
+
+
+def build_model(name, batch_size):
+    """
+    Builds a model on synthetic data.
+
+    Returns:
+        (feed_dict, train outputs, inference outputs, samples per step)
+    """
+    if name == 'lstm_lm':
+        tokens = batch_size * LM_TIME_STEPS
+        data = {'inp_txt': np.random.randint(0, LM_VOCAB, tokens),
+                'tgt_txt': np.random.randint(0, LM_VOCAB, tokens)}
+        train_set = SequentialArrayIterator(data, batch_size=batch_size,
+                                            time_steps=LM_TIME_STEPS)
+        inputs = train_set.make_placeholders()
+        batch = next(iter(train_set))
+        ax.Y.length = LM_VOCAB
+        init = UniformInit(low=-0.05, high=0.05)
+        model = Sequential([LookupTable(LM_VOCAB, LM_EMBED, init, update=True),
+                            LSTM(LM_HIDDEN, init, activation=Tanh(),
+                                 gate_activation=Logistic(), return_sequence=True),
+                            LSTM(LM_HIDDEN, init, activation=Tanh(),
+                                 gate_activation=Logistic(), return_sequence=True),
+                            Affine(init, activation=Softmax(), bias_init=init, axes=(ax.Y,))])
+        optimizer = RMSProp(gradient_clip_value=5)
+        data_key, label_key = 'inp_txt', 'tgt_txt'
+        samples = tokens
+    else:
+        if name == 'resnet50':
+            inputs, batch = image_data(batch_size, 3, 224, 224, 1000)
+            model = BuildResnet('i1k', 50, True, num_i1k_resmods(50))
+            optimizer = GradientDescentMomentum(0.1, 0.9, wdecay=0.0001)
+        elif name == 'vgg16':
+            inputs, batch = image_data(batch_size, 3, 224, 224, 1000)
+            model = vgg16()
+            optimizer = GradientDescentMomentum(0.01, 0.9, wdecay=0.0005)
+        elif name == 'mlp':
+            inputs, batch = image_data(batch_size, 1, 28, 28, 10)
+            model = mlp()
+            optimizer = GradientDescentMomentum(0.1, 0.9)
+        else:
+            raise ValueError("Unknown model {}".format(name))
+        data_key, label_key = 'image', 'label'
+        samples = batch_size
+
+    train_prob = model(inputs[data_key])
+    train_loss = ng.cross_entropy_multi(train_prob, ng.one_hot(inputs[label_key], axis=ax.Y))
+    batch_cost = ng.sequential([optimizer(train_loss), ng.mean(train_loss, out_axes=())])
+    with Layer.inference_mode_on():
+        inference_prob = model(inputs[data_key])
+
+    feed_dict = {inputs[k]: batch[k] for k in inputs.keys()}
+    return feed_dict, batch_cost, inference_prob, samples
+
+
+def op_category(transformer, exop):
+    op = exop.op
+    if isinstance(op, MklReorderOp):
+        return 'reorder'
+    if transformer.mkldnn.enabled and op.safe_name in transformer.mkldnn.kernels:
+        return 'mkl_kernel'
+    return 'numpy_op'
+
+
+def time_steps(function, feed_dict, warmup, iterations):
+    for _ in range(warmup):
+        function(feed_dict=feed_dict)
+    times = []
+    for _ in range(iterations):
+        start = monotonic()
+        function(feed_dict=feed_dict)
+        times.append(monotonic() - start)
+    return np.array(times) * 1000.0
+
+
+def profile_steps(computation, feed_dict, warmup, iterations):
+    """
+    Runs the computation with per-op timing.
+
+    Returns:
+        Mean milliseconds per step in each category of CATEGORIES.
+    """
+    os.environ['TRACING'] = '1'
+    try:
+        with closing(ngt.make_transformer_factory('cpu')()) as transformer:
+            function = transformer.add_computation(computation)
+            totals = dict()
+
+            def listener(timings):
+                for exop, start, stop in timings:
+                    category = op_category(transformer, exop)
+                    totals[category] = totals.get(category, 0.0) + stop - start
+
+            function.profile_listener = listener
+            for _ in range(warmup):
+                function(feed_dict=feed_dict)
+            totals.clear()
+            step_times = time_steps(function, feed_dict, 0, iterations)
+    finally:
+        del os.environ['TRACING']
+    profile = OrderedDict((c, totals.get(c, 0.0) * 1000.0 / iterations)
+                          for c in CATEGORIES[:-1])
+    profile['python_overhead'] = max(step_times.mean() - sum(profile.values()), 0.0)
+    return profile
+
+
+def run_config(args):
+    """
+    Runs one (model, mode) configuration in this process and prints its result.
+    """
+    np.random.seed(args.rng_seed if args.rng_seed is not None else 0)
+    feed_dict, batch_cost, inference_prob, samples = build_model(args.models[0],
+                                                                 args.batch_size)
+    mode = args.modes[0]
+    outputs = batch_cost if mode == 'train' else inference_prob
+    computation = ng.computation(outputs, 'all')
+
+    with closing(ngt.make_transformer_factory('cpu')()) as transformer:
+        # Compilation and the first step, which creates the MKL-DNN primitives
+        start = monotonic()
+        function = transformer.add_computation(computation)
+        function(feed_dict=feed_dict)
+        compile_s = monotonic() - start
+        times = time_steps(function, feed_dict, args.warmup, args.num_iterations)
+    # Linux reports kilobytes
+    peak_bytes = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss * 1024
+
+    result = OrderedDict([
+        ('model', args.models[0]),
+        ('mode', mode),
+        ('batch_size', args.batch_size),
+        ('samples_per_step', samples),
+        ('samples_per_s', samples / (times.mean() / 1000.0)),
+        ('mean_ms', times.mean()),
+        ('p50_ms', np.percentile(times, 50)),
+        ('p99_ms', np.percentile(times, 99)),
+        ('min_ms', times.min()),
+        ('compile_s', compile_s),
+        ('peak_memory_bytes', peak_bytes)])
+    if args.profile_iterations > 0:
+        result['profile_ms'] = profile_steps(computation, feed_dict, args.warmup,
+                                             args.profile_iterations)
+    print(RESULT_PREFIX + json.dumps(result))
+
+
+def thread_counts(values):
+    if hasattr(os, 'sched_getaffinity'):
+        max_threads = len(os.sched_getaffinity(0))
+    else:
+        max_threads = multiprocessing.cpu_count()
+    if not values:
+        counts = [1]
+        while counts[-1] * 2 < max_threads:
+            counts.append(counts[-1] * 2)
+        values = counts + ['max']
+    return sorted(set(max_threads if v == 'max' else min(int(v), max_threads)
+                      for v in values))
+
+
+def launch_config(args, model, mode, threads):
+    repo_root = os.path.dirname(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+    env = dict(os.environ)
+    env['OMP_NUM_THREADS'] = str(threads)
+    env['MKL_NUM_THREADS'] = str(threads)
+    env.setdefault('KMP_AFFINITY', 'granularity=fine,compact,1,0')
+    env['PYTHONPATH'] = os.pathsep.join(filter(None, [repo_root, env.get('PYTHONPATH')]))
+    command = [sys.executable, '-m', 'examples.benchmarks.cpu_throughput', '--run_config',
+               '--models', model, '--modes', mode, '-z', str(args.batch_size),
+               '-t', str(args.num_iterations), '--warmup', str(args.warmup),
+               '--profile_iterations', str(args.profile_iterations)]
+    if args.rng_seed is not None:
+        command += ['-r', str(args.rng_seed)]
+
+    def pin_cores():
+        if hasattr(os, 'sched_setaffinity'):
+            cores = sorted(os.sched_getaffinity(0))[:threads]
+            os.sched_setaffinity(0, cores)
+
+    process = subprocess.Popen(command, env=env, cwd=repo_root, stdout=subprocess.PIPE,
+                               universal_newlines=True, preexec_fn=pin_cores)
+    output, _ = process.communicate()
+    for line in output.splitlines():
+        if line.startswith(RESULT_PREFIX):
+            result = json.loads(line[len(RESULT_PREFIX):], object_pairs_hook=OrderedDict)
+            result['threads'] = threads
+            return result
+    print("{} {} with {} threads failed (exit status {})".format(
+        model, mode, threads, process.returncode))
+    return None
+
+
+def scaling_curves(results):
+    curves = []
+    for model in MODELS:
+        for mode in MODES:
+            runs = sorted((r for r in results if r['model'] == model and r['mode'] == mode),
+                          key=lambda r: r['threads'])
+            if not runs:
+                continue
+            base = runs[0]
+            points = []
+            for r in runs:
+                speedup = r['samples_per_s'] / base['samples_per_s']
+                points.append(OrderedDict([
+                    ('threads', r['threads']),
+                    ('samples_per_s', r['samples_per_s']),
+                    ('speedup', speedup),
+                    ('efficiency', speedup * base['threads'] / r['threads'])]))
+            curves.append(OrderedDict([('model', model), ('mode', mode), ('points', points)]))
+    return curves
+
+
+def print_results(results, curves):
+    header = ('Model', 'Mode', 'Threads', 'Samples/s', 'p50 ms', 'p99 ms', 'Peak MB',
+              'MKL ms', 'Reorder ms', 'Numpy ms', 'Python ms')
+    formatter = '| {:^12} ' * len(header) + '|'
+    head_str = formatter.format(*header)
+    sep = '-' * len(head_str)
+    print(sep)
+    print(head_str)
+    print(sep)
+    for r in results:
+        profile = r.get('profile_ms', {})
+        print(formatter.format(r['model'], r['mode'], r['threads'],
+                               '{:.1f}'.format(r['samples_per_s']),
+                               '{:.2f}'.format(r['p50_ms']), '{:.2f}'.format(r['p99_ms']),
+                               '{:.0f}'.format(r['peak_memory_bytes'] / 2.0**20),
+                               *('{:.2f}'.format(profile[c]) if c in profile else '-'
+                                 for c in CATEGORIES)))
+    print(sep)
+    for curve in curves:
+        print('{} {} scaling: '.format(curve['model'], curve['mode']) +
+              ', '.join('{}T {:.2f}x ({:.0%})'.format(p['threads'], p['speedup'],
+                                                     p['efficiency'])
+                        for p in curve['points']))
+
+
+def main():
+    parser = NgraphArgparser(description=__doc__)
+    parser.add_argument('--models', nargs='+', choices=MODELS, default=list(MODELS))
+    parser.add_argument('--modes', nargs='+', choices=MODES, default=list(MODES))
+    parser.add_argument('--threads', nargs='+', default=None,
+                        help="thread counts to run, 'max' for all cores "
+                             "(default: powers of two and max)")
+    parser.add_argument('--warmup', type=int, default=5,
+                        help='untimed steps before timing')
+    parser.add_argument('--profile_iterations', type=int, default=10,
+                        help='steps run with per-op timing, 0 to skip the op breakdown')
+    parser.add_argument('--results', default='cpu_throughput.json',
+                        help='JSON file to write the results to')
+    parser.add_argument('--run_config', action='store_true',
+                        help='internal: run the single given configuration in this process')
+    parser.set_defaults(batch_size=32, num_iterations=20)
+    args = parser.parse_args()
+
+    if args.run_config:
+        run_config(args)
+        return
+
+    results = []
+    for model in args.models:
+        for mode in args.modes:
+            for threads in thread_counts(args.threads):
+                print("Running {} {} with {} threads".format(model, mode, threads))
+                result = launch_config(args, model, mode, threads)
+                if result is not None:
+                    results.append(result)
+
+    curves = scaling_curves(results)
+    print_results(results, curves)
+    with open(args.results, 'w') as f:
+        json.dump(OrderedDict([('batch_size', args.batch_size),
+                               ('iterations', args.num_iterations),
+                               ('results', results),
+                               ('scaling', curves)]), f, indent=2)
+    print("Results written to {}".format(args.results))
+
+
+if __name__ == '__main__':
+    main()
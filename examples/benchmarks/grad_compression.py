@@ -0,0 +1,211 @@
+# ******************************************************************************
+# Copyright 2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+"""
+Gradient compression benchmark of the HeTr CPU allreduce.
+
+Trains a small MLP data parallel over several processes on a synthetic
+classification task (labels of a random teacher network) once per compression
+spec, and reports the gradient bytes each process sends per step, their
+reduction against uncompressed float32, the step time and the training loss
+over the run, to show the effect of the compression on convergence.
+
+Every spec runs in its own process with HETR_GRAD_COMPRESSION set, since the
+HeTr servers read it when they are launched. Gradients smaller than
+HETR_GRAD_COMPRESSION_MIN_ELEMENTS (the biases) stay uncompressed.
+
+Usage (from the repository root, with MLSL or HETR_COLLECTIVES=shm):
+
+    python -m examples.benchmarks.grad_compression --processes 2 \\
+        --specs none fp16 topk:0.1 topk:0.01 -z 64 -t 300
+
+"""
+from __future__ import division, print_function
+from collections import OrderedDict
+from contextlib import closing
+import json
+import os
+import subprocess
+import sys
+
+from monotonic import monotonic
+import numpy as np
+import ngraph as ng
+import ngraph.transformers as ngt
+from ngraph.frontends.neon import NgraphArgparser, ArrayIterator
+from ngraph.frontends.neon import Sequential, Affine, KaimingInit, Rectlin, Softmax
+from ngraph.frontends.neon import GradientDescentMomentum, ax
+from ngraph.transformers.cpu.grad_compression import compression_spec, make_compressor
+
+RESULT_PREFIX = 'GRAD_COMPRESSION_RESULT '
+NUM_FEATURES = 256
+NUM_CLASSES = 10
+NUM_SAMPLES = 8192
+
+
+def teacher_data(rng_seed):
+    """
+    Inputs and the labels a fixed random two layer network gives them.
+    """
+    rng = np.random.RandomState(rng_seed)
+    x = rng.normal(size=(NUM_SAMPLES, NUM_FEATURES)).astype(np.float32)
+    w1 = rng.normal(size=(NUM_FEATURES, 64)) / np.sqrt(NUM_FEATURES)
+    w2 = rng.normal(size=(64, NUM_CLASSES)) / 8.0
+    labels = np.argmax(np.maximum(x.dot(w1), 0).dot(w2), axis=1).astype(np.int32)
+    return {'image': {'data': x, 'axes': ('N', 'F')},
+            'label': {'data': labels, 'axes': ('N',)}}
+
+
+def sent_bytes(variables):
+    """
+    Bytes of gradients one process sends per step, and those of uncompressed float32.
+    """
+    sent = total = 0
+    for variable in variables:
+        size = variable.axes.size
+        compressor = make_compressor(compression_spec(variable.metadata, size), size)
+        total += 4 * size
+        sent += compressor.payload_bytes if compressor is not None else 4 * size
+    return sent, total
+
+
+def run_config(args):
+    """
+    Trains with the compression spec in the environment and prints the result.
+    """
+    rng_seed = args.rng_seed if args.rng_seed is not None else 0
+    np.random.seed(rng_seed)
+    train_set = ArrayIterator(teacher_data(rng_seed), batch_size=args.batch_size,
+                              total_iterations=args.num_iterations)
+    inputs = train_set.make_placeholders()
+    ax.Y.length = NUM_CLASSES
+
+    device_ids = tuple(str(i) for i in range(args.processes))
+    with ng.metadata(device_id=device_ids, parallel=ax.N):
+        init = KaimingInit()
+        model = Sequential([Affine(nout=args.hidden, weight_init=init, bias_init=init,
+                                   activation=Rectlin()),
+                            Affine(nout=args.hidden, weight_init=init, bias_init=init,
+                                   activation=Rectlin()),
+                            Affine(axes=ax.Y, weight_init=init, bias_init=init,
+                                   activation=Softmax())])
+        train_prob = model(inputs['image'])
+        train_loss = ng.cross_entropy_multi(train_prob,
+                                            ng.one_hot(inputs['label'], axis=ax.Y))
+        optimizer = GradientDescentMomentum(0.05, 0.9)
+        batch_cost = ng.sequential([optimizer(train_loss), ng.mean(train_loss, out_axes=())])
+    sent, total = sent_bytes(train_loss.variables())
+
+    losses = []
+    times = []
+    with closing(ngt.make_transformer_factory('hetr', device='cpu')()) as transformer:
+        function = transformer.computation(batch_cost, inputs['image'], inputs['label'])
+        for batch in train_set:
+            start = monotonic()
+            losses.append(float(function(batch['image'], batch['label'])))
+            times.append(monotonic() - start)
+    # The first step includes compilation
+    times = np.array(times[1:]) * 1000.0
+
+    window = max(1, len(losses) // 10)
+    result = OrderedDict([
+        ('spec', os.environ['HETR_GRAD_COMPRESSION']),
+        ('processes', args.processes),
+        ('sent_bytes_per_step', sent),
+        ('float32_bytes_per_step', total),
+        ('reduction', total / sent),
+        ('mean_ms', times.mean()),
+        ('initial_loss', float(np.mean(losses[:window]))),
+        ('final_loss', float(np.mean(losses[-window:]))),
+        ('losses', losses)])
+    print(RESULT_PREFIX + json.dumps(result))
+
+
+def launch_config(args, spec):
+    repo_root = os.path.dirname(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+    env = dict(os.environ)
+    env['HETR_GRAD_COMPRESSION'] = spec
+    env['PYTHONPATH'] = os.pathsep.join(filter(None, [repo_root, env.get('PYTHONPATH')]))
+    command = [sys.executable, '-m', 'examples.benchmarks.grad_compression', '--run_config',
+               '--processes', str(args.processes), '--hidden', str(args.hidden),
+               '-z', str(args.batch_size), '-t', str(args.num_iterations)]
+    if args.rng_seed is not None:
+        command += ['-r', str(args.rng_seed)]
+    process = subprocess.Popen(command, env=env, cwd=repo_root, stdout=subprocess.PIPE,
+                               universal_newlines=True)
+    output, _ = process.communicate()
+    for line in output.splitlines():
+        if line.startswith(RESULT_PREFIX):
+            return json.loads(line[len(RESULT_PREFIX):], object_pairs_hook=OrderedDict)
+    print("Compression {} failed (exit status {})".format(spec, process.returncode))
+    return None
+
+
+def print_results(results):
+    header = ('Compression', 'Processes', 'Sent KB/step', 'Reduction', 'Mean ms',
+              'Initial loss', 'Final loss')
+    formatter = '| {:^12} ' * len(header) + '|'
+    head_str = formatter.format(*header)
+    sep = '-' * len(head_str)
+    print(sep)
+    print(head_str)
+    print(sep)
+    for r in results:
+        print(formatter.format(r['spec'], r['processes'],
+                               '{:.1f}'.format(r['sent_bytes_per_step'] / 1024.0),
+                               '{:.1f}x'.format(r['reduction']),
+                               '{:.2f}'.format(r['mean_ms']),
+                               '{:.4f}'.format(r['initial_loss']),
+                               '{:.4f}'.format(r['final_loss'])))
+    print(sep)
+
+
+def main():
+    parser = NgraphArgparser(description=__doc__)
+    parser.add_argument('--processes', type=int, default=2,
+                        help='data parallel processes on this host')
+    parser.add_argument('--specs', nargs='+', default=['none', 'fp16', 'topk:0.1', 'topk:0.01'],
+                        help='gradient compression specs to run')
+    parser.add_argument('--hidden', type=int, default=512, help='units per hidden layer')
+    parser.add_argument('--results', default='grad_compression.json',
+                        help='JSON file to write the results, with the loss curves, to')
+    parser.add_argument('--run_config', action='store_true',
+                        help='internal: run the compression of the environment in this process')
+    parser.set_defaults(batch_size=64, num_iterations=300)
+    args = parser.parse_args()
+
+    if args.run_config:
+        run_config(args)
+        return
+
+    results = []
+    for spec in args.specs:
+        print("Running with {} gradients on {} processes".format(spec, args.processes))
+        result = launch_config(args, spec)
+        if result is not None:
+            results.append(result)
+    if not results:
+        return
+
+    print_results(results)
+    with open(args.results, 'w') as f:
+        json.dump(OrderedDict([('batch_size', args.batch_size),
+                               ('iterations', args.num_iterations),
+                               ('results', results)]), f, indent=2)
+    print("Results written to {}".format(args.results))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,205 @@
+# ******************************************************************************
+# Copyright 2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+"""
+Pipeline parallel benchmark of the HeTr CPU transformer.
+
+Splits a deep MLP into two stages, one HeTr server each, pinned to the cores of
+a NUMA node, and streams the batch through them in micro-batches. Reports the
+throughput for each number of micro-batches, with the bubble, the fraction of
+a call a stage idles while the pipeline fills and drains, (S - 1) / (M + S - 1)
+for S stages and M micro-batches.
+
+The stages are pinned with HETR_CPUSETS, to the cpus of the first two nodes of
+/sys/devices/system/node. On hosts with a single node, the two socket layout is
+emulated by splitting the cpus of this process in two halves.
+
+Every micro-batch count runs in its own process, since the HeTr servers read
+HETR_CPUSETS when they are launched.
+
+Usage (from the repository root):
+
+    python -m examples.benchmarks.pipeline_parallel --micro_batches 1 2 4 8 \\
+        -z 256 -t 50
+
+"""
+from __future__ import division, print_function
+from collections import OrderedDict
+from contextlib import closing
+import glob
+import json
+import multiprocessing
+import os
+import subprocess
+import sys
+
+from monotonic import monotonic
+import numpy as np
+import ngraph as ng
+import ngraph.transformers as ngt
+from ngraph.frontends.neon import NgraphArgparser
+from ngraph.frontends.neon import Sequential, Affine, KaimingInit, Rectlin, ax
+
+RESULT_PREFIX = 'PIPELINE_PARALLEL_RESULT '
+NUM_STAGES = 2
+NUM_FEATURES = 1024
+
+
+def stage_cpusets():
+    """
+    The cpulists the stages are pinned to, and whether the NUMA layout is emulated.
+    """
+    nodes = sorted(glob.glob('/sys/devices/system/node/node[0-9]*/cpulist'))
+    if len(nodes) >= NUM_STAGES:
+        cpulists = []
+        for node in nodes[:NUM_STAGES]:
+            with open(node) as f:
+                cpulists.append(f.read().strip())
+        return cpulists, False
+    if hasattr(os, 'sched_getaffinity'):
+        cpus = sorted(os.sched_getaffinity(0))
+    else:
+        cpus = list(range(multiprocessing.cpu_count()))
+    half = max(1, len(cpus) // NUM_STAGES)
+    halves = [cpus[:half], cpus[half:] or cpus[:half]]
+    return [','.join(str(c) for c in h) for h in halves], True
+
+
+def run_config(args):
+    """
+    Runs the forward pass in args.micro_batches micro-batches and prints the result.
+    """
+    rng_seed = args.rng_seed if args.rng_seed is not None else 0
+    np.random.seed(rng_seed)
+    ax.N.length = args.batch_size
+    F = ng.make_axis(length=NUM_FEATURES, name='F')
+    x = ng.placeholder([F, ax.N])
+
+    init = KaimingInit()
+    layers_per_stage = args.layers // NUM_STAGES
+    hidden = x
+    for stage in range(NUM_STAGES):
+        with ng.metadata(device_id=str(stage), pipeline=ax.N):
+            model = Sequential([Affine(nout=args.hidden, weight_init=init, bias_init=init,
+                                       activation=Rectlin())
+                                for _ in range(layers_per_stage)])
+            hidden = model(hidden)
+    with ng.metadata(device_id=str(NUM_STAGES - 1), pipeline=ax.N):
+        output = ng.sum(hidden, reduction_axes=hidden.axes.feature_axes())
+
+    data = np.random.normal(size=(NUM_FEATURES, args.batch_size)).astype(np.float32)
+    factory = ngt.make_transformer_factory('hetr', device='cpu',
+                                           micro_batches=args.micro_batches)
+    times = []
+    with closing(factory()) as transformer:
+        function = transformer.computation(output, x)
+        for _ in range(args.num_iterations):
+            start = monotonic()
+            function(data)
+            times.append(monotonic() - start)
+    # The first call includes compilation
+    times = np.array(times[1:])
+
+    result = OrderedDict([
+        ('micro_batches', args.micro_batches),
+        ('stages', NUM_STAGES),
+        ('bubble', (NUM_STAGES - 1) / (args.micro_batches + NUM_STAGES - 1)),
+        ('mean_ms', times.mean() * 1000.0),
+        ('samples_per_second', args.batch_size / times.mean())])
+    print(RESULT_PREFIX + json.dumps(result))
+
+
+def launch_config(args, micro_batches, cpusets):
+    repo_root = os.path.dirname(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+    env = dict(os.environ)
+    env['HETR_CPUSETS'] = ':'.join(cpusets)
+    env['PYTHONPATH'] = os.pathsep.join(filter(None, [repo_root, env.get('PYTHONPATH')]))
+    command = [sys.executable, '-m', 'examples.benchmarks.pipeline_parallel', '--run_config',
+               '--micro_batches', str(micro_batches), '--layers', str(args.layers),
+               '--hidden', str(args.hidden),
+               '-z', str(args.batch_size), '-t', str(args.num_iterations)]
+    if args.rng_seed is not None:
+        command += ['-r', str(args.rng_seed)]
+    process = subprocess.Popen(command, env=env, cwd=repo_root, stdout=subprocess.PIPE,
+                               universal_newlines=True)
+    output, _ = process.communicate()
+    for line in output.splitlines():
+        if line.startswith(RESULT_PREFIX):
+            return json.loads(line[len(RESULT_PREFIX):], object_pairs_hook=OrderedDict)
+    print("{} micro-batches failed (exit status {})".format(micro_batches, process.returncode))
+    return None
+
+
+def print_results(results):
+    header = ('Micro-batches', 'Stages', 'Bubble', 'Mean ms', 'Samples/s', 'Speedup')
+    formatter = '| {:^12} ' * len(header) + '|'
+    head_str = formatter.format(*header)
+    sep = '-' * len(head_str)
+    baseline = results[0]['samples_per_second']
+    print(sep)
+    print(head_str)
+    print(sep)
+    for r in results:
+        print(formatter.format(r['micro_batches'], r['stages'],
+                               '{:.1%}'.format(r['bubble']),
+                               '{:.2f}'.format(r['mean_ms']),
+                               '{:.0f}'.format(r['samples_per_second']),
+                               '{:.2f}x'.format(r['samples_per_second'] / baseline)))
+    print(sep)
+
+
+def main():
+    parser = NgraphArgparser(description=__doc__)
+    parser.add_argument('--micro_batches', type=int, nargs='+', default=[1, 2, 4, 8],
+                        help='micro-batch counts to run; the batch size must divide by them')
+    parser.add_argument('--layers', type=int, default=8,
+                        help='hidden layers, split evenly between the stages')
+    parser.add_argument('--hidden', type=int, default=2048, help='units per hidden layer')
+    parser.add_argument('--results', default='pipeline_parallel.json',
+                        help='JSON file to write the results to')
+    parser.add_argument('--run_config', action='store_true',
+                        help='internal: run with --micro_batches micro-batches in this process')
+    parser.set_defaults(batch_size=256, num_iterations=50)
+    args = parser.parse_args()
+
+    if args.run_config:
+        args.micro_batches = args.micro_batches[0]
+        run_config(args)
+        return
+
+    cpusets, emulated = stage_cpusets()
+    print("Stage cpus: {}{}".format(' | '.join(cpusets),
+                                    ' (emulated NUMA nodes)' if emulated else ''))
+    results = []
+    for micro_batches in args.micro_batches:
+        print("Running with {} micro-batches".format(micro_batches))
+        result = launch_config(args, micro_batches, cpusets)
+        if result is not None:
+            results.append(result)
+    if not results:
+        return
+
+    print_results(results)
+    with open(args.results, 'w') as f:
+        json.dump(OrderedDict([('batch_size', args.batch_size),
+                               ('iterations', args.num_iterations),
+                               ('cpusets', cpusets),
+                               ('emulated', emulated),
+                               ('results', results)]), f, indent=2)
+    print("Results written to {}".format(args.results))
+
+
+if __name__ == '__main__':
+    main()
@@ -464,6 +464,8 @@ class CPUMlslAllReduceStartOp(MutateInsteadOfCopyWithNewArgsMixin, AllReduceOp):
                                                       func=func)
         self._req = [None]  # use mutable field to share it between start and wait ops
         self.metadata['priority'] = 'high'
+        if 'grad_compression' in input_node.metadata:
+            self.metadata['grad_compression'] = input_node.metadata['grad_compression']
 
     @property
     def req(self):
@@ -4295,6 +4295,11 @@ class DerivOp(ValueOp):
         # Gradients are sum-reduced between replicas, since the resulting gradients
         # are divided by aggregate batch size in the optimizer to compute mean gradients.
         self.value_tensor.metadata['reduce_func'] = 'sum'
+        # Per variable compression of the exchanged gradient, see
+        # ngraph.transformers.cpu.grad_compression
+        if 'grad_compression' in self.independent.metadata:
+            self.value_tensor.metadata['grad_compression'] = \
+                self.independent.metadata['grad_compression']
 
 
 def deriv(dependent, independent, error=None):
@@ -0,0 +1,103 @@
+# ******************************************************************************
+# Copyright 2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+"""
+Grouping of the HeTr CPU gradient allreduces into flat buckets that are each reduced
+by a single MLSL allreduce.
+"""
+import numpy as np
+
+from ngraph.op_graph.comm_nodes import CPUMlslAllReduceStartOp
+
+
+class AllReduceBucket(object):
+    """
+    Allreduce inputs that are copied into one flat buffer and reduced by a single
+    MLSL allreduce, started by the last of them to run.
+
+    Arguments:
+        dtype: The element type of the members.
+
+    Attributes:
+        members: The CPUMlslAllReduceStartOps, in execution order.
+        offsets: Offset in elements of every member in the buffer.
+        size: Elements of the buffer.
+        buffer: The MLSL allocated buffer, created on first use.
+        filled: Members copied in since the last allreduce was started.
+        waited: True once the current allreduce has completed.
+    """
+
+    def __init__(self, dtype):
+        self.dtype = dtype
+        self.members = []
+        self.offsets = dict()
+        self.size = 0
+        self.buffer = None
+        self.req = None
+        self.filled = 0
+        self.waited = True
+
+    def add(self, start_op):
+        self.members.append(start_op)
+        self.offsets[start_op] = self.size
+        self.size += start_op.axes.size
+
+    @property
+    def nbytes(self):
+        return self.size * self.dtype.itemsize
+
+    def segment(self, start_op, shape):
+        offset = self.offsets[start_op]
+        return self.buffer[offset:offset + start_op.axes.size].reshape(shape)
+
+
+def plan_allreduce_buckets(allreduce_nodes, bucket_bytes, excluded=None):
+    """
+    Groups the float32 sum and mean allreduces in allreduce_nodes into buckets, in
+    the order their starts run, i.e. for gradients in the reverse topological order
+    of the forward pass. A bucket is closed when it holds bucket_bytes or when the
+    wait of one of its members runs before the next start, since the bucket's
+    allreduce must have been started by then. Every process runs the same code and
+    so builds the same buckets.
+
+    Arguments:
+        allreduce_nodes: The CPUMlslAllReduceStartOps and CPUMlslAllReduceWaitOps of
+            the computation, in execution order.
+        bucket_bytes: Size at which a bucket is closed.
+        excluded: Called with a start op, True if the op is not to be bucketed, e.g.
+            because its gradient is compressed.
+
+    Returns:
+        Dict of CPUMlslAllReduceStartOp to its AllReduceBucket.
+    """
+    buckets = dict()
+    bucket = None
+    for op in allreduce_nodes:
+        if not isinstance(op, CPUMlslAllReduceStartOp):
+            start_node = next(dep for dep in op.control_deps
+                              if isinstance(dep, CPUMlslAllReduceStartOp))
+            if bucket is not None and start_node in bucket.offsets:
+                bucket = None
+            continue
+        if op.reduce_func not in ('sum', 'mean') or op.dtype != np.float32 or \
+                (excluded is not None and excluded(op)):
+            continue
+        if bucket is None:
+            bucket = AllReduceBucket(np.dtype(op.dtype))
+        bucket.add(op)
+        buckets[op] = bucket
+        if bucket.nbytes >= bucket_bytes:
+            bucket = None
+    return buckets
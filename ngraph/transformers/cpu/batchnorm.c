@@ -138,15 +138,14 @@ void create_mkldnn_batchnorm_fprop_primitives(
       mkldnn_primitive_at(mkldnn_memory_prim_src, 0),
       mkldnn_primitive_at(opkernel->inputs[1].prim, 0)};
 
-  MKL_CHECK(mkldnn_primitive_create(&opkernel->op_prim, opkernel->op_desc,
-                                    batch_norm_prim_srcs,
-                                    batch_norm_prim_dsts));
+  create_opkernel_primitive(opkernel, batch_norm_prim_srcs, 2,
+                            batch_norm_prim_dsts, 3);
   //-------------------------------------------------------------------------------
   /* create fprop batchnorm net */
   if (opkernel->reorder_i[0])
     opkernel->net[opkernel->net_size++] = opkernel->reorder_i[0];
 
-  opkernel->net[opkernel->net_size++] = opkernel->op_prim;
+  opkernel->net[opkernel->net_size++] = NULL; /* op_prim */
 }
 
 void create_mkldnn_batchnorm_bprop_primitives(
@@ -340,8 +339,7 @@ void create_mkldnn_batchnorm_bprop_primitives(
       mkldnn_primitive_at(opkernel->inputs[2].prim, 0),
       mkldnn_primitive_at(mkldnn_memory_prim_src, 0),
       mkldnn_primitive_at(opkernel->inputs[4].prim, 0)};
-  MKL_CHECK(mkldnn_primitive_create(&opkernel->op_prim, opkernel->op_desc,
-                                    batch_norm_srcs, batch_norm_dsts));
+  create_opkernel_primitive(opkernel, batch_norm_srcs, 5, batch_norm_dsts, 2);
   //-------------------------------------------------------------------------------
   /* create bprop batchnorm net */
   if (opkernel->reorder_i[0])
@@ -349,7 +347,7 @@ void create_mkldnn_batchnorm_bprop_primitives(
   if (opkernel->reorder_i[3])
     opkernel->net[opkernel->net_size++] = opkernel->reorder_i[3];
 
-  opkernel->net[opkernel->net_size++] = opkernel->op_prim;
+  opkernel->net[opkernel->net_size++] = NULL; /* op_prim */
 
   if (opkernel->reorder_o[0])
     opkernel->net[opkernel->net_size++] = opkernel->reorder_o[0];
@@ -0,0 +1,311 @@
+/*******************************************************************************
+* Copyright 2017-2018 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+/*
+ * Broadcasting binary elementwise kernels (add, sub, mul, div, max, min).
+ *
+ * MKL-DNN has no binary primitive, so these kernels run their own OpenMP loop
+ * and plug into the opkernel through run_custom. One operand has the full
+ * output shape and an MKL layout, possibly blocked (nChw8c, nChw16c, ...); the
+ * output is written in that same layout, which makes the op a layout
+ * pass-through. The other operand is either in a layout with the same blocking
+ * or plain strided, and any of its dimensions may be 1 to broadcast,
+ * including all of them for scalars.
+ *
+ * At creation every logical dimension is split into its block and in-block
+ * loops, size-1 loops are dropped, the rest are sorted by the stride of the
+ * full operand and contiguous loops are merged. The innermost loop is then
+ * usually dense for the full operand and dense or constant for the other one.
+ */
+
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "mkldnn_engine.h"
+#include "mkldnn_util.h"
+
+#define MAX_BINARY_LOOPS (2 * TENSOR_MAX_DIMS)
+
+enum {
+  BINARY_ELTWISE_ADD = 0,
+  BINARY_ELTWISE_SUB,
+  BINARY_ELTWISE_MUL,
+  BINARY_ELTWISE_DIV,
+  BINARY_ELTWISE_MAX,
+  BINARY_ELTWISE_MIN
+};
+
+typedef struct {
+  int alg;
+  int swap; /* the broadcast operand is the first argument of the op */
+  int full_index;
+  int nloops;
+  long len[MAX_BINARY_LOOPS];
+  long full_stride[MAX_BINARY_LOOPS]; /* also the output strides */
+  long bcast_stride[MAX_BINARY_LOOPS];
+  long full_offset;
+  long bcast_offset;
+} binary_eltwise_plan;
+
+#define BINARY_LOOP(EXPR)                                        \
+  do {                                                           \
+    if (fs == 1 && bs == 0) {                                    \
+      const float b = bp[0];                                     \
+      for (long i = 0; i < n; i++) {                             \
+        const float a = ap[i];                                   \
+        dp[i] = (EXPR);                                          \
+      }                                                          \
+    } else if (fs == 1 && bs == 1) {                             \
+      for (long i = 0; i < n; i++) {                             \
+        const float a = ap[i], b = bp[i];                        \
+        dp[i] = (EXPR);                                          \
+      }                                                          \
+    } else {                                                     \
+      for (long i = 0; i < n; i++) {                             \
+        const float a = ap[i * fs], b = bp[i * bs];              \
+        dp[i * fs] = (EXPR);                                     \
+      }                                                          \
+    }                                                            \
+  } while (0)
+
+/* dst[i] = a[i] op b[i] over one innermost loop; a is the first argument */
+static void binary_eltwise_row(int alg, float *dp, const float *ap,
+                               const float *bp, long n, long fs, long bs) {
+  switch (alg) {
+  case BINARY_ELTWISE_ADD: BINARY_LOOP(a + b); break;
+  case BINARY_ELTWISE_SUB: BINARY_LOOP(a - b); break;
+  case BINARY_ELTWISE_MUL: BINARY_LOOP(a * b); break;
+  case BINARY_ELTWISE_DIV: BINARY_LOOP(a / b); break;
+  case BINARY_ELTWISE_MAX: BINARY_LOOP(a > b ? a : b); break;
+  case BINARY_ELTWISE_MIN: BINARY_LOOP(a < b ? a : b); break;
+  }
+}
+
+/* Same as binary_eltwise_row with the broadcast operand as first argument */
+static void binary_eltwise_row_swapped(int alg, float *dp, const float *ap,
+                                       const float *bp, long n, long fs,
+                                       long bs) {
+  switch (alg) {
+  case BINARY_ELTWISE_SUB: BINARY_LOOP(b - a); break;
+  case BINARY_ELTWISE_DIV: BINARY_LOOP(b / a); break;
+  default: binary_eltwise_row(alg, dp, ap, bp, n, fs, bs); break;
+  }
+}
+
+static void run_binary_eltwise(mkldnn_opkernel_t opkernel) {
+  binary_eltwise_plan *plan = (binary_eltwise_plan *)opkernel->custom_data;
+  void *full, *bcast, *dst;
+  MKL_CHECK(mkldnn_memory_get_data_handle(
+      opkernel->inputs[plan->full_index].prim, &full));
+  MKL_CHECK(mkldnn_memory_get_data_handle(
+      opkernel->inputs[1 - plan->full_index].prim, &bcast));
+  MKL_CHECK(mkldnn_memory_get_data_handle(opkernel->outputs[0].prim, &dst));
+
+  const float *ap = (const float *)full + plan->full_offset;
+  const float *bp = (const float *)bcast + plan->bcast_offset;
+  float *dp = (float *)dst + plan->full_offset;
+  const int outer = plan->nloops - 1;
+  const long n = plan->len[outer];
+  const long fs = plan->full_stride[outer];
+  const long bs = plan->bcast_stride[outer];
+  long rows = 1;
+  for (int l = 0; l < outer; l++) rows *= plan->len[l];
+
+#pragma omp parallel for schedule(static)
+  for (long r = 0; r < rows; r++) {
+    long rem = r, fo = 0, bo = 0;
+    for (int l = outer - 1; l >= 0; l--) {
+      long idx = rem % plan->len[l];
+      rem /= plan->len[l];
+      fo += idx * plan->full_stride[l];
+      bo += idx * plan->bcast_stride[l];
+    }
+    if (plan->swap)
+      binary_eltwise_row_swapped(plan->alg, dp + fo, ap + fo, bp + bo, n, fs, bs);
+    else
+      binary_eltwise_row(plan->alg, dp + fo, ap + fo, bp + bo, n, fs, bs);
+  }
+}
+
+static int is_full_shape(int ndims, const int *sizes, const int *dst_sizes) {
+  for (int i = 0; i < ndims; i++)
+    if (sizes[i] != dst_sizes[i]) return 0;
+  return 1;
+}
+
+/* Splits the logical dimensions into loops. Returns 0 if the blocking of the
+ * broadcast operand cannot be expressed in the loops of the full operand. */
+static int build_binary_eltwise_loops(binary_eltwise_plan *plan, int ndims,
+                                      const int *dst_sizes,
+                                      const mkldnn_memory_desc_t *full_md,
+                                      const int *bcast_sizes,
+                                      const mkldnn_memory_desc_t *bcast_md) {
+  const mkldnn_blocking_desc_t *fb = &full_md->layout_desc.blocking;
+  const mkldnn_blocking_desc_t *bb = &bcast_md->layout_desc.blocking;
+  int nloops = 0;
+
+  for (int d = 0; d < ndims; d++) {
+    int fblock = fb->block_dims[d];
+    int broadcast = bcast_sizes[d] == 1;
+    if (fb->padding_dims[d] != dst_sizes[d] || dst_sizes[d] % fblock) return 0;
+    if (!broadcast && bb->padding_dims[d] != bcast_sizes[d]) return 0;
+
+    long outer_bstride = 0, inner_bstride = 0;
+    if (!broadcast) {
+      if (bb->block_dims[d] == 1) {
+        inner_bstride = bb->strides[0][d];
+        outer_bstride = fblock * inner_bstride;
+      } else if (bb->block_dims[d] == fblock) {
+        outer_bstride = bb->strides[0][d];
+        inner_bstride = bb->strides[1][d];
+      } else {
+        return 0;
+      }
+    }
+    plan->len[nloops] = dst_sizes[d] / fblock;
+    plan->full_stride[nloops] = fb->strides[0][d];
+    plan->bcast_stride[nloops] = outer_bstride;
+    nloops++;
+    if (fblock > 1) {
+      plan->len[nloops] = fblock;
+      plan->full_stride[nloops] = fb->strides[1][d];
+      plan->bcast_stride[nloops] = inner_bstride;
+      nloops++;
+    }
+  }
+
+  /* Drop trivial loops and sort by decreasing stride of the full operand */
+  int kept = 0;
+  for (int l = 0; l < nloops; l++) {
+    if (plan->len[l] == 1) continue;
+    long len = plan->len[l], fs = plan->full_stride[l], bs = plan->bcast_stride[l];
+    int pos = kept++;
+    while (pos > 0 && plan->full_stride[pos - 1] < fs) {
+      plan->len[pos] = plan->len[pos - 1];
+      plan->full_stride[pos] = plan->full_stride[pos - 1];
+      plan->bcast_stride[pos] = plan->bcast_stride[pos - 1];
+      pos--;
+    }
+    plan->len[pos] = len;
+    plan->full_stride[pos] = fs;
+    plan->bcast_stride[pos] = bs;
+  }
+
+  /* Merge loops that walk both operands contiguously */
+  nloops = 0;
+  for (int l = 0; l < kept; l++) {
+    if (nloops > 0 &&
+        plan->full_stride[nloops - 1] == plan->len[l] * plan->full_stride[l] &&
+        plan->bcast_stride[nloops - 1] == plan->len[l] * plan->bcast_stride[l]) {
+      plan->len[nloops - 1] *= plan->len[l];
+      plan->full_stride[nloops - 1] = plan->full_stride[l];
+      plan->bcast_stride[nloops - 1] = plan->bcast_stride[l];
+    } else {
+      plan->len[nloops] = plan->len[l];
+      plan->full_stride[nloops] = plan->full_stride[l];
+      plan->bcast_stride[nloops] = plan->bcast_stride[l];
+      nloops++;
+    }
+  }
+  if (nloops == 0) {
+    plan->len[0] = 1;
+    plan->full_stride[0] = 1;
+    plan->bcast_stride[0] = 0;
+    nloops = 1;
+  }
+  plan->nloops = nloops;
+  plan->full_offset = fb->offset_padding;
+  plan->bcast_offset = bb->offset_padding;
+  return 1;
+}
+
+/* Creates a broadcasting binary elementwise kernel computing
+ * dst = src1 <alg> src2.
+ *
+ * sizes are in MKL order and 1 for broadcast dimensions. An operand with an
+ * MKL layout passes it in srcN_md; otherwise srcN_strides gives its element
+ * strides. One operand needs the output shape and an MKL layout, the output is
+ * created in its layout. Returns 0, leaving the kernel empty, if the operands
+ * cannot be handled. */
+int create_mkldnn_binary_eltwise_kernel(
+    mkldnn_engine_t engine, int ndims, int *dst_sizes, int *src1_sizes,
+    int *src1_strides, mkldnn_memory_desc_t *src1_md, int *src2_sizes,
+    int *src2_strides, mkldnn_memory_desc_t *src2_md, int alg,
+    mkldnn_data_type_t data_type, mkldnn_opkernel_t opkernel) {
+  if (data_type != mkldnn_f32) return 0;
+
+  int full_index;
+  if (src1_md && is_full_shape(ndims, src1_sizes, dst_sizes))
+    full_index = 0;
+  else if (src2_md && is_full_shape(ndims, src2_sizes, dst_sizes))
+    full_index = 1;
+  else
+    return 0;
+
+  int *sizes[] = {src1_sizes, src2_sizes};
+  int *strides[] = {src1_strides, src2_strides};
+  mkldnn_memory_desc_t *mds[] = {src1_md, src2_md};
+  mkldnn_memory_desc_t *native_md = NULL;
+  int bcast_index = 1 - full_index;
+  if (!mds[bcast_index]) {
+    int dense_strides[TENSOR_MAX_DIMS];
+    for (int d = 0; d < ndims; d++)
+      dense_strides[d] = sizes[bcast_index][d] == 1 ? 1 : strides[bcast_index][d];
+    native_md = create_mkldnn_layout_descriptor(engine, ndims, sizes[bcast_index],
+                                                dense_strides, data_type,
+                                                mkldnn_blocked);
+    mds[bcast_index] = native_md;
+  }
+
+  binary_eltwise_plan *plan =
+      (binary_eltwise_plan *)malloc(sizeof(binary_eltwise_plan));
+  plan->alg = alg;
+  plan->swap = full_index == 1;
+  plan->full_index = full_index;
+  /* Plain formats (nchw, nc, ...) only describe their blocking once the md
+   * is bound to a primitive desc, so plan from the queried descriptors */
+  mkldnn_tensor tensors[2];
+  for (int i = 0; i < 2; i++)
+    create_mkldnn_tensor_from_md(ndims, sizes[i], mds[i], engine, &tensors[i]);
+  const mkldnn_memory_desc_t *full_md =
+      mkldnn_primitive_desc_query_memory_d(tensors[full_index].desc);
+  const mkldnn_memory_desc_t *bcast_md =
+      mkldnn_primitive_desc_query_memory_d(tensors[bcast_index].desc);
+  if (!build_binary_eltwise_loops(plan, ndims, dst_sizes, full_md,
+                                  sizes[bcast_index], bcast_md)) {
+    for (int i = 0; i < 2; i++) delete_mkldnn_tensor(&tensors[i]);
+    free(plan);
+    free(native_md);
+    return 0;
+  }
+
+  opkernel->inputs[0] = tensors[0];
+  opkernel->inputs[1] = tensors[1];
+  create_mkldnn_tensor_from_md(ndims, dst_sizes, mds[full_index], engine,
+                               &(opkernel->outputs[0]));
+  free(native_md);
+  opkernel->num_inputs = 2;
+  opkernel->num_outputs = 1;
+  opkernel->reorder_i[0] = NULL;
+  opkernel->reorder_i[1] = NULL;
+  opkernel->reorder_o[0] = NULL;
+  opkernel->custom_data = plan;
+  opkernel->custom_impl_info = "ngraph:binary_eltwise";
+  opkernel->run_custom = run_binary_eltwise;
+  return 1;
+}
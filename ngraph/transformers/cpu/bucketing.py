@@ -0,0 +1,150 @@
+# ******************************************************************************
+# Copyright 2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+from __future__ import division
+
+import collections
+
+import numpy as np
+
+from ngraph.op_graph.op_graph import Op
+
+
+class BucketedComputation(object):
+    """
+    A computation whose inputs vary in the length of some axes between calls, e.g.
+    the batch size or the sequence length, compiled for a fixed set of lengths
+    (buckets) per such axis.
+
+    Every bucket is a separate computation of the transformer, built and compiled the
+    first time an argument falls into it, with its own memory plan and kernels.
+    Variables are shared across buckets, as between any computations of a
+    transformer, and so are the MKL-DNN reordered copies of weights.
+
+    A call picks for every dynamic axis the smallest bucket that is not shorter than
+    the arguments, pads the arguments along the dynamic axes with pad_value up to it
+    and slices the results back to the argument lengths. Ops that reduce over a
+    padded axis (batch statistics, losses summed over the batch, the last state of
+    a recurrence) see the padding, so such models have to mask it.
+
+    Arguments:
+        transformer: The transformer.
+        build: Called as build(**lengths) with the length of every dynamic axis,
+            by name; returns (results, *parameters) for transformer.computation.
+            It must make the dynamic axes with the given lengths and reuse the same
+            variables every time. results is an Op or a sequence of Ops.
+        buckets: Dict of dynamic axis name to the lengths to compile for.
+        pad_value: Value that padding elements of the arguments are set to.
+    """
+
+    def __init__(self, transformer, build, buckets, pad_value=0):
+        self.transformer = transformer
+        self.build = build
+        self.axis_names = sorted(buckets)
+        self.buckets = dict((name, sorted(set(lengths))) for name, lengths in buckets.items())
+        if not self.axis_names or not all(self.buckets.values()):
+            raise ValueError("Every dynamic axis needs at least one bucket length")
+        self.pad_value = pad_value
+        self.graphs = dict()          # bucket -> build() results not compiled yet
+        self.computations = dict()    # bucket -> computation
+        self.parameter_axes = None    # Names of the axes of every parameter
+
+    def bucket(self, lengths):
+        """
+        The bucket, a tuple of lengths in the order of axis_names, for arguments with
+        the given dynamic axis lengths.
+        """
+        bucket = []
+        for name in self.axis_names:
+            if name not in lengths:
+                # Not in any parameter; only the results have it
+                bucket.append(self.buckets[name][0])
+                continue
+            fits = [length for length in self.buckets[name] if length >= lengths[name]]
+            if not fits:
+                raise ValueError("Length {} of axis {} is larger than the largest bucket {}"
+                                 .format(lengths[name], name, self.buckets[name][-1]))
+            bucket.append(fits[0])
+        return tuple(bucket)
+
+    def graph(self, bucket):
+        graph = self.graphs.pop(bucket, None)
+        if graph is None:
+            graph = self.build(**dict(zip(self.axis_names, bucket)))
+        return graph
+
+    def computation(self, bucket):
+        """
+        Returns the computation of bucket, compiling it if needed.
+        """
+        computation = self.computations.get(bucket)
+        if computation is None:
+            computation = self.transformer.computation(*self.graph(bucket))
+            returns = computation.computation_op.returns
+            if returns is not None and not isinstance(returns, (Op, collections.Sequence)):
+                raise ValueError("Results of a bucketed computation must be an Op or a "
+                                 "sequence of Ops")
+            self.computations[bucket] = computation
+        return computation
+
+    def dynamic_lengths(self, args):
+        if self.parameter_axes is None:
+            # The axes of the parameters are the same in every bucket; keep the graph of
+            # the largest bucket so that it is not built twice
+            largest = tuple(self.buckets[name][-1] for name in self.axis_names)
+            self.graphs[largest] = graph = self.build(**dict(zip(self.axis_names, largest)))
+            self.parameter_axes = [[axis.name for axis in parameter.axes]
+                                   for parameter in graph[1:]]
+        if len(args) != len(self.parameter_axes):
+            raise ValueError("Bucketed computation was expecting {} arguments, but was "
+                             "called with {}.".format(len(self.parameter_axes), len(args)))
+        lengths = dict()
+        for arg, axis_names in zip(args, self.parameter_axes):
+            for name, length in zip(axis_names, np.shape(arg)):
+                if name in self.buckets and lengths.setdefault(name, length) != length:
+                    raise ValueError("Arguments disagree on the length of axis {}: {} and {}"
+                                     .format(name, lengths[name], length))
+        return lengths
+
+    def pad(self, arg, axis_names, bucket_lengths):
+        arg = np.asarray(arg)
+        padding = [(0, bucket_lengths[name] - length if name in bucket_lengths else 0)
+                   for name, length in zip(axis_names, arg.shape)]
+        if not any(after for _, after in padding):
+            return arg
+        return np.pad(arg, padding, mode='constant', constant_values=self.pad_value)
+
+    def unpad(self, value, op, lengths):
+        if value is None:
+            return None
+        index = tuple(slice(0, lengths[axis.name]) if axis.name in lengths else slice(None)
+                      for axis in op.axes)
+        return value[index]
+
+    def __call__(self, *args):
+        lengths = self.dynamic_lengths(args)
+        bucket = self.bucket(lengths)
+        bucket_lengths = dict(zip(self.axis_names, bucket))
+        computation = self.computation(bucket)
+        results = computation(*[self.pad(arg, axis_names, bucket_lengths)
+                                for arg, axis_names in zip(args, self.parameter_axes)])
+
+        # Axes that are in no parameter keep the bucket length
+        returns = computation.computation_op.returns
+        if returns is None:
+            return None
+        if isinstance(returns, Op):
+            return self.unpad(results, returns, lengths)
+        return tuple(self.unpad(value, op, lengths) for value, op in zip(results, returns))
@@ -0,0 +1,399 @@
+# ******************************************************************************
+# Copyright 2017-2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+"""
+On-disk cache of compiled CPU computations.
+
+Compiling a computation runs the full CPUTransformer graph pass pipeline,
+generates Python source and creates every MKL-DNN kernel. The result of all
+of that is deterministic for a given graph and engine, so it is stored as an
+artifact keyed by a structural hash of the graph and a hash of the engine
+(transformer sources, mkldnn_engine.so and the environment switches that
+change code generation). A warm start loads the artifact, replays the recorded
+MKL-DNN kernel creation calls and compiles the stored source, skipping the
+graph passes entirely.
+
+The cache is enabled by pointing NGRAPH_CPU_COMPILE_CACHE_DIR at a directory.
+"""
+from __future__ import division
+
+import ctypes as ct
+import glob
+import hashlib
+import logging
+import os
+import pickle
+import re
+import sys
+import tempfile
+
+import numpy as np
+from orderedset import OrderedSet
+
+from ngraph.op_graph.op_graph import Op
+from ngraph.op_graph.axes import Axis, Axes
+
+logger = logging.getLogger(__name__)
+
+CACHE_FORMAT_VERSION = 1
+
+# Environment variables that change the generated code or the kernels
+CODEGEN_ENVIRONMENT = ('NGRAPH_TOPOSORT_ALGO', 'NGRAPH_MKL_CONV_AUTOTUNE',
+                       'NGRAPH_MKL_LAYOUT_ASSIGN', 'NGRAPH_CPU_INPLACE', 'NGRAPH_MKL_LAZY_RETURNS',
+                       'HETR_SKIP_COMM_OPS', 'HETR_SKIP_INPUT_OPS', 'MKL_TEST_ENABLE')
+
+# Mkldnn entry points that create kernels and layouts, the only calls that are recorded
+# and replayed on a warm start
+RECORDED_MKLDNN_FUNCTIONS = ('create_empty_kernel', 'create_layout_md', 'layout_reorder',
+                             'flatten_axes', 'output_layout', 'add_kernel', 'sum_kernel',
+                             'binary_eltwise_kernel', 'batchnorm_fprop_kernel',
+                             'batchnorm_bprop_kernel', 'conv_fprop_kernel', 'conv_bprop_kernel',
+                             'update_conv_kernel', 'innerproduct_fprop_kernel',
+                             'pool_fprop_kernel', 'pool_bprop_kernel', 'relu_fprop_kernel',
+                             'relu_bprop_kernel', 'reorder_kernel')
+
+# Op attributes that do not affect the compiled code: names carry global counters
+# (graph_label_type defaults to the name), uuids are random
+IGNORED_OP_ATTRIBUTES = ('_NameableValue__name', '_ScopedNameableValue__scope',
+                         'graph_label_type', 'uuid', 'style', '__doc__')
+
+
+def compile_cache_dir():
+    """
+    Returns the compiled computation cache directory, or None if caching is disabled.
+    """
+    cache_dir = os.getenv('NGRAPH_CPU_COMPILE_CACHE_DIR', '')
+    if cache_dir == '':
+        return None
+    cache_dir = os.path.expanduser(cache_dir)
+    if not os.path.isdir(cache_dir):
+        os.makedirs(cache_dir)
+    return cache_dir
+
+
+class CacheMiss(Exception):
+    """
+    Raised when an artifact cannot be used, or a computation cannot be recorded.
+    """
+
+
+def _referenced_ops(value):
+    if isinstance(value, Op):
+        yield value
+    elif isinstance(value, (list, tuple, OrderedSet)):
+        for item in value:
+            for op in _referenced_ops(item):
+                yield op
+    elif isinstance(value, (set, frozenset)):
+        for item in sorted(value, key=lambda x: getattr(x, 'name', '')):
+            for op in _referenced_ops(item):
+                yield op
+    elif isinstance(value, dict):
+        for item in value.values():
+            for op in _referenced_ops(item):
+                yield op
+
+
+def _is_ignored_attribute(key):
+    return key in IGNORED_OP_ATTRIBUTES
+
+
+def graph_ops(computation_op):
+    """
+    Every op reachable from computation_op through any op-valued attribute, in a
+    deterministic order that only depends on the graph structure.
+
+    Returns:
+        The list of ops and a dict mapping each op to its index in the list.
+    """
+    ops = []
+    index = dict()
+    stack = [computation_op]
+    while stack:
+        op = stack.pop()
+        if op in index:
+            continue
+        index[op] = len(ops)
+        ops.append(op)
+        children = []
+        for key in sorted(op.__dict__):
+            if not _is_ignored_attribute(key):
+                children.extend(_referenced_ops(op.__dict__[key]))
+        stack.extend(reversed(children))
+    return ops, index
+
+
+def _encode_axis_name(axis, axis_names):
+    # Axes are told apart by name, and unnamed axes get a name from a global counter:
+    # those are numbered in the order they appear instead
+    if re.match(r'{}_\d+$'.format(type(axis).__name__), axis.name):
+        return axis_names.setdefault(axis.name, len(axis_names))
+    return axis.name
+
+
+def _encode(value, index, axis_names, hash_arrays):
+    if isinstance(value, Op):
+        return ('op', index.get(value, -1))
+    if isinstance(value, Axis):
+        if value.is_flattened:
+            return ('flattened_axis', _encode_axis_name(value, axis_names),
+                    _encode(value.axes, index, axis_names, hash_arrays))
+        return ('axis', _encode_axis_name(value, axis_names), value.length)
+    if isinstance(value, Axes):
+        return ('axes',) + tuple(_encode(axis, index, axis_names, hash_arrays)
+                                 for axis in value)
+    if isinstance(value, np.ndarray):
+        if not hash_arrays:
+            return ('ndarray', value.shape, str(value.dtype))
+        return ('ndarray', value.shape, str(value.dtype),
+                hashlib.sha1(np.ascontiguousarray(value).tobytes()).hexdigest())
+    if value is None or isinstance(value, (bool, int, float, str, np.generic, np.dtype, type)):
+        return repr(value)
+    if isinstance(value, (list, tuple, OrderedSet)):
+        return tuple(_encode(item, index, axis_names, hash_arrays) for item in value)
+    if isinstance(value, (set, frozenset)):
+        return tuple(sorted(repr(_encode(item, index, axis_names, hash_arrays))
+                            for item in value))
+    if isinstance(value, dict):
+        return tuple(sorted((repr(_encode(k, index, axis_names, hash_arrays)),
+                             _encode(v, index, axis_names, hash_arrays))
+                            for k, v in value.items()))
+    if isinstance(value, slice):
+        return ('slice', repr(value.start), repr(value.stop), repr(value.step))
+    # Anything else could hide a difference between graphs behind the same signature
+    raise CacheMiss("Cannot hash attribute of type {}".format(type(value).__name__))
+
+
+def graph_signature(computation_op):
+    """
+    Structural hash of the graph of computation_op.
+
+    Returns:
+        The hex digest, the ops in signature order and the op to index dict.
+
+    Raises:
+        CacheMiss if an op has an attribute the hash can not represent.
+    """
+    ops, index = graph_ops(computation_op)
+    axis_names = dict()
+    digest = hashlib.sha1()
+    for op in ops:
+        # Constant values can be folded into the generated code; variable initial
+        # values are loaded at run time so only their shape matters
+        hash_arrays = op.is_constant
+        attrs = tuple((key, _encode(op.__dict__[key], index, axis_names, hash_arrays))
+                      for key in sorted(op.__dict__) if not _is_ignored_attribute(key))
+        digest.update(repr((type(op).__name__, attrs)).encode())
+    return digest.hexdigest(), ops, index
+
+
+def engine_signature(mkldnn):
+    """
+    Hash of everything besides the graph that determines the compiled computation:
+    cache format, Python version, transformer sources, the MKL-DNN engine library
+    and code generation switches in the environment.
+    """
+    digest = hashlib.sha1()
+    digest.update(repr((CACHE_FORMAT_VERSION, sys.version_info[:2])).encode())
+    transformers_dir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    sources = sorted(glob.glob(os.path.join(transformers_dir, '*.py')) +
+                     glob.glob(os.path.join(transformers_dir, 'cpu', '*.py')) +
+                     glob.glob(os.path.join(transformers_dir, 'passes', '*.py')))
+    for path in sources:
+        with open(path, 'rb') as f:
+            digest.update(f.read())
+    if mkldnn.enabled:
+        with open(mkldnn.engine_path, 'rb') as f:
+            digest.update(f.read())
+    for var in CODEGEN_ENVIRONMENT:
+        digest.update(repr((var, os.getenv(var))).encode())
+    return digest.hexdigest()
+
+
+class MkldnnRecorder(object):
+    """
+    Records the Mkldnn kernel and layout creation calls made by the MKL-DNN graph
+    passes so they can be replayed without running the passes.
+
+    Pointers returned by a recorded call are stored as references to that call.
+    Kernel and layout registrations in mkldnn.kernels and mkldnn.native_layouts are
+    captured as references as well.
+    """
+
+    def __init__(self, mkldnn):
+        self.mkldnn = mkldnn
+        self.calls = []
+        self.handles = dict()
+        self.recordable = True
+        self.kernels = dict()
+        self.native_layouts = []
+
+    def __enter__(self):
+        self.kernels_before = set(self.mkldnn.kernels)
+        self.layouts_before = len(self.mkldnn.native_layouts)
+        self.wrapped = []
+        for attr, fn in list(vars(self.mkldnn).items()):
+            if isinstance(fn, ct._CFuncPtr) and attr in RECORDED_MKLDNN_FUNCTIONS:
+                setattr(self.mkldnn, attr, self.wrap(attr, fn))
+                self.wrapped.append((attr, fn))
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        for attr, fn in self.wrapped:
+            setattr(self.mkldnn, attr, fn)
+        try:
+            for name, kernel in self.mkldnn.kernels.items():
+                if name not in self.kernels_before:
+                    self.kernels[name] = self.handles[kernel]
+            for layout in self.mkldnn.native_layouts[self.layouts_before:]:
+                if layout:
+                    self.native_layouts.append(self.handles[layout])
+        except KeyError:
+            self.recordable = False
+        return False
+
+    def encode_arg(self, arg):
+        if arg is None or isinstance(arg, (float, bytes, str)):
+            return arg
+        if isinstance(arg, ct.Array):
+            return ('array', arg._type_.__name__, list(arg))
+        if isinstance(arg, int) or (sys.version_info[0] == 2 and isinstance(arg, long)):  # noqa
+            if arg == self.mkldnn.mkldnn_engine:
+                return ('engine',)
+            if arg in self.handles:
+                return ('handle', self.handles[arg])
+            return arg
+        raise CacheMiss("Cannot record argument of type {}".format(type(arg).__name__))
+
+    def wrap(self, attr, fn):
+        def recorded(*args):
+            result = fn(*args)
+            try:
+                self.calls.append((attr, [self.encode_arg(arg) for arg in args]))
+            except CacheMiss:
+                self.recordable = False
+            if fn.restype is ct.c_void_p and result:
+                self.handles[result] = len(self.calls) - 1
+            return result
+        return recorded
+
+
+def replay_mkldnn_calls(mkldnn, calls):
+    """
+    Re-executes recorded Mkldnn calls.
+
+    Returns:
+        The result of each call, indexed like calls.
+    """
+    results = []
+
+    def decode(arg):
+        if isinstance(arg, tuple):
+            if arg[0] == 'engine':
+                return mkldnn.mkldnn_engine
+            if arg[0] == 'handle':
+                return results[arg[1]]
+            if arg[0] == 'array':
+                ctype = getattr(ct, arg[1])
+                return (ctype * len(arg[2]))(*arg[2])
+        return arg
+
+    for attr, args in calls:
+        results.append(getattr(mkldnn, attr)(*[decode(arg) for arg in args]))
+    return results
+
+
+def artifact_path(cache_dir, key):
+    return os.path.join(cache_dir, key + '.ngc')
+
+
+def load_artifact(cache_dir, key):
+    path = artifact_path(cache_dir, key)
+    if not os.path.exists(path):
+        return None
+    try:
+        with open(path, 'rb') as f:
+            artifact = pickle.load(f)
+    except Exception as e:
+        logger.warning("Ignoring unreadable compiled computation %s: %s", path, e)
+        return None
+    if artifact.get('format') != CACHE_FORMAT_VERSION:
+        return None
+    return artifact
+
+
+def save_artifact(cache_dir, key, artifact):
+    artifact['format'] = CACHE_FORMAT_VERSION
+    # Write and rename so concurrent processes never read a partial artifact
+    fd, tmp_path = tempfile.mkstemp(dir=cache_dir, suffix='.tmp')
+    try:
+        with os.fdopen(fd, 'wb') as f:
+            pickle.dump(artifact, f, protocol=2)
+        os.rename(tmp_path, artifact_path(cache_dir, key))
+    except Exception as e:
+        logger.warning("Could not save compiled computation %s: %s", key, e)
+        if os.path.exists(tmp_path):
+            os.unlink(tmp_path)
+
+
+def is_same_view(tensor, value):
+    """
+    True if value views the memory of tensor the same way, as an argument written in
+    place by a HeTr client does, so assigning it to tensor would copy it onto itself.
+    """
+    return isinstance(value, np.ndarray) and value.size > 0 and \
+        value.ctypes.data == tensor.ctypes.data and value.dtype == tensor.dtype and \
+        value.shape == tensor.shape and value.strides == tensor.strides
+
+
+class CachedTensorView(object):
+    """
+    Host access to a tensor view of a computation loaded from the cache.
+    Provides the subset of CPUDeviceTensorView used by the transformer.
+
+    lazy_reorder names the reorder kernel of a result returned in its MKL layout.
+    """
+
+    def __init__(self, namespace, name, lazy_reorder=None):
+        self.namespace = namespace
+        self.name = name
+        self.lazy_reorder = lazy_reorder
+
+    @property
+    def tensor(self):
+        return self.namespace[self.name]
+
+    def host_tensor(self):
+        if self.lazy_reorder is None:
+            return self.tensor
+        return self.namespace['mkldnn'].lazy_reorder(self.lazy_reorder, self.tensor)
+
+    def get(self, tensor):
+        if tensor is None:
+            return self.host_tensor()
+        if self.lazy_reorder is not None:
+            self.host_tensor().get(tensor)
+            return
+        tensor[:] = self.tensor
+
+    def __getitem__(self, key):
+        return self.host_tensor().__getitem__(key)
+
+    def __setitem__(self, key, value):
+        if hasattr(value, '_tensor'):
+            value = value._tensor
+        if isinstance(key, tuple) and not key and is_same_view(self.tensor, value):
+            return
+        self.tensor.__setitem__(key, value)
@@ -0,0 +1,396 @@
+/*******************************************************************************
+* Copyright 2017-2018 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+/*
+ * Per-shape convolution algorithm autotuner.
+ *
+ * The convolution kernel builders hand over one op descriptor per candidate
+ * algorithm (direct, winograd). With autotuning disabled the first candidate
+ * is used exactly as before. With autotuning enabled every implementation
+ * MKL-DNN offers for every candidate is timed on scratch buffers and the
+ * fastest one is kept. The decision is recorded in a text table, one line per
+ * key, where the key encodes direction, shapes, conv parameters, CPU ISA and
+ * thread count:
+ *
+ *   <key> <algorithm> <impl_info_str> <time_ms>
+ *
+ * The table is read when autotuning is enabled and rewritten after every new
+ * decision, so later runs skip the benchmark for shapes already seen.
+ */
+
+#include <string.h>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "mkldnn_engine.h"
+#include "mkldnn_util.h"
+
+#define AUTOTUNE_KEY_LEN 512
+#define AUTOTUNE_IMPL_LEN 128
+#define AUTOTUNE_WARMUP_ITERS 1
+#define AUTOTUNE_TIMED_ITERS 5
+
+typedef struct {
+  char key[AUTOTUNE_KEY_LEN];
+  mkldnn_alg_kind_t alg;
+  char impl[AUTOTUNE_IMPL_LEN];
+  double time_ms;
+} conv_autotune_entry;
+
+static int autotune_enabled = 0;
+static char autotune_path[1024] = "";
+static conv_autotune_entry *autotune_table = NULL;
+static int autotune_table_size = 0;
+static int autotune_table_capacity = 0;
+
+static const char *alg_name(mkldnn_alg_kind_t alg) {
+  return alg == mkldnn_convolution_winograd ? "winograd" : "direct";
+}
+
+static mkldnn_alg_kind_t alg_from_name(const char *name) {
+  return strcmp(name, "winograd") == 0 ? mkldnn_convolution_winograd
+                                       : mkldnn_convolution_direct;
+}
+
+static const char *cpu_isa_name(void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return "avx512";
+  if (__builtin_cpu_supports("avx2")) return "avx2";
+  if (__builtin_cpu_supports("avx")) return "avx";
+  if (__builtin_cpu_supports("sse4.2")) return "sse42";
+#endif
+  return "generic";
+}
+
+static int append_dims(char *buf, int len, const char *tag,
+                       const mkldnn_memory_desc_t *md) {
+  int n = snprintf(buf + len, AUTOTUNE_KEY_LEN - len, "%s", tag);
+  for (int i = 0; i < md->ndims; i++)
+    n += snprintf(buf + len + n, AUTOTUNE_KEY_LEN - len - n, "%s%d",
+                  i ? "x" : "", md->dims[i]);
+  return len + n;
+}
+
+/* Key covers everything that changes which implementation wins */
+static void make_autotune_key(const mkldnn_convolution_desc_t *desc,
+                              char *key) {
+  const mkldnn_memory_desc_t *src, *weights, *bias, *dst;
+  const char *dir;
+  switch (desc->prop_kind) {
+    case mkldnn_backward_data:
+      dir = "bwd_d";
+      src = &desc->diff_src_desc;
+      weights = &desc->weights_desc;
+      bias = &desc->bias_desc;
+      dst = &desc->diff_dst_desc;
+      break;
+    case mkldnn_backward_weights:
+      dir = "bwd_w";
+      src = &desc->src_desc;
+      weights = &desc->diff_weights_desc;
+      bias = &desc->diff_bias_desc;
+      dst = &desc->diff_dst_desc;
+      break;
+    default:
+      dir = "fwd";
+      src = &desc->src_desc;
+      weights = &desc->weights_desc;
+      bias = &desc->bias_desc;
+      dst = &desc->dst_desc;
+      break;
+  }
+  int nthr = 1;
+#ifdef _OPENMP
+  nthr = omp_get_max_threads();
+#endif
+  int len = snprintf(key, AUTOTUNE_KEY_LEN, "%s", dir);
+  len = append_dims(key, len, ":src=", src);
+  len = append_dims(key, len, ":wei=", weights);
+  len = append_dims(key, len, ":dst=", dst);
+  len += snprintf(key + len, AUTOTUNE_KEY_LEN - len,
+                  ":bias=%d:str=%dx%d:dil=%dx%d:pad=%dx%d:dt=%d:isa=%s:nthr=%d",
+                  bias->ndims > 0, desc->strides[0], desc->strides[1],
+                  desc->dilates[0], desc->dilates[1], desc->padding[0][0],
+                  desc->padding[0][1], src->data_type, cpu_isa_name(), nthr);
+}
+
+static conv_autotune_entry *find_autotune_entry(const char *key) {
+  for (int i = 0; i < autotune_table_size; i++)
+    if (strcmp(autotune_table[i].key, key) == 0) return &autotune_table[i];
+  return NULL;
+}
+
+static conv_autotune_entry *add_autotune_entry(const char *key) {
+  conv_autotune_entry *entry = find_autotune_entry(key);
+  if (entry) return entry;
+  if (autotune_table_size == autotune_table_capacity) {
+    autotune_table_capacity =
+        autotune_table_capacity ? 2 * autotune_table_capacity : 64;
+    autotune_table = (conv_autotune_entry *)realloc(
+        autotune_table, autotune_table_capacity * sizeof(conv_autotune_entry));
+    MKL_CHECK_TRUE(autotune_table != NULL);
+  }
+  entry = &autotune_table[autotune_table_size++];
+  snprintf(entry->key, AUTOTUNE_KEY_LEN, "%s", key);
+  return entry;
+}
+
+static void load_autotune_table(void) {
+  autotune_table_size = 0;
+  if (!autotune_path[0]) return;
+  FILE *f = fopen(autotune_path, "r");
+  if (!f) return;
+  char key[AUTOTUNE_KEY_LEN], alg[32], impl[AUTOTUNE_IMPL_LEN];
+  double time_ms;
+  while (fscanf(f, "%511s %31s %127s %lf", key, alg, impl, &time_ms) == 4) {
+    conv_autotune_entry *entry = add_autotune_entry(key);
+    entry->alg = alg_from_name(alg);
+    snprintf(entry->impl, AUTOTUNE_IMPL_LEN, "%s", impl);
+    entry->time_ms = time_ms;
+  }
+  fclose(f);
+}
+
+static void save_autotune_table(void) {
+  if (!autotune_path[0]) return;
+  // Write to a temporary file and rename so a concurrent reader never sees a
+  // partially written table
+  char tmp_path[sizeof(autotune_path) + 16];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", autotune_path);
+  FILE *f = fopen(tmp_path, "w");
+  if (!f) {
+    fprintf(stderr, "conv autotune: cannot write %s, decisions not persisted\n",
+            tmp_path);
+    return;
+  }
+  for (int i = 0; i < autotune_table_size; i++)
+    fprintf(f, "%s %s %s %.6f\n", autotune_table[i].key,
+            alg_name(autotune_table[i].alg), autotune_table[i].impl,
+            autotune_table[i].time_ms);
+  if (fclose(f) != 0 || rename(tmp_path, autotune_path) != 0) {
+    fprintf(stderr, "conv autotune: cannot write %s, decisions not persisted\n",
+            autotune_path);
+    remove(tmp_path);
+  }
+}
+
+void set_conv_autotune(const char *table_path, int enable) {
+  autotune_enabled = enable;
+  snprintf(autotune_path, sizeof(autotune_path), "%s",
+           table_path ? table_path : "");
+  if (autotune_enabled) load_autotune_table();
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Execution arguments of a convolution primitive, in primitive order */
+static int conv_arg_pds(const_mkldnn_primitive_desc_t pd,
+                        mkldnn_prop_kind_t prop_kind,
+                        const_mkldnn_primitive_desc_t *srcs, int *num_srcs,
+                        const_mkldnn_primitive_desc_t *dsts, int *num_dsts) {
+  switch (prop_kind) {
+    case mkldnn_backward_data:
+      srcs[0] = mkldnn_primitive_desc_query_pd(pd, mkldnn_query_diff_dst_pd, 0);
+      srcs[1] = mkldnn_primitive_desc_query_pd(pd, mkldnn_query_weights_pd, 0);
+      *num_srcs = 2;
+      dsts[0] = mkldnn_primitive_desc_query_pd(pd, mkldnn_query_diff_src_pd, 0);
+      *num_dsts = 1;
+      break;
+    case mkldnn_backward_weights:
+      srcs[0] = mkldnn_primitive_desc_query_pd(pd, mkldnn_query_src_pd, 0);
+      srcs[1] = mkldnn_primitive_desc_query_pd(pd, mkldnn_query_diff_dst_pd, 0);
+      *num_srcs = 2;
+      dsts[0] =
+          mkldnn_primitive_desc_query_pd(pd, mkldnn_query_diff_weights_pd, 0);
+      dsts[1] =
+          mkldnn_primitive_desc_query_pd(pd, mkldnn_query_diff_weights_pd, 1);
+      *num_dsts = dsts[1] ? 2 : 1;
+      break;
+    default:
+      srcs[0] = mkldnn_primitive_desc_query_pd(pd, mkldnn_query_src_pd, 0);
+      srcs[1] = mkldnn_primitive_desc_query_pd(pd, mkldnn_query_weights_pd, 0);
+      srcs[2] = mkldnn_primitive_desc_query_pd(pd, mkldnn_query_weights_pd, 1);
+      *num_srcs = srcs[2] ? 3 : 2;
+      dsts[0] = mkldnn_primitive_desc_query_pd(pd, mkldnn_query_dst_pd, 0);
+      *num_dsts = 1;
+      break;
+  }
+  for (int i = 0; i < *num_srcs; i++)
+    if (!srcs[i]) return 0;
+  for (int i = 0; i < *num_dsts; i++)
+    if (!dsts[i]) return 0;
+  return 1;
+}
+
+static mkldnn_primitive_t create_scratch_memory(
+    const_mkldnn_primitive_desc_t mem_pd, void **buf) {
+  mkldnn_primitive_t mem;
+  size_t bytes = mkldnn_memory_primitive_desc_get_size(mem_pd);
+  *buf = alloc_tracked_memory(bytes, 64, ENGINE_MEM_WORKSPACE);
+  memset(*buf, 0, bytes);
+  MKL_CHECK(mkldnn_primitive_create(&mem, mem_pd, NULL, NULL));
+  MKL_CHECK(mkldnn_memory_set_data_handle(mem, *buf));
+  return mem;
+}
+
+/* Best-of-N wall time of one primitive descriptor in milliseconds, or a
+ * negative value if the primitive could not be created or executed */
+static double benchmark_conv_pd(const_mkldnn_primitive_desc_t pd,
+                                mkldnn_prop_kind_t prop_kind) {
+  const_mkldnn_primitive_desc_t src_pds[3], dst_pds[2];
+  int num_srcs, num_dsts;
+  if (!conv_arg_pds(pd, prop_kind, src_pds, &num_srcs, dst_pds, &num_dsts))
+    return -1;
+
+  mkldnn_primitive_t src_mems[3], dst_mems[2];
+  void *src_bufs[3], *dst_bufs[2];
+  mkldnn_primitive_at_t srcs[3];
+  const_mkldnn_primitive_t dsts[2];
+  for (int i = 0; i < num_srcs; i++) {
+    src_mems[i] = create_scratch_memory(src_pds[i], &src_bufs[i]);
+    srcs[i] = mkldnn_primitive_at(src_mems[i], 0);
+  }
+  for (int i = 0; i < num_dsts; i++) {
+    dst_mems[i] = create_scratch_memory(dst_pds[i], &dst_bufs[i]);
+    dsts[i] = dst_mems[i];
+  }
+
+  double best = -1;
+  mkldnn_primitive_t conv;
+  mkldnn_stream_t stream;
+  mkldnn_primitive_t error_primitive;
+  if (mkldnn_primitive_create(&conv, pd, srcs, dsts) == mkldnn_success) {
+    MKL_CHECK(mkldnn_stream_create(&stream, mkldnn_eager));
+    if (mkldnn_stream_submit(stream, 1, &conv, &error_primitive) ==
+            mkldnn_success &&
+        mkldnn_stream_wait(stream, 1, NULL) == mkldnn_success) {
+      for (int it = 0; it < AUTOTUNE_WARMUP_ITERS + AUTOTUNE_TIMED_ITERS;
+           it++) {
+        double start = now_ms();
+        MKL_CHECK(mkldnn_stream_rerun(stream, &error_primitive));
+        MKL_CHECK(mkldnn_stream_wait(stream, 1, NULL));
+        double elapsed = now_ms() - start;
+        if (it >= AUTOTUNE_WARMUP_ITERS && (best < 0 || elapsed < best))
+          best = elapsed;
+      }
+    }
+    MKL_CHECK(mkldnn_stream_destroy(stream));
+    MKL_CHECK(mkldnn_primitive_destroy(conv));
+  }
+
+  for (int i = 0; i < num_srcs; i++) {
+    MKL_CHECK(mkldnn_primitive_destroy(src_mems[i]));
+    free_memory(src_bufs[i]);
+  }
+  for (int i = 0; i < num_dsts; i++) {
+    MKL_CHECK(mkldnn_primitive_destroy(dst_mems[i]));
+    free_memory(dst_bufs[i]);
+  }
+  return best;
+}
+
+static const char *pd_impl_info(const_mkldnn_primitive_desc_t pd) {
+  const char *str_buf = NULL;
+  MKL_CHECK(mkldnn_primitive_desc_query(pd, mkldnn_query_impl_info_str, 0,
+                                        &str_buf));
+  return str_buf;
+}
+
+/* Walks every implementation of every candidate. With 'impl' set, returns the
+ * first implementation of algorithm 'alg' whose impl_info_str matches;
+ * otherwise benchmarks them all and returns the fastest. */
+static mkldnn_primitive_desc_t search_conv_pd(
+    mkldnn_engine_t engine, const mkldnn_convolution_desc_t *candidates,
+    int num_candidates, mkldnn_alg_kind_t alg, const char *impl,
+    conv_autotune_entry *result) {
+  mkldnn_primitive_desc_t best_pd = NULL;
+  double best_time = -1;
+  for (int c = 0; c < num_candidates; c++) {
+    if (impl && candidates[c].alg_kind != alg) continue;
+    mkldnn_primitive_desc_iterator_t it;
+    if (mkldnn_primitive_desc_iterator_create(&it, &candidates[c], engine,
+                                              NULL) != mkldnn_success)
+      continue;  // algorithm not implemented for this shape/ISA
+    do {
+      mkldnn_primitive_desc_t pd = mkldnn_primitive_desc_iterator_fetch(it);
+      if (!pd) continue;
+      const char *info = pd_impl_info(pd);
+      if (impl) {
+        if (strcmp(info, impl) == 0) {
+          MKL_CHECK(mkldnn_primitive_desc_iterator_destroy(it));
+          return pd;
+        }
+        MKL_CHECK(mkldnn_primitive_desc_destroy(pd));
+        continue;
+      }
+      double t = benchmark_conv_pd(pd, candidates[c].prop_kind);
+      if (t >= 0 && (best_time < 0 || t < best_time)) {
+        if (best_pd) MKL_CHECK(mkldnn_primitive_desc_destroy(best_pd));
+        best_pd = pd;
+        best_time = t;
+        result->alg = candidates[c].alg_kind;
+        snprintf(result->impl, AUTOTUNE_IMPL_LEN, "%s", info);
+        result->time_ms = t;
+      } else {
+        MKL_CHECK(mkldnn_primitive_desc_destroy(pd));
+      }
+    } while (mkldnn_primitive_desc_iterator_next(it) == mkldnn_success);
+    MKL_CHECK(mkldnn_primitive_desc_iterator_destroy(it));
+  }
+  return best_pd;
+}
+
+mkldnn_primitive_desc_t create_conv_primitive_desc(
+    mkldnn_engine_t engine, const mkldnn_convolution_desc_t *candidates,
+    int num_candidates) {
+  mkldnn_primitive_desc_t pd = NULL;
+  if (!autotune_enabled) {
+    MKL_CHECK(mkldnn_primitive_desc_create(&pd, &candidates[0], engine, NULL));
+    return pd;
+  }
+
+  char key[AUTOTUNE_KEY_LEN];
+  make_autotune_key(&candidates[0], key);
+  conv_autotune_entry *entry = find_autotune_entry(key);
+  if (entry) {
+    conv_autotune_entry unused;
+    pd = search_conv_pd(engine, candidates, num_candidates, entry->alg,
+                        entry->impl, &unused);
+    if (pd) return pd;
+    // Recorded implementation no longer available (library or ISA changed)
+  }
+
+  conv_autotune_entry best;
+  pd = search_conv_pd(engine, candidates, num_candidates,
+                      mkldnn_convolution_direct, NULL, &best);
+  if (!pd) {
+    MKL_CHECK(mkldnn_primitive_desc_create(&pd, &candidates[0], engine, NULL));
+    return pd;
+  }
+  entry = add_autotune_entry(key);
+  entry->alg = best.alg;
+  snprintf(entry->impl, AUTOTUNE_IMPL_LEN, "%s", best.impl);
+  entry->time_ms = best.time_ms;
+  save_autotune_table();
+  return pd;
+}
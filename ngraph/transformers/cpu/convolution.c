@@ -43,24 +43,32 @@ void create_mkldnn_conv_fprop_kernel(mkldnn_engine_t engine, int src_dims,
   }
   MKL_CHECK(mkldnn_memory_desc_init(&mkldnn_memory_desc_dst_md, dst_dims,
                                     dst_sizes, data_type, mkldnn_any));
-  mkldnn_convolution_desc_t conv_desc;
+  // Direct is always the first candidate; it is what runs without autotuning
+  mkldnn_convolution_desc_t conv_desc[2];
+  int num_candidates = 1;
   if (dilates[0] != 0 || dilates[1] != 0) {
     MKL_CHECK(mkldnn_dilated_convolution_forward_desc_init(
-      &conv_desc, mkldnn_forward, mkldnn_convolution_direct,
+      &conv_desc[0], mkldnn_forward, mkldnn_convolution_direct,
       &mkldnn_memory_desc_src_md, &mkldnn_memory_desc_weights_md, bias_desc,
       &mkldnn_memory_desc_dst_md, strides, dilates, padding, padding,
       mkldnn_padding_zero));
   }
   else {
     MKL_CHECK(mkldnn_convolution_forward_desc_init(
-      &conv_desc, mkldnn_forward, mkldnn_convolution_direct,
+      &conv_desc[0], mkldnn_forward, mkldnn_convolution_direct,
       &mkldnn_memory_desc_src_md, &mkldnn_memory_desc_weights_md, bias_desc,
       &mkldnn_memory_desc_dst_md, strides, padding, padding,
       mkldnn_padding_zero));
+    if (mkldnn_convolution_forward_desc_init(
+            &conv_desc[1], mkldnn_forward, mkldnn_convolution_winograd,
+            &mkldnn_memory_desc_src_md, &mkldnn_memory_desc_weights_md,
+            bias_desc, &mkldnn_memory_desc_dst_md, strides, padding, padding,
+            mkldnn_padding_zero) == mkldnn_success)
+      num_candidates++;
   }
 
-  MKL_CHECK(mkldnn_primitive_desc_create(&opkernel->op_desc, &conv_desc, engine,
-                                         NULL));
+  opkernel->op_desc =
+      create_conv_primitive_desc(engine, conv_desc, num_candidates);
 
   const_mkldnn_primitive_desc_t kernel_src_pd =
       mkldnn_primitive_desc_query_pd(opkernel->op_desc, mkldnn_query_src_pd, 0);
@@ -249,8 +257,8 @@ void create_mkldnn_conv_fprop_kernel(mkldnn_engine_t engine, int src_dims,
   if (bias_sizes) 
       conv_srcs[2] = mkldnn_primitive_at(mkldnn_memory_prim_bias, 0);
   
-  MKL_CHECK(mkldnn_primitive_create(&opkernel->op_prim, opkernel->op_desc,
-                                    conv_srcs, conv_dsts));
+  create_opkernel_primitive(opkernel, conv_srcs, bias_sizes ? 3 : 2,
+                            conv_dsts, 1);
 
   if (opkernel->reorder_i[0])
     opkernel->net[opkernel->net_size++] = opkernel->reorder_i[0];
@@ -261,7 +269,7 @@ void create_mkldnn_conv_fprop_kernel(mkldnn_engine_t engine, int src_dims,
     if (opkernel->reorder_i[2])
        opkernel->net[opkernel->net_size++] = opkernel->reorder_i[2];
   }  
-  opkernel->net[opkernel->net_size++] = opkernel->op_prim;
+  opkernel->net[opkernel->net_size++] = NULL; /* op_prim */
   if (opkernel->reorder_o[0])
     opkernel->net[opkernel->net_size++] = opkernel->reorder_o[0];
 }
@@ -281,21 +289,28 @@ void create_mkldnn_conv_bprop_data_kernel(
                                     mkldnn_any));
   MKL_CHECK(mkldnn_memory_desc_init(&mkldnn_memory_desc_dst_md, dst_dims,
                                     dst_sizes, data_type, mkldnn_any));
-  mkldnn_convolution_desc_t conv_desc_data;
+  mkldnn_convolution_desc_t conv_desc_data[2];
+  int num_candidates = 1;
   if (dilates[0] != 0 || dilates[1] != 0) {
     MKL_CHECK(mkldnn_dilated_convolution_backward_data_desc_init(
-      &conv_desc_data, mkldnn_convolution_direct, &mkldnn_memory_desc_dst_md,
+      &conv_desc_data[0], mkldnn_convolution_direct, &mkldnn_memory_desc_dst_md,
       &mkldnn_memory_desc_weights_md, &mkldnn_memory_desc_src_md, strides,
       dilates, padding, padding, mkldnn_padding_zero));
   }
   else {
     MKL_CHECK(mkldnn_convolution_backward_data_desc_init(
-        &conv_desc_data, mkldnn_convolution_direct, &mkldnn_memory_desc_dst_md,
+        &conv_desc_data[0], mkldnn_convolution_direct, &mkldnn_memory_desc_dst_md,
         &mkldnn_memory_desc_weights_md, &mkldnn_memory_desc_src_md, strides,
         padding, padding, mkldnn_padding_zero));
+    if (mkldnn_convolution_backward_data_desc_init(
+            &conv_desc_data[1], mkldnn_convolution_winograd,
+            &mkldnn_memory_desc_dst_md, &mkldnn_memory_desc_weights_md,
+            &mkldnn_memory_desc_src_md, strides, padding, padding,
+            mkldnn_padding_zero) == mkldnn_success)
+      num_candidates++;
   }
-  MKL_CHECK(mkldnn_primitive_desc_create(&opkernel->op_desc, &conv_desc_data,
-                                         engine, NULL));
+  opkernel->op_desc =
+      create_conv_primitive_desc(engine, conv_desc_data, num_candidates);
 
   const_mkldnn_primitive_desc_t kernel_src_pd = mkldnn_primitive_desc_query_pd(
       opkernel->op_desc, mkldnn_query_diff_dst_pd, 0);
@@ -398,14 +413,13 @@ void create_mkldnn_conv_bprop_data_kernel(
       mkldnn_primitive_at(mkldnn_memory_prim_src, 0),
       mkldnn_primitive_at(mkldnn_memory_prim_weights, 0)};
 
-  MKL_CHECK(mkldnn_primitive_create(&opkernel->op_prim, opkernel->op_desc,
-                                    conv_srcs, conv_dsts));
+  create_opkernel_primitive(opkernel, conv_srcs, 2, conv_dsts, 1);
 
   if (opkernel->reorder_i[0])
     opkernel->net[opkernel->net_size++] = opkernel->reorder_i[0];
   if (opkernel->reorder_i[1])
     opkernel->net[opkernel->net_size++] = opkernel->reorder_i[1];
-  opkernel->net[opkernel->net_size++] = opkernel->op_prim;
+  opkernel->net[opkernel->net_size++] = NULL; /* op_prim */
 }
 
 // src - diff_dst
@@ -434,24 +448,31 @@ void create_mkldnn_conv_bprop_weights_kernel(
                                       bias_sizes, data_type, mkldnn_x));
   }
 
-  mkldnn_convolution_desc_t conv_desc_weights;
+  mkldnn_convolution_desc_t conv_desc_weights[2];
+  int num_candidates = 1;
   mkldnn_memory_desc_t* bias;
   bias = (bias_sizes) ? &mkldnn_memory_desc_diff_bias_md : NULL;
   if (dilates[0] != 0 || dilates[1] != 0) {
     MKL_CHECK(mkldnn_dilated_convolution_backward_weights_desc_init(
-      &conv_desc_weights, mkldnn_convolution_direct, &mkldnn_memory_desc_dst_md,
+      &conv_desc_weights[0], mkldnn_convolution_direct, &mkldnn_memory_desc_dst_md,
       &mkldnn_memory_desc_weights_md, bias,
       &mkldnn_memory_desc_src_md, strides,
       dilates, padding, padding, mkldnn_padding_zero));
   }
   else { 
     MKL_CHECK(mkldnn_convolution_backward_weights_desc_init(
-      &conv_desc_weights, mkldnn_convolution_direct, &mkldnn_memory_desc_dst_md,
+      &conv_desc_weights[0], mkldnn_convolution_direct, &mkldnn_memory_desc_dst_md,
       &mkldnn_memory_desc_weights_md, bias, &mkldnn_memory_desc_src_md,
       strides, padding, padding, mkldnn_padding_zero));
+    if (mkldnn_convolution_backward_weights_desc_init(
+            &conv_desc_weights[1], mkldnn_convolution_winograd,
+            &mkldnn_memory_desc_dst_md, &mkldnn_memory_desc_weights_md, bias,
+            &mkldnn_memory_desc_src_md, strides, padding, padding,
+            mkldnn_padding_zero) == mkldnn_success)
+      num_candidates++;
   }
-  MKL_CHECK(mkldnn_primitive_desc_create(&opkernel->op_desc, &conv_desc_weights,
-                                         engine, NULL));
+  opkernel->op_desc =
+      create_conv_primitive_desc(engine, conv_desc_weights, num_candidates);
 
   const_mkldnn_primitive_desc_t kernel_src_pd = mkldnn_primitive_desc_query_pd(
       opkernel->op_desc, mkldnn_query_diff_dst_pd, 0);
@@ -592,14 +613,14 @@ void create_mkldnn_conv_bprop_weights_kernel(
       mkldnn_primitive_at(mkldnn_memory_prim_dst, 0),
       mkldnn_primitive_at(mkldnn_memory_prim_src, 0)};
 
-  MKL_CHECK(mkldnn_primitive_create(&opkernel->op_prim, opkernel->op_desc,
-                                    conv_srcs, conv_dsts));
+  create_opkernel_primitive(opkernel, conv_srcs, 2, conv_dsts,
+                            bias_sizes ? 2 : 1);
 
   if (opkernel->reorder_i[0])
     opkernel->net[opkernel->net_size++] = opkernel->reorder_i[0];
   if (opkernel->reorder_i[1])
     opkernel->net[opkernel->net_size++] = opkernel->reorder_i[1];
-  opkernel->net[opkernel->net_size++] = opkernel->op_prim;
+  opkernel->net[opkernel->net_size++] = NULL; /* op_prim */
   if (opkernel->reorder_o[0])
     opkernel->net[opkernel->net_size++] = opkernel->reorder_o[0];
 }
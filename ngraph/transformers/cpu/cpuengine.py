@@ -16,16 +16,99 @@
 
 from __future__ import division
 from __future__ import print_function
+import copy
 import ctypes as ct
+import logging
+import multiprocessing
 import os
 import sys
 import itertools as itt
 import numpy as np
+from numpy.lib.mixins import NDArrayOperatorsMixin
+
+logger = logging.getLogger(__name__)
+
+
+# (library name part, thread count setters to try) of the BLAS libraries numpy links
+BLAS_THREAD_FUNCTIONS = (('openblas', ('openblas_set_num_threads',
+                                       'openblas_set_num_threads64_',
+                                       'scipy_openblas_set_num_threads64_')),
+                         ('mkl_rt', ('MKL_Set_Num_Threads',)),
+                         ('blis', ('bli_thread_set_num_threads',)))
+
+
+def parse_cpulist(cpulist):
+    """
+    The cpus of a cpulist such as '0-3,8-11', the format of the cpusets and of
+    /sys/devices/system/node/node*/cpulist.
+    """
+    cpus = []
+    for part in cpulist.strip().split(','):
+        if '-' in part:
+            first, last = part.split('-')
+            cpus.extend(range(int(first), int(last) + 1))
+        elif part:
+            cpus.append(int(part))
+    return cpus
+
+
+def set_blas_threads(num_threads):
+    """
+    Sets the thread pool size of the BLAS libraries loaded in the process, the ones
+    numpy's np.dot fallbacks run on.
+
+    Returns:
+        The file names of the libraries set.
+    """
+    try:
+        with open('/proc/self/maps') as maps:
+            paths = set(line.split()[-1] for line in maps if '.so' in line)
+    except IOError:
+        return []
+    libraries = []
+    for path in sorted(paths):
+        name = os.path.basename(path)
+        for part, functions in BLAS_THREAD_FUNCTIONS:
+            if part not in name:
+                continue
+            try:
+                library = ct.CDLL(path)
+            except OSError:
+                continue
+            function = next((getattr(library, function) for function in functions
+                             if hasattr(library, function)), None)
+            if function is not None:
+                function(ct.c_int(num_threads))
+                libraries.append(name)
+    return libraries
+
+
+def thread_config_from_env():
+    """
+    The configure_threads arguments set in the environment.
+    """
+    config = dict()
+    for key, variable in (('num_threads', 'NGRAPH_MKL_THREADS'),
+                          ('callers', 'NGRAPH_MKL_CALLERS'),
+                          ('spin_us', 'NGRAPH_MKL_SPIN_US'),
+                          ('blas_threads', 'NGRAPH_MKL_BLAS_THREADS')):
+        if os.getenv(variable):
+            config[key] = int(os.environ[variable])
+    if os.getenv('NGRAPH_MKL_CPUS'):
+        config['cpus'] = parse_cpulist(os.environ['NGRAPH_MKL_CPUS'])
+    return config
 
 
 class Mkldnn(object):
 
+    # Memory accounting categories, in the order of the engine's ENGINE_MEM_* values
+    memory_categories = ('reorder_scratch', 'workspace', 'temporary', 'persistent')
+    # Thread stats, in the order of the engine's THREAD_STAT_* values
+    thread_stat_names = ('idle_ns', 'idle_gaps', 'wakeup_ns', 'wakeups', 'max_wakeup_ns',
+                         'kernel_runs')
+
     def __init__(self, engine_path):
+        self.engine_path = engine_path
         self.enabled = False
         self.mkldnn_engine_initialized = False
         self.mkldnn_verbose = False
@@ -42,6 +125,22 @@ class Mkldnn(object):
         }
         self.kernels = dict()        # MKL Op kernels
         self.native_layouts = []     # Layout objects owned by transformer
+        self.warmup_enabled = False
+        self.build_threads = 0
+        self.warmed_up_kernels = set()
+        self.layout_reports = []     # Reorder bytes per computation, see MklAssignLayouts
+        self.layout_report_enabled = os.getenv('NGRAPH_MKL_LAYOUT_REPORT', '0') == '1'
+        # NGRAPH_MKL_PERF_COUNTERS=1 times every primitive and reads hardware counters
+        self.perf_counters_enabled = os.getenv('NGRAPH_MKL_PERF_COUNTERS', '0') == '1'
+        self.tracked_pools = []      # (category, bytes) of graph pools added to the accounting
+        self.shared_reorders = dict()  # Persistent tensor -> [(kernel, input index)]
+        self.context_kernels = []    # Kernel copies of execution contexts, see context()
+        self.scale_shift_buffers = dict()  # (kernel name, index) -> 2 x C array
+        # Threads of kernel runs and BLAS, see configure_threads
+        self.thread_config = thread_config_from_env()
+        self.thread_counters_enabled = os.getenv('NGRAPH_MKL_THREAD_COUNTERS', '0') == '1'
+        if 'spin_us' in self.thread_config:
+            self.set_openmp_wait_policy(self.thread_config['spin_us'])
         try:
             self.mkllib = ct.CDLL(engine_path)
             self.enabled = True
@@ -79,6 +178,9 @@ class Mkldnn(object):
             self.output_layout = self.mkllib.query_opkernel_layout
             self.output_layout.argtypes = [ct.c_void_p, ct.c_int]
             self.output_layout.restype = ct.c_void_p
+            self.input_layout = self.mkllib.query_opkernel_input_layout
+            self.input_layout.argtypes = [ct.c_void_p, ct.c_int]
+            self.input_layout.restype = ct.c_void_p
             self.cmp_layouts = self.mkllib.mkldnn_compare_memdesc
             self.cmp_layouts.argtypes = [ct.c_void_p, ct.c_void_p]
             self.cmp_layouts.restype = ct.c_int
@@ -108,6 +210,18 @@ class Mkldnn(object):
                 [ct.c_void_p, ct.c_int, ct.c_int, ct.c_int, ct.c_void_p,
                  ct.c_void_p, ct.c_void_p, ct.c_void_p, ct.c_void_p, ct.c_int,
                  ct.c_int, ct.c_void_p]
+            self.sum_kernel = \
+                self.mkllib.create_mkldnn_sum_kernel
+            self.sum_kernel.argtypes = \
+                [ct.c_void_p, ct.c_int, ct.c_void_p, ct.c_int, ct.c_void_p,
+                 ct.c_void_p, ct.c_int, ct.c_int, ct.c_void_p]
+            self.binary_eltwise_kernel = \
+                self.mkllib.create_mkldnn_binary_eltwise_kernel
+            self.binary_eltwise_kernel.argtypes = \
+                [ct.c_void_p, ct.c_int, ct.c_void_p, ct.c_void_p, ct.c_void_p,
+                 ct.c_void_p, ct.c_void_p, ct.c_void_p, ct.c_void_p, ct.c_int,
+                 ct.c_int, ct.c_void_p]
+            self.binary_eltwise_kernel.restype = ct.c_int
 
             self.batchnorm_fprop_kernel = \
                 self.mkllib.create_mkldnn_batchnorm_fprop_primitives
@@ -180,25 +294,526 @@ class Mkldnn(object):
                 [ct.c_void_p, ct.c_int, ct.c_void_p, ct.c_int,
                  ct.c_void_p, ct.c_void_p, ct.c_void_p]
 
+            self.set_conv_autotune = self.mkllib.set_conv_autotune
+            self.set_conv_autotune.argtypes = [ct.c_char_p, ct.c_int]
+            self.query_impl_info = self.mkllib.query_opkernel_impl_info
+            self.query_impl_info.argtypes = [ct.c_void_p]
+            self.query_impl_info.restype = ct.c_char_p
+            self.inplace_compatible = self.mkllib.opkernel_inplace_compatible
+            self.inplace_compatible.argtypes = [ct.c_void_p, ct.c_int, ct.c_int]
+            self.inplace_compatible.restype = ct.c_int
+            self.start_kernel_build_threads = self.mkllib.start_kernel_build_threads
+            self.start_kernel_build_threads.argtypes = [ct.c_int]
+            self.stop_kernel_build_threads = self.mkllib.stop_kernel_build_threads
+            self.wait_kernel_build = self.mkllib.wait_kernel_build
+            self.wait_kernel_build.argtypes = [ct.c_void_p]
+            self.warmup_opkernel = self.mkllib.warmup_opkernel
+            self.warmup_opkernel.argtypes = [ct.c_void_p]
+            self.enable_counters = self.mkllib.enable_opkernel_counters
+            self.enable_counters.argtypes = [ct.c_int]
+            self.enable_counters.restype = ct.c_int
+            self.reset_counters = self.mkllib.reset_opkernel_counters
+            self.reset_counters.argtypes = [ct.c_void_p]
+            self.query_counters = self.mkllib.query_opkernel_counters
+            self.query_counters.argtypes = [ct.c_void_p, ct.c_int, ct.c_void_p]
+            self.query_counters.restype = ct.c_longlong
+            self.account_memory = self.mkllib.account_memory
+            self.account_memory.argtypes = [ct.c_int, ct.c_longlong]
+            self.query_memory_stats = self.mkllib.query_memory_stats
+            self.query_memory_stats.argtypes = [ct.c_void_p]
+            self.reset_memory_peaks = self.mkllib.reset_memory_peaks
+            self.begin_memory_mark = self.mkllib.begin_memory_mark
+            self.end_memory_mark = self.mkllib.end_memory_mark
+            self.end_memory_mark.argtypes = [ct.c_int]
+            self.end_memory_mark.restype = ct.c_longlong
+            self.query_kernel_memory = self.mkllib.query_opkernel_memory
+            self.query_kernel_memory.argtypes = [ct.c_void_p]
+            self.query_kernel_memory.restype = ct.c_longlong
+            self.share_internal_input = self.mkllib.share_opkernel_internal_input
+            self.share_internal_input.argtypes = [ct.c_void_p, ct.c_int, ct.c_void_p, ct.c_int]
+            self.share_internal_input.restype = ct.c_int
+            self.create_kernel_context = self.mkllib.create_opkernel_context
+            self.create_kernel_context.argtypes = [ct.c_void_p, ct.c_uint]
+            self.create_kernel_context.restype = ct.c_void_p
+            self.reset_kernel_contexts = self.mkllib.reset_opkernel_contexts
+            self.reset_kernel_contexts.argtypes = [ct.c_void_p]
+            self.query_memory_desc_size = self.mkllib.query_memory_desc_size
+            self.query_memory_desc_size.restype = ct.c_size_t
+            self.query_prepacked_size = self.mkllib.query_opkernel_prepacked_size
+            self.query_prepacked_size.argtypes = [ct.c_void_p, ct.c_int]
+            self.query_prepacked_size.restype = ct.c_size_t
+            self.query_prepacked_layout = self.mkllib.query_opkernel_prepacked_layout
+            self.query_prepacked_layout.argtypes = [ct.c_void_p, ct.c_int]
+            self.query_prepacked_layout.restype = ct.c_void_p
+            self.pack_opkernel_input = self.mkllib.pack_opkernel_input
+            self.pack_opkernel_input.argtypes = [ct.c_void_p, ct.c_int, ct.c_void_p, ct.c_void_p]
+            self.unpack_opkernel_input = self.mkllib.unpack_opkernel_input
+            self.unpack_opkernel_input.argtypes = \
+                [ct.c_void_p, ct.c_int, ct.c_char_p, ct.c_void_p, ct.c_void_p]
+            self.unpack_opkernel_input.restype = ct.c_int
+            self.bind_prepacked_input = self.mkllib.bind_opkernel_prepacked_input
+            self.bind_prepacked_input.argtypes = \
+                [ct.c_void_p, ct.c_int, ct.c_char_p, ct.c_void_p]
+            self.bind_prepacked_input.restype = ct.c_int
+            self.configure_thread_runtime = self.mkllib.configure_thread_runtime
+            self.configure_thread_runtime.argtypes = \
+                [ct.c_int, ct.c_int, ct.c_void_p, ct.c_int, ct.c_int]
+            self.query_thread_team_size = self.mkllib.query_thread_team_size
+            self.query_thread_team_size.restype = ct.c_int
+            self.enable_thread_counters = self.mkllib.enable_thread_counters
+            self.enable_thread_counters.argtypes = [ct.c_int]
+            self.query_thread_stats = self.mkllib.query_thread_stats
+            self.query_thread_stats.argtypes = [ct.c_void_p]
+            self.clear_thread_stats = self.mkllib.reset_thread_stats
+
+            self.gemm_conv_fprop = self.mkllib.run_gemm_conv_fprop
+            self.gemm_conv_fprop.argtypes = \
+                [ct.c_void_p, ct.c_void_p, ct.c_void_p, ct.c_void_p,
+                 ct.c_void_p, ct.c_void_p, ct.c_void_p, ct.c_void_p,
+                 ct.c_void_p, ct.c_void_p]
+            self.gemm_conv_bprop_data = self.mkllib.run_gemm_conv_bprop_data
+            self.gemm_conv_bprop_data.argtypes = \
+                [ct.c_void_p, ct.c_void_p, ct.c_void_p, ct.c_void_p,
+                 ct.c_void_p, ct.c_void_p, ct.c_void_p, ct.c_void_p,
+                 ct.c_void_p]
+            self.gemm_conv_bprop_weights = self.mkllib.run_gemm_conv_bprop_weights
+            self.gemm_conv_bprop_weights.argtypes = \
+                [ct.c_void_p, ct.c_void_p, ct.c_void_p, ct.c_void_p,
+                 ct.c_void_p, ct.c_void_p, ct.c_void_p, ct.c_void_p,
+                 ct.c_void_p]
+
     def open(self):
         if (self.enabled):
             self.mkldnn_engine = self.init_mkldnn_engine_fn()
             self.mkldnn_engine_initialized = True
+            # NGRAPH_MKL_CONV_AUTOTUNE=1 benchmarks convolution algorithms per shape and
+            # records the winners in NGRAPH_MKL_CONV_AUTOTUNE_CACHE for later runs. The
+            # setting is global to the engine library, so every open sets it.
+            if os.getenv('NGRAPH_MKL_CONV_AUTOTUNE', '0') == '1':
+                table_path = os.path.expanduser(os.getenv(
+                    'NGRAPH_MKL_CONV_AUTOTUNE_CACHE',
+                    os.path.join('~', '.ngraph', 'mkldnn_conv_autotune.txt')))
+                table_dir = os.path.dirname(table_path)
+                if table_dir and not os.path.isdir(table_dir):
+                    os.makedirs(table_dir)
+                self.set_conv_autotune(table_path.encode(), 1)
+            else:
+                self.set_conv_autotune(None, 0)
+            # NGRAPH_MKL_BUILD_THREADS=n creates kernel primitives (and their JIT code) on
+            # n background threads while compilation continues, instead of inline
+            self.build_threads = int(os.getenv('NGRAPH_MKL_BUILD_THREADS', '0'))
+            if self.build_threads > 0:
+                self.start_kernel_build_threads(self.build_threads)
+            self.warmup_enabled = os.getenv('NGRAPH_MKL_WARMUP', '0') == '1'
+            if self.thread_counters_enabled:
+                self.enable_thread_counters(1)
+            if self.perf_counters_enabled:
+                # Opened before any kernel runs so that OpenMP threads inherit them
+                if self.enable_counters(1) == 0:
+                    logger.warning("MKL perf counters: perf_event_open failed, recording "
+                                   "times only")
+        if self.thread_config:
+            self.configure_threads(**self.thread_config)
+
+    def kernel_impl_info(self, name):
+        """
+        Returns the MKL-DNN implementation string (e.g. 'jit_wino:avx512_common')
+        chosen for the kernel of op 'name', or None if the op has no MKL-DNN kernel.
+        """
+        if not (self.enabled and name in self.kernels):
+            return None
+        return self.query_impl_info(self.kernels[name]).decode()
+
+    def warmup_kernels(self):
+        """
+        Runs every kernel not run before once on scratch buffers, so the first real
+        call does not pay for page faults on JIT code and internal buffers.
+        """
+        if not (self.enabled and self.warmup_enabled):
+            return
+        for name, kernel in self.kernels.items():
+            if kernel not in self.warmed_up_kernels:
+                self.warmup_opkernel(kernel)
+                self.warmed_up_kernels.add(kernel)
+                if self.perf_counters_enabled:
+                    self.reset_counters(kernel)
+
+    def track_pool(self, pool, category):
+        """
+        Adds a graph tensor pool allocated by the transformer to the engine's memory
+        accounting until close().
+        """
+        if self.enabled:
+            index = self.memory_categories.index(category)
+            self.account_memory(index, pool.nbytes)
+            self.tracked_pools.append((index, pool.nbytes))
+
+    def untrack_pool(self, pool, category):
+        """
+        Removes a pool added with track_pool before it is freed.
+        """
+        if self.enabled:
+            index = self.memory_categories.index(category)
+            self.account_memory(index, -pool.nbytes)
+            self.tracked_pools.remove((index, pool.nbytes))
+
+    def memory_stats(self):
+        """
+        Bytes currently held and the peak since start (or reset_memory_stats) in total
+        and per category: 'reorder_scratch' for the internal tensors kernels reorder
+        their inputs and outputs to, 'workspace' for scratch buffers of kernel runs,
+        autotuning and warmup, and 'temporary' and 'persistent' for the graph tensor
+        pools. Memory allocated inside MKL-DNN primitives is not included.
+
+        Returns:
+            dict(current=bytes, peak=bytes, categories={category: dict(current, peak)})
+        """
+        values = [0] * (2 + 2 * len(self.memory_categories))
+        if self.enabled:
+            out = (ct.c_longlong * len(values))()
+            self.query_memory_stats(out)
+            values = list(out)
+        return dict(current=values[0], peak=values[1],
+                    categories=dict((category, dict(current=values[2 + 2 * i],
+                                                    peak=values[3 + 2 * i]))
+                                    for i, category in enumerate(self.memory_categories)))
+
+    def reset_memory_stats(self):
+        """
+        Lowers the peaks reported by memory_stats to the current values.
+        """
+        if self.enabled:
+            self.reset_memory_peaks()
+
+    @staticmethod
+    def set_openmp_wait_policy(spin_us):
+        """
+        Sets the environment of the OpenMP runtimes for idle threads that spin spin_us
+        microseconds, unless already set. The runtimes read it when they are loaded
+        or first used, so this only takes effect before the first kernel runs.
+        """
+        if spin_us == 0:
+            os.environ.setdefault('OMP_WAIT_POLICY', 'PASSIVE')
+        os.environ.setdefault('KMP_BLOCKTIME', str((spin_us + 999) // 1000))
+        # GNU OpenMP spins in iterations of about a nanosecond
+        os.environ.setdefault('GOMP_SPINCOUNT', str(spin_us * 1000))
+
+    def configure_threads(self, num_threads=None, cpus=None, callers=1, spin_us=None,
+                          blas_threads=None):
+        """
+        Sets the threads of kernel runs and of the BLAS library, so that MKL-DNN,
+        numpy and concurrent callers do not run more busy threads than there are
+        cores. Also set from the environment when the engine opens, see
+        thread_config_from_env.
+
+        Arguments:
+            num_threads: Threads for all kernel runs, by default the number of cpus,
+                or of the cpus given.
+            cpus: Cpus to pin the OpenMP threads of kernel runs to, one per thread.
+            callers: Threads that run kernels at the same time (execution contexts,
+                HeTr workers). Each gets num_threads / callers threads and its own
+                slice of cpus.
+            spin_us: Microseconds idle OpenMP threads spin before they sleep. 0 makes
+                them sleep right away, which frees the cores for numpy between kernels.
+            blas_threads: Threads of the BLAS library, by default those of one caller.
+
+        Returns:
+            dict of the OpenMP threads per caller ('team_size') and the BLAS libraries
+            set ('blas_libraries').
+        """
+        self.thread_config = dict(num_threads=num_threads, cpus=cpus, callers=callers,
+                                  spin_us=spin_us, blas_threads=blas_threads)
+        cpus = list(cpus or [])
+        if self.enabled:
+            self.configure_thread_runtime(num_threads or 0, callers,
+                                          (ct.c_int * len(cpus))(*cpus) if cpus else None,
+                                          len(cpus), -1 if spin_us is None else spin_us)
+            team_size = self.query_thread_team_size()
+        else:
+            team_size = max(1, (num_threads or len(cpus) or multiprocessing.cpu_count()) //
+                            max(1, callers))
+        libraries = set_blas_threads(blas_threads or team_size)
+        return dict(team_size=team_size, blas_libraries=libraries)
+
+    def thread_stats(self):
+        """
+        Time the OpenMP teams of kernel runs sat idle between the kernel runs of their
+        caller ('idle_ms' over 'idle_gaps' gaps), and the time a team took to wake up
+        for a kernel run ('wakeup_ms' in total over 'wakeups', 'max_wakeup_ms'), since
+        start or reset_thread_stats. Wakeups are measured with NGRAPH_MKL_THREAD_COUNTERS=1
+        only, since each costs an empty parallel region.
+        """
+        values = [0] * len(self.thread_stat_names)
+        if self.enabled:
+            out = (ct.c_longlong * len(values))()
+            self.query_thread_stats(out)
+            values = list(out)
+        stats = dict(zip(self.thread_stat_names, values))
+        for name in ('idle', 'wakeup', 'max_wakeup'):
+            stats[name + '_ms'] = stats.pop(name + '_ns') / 1e6
+        return stats
+
+    def reset_thread_stats(self):
+        if self.enabled:
+            self.clear_thread_stats()
+
+    def kernel_memory(self, name):
+        """
+        Bytes of the internal tensors held by the kernel of op 'name'.
+        """
+        if not (self.enabled and name in self.kernels):
+            return 0
+        return self.query_kernel_memory(self.kernels[name])
+
+    def share_reorder(self, key, kernel, index):
+        """
+        Input 'index' of kernel reads the persistent tensor identified by key. If another
+        kernel already reorders that tensor to the same layout, both reorder into one
+        buffer, so e.g. the weights of computations compiled for several batch sizes are
+        held once in MKL-DNN layout.
+        """
+        owners = self.shared_reorders.setdefault(key, [])
+        for owner, owner_index in owners:
+            if self.share_internal_input(kernel, index, owner, owner_index):
+                return True
+        owners.append((kernel, index))
+        return False
+
+    def context(self, names, shared_inputs):
+        """
+        Returns a copy of this object for running the kernels of the ops in names
+        concurrently with the kernels of this object: every kernel is replaced by a copy
+        with its own memory primitives, streams and internal buffers. Kernels share
+        their descriptors and JIT code with the original and, for the input indices set
+        in the bit mask shared_inputs[kernel], the reordered copy of the input.
+        Ops without a kernel are left out.
+
+        Raises:
+            ValueError: If a kernel can not be copied.
+        """
+        context = copy.copy(self)
+        context.kernels = dict()
+        context.scale_shift_buffers = dict()
+        if not self.enabled:
+            return context
+        for name in names:
+            kernel = self.kernels.get(name)
+            if kernel is None:
+                continue
+            context_kernel = self.create_kernel_context(kernel, shared_inputs.get(kernel, 0))
+            if not context_kernel:
+                self.release_context(context)
+                raise ValueError("Kernel of {} can not run in several contexts".format(name))
+            context.kernels[name] = context_kernel
+            self.context_kernels.append(context_kernel)
+        return context
+
+    def release_context(self, context):
+        """
+        Deletes the kernels of a copy returned by context().
+        """
+        for kernel in context.kernels.values():
+            if kernel in self.context_kernels:
+                self.context_kernels.remove(kernel)
+                self.delete_opkernel(kernel)
+        context.kernels = dict()
+
+    def reset_contexts(self):
+        """
+        Makes the kernel copies of all contexts reorder their shared inputs again on
+        their next run, e.g. after the variables were updated.
+        """
+        if self.enabled:
+            for kernel in self.kernels.values():
+                self.reset_kernel_contexts(kernel)
+
+    def prepacked_layout(self, name, index):
+        """
+        The memory descriptor bytes of the layout the kernel of op 'name' reorders
+        input 'index' to, or None if it reads the input as is.
+        """
+        kernel = self.kernels.get(name) if self.enabled else None
+        if kernel is None:
+            return None
+        layout = self.query_prepacked_layout(kernel, index)
+        if not layout:
+            return None
+        return ct.string_at(layout, self.query_memory_desc_size())
+
+    def prepacked_size(self, name, index):
+        return self.query_prepacked_size(self.kernels[name], index)
+
+    def pack_input(self, name, index, src, dst):
+        """
+        Writes src, input 'index' of the kernel of op 'name', to the array dst in the
+        layout returned by prepacked_layout.
+        """
+        self.pack_opkernel_input(self.kernels[name], index, src.ctypes.data, dst.ctypes.data)
+
+    def unpack_input(self, name, index, layout, src, dst):
+        """
+        Writes src, in the layout with memory descriptor bytes 'layout', to the array dst
+        in the layout of input 'index' of the kernel of op 'name'. Returns False if
+        MKL-DNN can not reorder it.
+        """
+        return bool(self.unpack_opkernel_input(self.kernels[name], index, layout,
+                                               src.ctypes.data, dst.ctypes.data))
+
+    def bind_input(self, name, index, layout, src):
+        """
+        Makes the kernel of op 'name' read input 'index' from the array src, in the layout
+        with memory descriptor bytes 'layout', in place of reordering the input on every
+        run. src must outlive the kernel. Returns False if the kernel reorders the input
+        to another layout.
+        """
+        return bool(self.bind_prepacked_input(self.kernels[name], index, layout,
+                                              src.ctypes.data))
+
+    def reset_perf_counters(self):
+        """
+        Clears the counters of all kernels, e.g. after warmup iterations.
+        """
+        if self.enabled and self.perf_counters_enabled:
+            for kernel in self.kernels.values():
+                self.reset_counters(kernel)
+
+    def roofline_report(self, names=None, peak_gflops=None, peak_gbps=None):
+        """
+        Per op roofline data of the kernels run with NGRAPH_MKL_PERF_COUNTERS=1.
+
+        Every kernel of the ops in names (default: all) gives a row for the op and, if
+        the kernel reorders inputs or outputs, a row for the reorders. Times, counters
+        and DRAM bytes (estimated as one cache line per last level cache miss) are per
+        call; flops and bytes are the analytical counts of the kernel shapes, and
+        intensity is their ratio. Given the peak GFLOP/s and GB/s of the machine
+        (default NGRAPH_MKL_PEAK_GFLOPS and NGRAPH_MKL_PEAK_GBPS), rows are classified
+        as 'compute' or 'memory' bound and efficiency is the fraction of the
+        attainable GFLOP/s (or GB/s for reorders) reached.
+
+        Returns:
+            List of dicts, slowest first.
+        """
+        if not (self.enabled and self.perf_counters_enabled):
+            return []
+        peak_gflops = peak_gflops or float(os.getenv('NGRAPH_MKL_PEAK_GFLOPS', 0))
+        peak_gbps = peak_gbps or float(os.getenv('NGRAPH_MKL_PEAK_GBPS', 0))
+        out = (ct.c_double * 7)()
+        rows = []
+        for name in (self.kernels if names is None else names):
+            kernel = self.kernels.get(name)
+            if kernel is None:
+                continue
+            calls = 0
+            totals = dict()
+            for entry in itt.count():
+                entry_calls = self.query_counters(kernel, entry, out)
+                if entry_calls < 0:
+                    break
+                calls = entry_calls
+                kind = 'reorder' if out[0] else 'op'
+                totals[kind] = [t + v for t, v in zip(totals.get(kind, [0.0] * 6), out[1:])]
+            if calls == 0:
+                continue
+            for kind, values in sorted(totals.items()):
+                time_ms, cycles, instructions, llc_misses = [v / calls for v in values[:4]]
+                flops, nbytes = values[4:]
+                seconds = time_ms / 1e3
+                row = dict(name=name, kind=kind, calls=calls, time_ms=time_ms,
+                           flops=flops, bytes=nbytes,
+                           intensity=flops / nbytes if nbytes else 0.0,
+                           gflops=flops / seconds / 1e9 if seconds else 0.0,
+                           gbps=nbytes / seconds / 1e9 if seconds else 0.0,
+                           dram_bytes=llc_misses * 64,
+                           ipc=instructions / cycles if cycles else None,
+                           bound=None, efficiency=None)
+                if peak_gflops and peak_gbps:
+                    ridge = peak_gflops / peak_gbps
+                    row['bound'] = 'compute' if row['intensity'] >= ridge else 'memory'
+                    if flops:
+                        attainable = min(peak_gflops, row['intensity'] * peak_gbps)
+                        row['efficiency'] = row['gflops'] / attainable
+                    else:
+                        row['efficiency'] = row['gbps'] / peak_gbps
+                rows.append(row)
+        return sorted(rows, key=lambda row: -row['time_ms'] * row['calls'])
+
+    @staticmethod
+    def format_roofline_report(rows):
+        lines = ["{:<40} {:<7} {:>6} {:>9} {:>9} {:>8} {:>8} {:>10} {:>5} {:>8} {:>5}".format(
+            'op', 'kind', 'calls', 'ms/call', 'GFLOP/s', 'GB/s', 'flop/B', 'DRAM MB', 'IPC',
+            'bound', 'eff')]
+        for row in rows:
+            lines.append(
+                "{:<40} {:<7} {:>6} {:>9.3f} {:>9.1f} {:>8.1f} {:>8.2f} {:>10.2f} {:>5} {:>8} "
+                "{:>5}".format(
+                    row['name'][-40:], row['kind'], row['calls'], row['time_ms'],
+                    row['gflops'], row['gbps'], row['intensity'], row['dram_bytes'] / 1e6,
+                    '-' if row['ipc'] is None else '{:.2f}'.format(row['ipc']),
+                    row['bound'] or '-',
+                    '-' if row['efficiency'] is None else '{:.0%}'.format(row['efficiency'])))
+        return '\n'.join(lines)
 
     def close(self):
         if (self.mkldnn_engine_initialized):
+            if self.build_threads > 0:
+                self.stop_kernel_build_threads()
+            if self.perf_counters_enabled and logger.isEnabledFor(logging.INFO):
+                rows = self.roofline_report()
+                if rows:
+                    logger.info("MKL roofline report:\n%s", self.format_roofline_report(rows))
+            for kernel in self.context_kernels:
+                self.delete_opkernel(kernel)
+            self.context_kernels = []
             for op in self.kernels:
                 self.delete_opkernel(self.kernels[op])
             for layout in self.native_layouts:
                 self.delete_layout(layout)
             self.destroy_mkldnn_engine_fn(self.mkldnn_engine)
+            for index, nbytes in self.tracked_pools:
+                self.account_memory(index, -nbytes)
+            self.tracked_pools = []
+            self.shared_reorders = dict()
+            self.scale_shift_buffers = dict()
             self.mkldnn_engine_initialized = False
 
+    @staticmethod
+    def are_rows(first, second):
+        """
+        True if second starts where the dense array first ends, so that the two are
+        the rows of one array, as MemLayoutPass places the tensors of packed_inputs.
+        """
+        return first.flags.c_contiguous and second.flags.c_contiguous and \
+            first.size == second.size and \
+            second.ctypes.data == first.ctypes.data + first.nbytes
+
+    def scale_shift_buffer(self, name, index, channels):
+        """
+        The 2 x C weights array of input or output index of a batchnorm kernel, for
+        scales and shifts that are not laid out back to back. Allocated once.
+        """
+        buffer = self.scale_shift_buffers.get((name, index))
+        if buffer is None:
+            buffer = np.empty((2, channels), dtype=np.float32)
+            self.scale_shift_buffers[(name, index)] = buffer
+        return buffer
+
+    def scale_shift(self, name, index, gamma, bias):
+        """
+        Address of the scale-shift weights input of a batchnorm kernel: gamma itself
+        if bias follows it in memory, otherwise a copy of both.
+        """
+        if self.are_rows(gamma, bias):
+            return gamma.ctypes.data
+        weights = self.scale_shift_buffer(name, index, gamma.size)
+        np.copyto(weights[0], gamma)
+        np.copyto(weights[1], bias)
+        return weights.ctypes.data
+
     def fprop_batchnorm(self, name, inputs, outputs, gamma, bias, mean, variance, epsilon):
         assert self.enabled and name in self.kernels
-        weights = np.stack([gamma[:, 0], bias[:, 0]])
+        weights = self.scale_shift(name, 1, gamma[:, 0], bias[:, 0])
         self.set_input_tensor(self.kernels[name], inputs.ctypes.data, 0)
-        self.set_input_tensor(self.kernels[name], weights.ctypes.data, 1)
+        self.set_input_tensor(self.kernels[name], weights, 1)
         self.set_output_tensor(self.kernels[name], outputs.ctypes.data, 0)
         self.set_output_tensor(self.kernels[name], mean.ctypes.data, 1)
         self.set_output_tensor(self.kernels[name], variance.ctypes.data, 2)
@@ -218,20 +833,34 @@ class Mkldnn(object):
             variance,
             epsilon):
         assert self.enabled and name in self.kernels
-        weights = np.stack([gamma[:, 0], bias[:, 0]])
-        diff_weights = np.stack((dgamma, dbeta))
+        weights = self.scale_shift(name, 4, gamma[:, 0], bias[:, 0])
+        if self.are_rows(dgamma, dbeta):
+            diff_weights = None
+        else:
+            diff_weights = self.scale_shift_buffer(name, -1, dgamma.size)
         self.set_input_tensor(self.kernels[name], inputs.ctypes.data, 0)
         self.set_input_tensor(self.kernels[name], mean.ctypes.data, 1)
         self.set_input_tensor(self.kernels[name], variance.ctypes.data, 2)
         self.set_input_tensor(self.kernels[name], delta.ctypes.data, 3)
-        self.set_input_tensor(self.kernels[name], weights.ctypes.data, 4)
+        self.set_input_tensor(self.kernels[name], weights, 4)
         self.set_output_tensor(self.kernels[name], outputs.ctypes.data, 0)
-        self.set_output_tensor(self.kernels[name], diff_weights.ctypes.data, 1)
+        if diff_weights is None:
+            self.set_output_tensor(self.kernels[name], dgamma.ctypes.data, 1)
+        else:
+            self.set_output_tensor(self.kernels[name], diff_weights.ctypes.data, 1)
         self.run_opkernel(self.kernels[name], self.mkldnn_verbose)
-        np.copyto(dgamma, diff_weights[0, None])
-        np.copyto(dbeta, diff_weights[1, None])
+        if diff_weights is not None:
+            np.copyto(dgamma, diff_weights[0].reshape(dgamma.shape))
+            np.copyto(dbeta, diff_weights[1].reshape(dbeta.shape))
 
-    def fprop_conv(self, name, conv_slices, I, F, B, O):
+    def can_use_gemm_conv(self, *arrays):
+        """
+        The C im2col/GEMM convolution only handles dense float32 tensors.
+        """
+        return self.enabled and all(a.dtype == np.float32 and a.flags['C_CONTIGUOUS']
+                                    for a in arrays if a is not None)
+
+    def fprop_conv(self, name, conv_slices, conv_params, I, F, B, O):
         if (self.enabled and name in self.kernels):
             self.set_input_tensor(self.kernels[name], I.ctypes.data, 0)
             self.set_input_tensor(self.kernels[name], F.ctypes.data, 1)
@@ -239,6 +868,10 @@ class Mkldnn(object):
                 self.set_input_tensor(self.kernels[name], B.ctypes.data, 2)
             self.set_output_tensor(self.kernels[name], O.ctypes.data, 0)
             self.run_opkernel(self.kernels[name], self.mkldnn_verbose)
+        elif self.can_use_gemm_conv(I, F, B, O):
+            self.gemm_conv_fprop(I.ctypes.data, F.ctypes.data,
+                                 B.ctypes.data if B is not None else None,
+                                 O.ctypes.data, *get_gemm_conv_args(I, F, O, conv_params))
         else:
             mSlice, pSlice, qSlice, _, _, _ = conv_slices
             K, M, P, Q, N = O.shape
@@ -252,13 +885,18 @@ class Mkldnn(object):
                 slicedF = F[:, sliceT, sliceR, sliceS, :].reshape((-1, K))
                 slicedI = I[:, sliceD, sliceH, sliceW, :].reshape((-1, N))
                 O[:, m, p, q, :] = np.dot(slicedF.T, slicedI)
+            if B is not None:
+                O += B.reshape((K, 1, 1, 1, 1))
 
-    def bprop_conv(self, name, conv_slices, E, F, gI):
+    def bprop_conv(self, name, conv_slices, conv_params, E, F, gI):
         if (self.enabled and name in self.kernels):
             self.set_input_tensor(self.kernels[name], E.ctypes.data, 0)
             self.set_input_tensor(self.kernels[name], F.ctypes.data, 1)
             self.set_output_tensor(self.kernels[name], gI.ctypes.data, 0)
             self.run_opkernel(self.kernels[name], self.mkldnn_verbose)
+        elif self.can_use_gemm_conv(E, F, gI):
+            self.gemm_conv_bprop_data(E.ctypes.data, F.ctypes.data, gI.ctypes.data,
+                                      *get_gemm_conv_args(gI, F, E, conv_params))
         else:
             _, _, _, mSlice, pSlice, qSlice = conv_slices
             F = np.transpose(F[:, ::-1, ::-1, ::-1, :], (4, 1, 2, 3, 0)).copy()
@@ -359,6 +997,38 @@ class Mkldnn(object):
         else:
             np.add(I_array1, I_array2, out=O_array)
 
+    def elementwise_binary(self, name, np_op, x, y, out):
+        if (self.enabled and name in self.kernels):
+            # Literal scalars are bound as one element tensors
+            if not isinstance(x, np.ndarray):
+                x = np.full(1, x, dtype=out.dtype)
+            if not isinstance(y, np.ndarray):
+                y = np.full(1, y, dtype=out.dtype)
+            self.set_input_tensor(self.kernels[name], x.ctypes.data, 0)
+            self.set_input_tensor(self.kernels[name], y.ctypes.data, 1)
+            self.set_output_tensor(self.kernels[name], out.ctypes.data, 0)
+            self.run_opkernel(self.kernels[name], self.mkldnn_verbose)
+        else:
+            np_op(x, y, out=out)
+
+    def scaled_sum(self, name, inputs, scales, out):
+        if (self.enabled and name in self.kernels):
+            for index, x in enumerate(inputs):
+                self.set_input_tensor(self.kernels[name], x.ctypes.data, index)
+            self.set_output_tensor(self.kernels[name], out.ctypes.data, 0)
+            self.run_opkernel(self.kernels[name], self.mkldnn_verbose)
+        else:
+            # Accumulate into a temporary in case out shares memory with an input
+            acc = np.multiply(inputs[0], scales[0])
+            for x, scale in zip(inputs[1:], scales[1:]):
+                if scale == 1.0:
+                    acc += x
+                elif scale == -1.0:
+                    acc -= x
+                else:
+                    acc += scale * x
+            out[...] = acc
+
     def fprop_relu(self, name, inputs, out, slope):
         if (self.enabled and name in self.kernels):
             self.set_input_tensor(self.kernels[name], inputs.ctypes.data, 0)
@@ -384,6 +1054,14 @@ class Mkldnn(object):
         self.set_output_tensor(self.kernels[name], output.ctypes.data, 0)
         self.run_opkernel(self.kernels[name], self.mkldnn_verbose)
 
+    def lazy_reorder(self, name, input):
+        """
+        Returns an MklLayoutTensor for input, a tensor in the MKL layout that the
+        reorder kernel 'name' converts to the native layout on first access.
+        """
+        assert self.enabled and name in self.kernels
+        return MklLayoutTensor(self, name, input)
+
     def mkl_contiguous(self, name, output, input):
         if name in self.kernels:
             self.set_input_tensor(self.kernels[name], input.ctypes.data, 0)
@@ -392,7 +1070,7 @@ class Mkldnn(object):
         else:
             output[()] = input
 
-    def update_conv(self, name, conv_slices, I, E, U, dB):
+    def update_conv(self, name, conv_slices, conv_params, I, E, U, dB):
         if (self.enabled and name in self.kernels):
             self.set_input_tensor(self.kernels[name], E.ctypes.data, 0)
             self.set_input_tensor(self.kernels[name], I.ctypes.data, 1)
@@ -400,6 +1078,10 @@ class Mkldnn(object):
             if dB is not None:
                 self.set_output_tensor(self.kernels[name], dB.ctypes.data, 1)
             self.run_opkernel(self.kernels[name], self.mkldnn_verbose)
+        elif self.can_use_gemm_conv(I, E, U):
+            # Without an MKL kernel dB is produced by the separate bias grad op
+            self.gemm_conv_bprop_weights(I.ctypes.data, E.ctypes.data, U.ctypes.data,
+                                         *get_gemm_conv_args(I, U, E, conv_params))
         else:
             mSlice, pSlice, qSlice, _, _, _ = conv_slices
             K, M, P, Q, N = E.shape
@@ -418,6 +1100,129 @@ class Mkldnn(object):
                 U[:, sliceT, sliceR, sliceS, :] += update
 
 
+class MklLayoutTensor(NDArrayOperatorsMixin):
+    """
+    A computation result returned in its MKL-DNN layout.
+
+    The value is converted to the native layout by the reorder kernel of the
+    result the first time it is read, and only then, so results that are
+    mostly ignored (e.g. periodically logged costs) do not pay for a reorder
+    every step. The MKL layout data and its descriptor stay available to
+    consumers that can use them directly.
+
+    Otherwise it behaves like the ndarray of its value: ufuncs and operators
+    take that value, and the other ndarray attributes (copy(), sum(), T, ...)
+    are those of the value. np.asarray() gives the ndarray itself.
+
+    Arguments:
+        mkldnn: The Mkldnn engine owning the kernel.
+        name: Name of the reorder kernel.
+        mkl_data: The result tensor, holding data in the MKL layout.
+
+    Attributes:
+        mkl_data: The result tensor, holding data in the MKL layout.
+    """
+
+    def __init__(self, mkldnn, name, mkl_data):
+        self.mkldnn = mkldnn
+        self.name = name
+        self.mkl_data = mkl_data
+        self.__value = None
+
+    @property
+    def mkl_layout(self):
+        """
+        The MKL-DNN memory descriptor of mkl_data.
+        """
+        return self.mkldnn.input_layout(self.mkldnn.kernels[self.name], 0)
+
+    @property
+    def shape(self):
+        return self.mkl_data.shape
+
+    @property
+    def dtype(self):
+        return self.mkl_data.dtype
+
+    @property
+    def ndim(self):
+        return self.mkl_data.ndim
+
+    @property
+    def size(self):
+        return self.mkl_data.size
+
+    def get(self, tensor=None):
+        """
+        Converts the result to the native layout.
+
+        Arguments:
+            tensor: Optional tensor to convert into.
+
+        Returns:
+            The converted value.
+        """
+        if self.__value is None and tensor is not None and \
+                tensor.flags['C_CONTIGUOUS'] and \
+                tensor.shape == self.shape and tensor.dtype == self.dtype:
+            # Convert straight into the caller's tensor
+            self.mkldnn.mkl_reorder(self.name, tensor, self.mkl_data)
+            return tensor
+        if self.__value is None:
+            self.__value = np.empty(self.shape, dtype=self.dtype)
+            self.mkldnn.mkl_reorder(self.name, self.__value, self.mkl_data)
+        if tensor is None:
+            return self.__value
+        tensor[...] = self.__value
+        return tensor
+
+    def __array__(self, dtype=None):
+        value = self.get()
+        if dtype is not None:
+            return value.astype(dtype)
+        return value
+
+    def __array_ufunc__(self, ufunc, method, *inputs, **kwargs):
+        def value(x):
+            return x.get() if isinstance(x, MklLayoutTensor) else x
+        inputs = tuple(value(x) for x in inputs)
+        if 'out' in kwargs:
+            kwargs['out'] = tuple(value(x) for x in kwargs['out'])
+        return getattr(ufunc, method)(*inputs, **kwargs)
+
+    def __getattr__(self, name):
+        # Only called for attributes the class does not define
+        if name.startswith('_'):
+            raise AttributeError(name)
+        return getattr(self.get(), name)
+
+    def __getitem__(self, key):
+        return self.get().__getitem__(key)
+
+    def __setitem__(self, key, value):
+        self.get().__setitem__(key, value)
+
+    def __len__(self):
+        return len(self.mkl_data)
+
+    def __repr__(self):
+        return repr(self.get())
+
+
+def get_gemm_conv_args(I, F, O, conv_params):
+    """
+    Marshall shapes and conv params for the C im2col/GEMM convolution.
+    I is in (C, D, H, W, N), F in (C, T, R, S, K) and O in (K, M, P, Q, N) layout.
+    """
+    def ctypes_arg(x):
+        return (ct.c_int * len(x))(*x)
+
+    return (ctypes_arg(I.shape), ctypes_arg(F.shape), ctypes_arg(O.shape),
+            ctypes_arg([conv_params['str_' + s] for s in ('d', 'h', 'w')]),
+            ctypes_arg([conv_params['pad_' + s] for s in ('d', 'h', 'w')]),
+            ctypes_arg([conv_params['dil_' + s] for s in ('d', 'h', 'w')]))
+
+
 def fprop_lut(lut, idx, axis, output):
     output[:] = lut.take(idx.astype(int), axis)
 
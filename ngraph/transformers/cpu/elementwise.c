@@ -16,114 +16,94 @@
 #include "mkldnn_engine.h"
 #include "mkldnn_util.h"
 
-/* Create list of mkldnn primitives to run elelment Wise add primitive  */
-void create_mkldnn_add_kernel(mkldnn_engine_t engine, int src1_dims,
-                              int src2_dims, int dst_dims, int* src1_sizes,
-                              int* src2_sizes, int* dst_sizes,
-                              mkldnn_memory_desc_t* src1_md,
-                              mkldnn_memory_desc_t* src2_md,
-                              int num_matrix_to_add,
+/* Create list of mkldnn primitives to run an N-ary scaled sum
+ *   dst = sum(scales[i] * src[i])
+ * over tensors of any shape. The sum runs and produces its output in the
+ * layout of src[primary]; inputs in other layouts are reordered to it first. */
+void create_mkldnn_sum_kernel(mkldnn_engine_t engine, int ndims, int* sizes,
+                              int num_inputs, mkldnn_memory_desc_t** src_mds,
+                              float* scales, int primary,
                               mkldnn_data_type_t data_type,
                               mkldnn_opkernel_t opkernel) {
-  assert(src1_dims == 1);
-  assert(src2_dims == 1);
-  assert(dst_dims == 1);
-  assert(num_matrix_to_add == 2);
-
-  // create memory primitive descriptor
-  mkldnn_memory_desc_t md1;
-  mkldnn_primitive_desc_t pd1;
-  if (src1_md) {
-    md1 = *src1_md;
-  } else {
-    MKL_CHECK(mkldnn_memory_desc_init(&md1, src1_dims, src1_sizes, data_type,
-                                      mkldnn_x));
-  }
-  MKL_CHECK(mkldnn_memory_primitive_desc_create(&pd1, &md1, engine));
+  MKL_CHECK_TRUE(num_inputs >= 1 && num_inputs <= MKLDNN_MAX_ARGS);
+  MKL_CHECK_TRUE(primary >= 0 && primary < num_inputs);
 
-  mkldnn_memory_desc_t md2;
-  mkldnn_primitive_desc_t pd2;
-  if (src2_md) {
-    md2 = *src2_md;
-  } else {
-    MKL_CHECK(mkldnn_memory_desc_init(&md2, src2_dims, src2_sizes, data_type,
-                                      mkldnn_x));
+  // create a memory primitive for inputs and output
+  for (int i = 0; i < num_inputs; i++) {
+    create_mkldnn_tensor_from_md(ndims, sizes, src_mds[i], engine,
+                                 &(opkernel->inputs[i]));
   }
-  MKL_CHECK(mkldnn_memory_primitive_desc_create(&pd2, &md2, engine));
+  create_mkldnn_tensor_from_md(ndims, sizes, src_mds[primary], engine,
+                               &(opkernel->outputs[0]));
+  opkernel->num_inputs = num_inputs;
+  opkernel->num_outputs = 1;
+  opkernel->reorder_o[0] = NULL;
 
-  // Create sum in src1 layout
-  const_mkldnn_primitive_desc_t input_pds[] = {pd1, pd1};
+  // Sum in the layout of the primary input
+  const_mkldnn_primitive_desc_t input_pds[MKLDNN_MAX_ARGS];
+  for (int i = 0; i < num_inputs; i++)
+    input_pds[i] = opkernel->inputs[primary].desc;
 
   // create a Sum primitive descriptor
-  float scale_vector[] = {1, 1};
   MKL_CHECK(mkldnn_sum_primitive_desc_create(
-      &opkernel->op_desc, NULL, num_matrix_to_add, scale_vector, input_pds));
-
-  // create a memory primitive for input and output
-  if (src1_md) {
-    create_mkldnn_tensor_from_md(src1_dims, src1_sizes, src1_md, engine,
-                                 &(opkernel->inputs[0]));
-  } else {
-    create_mkldnn_tensor(src1_dims, src1_sizes, data_type, mkldnn_x, engine,
-                         &(opkernel->inputs[0]));
-  }
-
-  if (src2_md) {
-    create_mkldnn_tensor_from_md(src2_dims, src2_sizes, src2_md, engine,
-                                 &(opkernel->inputs[1]));
-  } else {
-    create_mkldnn_tensor(src2_dims, src2_sizes, data_type, mkldnn_x, engine,
-                         &(opkernel->inputs[1]));
-  }
-  mkldnn_memory_desc_t dst_md = md1;
-  create_mkldnn_tensor_from_md(dst_dims, dst_sizes, &dst_md, engine,
-                               &(opkernel->outputs[0]));
-  opkernel->num_inputs = 2;
-  opkernel->num_outputs = 1;
-
-  // No reorders required
-  opkernel->reorder_i[0] = NULL;
-  opkernel->reorder_o[0] = NULL;
+      &opkernel->op_desc, NULL, num_inputs, scales, input_pds));
 
-  if (!mkldnn_memory_primitive_desc_equal(opkernel->inputs[1].desc,
-                                          opkernel->inputs[0].desc)) {
+  mkldnn_primitive_at_t sum_prim_srcs[MKLDNN_MAX_ARGS];
+  for (int i = 0; i < num_inputs; i++) {
+    if (mkldnn_memory_primitive_desc_equal(opkernel->inputs[i].desc,
+                                           opkernel->inputs[primary].desc)) {
+      opkernel->reorder_i[i] = NULL;
+      sum_prim_srcs[i] = mkldnn_primitive_at(opkernel->inputs[i].prim, 0);
+      continue;
+    }
     mkldnn_memory_desc_t md =
-        *mkldnn_primitive_desc_query_memory_d(opkernel->inputs[0].desc);
-    create_mkldnn_tensor_from_md(src2_dims, src2_sizes, &md, engine,
-                                 &(opkernel->internal_inputs[1]));
+        *mkldnn_primitive_desc_query_memory_d(opkernel->inputs[primary].desc);
+    create_mkldnn_tensor_from_md(ndims, sizes, &md, engine,
+                                 &(opkernel->internal_inputs[i]));
     mkldnn_primitive_desc_t reorder_pd;
     MKL_CHECK(mkldnn_reorder_primitive_desc_create(
-        &reorder_pd, opkernel->inputs[1].desc, opkernel->inputs[0].desc));
+        &reorder_pd, opkernel->inputs[i].desc, opkernel->inputs[primary].desc));
     mkldnn_primitive_at_t inputs[] = {
-        mkldnn_primitive_at(opkernel->inputs[1].prim, 0)};
-    const_mkldnn_primitive_t outputs[] = {opkernel->internal_inputs[1].prim};
-    MKL_CHECK(mkldnn_primitive_create(&(opkernel->reorder_i[1]), reorder_pd,
+        mkldnn_primitive_at(opkernel->inputs[i].prim, 0)};
+    const_mkldnn_primitive_t outputs[] = {opkernel->internal_inputs[i].prim};
+    MKL_CHECK(mkldnn_primitive_create(&(opkernel->reorder_i[i]), reorder_pd,
                                       inputs, outputs));
-  } else {
-    opkernel->reorder_i[1] = NULL;
-  }
 
-  if (opkernel->reorder_i[1]) {
     void* tmp_buf;
-    alloc_aligned_memory(&tmp_buf, product(src2_sizes, src2_dims), data_type, 64);
-    opkernel->internal_inputs[1].buffer = tmp_buf;
-    MKL_CHECK(mkldnn_memory_set_data_handle(opkernel->internal_inputs[1].prim,
+    alloc_aligned_memory(&tmp_buf, product(sizes, ndims), data_type, 64);
+    opkernel->internal_inputs[i].buffer = tmp_buf;
+    MKL_CHECK(mkldnn_memory_set_data_handle(opkernel->internal_inputs[i].prim,
                                             tmp_buf));
+    sum_prim_srcs[i] = mkldnn_primitive_at(opkernel->internal_inputs[i].prim, 0);
   }
-  mkldnn_primitive_t mkldnn_memory_prim_src2 =
-      opkernel->reorder_i[1] ? opkernel->internal_inputs[1].prim
-                             : opkernel->inputs[1].prim;
+
   // create sum primitive
-  const_mkldnn_primitive_t add_prim_dsts[] = {opkernel->outputs[0].prim};
-  mkldnn_primitive_at_t add_prim_srcs[] = {
-      mkldnn_primitive_at(opkernel->inputs[0].prim, 0),
-      mkldnn_primitive_at(mkldnn_memory_prim_src2, 0),
-  };
+  const_mkldnn_primitive_t sum_prim_dsts[] = {opkernel->outputs[0].prim};
+  create_opkernel_primitive(opkernel, sum_prim_srcs, num_inputs, sum_prim_dsts,
+                            1);
 
-  MKL_CHECK(mkldnn_primitive_create(&opkernel->op_prim, opkernel->op_desc,
-                                    add_prim_srcs, add_prim_dsts));
+  for (int i = 0; i < num_inputs; i++) {
+    if (opkernel->reorder_i[i])
+      opkernel->net[opkernel->net_size++] = opkernel->reorder_i[i];
+  }
+  opkernel->net[opkernel->net_size++] = NULL; /* op_prim */
+}
 
-  if (opkernel->reorder_i[1])
-    opkernel->net[opkernel->net_size++] = opkernel->reorder_i[1];
-  opkernel->net[opkernel->net_size++] = opkernel->op_prim;
+/* Create list of mkldnn primitives to run elelment Wise add primitive  */
+void create_mkldnn_add_kernel(mkldnn_engine_t engine, int src1_dims,
+                              int src2_dims, int dst_dims, int* src1_sizes,
+                              int* src2_sizes, int* dst_sizes,
+                              mkldnn_memory_desc_t* src1_md,
+                              mkldnn_memory_desc_t* src2_md,
+                              int num_matrix_to_add,
+                              mkldnn_data_type_t data_type,
+                              mkldnn_opkernel_t opkernel) {
+  /* Same shape operands only; broadcasting adds use the binary kernel */
+  assert(src1_dims == src2_dims && src1_dims == dst_dims);
+  assert(num_matrix_to_add == 2);
+
+  mkldnn_memory_desc_t* src_mds[] = {src1_md, src2_md};
+  float scale_vector[] = {1, 1};
+  create_mkldnn_sum_kernel(engine, src1_dims, src1_sizes, num_matrix_to_add,
+                           src_mds, scale_vector, 0, data_type, opkernel);
 }
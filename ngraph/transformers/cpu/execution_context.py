@@ -0,0 +1,105 @@
+# ******************************************************************************
+# Copyright 2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+import collections
+
+from orderedset import OrderedSet
+
+from ngraph.op_graph.op_graph import Op
+from ngraph.transformers.cpu.compiled_cache import CachedTensorView
+
+
+class ExecutionContext(object):
+    """
+    A private set of the per-call state of a compiled computation: the temporary
+    tensors, the arguments and the MKL-DNN kernels with their streams and internal
+    buffers. Variables, constants, kernel descriptors and JIT code and the reordered
+    copies of weights are shared with the computation and its other contexts, so
+    several threads can each call their own context at the same time with one copy
+    of the model.
+
+    Contexts are meant for inference. The shared weights are reordered by the first
+    context that runs after the contexts were created or reset_weights() was called,
+    and must not change while contexts run, so neither the computation nor another
+    computation updating the variables may run concurrently with them.
+
+    Returned values are views of the context's tensors, valid until its next call.
+
+    Arguments:
+        computation: The CPUDeviceComputation.
+        namespace: Globals of the generated code, with the context's tensors.
+        executor: The generated executor, running in namespace.
+        views: Dicts 'parameters', 'returns' and 'lazy_returns' of op to the name of
+            its tensor view in namespace, or, for lazy returns, its reorder kernel.
+        pools: (array, category) of the memory allocated for the context.
+    """
+
+    def __init__(self, computation, namespace, executor, views, pools):
+        self.computation = computation
+        self.namespace = namespace
+        self.executor = executor
+        self.parameters = views['parameters']
+        self.returns = views['returns']
+        self.lazy_returns = views['lazy_returns']
+        self.pools = pools
+
+    @property
+    def mkldnn(self):
+        return self.namespace['mkldnn']
+
+    def __call__(self, *args, **kwargs):
+        if self.executor is None:
+            raise ValueError("Execution context is closed")
+        computation_op = self.computation.computation_op
+        args = self.computation.unpack_args_or_feed_dict(args, kwargs)
+        for op, arg in zip(computation_op.parameters, args):
+            CachedTensorView(self.namespace, self.parameters[op])[()] = arg
+
+        self.executor()
+
+        def value(op):
+            if op in self.returns:
+                return CachedTensorView(self.namespace, self.returns[op],
+                                        self.lazy_returns.get(op)).get(None)
+            return None
+
+        returns = computation_op.returns
+        if isinstance(returns, Op):
+            return value(returns)
+        elif isinstance(returns, (collections.Sequence, OrderedSet)):
+            return tuple(value(op) for op in returns)
+        elif isinstance(returns, collections.Set):
+            return dict((op, value(op)) for op in returns)
+        return None
+
+    def reset_weights(self):
+        """
+        Makes the contexts reorder the shared weights again on their next call, after
+        the variables were updated.
+        """
+        self.computation.mkldnn.reset_contexts()
+
+    def close(self):
+        """
+        Frees the kernels and tensors of the context.
+        """
+        if self.executor is None:
+            return
+        self.computation.mkldnn.release_context(self.mkldnn)
+        for pool, category in self.pools:
+            self.computation.mkldnn.untrack_pool(pool, category)
+        self.executor = None
+        self.namespace = None
+        self.pools = []
@@ -0,0 +1,310 @@
+/*******************************************************************************
+* Copyright 2017-2018 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+/* im2col + GEMM convolution used when MKL-DNN does not provide a kernel
+ * (3D convolutions, unsupported dilations, engine disabled by the pass).
+ *
+ * All tensors are dense float32 in ngraph's native CPU layout:
+ *   src/diff_src     (C, D, H, W, N)
+ *   weights          (C, T, R, S, K)
+ *   dst/diff_dst     (K, M, P, Q, N)
+ * strides, padding and dilates are given in (d, h, w) order. Dilation uses
+ * ngraph semantics, i.e. 1 means a dense filter.
+ *
+ * Output positions are processed in blocks so that the column buffer stays
+ * cache sized instead of materializing the full (CTRS x MPQN) matrix.
+ */
+
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "mkldnn_engine.h"
+#include "mkldnn_util.h"
+
+#define GEMM_MB 64
+#define GEMM_NB 256
+#define GEMM_KB 256
+
+/* Target number of floats in one im2col block */
+#define IM2COL_BLOCK_ELEMS (1 << 20)
+
+typedef struct {
+  int C, D, H, W, N;
+  int T, R, S, K;
+  int M, P, Q;
+  int str_d, str_h, str_w;
+  int pad_d, pad_h, pad_w;
+  int dil_d, dil_h, dil_w;
+} gemm_conv_shape;
+
+static void init_gemm_conv_shape(gemm_conv_shape *s, int *src_sizes,
+                                 int *weights_sizes, int *dst_sizes,
+                                 int *strides, int *padding, int *dilates) {
+  s->C = src_sizes[0]; s->D = src_sizes[1]; s->H = src_sizes[2];
+  s->W = src_sizes[3]; s->N = src_sizes[4];
+  s->T = weights_sizes[1]; s->R = weights_sizes[2]; s->S = weights_sizes[3];
+  s->K = weights_sizes[4];
+  s->M = dst_sizes[1]; s->P = dst_sizes[2]; s->Q = dst_sizes[3];
+  s->str_d = strides[0]; s->str_h = strides[1]; s->str_w = strides[2];
+  s->pad_d = padding[0]; s->pad_h = padding[1]; s->pad_w = padding[2];
+  s->dil_d = dilates[0]; s->dil_h = dilates[1]; s->dil_w = dilates[2];
+  MKL_CHECK_TRUE(weights_sizes[0] == s->C);
+  MKL_CHECK_TRUE(dst_sizes[0] == s->K && dst_sizes[4] == s->N);
+}
+
+/* Number of output positions handled per im2col block */
+static int gemm_conv_block_positions(const gemm_conv_shape *s) {
+  long rows = (long)s->C * s->T * s->R * s->S;
+  long per_pos = rows * s->N;
+  long npos = per_pos > 0 ? IM2COL_BLOCK_ELEMS / per_pos : 1;
+  long total = (long)s->M * s->P * s->Q;
+  if (npos > total) npos = total;
+  if (npos < 1) npos = 1;
+  return (int)npos;
+}
+
+/* Row-major single precision GEMM:
+ *   C[m x n] = alpha * op(A)[m x k] * op(B)[k x n] + beta * C
+ * op(X) is X or X^T depending on trans_x. Tiles of C are distributed over
+ * the OpenMP team; A and B panels are packed per thread so that the inner
+ * loop streams over contiguous memory regardless of transposition.
+ */
+void gemm_sgemm(int trans_a, int trans_b, int m, int n, int k, float alpha,
+                const float *A, int lda, const float *B, int ldb, float beta,
+                float *C, int ldc) {
+  int m_tiles = (m + GEMM_MB - 1) / GEMM_MB;
+  int n_tiles = (n + GEMM_NB - 1) / GEMM_NB;
+
+#pragma omp parallel
+  {
+    float *a_pack = (float *)alloc_tracked_memory(
+        sizeof(float) * GEMM_MB * GEMM_KB, 64, ENGINE_MEM_WORKSPACE);
+    float *b_pack = (float *)alloc_tracked_memory(
+        sizeof(float) * GEMM_KB * GEMM_NB, 64, ENGINE_MEM_WORKSPACE);
+    float *c_tile = (float *)alloc_tracked_memory(
+        sizeof(float) * GEMM_MB * GEMM_NB, 64, ENGINE_MEM_WORKSPACE);
+
+#pragma omp for schedule(dynamic, 1) collapse(2)
+    for (int mt = 0; mt < m_tiles; mt++) {
+      for (int nt = 0; nt < n_tiles; nt++) {
+        int i0 = mt * GEMM_MB;
+        int j0 = nt * GEMM_NB;
+        int mb = (m - i0) < GEMM_MB ? (m - i0) : GEMM_MB;
+        int nb = (n - j0) < GEMM_NB ? (n - j0) : GEMM_NB;
+        memset(c_tile, 0, sizeof(float) * GEMM_MB * GEMM_NB);
+
+        for (int p0 = 0; p0 < k; p0 += GEMM_KB) {
+          int kb = (k - p0) < GEMM_KB ? (k - p0) : GEMM_KB;
+          for (int i = 0; i < mb; i++) {
+            for (int p = 0; p < kb; p++) {
+              a_pack[i * GEMM_KB + p] =
+                  trans_a ? A[(size_t)(p0 + p) * lda + i0 + i]
+                          : A[(size_t)(i0 + i) * lda + p0 + p];
+            }
+          }
+          for (int p = 0; p < kb; p++) {
+            for (int j = 0; j < nb; j++) {
+              b_pack[p * GEMM_NB + j] =
+                  trans_b ? B[(size_t)(j0 + j) * ldb + p0 + p]
+                          : B[(size_t)(p0 + p) * ldb + j0 + j];
+            }
+          }
+          for (int i = 0; i < mb; i++) {
+            float *c_row = c_tile + i * GEMM_NB;
+            for (int p = 0; p < kb; p++) {
+              float a_ip = a_pack[i * GEMM_KB + p];
+              const float *b_row = b_pack + p * GEMM_NB;
+              for (int j = 0; j < nb; j++) {
+                c_row[j] += a_ip * b_row[j];
+              }
+            }
+          }
+        }
+
+        for (int i = 0; i < mb; i++) {
+          float *c_out = C + (size_t)(i0 + i) * ldc + j0;
+          const float *c_row = c_tile + i * GEMM_NB;
+          if (beta == 0.0f) {
+            for (int j = 0; j < nb; j++) c_out[j] = alpha * c_row[j];
+          } else {
+            for (int j = 0; j < nb; j++)
+              c_out[j] = alpha * c_row[j] + beta * c_out[j];
+          }
+        }
+      }
+    }
+    free_memory(a_pack);
+    free_memory(b_pack);
+    free_memory(c_tile);
+  }
+}
+
+/* Decompose a flattened output position into (m, p, q) */
+static inline void gemm_conv_position(const gemm_conv_shape *s, int pos,
+                                      int *m, int *p, int *q) {
+  *q = pos % s->Q;
+  *p = (pos / s->Q) % s->P;
+  *m = pos / (s->Q * s->P);
+}
+
+/* col[(c, t, r, s), (pos - pos0, n)] = src[c, d, h, w, n] or 0 if padded */
+static void gemm_conv_im2col(const gemm_conv_shape *s, const float *src,
+                             float *col, int pos0, int npos) {
+  int rows = s->C * s->T * s->R * s->S;
+  size_t ld = (size_t)npos * s->N;
+  size_t src_c = (size_t)s->D * s->H * s->W * s->N;
+
+#pragma omp parallel for schedule(static)
+  for (int row = 0; row < rows; row++) {
+    int fs = row % s->S;
+    int fr = (row / s->S) % s->R;
+    int ft = (row / (s->S * s->R)) % s->T;
+    int c = row / (s->S * s->R * s->T);
+    float *col_row = col + row * ld;
+    for (int i = 0; i < npos; i++) {
+      int m, p, q;
+      gemm_conv_position(s, pos0 + i, &m, &p, &q);
+      int d = m * s->str_d - s->pad_d + ft * s->dil_d;
+      int h = p * s->str_h - s->pad_h + fr * s->dil_h;
+      int w = q * s->str_w - s->pad_w + fs * s->dil_w;
+      float *out = col_row + (size_t)i * s->N;
+      if (d < 0 || d >= s->D || h < 0 || h >= s->H || w < 0 || w >= s->W) {
+        memset(out, 0, sizeof(float) * s->N);
+      } else {
+        const float *in = src + c * src_c +
+                          (((size_t)d * s->H + h) * s->W + w) * s->N;
+        memcpy(out, in, sizeof(float) * s->N);
+      }
+    }
+  }
+}
+
+/* diff_src[c, d, h, w, n] += col[(c, t, r, s), (pos - pos0, n)]
+ * Every channel owns a disjoint slice of diff_src, so parallelizing over
+ * channels is race free.
+ */
+static void gemm_conv_col2im(const gemm_conv_shape *s, const float *col,
+                             float *diff_src, int pos0, int npos) {
+  int trs = s->T * s->R * s->S;
+  size_t ld = (size_t)npos * s->N;
+  size_t src_c = (size_t)s->D * s->H * s->W * s->N;
+
+#pragma omp parallel for schedule(static)
+  for (int c = 0; c < s->C; c++) {
+    for (int f = 0; f < trs; f++) {
+      int fs = f % s->S;
+      int fr = (f / s->S) % s->R;
+      int ft = f / (s->S * s->R);
+      const float *col_row = col + ((size_t)c * trs + f) * ld;
+      for (int i = 0; i < npos; i++) {
+        int m, p, q;
+        gemm_conv_position(s, pos0 + i, &m, &p, &q);
+        int d = m * s->str_d - s->pad_d + ft * s->dil_d;
+        int h = p * s->str_h - s->pad_h + fr * s->dil_h;
+        int w = q * s->str_w - s->pad_w + fs * s->dil_w;
+        if (d < 0 || d >= s->D || h < 0 || h >= s->H || w < 0 || w >= s->W)
+          continue;
+        float *out = diff_src + c * src_c +
+                     (((size_t)d * s->H + h) * s->W + w) * s->N;
+        const float *in = col_row + (size_t)i * s->N;
+        for (int n = 0; n < s->N; n++) out[n] += in[n];
+      }
+    }
+  }
+}
+
+/* dst = weights^T * im2col(src) (+ bias) */
+void run_gemm_conv_fprop(float *src, float *weights, float *bias, float *dst,
+                         int *src_sizes, int *weights_sizes, int *dst_sizes,
+                         int *strides, int *padding, int *dilates) {
+  gemm_conv_shape s;
+  init_gemm_conv_shape(&s, src_sizes, weights_sizes, dst_sizes, strides,
+                       padding, dilates);
+  int rows = s.C * s.T * s.R * s.S;
+  int total = s.M * s.P * s.Q;
+  int ldo = total * s.N;
+  int block = gemm_conv_block_positions(&s);
+  float *col = (float *)alloc_tracked_memory(
+      sizeof(float) * (size_t)rows * block * s.N, 64, ENGINE_MEM_WORKSPACE);
+
+  for (int pos0 = 0; pos0 < total; pos0 += block) {
+    int npos = (total - pos0) < block ? (total - pos0) : block;
+    gemm_conv_im2col(&s, src, col, pos0, npos);
+    gemm_sgemm(1, 0, s.K, npos * s.N, rows, 1.0f, weights, s.K, col,
+               npos * s.N, 0.0f, dst + (size_t)pos0 * s.N, ldo);
+  }
+  free_memory(col);
+
+  if (bias) {
+#pragma omp parallel for schedule(static)
+    for (int k = 0; k < s.K; k++) {
+      float *out = dst + (size_t)k * ldo;
+      for (int j = 0; j < ldo; j++) out[j] += bias[k];
+    }
+  }
+}
+
+/* diff_src = col2im(weights * diff_dst) */
+void run_gemm_conv_bprop_data(float *diff_dst, float *weights, float *diff_src,
+                              int *diff_src_sizes, int *weights_sizes,
+                              int *diff_dst_sizes, int *strides, int *padding,
+                              int *dilates) {
+  gemm_conv_shape s;
+  init_gemm_conv_shape(&s, diff_src_sizes, weights_sizes, diff_dst_sizes,
+                       strides, padding, dilates);
+  int rows = s.C * s.T * s.R * s.S;
+  int total = s.M * s.P * s.Q;
+  int lde = total * s.N;
+  int block = gemm_conv_block_positions(&s);
+  float *col = (float *)alloc_tracked_memory(
+      sizeof(float) * (size_t)rows * block * s.N, 64, ENGINE_MEM_WORKSPACE);
+
+  memset(diff_src, 0, sizeof(float) * product(diff_src_sizes, 5));
+  for (int pos0 = 0; pos0 < total; pos0 += block) {
+    int npos = (total - pos0) < block ? (total - pos0) : block;
+    gemm_sgemm(0, 0, rows, npos * s.N, s.K, 1.0f, weights, s.K,
+               diff_dst + (size_t)pos0 * s.N, lde, 0.0f, col, npos * s.N);
+    gemm_conv_col2im(&s, col, diff_src, pos0, npos);
+  }
+  free_memory(col);
+}
+
+/* diff_weights = im2col(src) * diff_dst^T, accumulated over position blocks */
+void run_gemm_conv_bprop_weights(float *src, float *diff_dst,
+                                 float *diff_weights, int *src_sizes,
+                                 int *weights_sizes, int *diff_dst_sizes,
+                                 int *strides, int *padding, int *dilates) {
+  gemm_conv_shape s;
+  init_gemm_conv_shape(&s, src_sizes, weights_sizes, diff_dst_sizes, strides,
+                       padding, dilates);
+  int rows = s.C * s.T * s.R * s.S;
+  int total = s.M * s.P * s.Q;
+  int lde = total * s.N;
+  int block = gemm_conv_block_positions(&s);
+  float *col = (float *)alloc_tracked_memory(
+      sizeof(float) * (size_t)rows * block * s.N, 64, ENGINE_MEM_WORKSPACE);
+
+  for (int pos0 = 0; pos0 < total; pos0 += block) {
+    int npos = (total - pos0) < block ? (total - pos0) : block;
+    gemm_conv_im2col(&s, src, col, pos0, npos);
+    gemm_sgemm(0, 1, rows, s.K, npos * s.N, 1.0f, col, npos * s.N,
+               diff_dst + (size_t)pos0 * s.N, lde, pos0 == 0 ? 0.0f : 1.0f,
+               diff_weights, s.K);
+  }
+  free_memory(col);
+}
@@ -0,0 +1,170 @@
+# ******************************************************************************
+# Copyright 2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+"""
+Compression of gradients exchanged by the HeTr CPU allreduce.
+
+A compressed gradient is sent as a fixed size byte payload. The payloads of all
+processes are allgathered and every process sums them back into a float32
+gradient, so the reduction stays in float32.
+
+Specs, as in HETR_GRAD_COMPRESSION or the 'grad_compression' metadata of a
+variable:
+    'none': The gradient is allreduced uncompressed.
+    'fp16': Every element is sent as float16.
+    'topk' or 'topk:<ratio>': Only the ratio (default 0.01) of the elements largest in
+        magnitude are sent, as int32 indices and float32 values. What is not sent is
+        kept in a residual that is added to the next gradient of the tensor (error
+        feedback), so that every update eventually reaches the other processes.
+"""
+from __future__ import division
+
+import math
+import os
+
+import numpy as np
+
+DEFAULT_TOPK_RATIO = 0.01
+# Gradients with fewer elements are not compressed by HETR_GRAD_COMPRESSION alone; they
+# are latency rather than bandwidth bound
+DEFAULT_MIN_ELEMENTS = 4096
+
+
+class Fp16Compressor(object):
+    """
+    Sends every element as float16.
+
+    Arguments:
+        size: Elements of the gradient.
+    """
+
+    def __init__(self, size):
+        self.size = size
+        self.payload = np.empty(self.payload_bytes, dtype=np.uint8)
+
+    @property
+    def payload_bytes(self):
+        return 2 * self.size
+
+    def compress(self, x):
+        """
+        Returns the payload of gradient x, valid until the next call.
+        """
+        np.copyto(self.payload.view(np.float16), x.reshape(-1), casting='same_kind')
+        return self.payload
+
+    def accumulate(self, payloads, out):
+        """
+        Sets out to the sum of the gradients in payloads, an array of one payload per
+        process.
+        """
+        halves = payloads.reshape(len(payloads), -1).view(np.float16)
+        np.sum(halves, axis=0, dtype=np.float32, out=out.reshape(-1))
+
+
+class TopKCompressor(object):
+    """
+    Sends the k elements largest in magnitude of the gradient plus the residual of
+    the elements not sent before.
+
+    Arguments:
+        size: Elements of the gradient.
+        ratio: Fraction of the elements that are sent.
+    """
+
+    def __init__(self, size, ratio=DEFAULT_TOPK_RATIO):
+        self.size = size
+        self.k = min(size, max(1, int(math.ceil(ratio * size))))
+        self.payload = np.empty(self.payload_bytes, dtype=np.uint8)
+        self.residual = np.zeros(size, dtype=np.float32)
+
+    @property
+    def payload_bytes(self):
+        return 8 * self.k
+
+    def split(self, payload):
+        return (payload[:4 * self.k].view(np.int32),
+                payload[4 * self.k:8 * self.k].view(np.float32))
+
+    def compress(self, x):
+        """
+        Returns the payload of gradient x, valid until the next call.
+        """
+        residual = self.residual
+        residual += x.reshape(-1)
+        indices, values = self.split(self.payload)
+        if self.k < self.size:
+            indices[...] = np.argpartition(np.abs(residual), self.size - self.k)[-self.k:]
+        else:
+            indices[...] = np.arange(self.size)
+        values[...] = residual[indices]
+        residual[indices] = 0
+        return self.payload
+
+    def accumulate(self, payloads, out):
+        """
+        Sets out to the sum of the gradients in payloads, an array of one payload per
+        process.
+        """
+        flat = out.reshape(-1)
+        flat.fill(0)
+        for payload in payloads.reshape(len(payloads), -1):
+            indices, values = self.split(payload)
+            # Indices are distinct within a payload
+            flat[indices] += values
+
+
+def parse_spec(spec):
+    """
+    Returns (kind, ratio) of a compression spec, kind None for no compression.
+    """
+    if spec is None or spec == 'none':
+        return None, None
+    kind, _, ratio = spec.partition(':')
+    if kind == 'fp16' and not ratio:
+        return 'fp16', None
+    if kind == 'topk':
+        ratio = float(ratio) if ratio else DEFAULT_TOPK_RATIO
+        if not 0 < ratio <= 1:
+            raise ValueError("Top-k ratio must be in (0, 1], got {}".format(ratio))
+        return 'topk', ratio
+    raise ValueError("Unknown gradient compression {}".format(spec))
+
+
+def compression_spec(metadata, size):
+    """
+    The compression spec of a gradient of size elements: its 'grad_compression'
+    metadata if set, else HETR_GRAD_COMPRESSION for gradients of at least
+    HETR_GRAD_COMPRESSION_MIN_ELEMENTS elements.
+    """
+    spec = metadata.get('grad_compression')
+    if spec is not None:
+        return spec
+    min_elements = int(os.getenv('HETR_GRAD_COMPRESSION_MIN_ELEMENTS', DEFAULT_MIN_ELEMENTS))
+    if size < min_elements:
+        return None
+    return os.getenv('HETR_GRAD_COMPRESSION')
+
+
+def make_compressor(spec, size):
+    """
+    Returns the compressor for spec of a gradient of size elements, or None.
+    """
+    kind, ratio = parse_spec(spec)
+    if kind == 'fp16':
+        return Fp16Compressor(size)
+    if kind == 'topk':
+        return TopKCompressor(size, ratio)
+    return None
@@ -15,16 +15,33 @@
 # ******************************************************************************
 from __future__ import division
 
+import functools
 import numpy as np
-import mlsl
-from mpi4py import MPI
-import ctypes
-from ngraph.op_graph.comm_nodes import CPUMlslAllReduceStartOp
-import logging
+import os
+if os.getenv('HETR_COLLECTIVES', 'mlsl') == 'shm':
+    # Same API over shared memory, for processes on one host
+    from ngraph.transformers.cpu import shm_collectives as mlsl
+else:
+    import mlsl
+from mpi4py import MPI  # noqa: E402
+import ctypes  # noqa: E402
+from ngraph.op_graph.comm_nodes import CPUMlslAllReduceStartOp  # noqa: E402
+from ngraph.transformers.cpu import allreduce_buckets  # noqa: E402
+from ngraph.transformers.cpu import grad_compression  # noqa: E402
+from ngraph.transformers.cpu import input_prefetch  # noqa: E402
+from ngraph.transformers.cpu.shm_collectives import ShmPipe  # noqa: E402
+import logging  # noqa: E402
 
 logger = logging.getLogger(__name__)
 USER_TAG = 1
 
+# Micro-batches a pipeline stage can send ahead of the stage after it
+PIPELINE_DEPTH = 2
+
+# Gradients are allreduced in flat buckets of about this many bytes; 0 issues one
+# allreduce per tensor
+ALLREDUCE_BUCKET_BYTES = 4 * 1024 * 1024
+
 
 class HetrLocals(object):
 
@@ -52,23 +69,48 @@ class HetrLocals(object):
         self.dataloaders = dict()
         self.dataloader_data = dict()
         self.dataloader_trackers = dict()
+        # Batches loaded ahead of the step by the dataloaders; 0 loads them in the step
+        self.input_prefetch_depth = int(os.getenv('HETR_INPUT_PREFETCH_DEPTH',
+                                                  input_prefetch.DEFAULT_PREFETCH_DEPTH))
+        # Batches read by InputOps, and the steps that waited for their batch and how long
+        self.input_stats = dict(batches=0, stalls=0, stall_seconds=0.0)
 
         # MLSL-specific
         self.distribution = None
+        self.allreduce_bucket_bytes = int(os.getenv('HETR_ALLREDUCE_BUCKET_BYTES',
+                                                    ALLREDUCE_BUCKET_BYTES))
+        self.allreduce_buckets = None  # CPUMlslAllReduceStartOp -> AllReduceBucket
+        self.grad_compressors = dict()  # CPUMlslAllReduceStartOp -> compressor or None
+        self.gathered_payloads = dict()  # CPUMlslAllReduceStartOp -> payloads of all
+        # Bytes of the gradients given to allreduces and of what this process sent for them
+        self.allreduce_stats = dict(gradient_bytes=0, sent_bytes=0)
+
+        # Pipeline parallel: shared memory queues of the sends between stages
+        self.pipeline_depth = int(os.getenv('HETR_PIPELINE_DEPTH', PIPELINE_DEPTH))
+        timeout = os.getenv('HETR_PIPELINE_TIMEOUT')
+        self.pipeline_timeout = float(timeout) if timeout else None
+        self.stage_pipes = dict()  # uuid of the send op -> ShmPipe
 
         # MPI-specific
         self.comm = MPI.COMM_WORLD
 
     def get_dataloader_data(self, input_id):
         from ngraph.frontends.neon.aeon_shim import AeonDataLoader
+        from ngraph.transformers.cputransform import host_align_ndarray
         input_op = self.input_nodes[input_id]
         session_id = input_op.session_id
         if session_id not in self.dataloaders:
-            self.dataloaders[session_id] = AeonDataLoader(config=input_op.aeon_cfg)
+            # Batches are copied into aligned buffers on a background thread while the
+            # steps before them run
+            self.dataloaders[session_id] = input_prefetch.InputPrefetcher(
+                AeonDataLoader(config=input_op.aeon_cfg), depth=self.input_prefetch_depth,
+                alloc=functools.partial(host_align_ndarray, alignment=64),
+                stats=self.input_stats)
             self.dataloader_data[session_id] = dict()
 
         if len(self.dataloader_data[session_id]) == 0:
-            self.dataloader_data[session_id] = next(self.dataloaders[session_id])
+            # Step boundary: the buffers of the previous batch go back to the prefetcher
+            self.dataloader_data[session_id] = dict(self.dataloaders[session_id].next_batch())
 
         # Data should be in place already, and each
         # element should be consumed exactly once before next()
@@ -81,6 +123,18 @@ class HetrLocals(object):
             self.distribution = self.mlsl_obj.create_distribution(self.process_count, 1)
 
     def close(self):
+        for prefetcher in self.dataloaders.values():
+            prefetcher.close()
+        self.dataloaders.clear()
+        for pipe in self.stage_pipes.values():
+            pipe.close()
+        self.stage_pipes.clear()
+        for bucket in set((self.allreduce_buckets or dict()).values()):
+            if bucket.req is not None and not bucket.waited:
+                self.mlsl_obj.wait(bucket.req)
+            if bucket.buffer is not None:
+                self.mlsl_free(bucket.buffer)
+        self.allreduce_buckets = None
         if self.distribution:
             self.mlsl_obj.delete_distribution(self.distribution)
 
@@ -117,12 +171,30 @@ class HetrLocals(object):
             array = np.atleast_1d(array)
         return np.ctypeslib.as_ctypes(array)
 
+    def stage_pipe(self, send_op, nbytes, create):
+        """
+        The queue of send_op between two pipeline stages, created by the sender.
+        """
+        pipe = self.stage_pipes.get(send_op.uuid)
+        if pipe is None:
+            name = 'ngraph_hetr_pipe_{}'.format(send_op.uuid.hex)
+            pipe = ShmPipe(name, nbytes, self.pipeline_depth, create=create,
+                           timeout=self.pipeline_timeout)
+            self.stage_pipes[send_op.uuid] = pipe
+        return pipe
+
     def mlsl_send(self, send_id, x_nparr):
         send_op = self.send_nodes[send_id]
+        if send_op.metadata.get('pipeline_boundary'):
+            self.stage_pipe(send_op, x_nparr.nbytes, create=True).send(x_nparr)
+            return
         self.comm.Send(x_nparr, dest=send_op.metadata['peer_id'], tag=USER_TAG)
 
     def recv_from_mlsl_send(self, recv_id, out):
         recv_op = self.recv_nodes[recv_id]
+        if recv_op.metadata.get('pipeline_boundary'):
+            self.stage_pipe(recv_op.send_node(), out.nbytes, create=False).recv(out)
+            return out
         self.comm.Recv(out, source=recv_op.metadata['peer_id'], tag=USER_TAG)
         return out
 
@@ -208,12 +280,34 @@ class HetrLocals(object):
         self.mlsl_obj.wait(req)
         return out
 
+    def plan_allreduce_buckets(self):
+        """
+        Buckets of the allreduces of the computation; gradients that are compressed
+        are left out. See allreduce_buckets.plan_allreduce_buckets.
+        """
+        return allreduce_buckets.plan_allreduce_buckets(
+            self.allreduce_nodes, self.allreduce_bucket_bytes,
+            lambda op: self.grad_compressor(op) is not None)
+
     def mlsl_allreduce_start(self, allreduce_id, out, x_nparr):
         allreduce_op = self.allreduce_nodes[allreduce_id]
         if not hasattr(allreduce_op, '_req'):
             allreduce_op._req = [None]
         if allreduce_op.reduce_func == 'sum' or allreduce_op.reduce_func == 'mean':
             allreduce_op.arr = out
+            self.allreduce_stats['gradient_bytes'] += x_nparr.nbytes
+            compressor = self.grad_compressor(allreduce_op)
+            if compressor is not None:
+                self.compressed_allreduce_start(allreduce_op, compressor, x_nparr)
+                return
+            self.allreduce_stats['sent_bytes'] += x_nparr.nbytes
+            if self.allreduce_bucket_bytes > 0:
+                if self.allreduce_buckets is None:
+                    self.allreduce_buckets = self.plan_allreduce_buckets()
+                bucket = self.allreduce_buckets.get(allreduce_op)
+                if bucket is not None:
+                    self.bucket_allreduce_start(bucket, allreduce_op, x_nparr)
+                    return
             send_buf = self.as_buffer(x_nparr)
             send_count = x_nparr.size
             recv_buf = self.as_buffer(out)
@@ -225,11 +319,65 @@ class HetrLocals(object):
             raise RuntimeError('Reduce function {} is not supported.'
                                .format(allreduce_op.reduce_func))
 
+    def grad_compressor(self, allreduce_op):
+        """
+        The compressor of the input of allreduce_op, see grad_compression, or None.
+        """
+        if allreduce_op not in self.grad_compressors:
+            compressor = None
+            if allreduce_op.dtype == np.float32:
+                size = allreduce_op.axes.size
+                spec = grad_compression.compression_spec(allreduce_op.metadata, size)
+                compressor = grad_compression.make_compressor(spec, size)
+            self.grad_compressors[allreduce_op] = compressor
+        return self.grad_compressors[allreduce_op]
+
+    def compressed_allreduce_start(self, allreduce_op, compressor, x_nparr):
+        # Payloads are allgathered as bytes and summed in float32 by the wait
+        payload = compressor.compress(x_nparr)
+        gathered = self.gathered_payloads.get(allreduce_op)
+        if gathered is None:
+            gathered = np.empty((self.process_count, payload.size), dtype=np.uint8)
+            self.gathered_payloads[allreduce_op] = gathered
+        self.allreduce_stats['sent_bytes'] += payload.nbytes
+        allreduce_op.req = self.distribution.all_gather(np.ctypeslib.as_ctypes(payload),
+                                                        payload.size,
+                                                        np.ctypeslib.as_ctypes(gathered),
+                                                        mlsl.DataType.BYTE,
+                                                        mlsl.GroupType.DATA)
+
+    def bucket_allreduce_start(self, bucket, allreduce_op, x_nparr):
+        if bucket.buffer is None:
+            bucket.buffer = self.mlsl_alloc(bucket.size, 64, bucket.dtype)
+        np.copyto(bucket.segment(allreduce_op, x_nparr.shape), x_nparr)
+        bucket.filled += 1
+        if bucket.filled == len(bucket.members):
+            # The bucket is full: reduce it in place while the backprop goes on
+            buf = self.as_buffer(bucket.buffer)
+            bucket.req = self.distribution.all_reduce(buf, buf, bucket.size,
+                                                      mlsl.DataType.FLOAT,
+                                                      mlsl.ReductionType.SUM,
+                                                      mlsl.GroupType.DATA)
+            bucket.filled = 0
+            bucket.waited = False
+
     def mlsl_allreduce_wait(self, allreduce_id):
         allreduce_op = self.allreduce_nodes[allreduce_id]
         start_node = next(op for op in allreduce_op.control_deps
                           if isinstance(op, CPUMlslAllReduceStartOp))
-        self.mlsl_obj.wait(start_node.req)
+        bucket = (self.allreduce_buckets or dict()).get(start_node)
+        compressor = self.grad_compressors.get(start_node)
+        if compressor is not None:
+            self.mlsl_obj.wait(start_node.req)
+            compressor.accumulate(self.gathered_payloads[start_node], start_node.arr)
+        elif bucket is None:
+            self.mlsl_obj.wait(start_node.req)
+        else:
+            # The first member waited for completes the allreduce of the whole bucket
+            if not bucket.waited:
+                self.mlsl_obj.wait(bucket.req)
+                bucket.waited = True
+            np.copyto(start_node.arr, bucket.segment(start_node, start_node.arr.shape))
 
         if allreduce_op.reduce_func == 'sum':
             # sum reduction is performed inside MLSL
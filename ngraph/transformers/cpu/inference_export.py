@@ -0,0 +1,599 @@
+# ******************************************************************************
+# Copyright 2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+"""
+Export of compiled CPU computations for the standalone inference runtime.
+
+The runtime (inference_runtime.c, built into libngraph_inference.so) runs a
+computation without Python: it replays the kernel creation calls the MKL-DNN
+passes made, recorded like for the compile cache, and runs the steps of the
+generated code in exop order. Steps that the generated code runs with numpy run
+as plain loops in double precision.
+
+The file is little-endian:
+
+    magic 'NGINFER1', u32 version
+    u32 buffers    {i64 nbytes, u32 has_data, [nbytes bytes]}
+    u32 tensors    {u32 buffer, i64 offset, u32 type, u32 ndim, i64 shape[ndim],
+                    i64 strides[ndim] (bytes)}
+    u32 calls      {string function, u32 nargs, {u32 tag, value}}
+    u32 kernels    {string name, u32 call}
+    u32 steps      {u32 kind, i64 kernel, u32 code, f64 scalar, u32 n, u32 tensors[n],
+                    u32 n, i64 ints[n], u32 n, f64 values[n]}
+    u32 inputs     {string name, u32 tensor}
+    u32 outputs    {string name, u32 tensor}
+
+where a string is a u32 length and the bytes. Buffers without data (the temporary
+pool and scratch arrays) are allocated zeroed by the runtime.
+"""
+from __future__ import division
+
+import ctypes as ct
+import struct
+from collections import namedtuple
+
+import numpy as np
+
+from ngraph.op_graph.op_graph import AbsoluteOp, Add, Argmax, Argmin, ContiguousOp, \
+    CosOp, Op, Divide, FloorDivide, DotLowDimension, Mod, Equal, ExpOp, Greater, \
+    GreaterEqual, Less, LessEqual, LogOp, Max, Maximum, Min, Minimum, Multiply, \
+    NegativeOp, NotEqual, ReciprocalOp, Power, AssignOp, SignOp, SinOp, SqrtOp, \
+    SquareOp, Subtract, Sum, Prod, TanhOp, TensorSizeOp, Fill, WriteOp, ReadOp
+from ngraph.op_graph.pooling import PoolingOp
+from ngraph.op_graph.convolution import ConvolutionOp
+from ngraph.transformers.cpu.batchnorm import BatchnormOp
+from ngraph.transformers.cpu.relu import ReluOp
+from ngraph.transformers.cpu.scaled_sum import ScaledSumOp
+from ngraph.transformers.exop import LiteralScalarOp
+from ngraph.transformers.passes.mkldnnpasses import MklReorderOp
+from ngraph.util.generics import generic_method
+
+MAGIC = b'NGINFER1'
+FORMAT_VERSION = 1
+MAX_DIMS = 8
+
+# Must match inference_runtime.c
+STEP_KERNEL, STEP_COPY, STEP_FILL, STEP_UNARY, STEP_BINARY, STEP_SCALED_SUM, \
+    STEP_REDUCE, STEP_ARG_REDUCE, STEP_DOT = range(9)
+
+UNARY_NEGATIVE, UNARY_ABSOLUTE, UNARY_EXP, UNARY_LOG, UNARY_TANH, UNARY_SQRT, \
+    UNARY_SQUARE, UNARY_RECIPROCAL, UNARY_SIGN, UNARY_SIN, UNARY_COS, UNARY_RELU = range(12)
+
+BINARY_ADD, BINARY_SUBTRACT, BINARY_MULTIPLY, BINARY_DIVIDE, BINARY_MAXIMUM, \
+    BINARY_MINIMUM, BINARY_POWER, BINARY_EQUAL, BINARY_NOT_EQUAL, BINARY_GREATER, \
+    BINARY_GREATER_EQUAL, BINARY_LESS, BINARY_LESS_EQUAL, BINARY_MOD, \
+    BINARY_FLOOR_DIVIDE = range(15)
+
+REDUCE_SUM, REDUCE_PROD, REDUCE_MAX, REDUCE_MIN = range(4)
+
+ARG_REDUCE_MAX, ARG_REDUCE_MIN = range(2)
+
+ARG_NULL, ARG_INT, ARG_DOUBLE, ARG_ENGINE, ARG_HANDLE, ARG_INT_ARRAY, ARG_FLOAT_ARRAY, \
+    ARG_HANDLE_ARRAY, ARG_STRING = range(9)
+
+ELEMENT_TYPES = {np.dtype(np.float32): 0, np.dtype(np.float64): 1,
+                 np.dtype(np.int32): 2, np.dtype(np.int64): 3, np.dtype(np.uint8): 4}
+
+# The engine functions the runtime replays, keep in sync with replay_functions in
+# inference_runtime.c
+RUNTIME_FUNCTIONS = ('create_empty_kernel', 'create_mkldnn_layout_descriptor',
+                     'mkldnn_reorder_axes', 'mkldnn_flatten_axes', 'query_opkernel_layout',
+                     'create_mkldnn_add_kernel', 'create_mkldnn_sum_kernel',
+                     'create_mkldnn_binary_eltwise_kernel',
+                     'create_mkldnn_batchnorm_fprop_primitives',
+                     'create_mkldnn_conv_fprop_kernel',
+                     'create_mkldnn_innerproduct_fprop_kernel',
+                     'create_mkldnn_pool_fprop_kernel', 'create_mkldnn_relu_fprop_kernel',
+                     'create_mkldnn_reorder_kernel')
+
+UNARY_CODES = {AbsoluteOp: UNARY_ABSOLUTE, CosOp: UNARY_COS, ExpOp: UNARY_EXP,
+               LogOp: UNARY_LOG, NegativeOp: UNARY_NEGATIVE, ReciprocalOp: UNARY_RECIPROCAL,
+               SignOp: UNARY_SIGN, SinOp: UNARY_SIN, SqrtOp: UNARY_SQRT,
+               SquareOp: UNARY_SQUARE, TanhOp: UNARY_TANH}
+
+BINARY_CODES = {Add: BINARY_ADD, Subtract: BINARY_SUBTRACT, Multiply: BINARY_MULTIPLY,
+                Divide: BINARY_DIVIDE, Maximum: BINARY_MAXIMUM, Minimum: BINARY_MINIMUM,
+                Power: BINARY_POWER, Equal: BINARY_EQUAL, NotEqual: BINARY_NOT_EQUAL,
+                Greater: BINARY_GREATER, GreaterEqual: BINARY_GREATER_EQUAL,
+                Less: BINARY_LESS, LessEqual: BINARY_LESS_EQUAL, Mod: BINARY_MOD,
+                FloorDivide: BINARY_FLOOR_DIVIDE}
+
+REDUCE_CODES = {Sum: REDUCE_SUM, Prod: REDUCE_PROD, Max: REDUCE_MAX, Min: REDUCE_MIN}
+
+ARG_REDUCE_CODES = {Argmax: ARG_REDUCE_MAX, Argmin: ARG_REDUCE_MIN}
+
+Step = namedtuple('Step', ['kind', 'kernel', 'code', 'scalar', 'tensors', 'ints', 'values'])
+
+
+def op_code(codes, op):
+    """
+    The code in codes of the class of op or of its closest base class.
+    """
+    return next(codes[op_type] for op_type in type(op).__mro__ if op_type in codes)
+
+
+def make_step(kind, tensors, kernel=-1, code=0, scalar=0.0, ints=(), values=()):
+    return Step(kind, kernel, code, float(scalar), list(tensors), list(ints), list(values))
+
+
+def extent(array):
+    """
+    The [start, end) addresses of the bytes array views.
+    """
+    start = end = array.ctypes.data
+    if array.size == 0:
+        return start, end
+    end += array.itemsize
+    for length, stride in zip(array.shape, array.strides):
+        if stride < 0:
+            start += (length - 1) * stride
+        else:
+            end += (length - 1) * stride
+    return start, end
+
+
+class InferenceExporter(object):
+    """
+    Collects the buffers, tensors, kernel creation calls and steps of a compiled
+    computation, see CPUDeviceComputation.export_inference.
+
+    Arguments:
+        computation: The CPUDeviceComputation.
+        recorder: The MkldnnRecorder of the MKL-DNN passes of the computation.
+    """
+    def __init__(self, computation, recorder):
+        self.computation = computation
+        self.transformer = computation.transformer
+        self.mkldnn = computation.mkldnn
+        self.recorder = recorder
+        self.arrays = []        # tensor index -> ndarray
+        self.scratch = []       # arrays written by the steps before they are read
+        self.steps = []
+        self.kernels = []       # (name, call index)
+        self.exop = None
+
+    def tensor(self, array, shape=None, dtype=None):
+        """
+        Index of the tensor of array, a literal scalar when it is not an ndarray,
+        broadcast to shape if given.
+        """
+        if not isinstance(array, np.ndarray):
+            array = np.full((), array, dtype=dtype or np.float32)
+        if shape is not None and array.shape != tuple(shape):
+            array = np.broadcast_to(array, shape)
+        if array.dtype not in ELEMENT_TYPES:
+            raise ValueError("Tensors of type {} can not be exported".format(array.dtype))
+        if array.ndim > MAX_DIMS:
+            raise ValueError("Tensors of more than {} dimensions can not be exported"
+                             .format(MAX_DIMS))
+        self.arrays.append(array)
+        return len(self.arrays) - 1
+
+    def value(self, decl):
+        """
+        The ndarray of an input or output decl, or the scalar of a literal input.
+        """
+        if decl is None:
+            return None
+        source = getattr(decl, 'source_output_decl', None)
+        if source is not None and isinstance(source.exop.op, LiteralScalarOp):
+            return source.exop.op.scalar
+        return self.transformer.device_tensor_view(decl.tensor_view_decl).tensor
+
+    def add_step(self, kind, arrays, **kwargs):
+        self.steps.append(make_step(kind, [self.tensor(array) for array in arrays], **kwargs))
+
+    def kernel(self, op, inputs, outputs):
+        """
+        Adds a run of the MKL-DNN kernel of op.
+        """
+        name = op.safe_name
+        call = self.recorder.kernels.get(name)
+        if call is None:
+            raise ValueError("The kernel of {} was not created by the passes of this "
+                             "computation".format(op.name))
+        self.kernels.append((name, call))
+        tensors = [self.tensor(array) for array in list(inputs) + list(outputs)]
+        self.steps.append(make_step(STEP_KERNEL, tensors, kernel=len(self.kernels) - 1,
+                                    ints=[len(inputs)]))
+
+    def has_kernel(self, op):
+        return self.mkldnn.enabled and op.safe_name in self.mkldnn.kernels
+
+    def copy(self, out, x):
+        if isinstance(x, np.ndarray):
+            self.steps.append(make_step(STEP_COPY, [self.tensor(out),
+                                                    self.tensor(x, out.shape)]))
+        else:
+            self.steps.append(make_step(STEP_FILL, [self.tensor(out)], scalar=x))
+
+    def unary(self, code, out, x, scalar=0.0):
+        self.steps.append(make_step(STEP_UNARY, [self.tensor(out),
+                                                 self.tensor(x, out.shape, out.dtype)],
+                                    code=code, scalar=scalar))
+
+    def binary(self, code, out, x, y):
+        self.steps.append(make_step(STEP_BINARY, [self.tensor(out),
+                                                  self.tensor(x, out.shape, out.dtype),
+                                                  self.tensor(y, out.shape, out.dtype)],
+                                    code=code))
+
+    def binary_elementwise(self, op, code, out, x, y):
+        out, x, y = self.value(out), self.value(x), self.value(y)
+        if self.has_kernel(op):
+            # Literal scalars are bound as one element tensors
+            x, y = [np.full(1, v, dtype=out.dtype) if not isinstance(v, np.ndarray) else v
+                    for v in (x, y)]
+            self.kernel(op, [x, y], [out])
+        else:
+            self.binary(code, out, x, y)
+
+    def reduce(self, kind, code, op, out, x):
+        axes = self.transformer.exop_codegen.np_reduction_axis(op)
+        if not isinstance(axes, tuple):
+            axes = (axes,)
+        kept = [axis for axis in range(x.ndim) if axis not in axes]
+        self.steps.append(make_step(kind, [self.tensor(out),
+                                           self.tensor(x.transpose(kept + list(axes)))],
+                                    code=code))
+
+    def export(self):
+        """
+        Exports the computation.
+
+        Returns:
+            The inputs and outputs as lists of (name, tensor index).
+        """
+        computation = self.computation
+        views = self.transformer.computation_views(computation.computation_decl)
+        if views['lazy_returns']:
+            raise ValueError("Returns left in an MKL layout can not be exported")
+        namespace = computation.namespace
+        inputs = [(param.tensor.name, self.tensor(namespace[views['parameters'][param]]))
+                  for param in computation.computation_op.parameters]
+        for exop in computation.computation_decl.exop_block:
+            self.exop = exop
+            out = exop.output_decls[0] if len(exop.output_decls) > 0 else None
+            self.export_op(exop.op, out, *exop.input_decls)
+        returns = computation.computation_op.returns
+        if returns is None:
+            returns = []
+        elif isinstance(returns, Op):
+            returns = [returns]
+        outputs = [(op.name, self.tensor(namespace[views['returns'][op]]))
+                   for op in returns if op in views['returns']]
+        return inputs, outputs
+
+    @generic_method(Op)
+    def export_op(self, op, *args):
+        if op.is_device_op:
+            raise ValueError("{} ops can not be exported for inference".format(
+                op.__class__.__name__))
+
+    @export_op.on_type(ReadOp)
+    def export_op(self, op, out):
+        pass
+
+    @export_op.on_type(WriteOp)
+    def export_op(self, op, out, *args):
+        for dest, source in zip(self.exop.write_args, args):
+            self.copy(self.value(dest), self.value(source))
+
+    @export_op.on_type(AssignOp)
+    def export_op(self, op, out, tensor, value):
+        self.copy(self.value(tensor), self.value(value))
+
+    @export_op.on_type(Fill)
+    def export_op(self, op, out, x):
+        self.copy(self.value(x), op.scalar)
+
+    @export_op.on_type(TensorSizeOp)
+    def export_op(self, op, out, x):
+        self.copy(self.value(out), op.reduction_axes.size)
+
+    @export_op.on_type(ContiguousOp)
+    def export_op(self, op, out, x):
+        if op.safe_name in self.mkldnn.kernels:
+            self.kernel(op, [self.value(x)], [self.value(out)])
+        else:
+            self.copy(self.value(out), self.value(x))
+
+    @export_op.on_type(MklReorderOp)
+    def export_op(self, op, out, x):
+        self.kernel(op, [self.value(x)], [self.value(out)])
+
+    def export_unary(self, op, out, x):
+        self.unary(op_code(UNARY_CODES, op), self.value(out), self.value(x))
+
+    for op_type in UNARY_CODES:
+        export_op.on_type(op_type)(export_unary)
+
+    @export_op.on_type(Add)
+    def export_op(self, op, out, x, y):
+        if self.has_kernel(op):
+            self.kernel(op, [self.value(x), self.value(y)], [self.value(out)])
+        else:
+            self.binary(BINARY_ADD, self.value(out), self.value(x), self.value(y))
+
+    def export_binary(self, op, out, x, y):
+        # Only ops of binary_eltwise_algs have kernels
+        self.binary_elementwise(op, op_code(BINARY_CODES, op), out, x, y)
+
+    for op_type in BINARY_CODES:
+        if op_type is not Add:
+            export_op.on_type(op_type)(export_binary)
+
+    def export_reduce(self, op, out, x):
+        self.reduce(STEP_REDUCE, op_code(REDUCE_CODES, op), op, self.value(out),
+                    self.value(x))
+
+    def export_arg_reduce(self, op, out, x):
+        self.reduce(STEP_ARG_REDUCE, op_code(ARG_REDUCE_CODES, op), op, self.value(out),
+                    self.value(x))
+
+    for op_type in REDUCE_CODES:
+        export_op.on_type(op_type)(export_reduce)
+    for op_type in ARG_REDUCE_CODES:
+        export_op.on_type(op_type)(export_arg_reduce)
+    del op_type
+
+    @export_op.on_type(ScaledSumOp)
+    def export_op(self, op, out, *args):
+        out = self.value(out)
+        args = [self.value(arg) for arg in args]
+        if self.has_kernel(op):
+            self.kernel(op, args, [out])
+        else:
+            self.steps.append(make_step(
+                STEP_SCALED_SUM,
+                [self.tensor(out)] + [self.tensor(arg, out.shape, out.dtype) for arg in args],
+                values=op.scales))
+
+    @export_op.on_type(ReluOp)
+    def export_op(self, op, out, x):
+        out, x = self.value(out), self.value(x)
+        if self.has_kernel(op):
+            self.kernel(op, [x], [out])
+        else:
+            self.unary(UNARY_RELU, out, x, scalar=op.slope)
+
+    @export_op.on_type(DotLowDimension)
+    def export_op(self, op, out, x, y, bias=None):
+        out, x, y, bias = self.value(out), self.value(x), self.value(y), self.value(bias)
+        if self.has_kernel(op):
+            self.kernel(op, [x, y] + ([bias] if bias is not None else []), [out])
+            return
+        # The runtime multiplies matrices, vectors become single rows or columns
+        if x.ndim == 1:
+            x, out = x[None, :], out[None]
+        if y.ndim == 1:
+            y, out = y[:, None], out[..., None]
+        arrays = [out, x, y]
+        if bias is not None:
+            arrays.append(np.broadcast_to(bias[:, None], out.shape))
+        self.add_step(STEP_DOT, arrays)
+
+    @export_op.on_type(ConvolutionOp)
+    def export_op(self, op, out, inputs, filters, bias=None):
+        if not self.has_kernel(op):
+            raise ValueError("Convolutions without an MKL-DNN kernel can not be exported")
+        bias = self.value(bias)
+        self.kernel(op, [self.value(inputs), self.value(filters)] +
+                    ([bias] if bias is not None else []), [self.value(out)])
+
+    @export_op.on_type(PoolingOp)
+    def export_op(self, op, out, inputs):
+        if not self.has_kernel(op):
+            raise ValueError("Pooling without an MKL-DNN kernel can not be exported")
+        outputs = [self.value(out)]
+        _, _, _, _, pool_op, argmax = self.computation.pool_slices[op.safe_name]
+        if pool_op == 'max':
+            # Only the kernel reads the uint32 argmax indices
+            argmax = argmax.view(np.int32)
+            self.scratch.append(argmax)
+            outputs.append(argmax)
+        self.kernel(op, [self.value(inputs)], outputs)
+
+    @export_op.on_type(BatchnormOp)
+    def export_op(self, op, out, inputs, gamma, bias, epsilon, mean, variance):
+        gamma, bias = self.value(gamma)[:, 0], self.value(bias)[:, 0]
+        if self.mkldnn.are_rows(gamma, bias):
+            weights = gamma
+        else:
+            # The scale-shift copy Mkldnn.scale_shift makes on every run
+            weights = np.empty((2, gamma.size), dtype=np.float32)
+            self.scratch.append(weights)
+            self.copy(weights[0], gamma)
+            self.copy(weights[1], bias)
+        self.kernel(op, [self.value(inputs), weights],
+                    [self.value(out), self.value(mean), self.value(variance)])
+
+    def buffers(self):
+        """
+        Groups the tensors into buffers of overlapping memory.
+
+        Returns:
+            [(nbytes, data or None)] and [(buffer, offset)] for each tensor.
+        """
+        extents = [extent(array) for array in self.arrays]
+        order = sorted(range(len(extents)), key=lambda i: extents[i])
+        temporary = self.computation.pool('temporary')
+        temporary = extent(temporary) if temporary is not None else (0, 0)
+        scratch = set(extent(array) for array in self.scratch)
+        buffers = []
+        placement = [None] * len(self.arrays)
+        groups = []
+        for i in order:
+            start, end = extents[i]
+            if groups and start < groups[-1][1]:
+                groups[-1][1] = max(groups[-1][1], end)
+                groups[-1][2].append(i)
+            else:
+                groups.append([start, end, [i]])
+        for start, end, members in groups:
+            for i in members:
+                placement[i] = (len(buffers), self.arrays[i].ctypes.data - start)
+            if temporary[0] <= start and end <= temporary[1] or (start, end) in scratch:
+                buffers.append((end - start, None))
+            else:
+                buffers.append((end - start, ct.string_at(start, end - start)))
+        return buffers, placement
+
+    def calls(self):
+        """
+        The recorded calls that create the exported kernels, as (function, [(tag,
+        value)]) with handles renumbered to the kept calls, and the new index of
+        every kept call.
+        """
+        recorder = self.recorder
+        functions = [getattr(self.mkldnn, attr) for attr, _ in recorder.calls]
+
+        def references(args):
+            refs = []
+            for arg in args:
+                if isinstance(arg, tuple) and arg[0] == 'handle':
+                    refs.append(arg[1])
+                elif isinstance(arg, tuple) and arg[0] == 'array' and arg[1] == 'c_void_p':
+                    refs.extend(recorder.handles[value] for value in arg[2]
+                                if value in recorder.handles)
+            return refs
+
+        empty_kernels = set(index for index, function in enumerate(functions)
+                            if function.__name__ == 'create_empty_kernel')
+        needed = set(call for _, call in self.kernels)
+        for index in reversed(range(len(recorder.calls))):
+            refs = references(recorder.calls[index][1])
+            # Calls without a handle result build the kernels they are given
+            builds = functions[index].restype is not ct.c_void_p and \
+                any(ref in needed and ref in empty_kernels for ref in refs)
+            if index in needed or builds:
+                needed.add(index)
+                needed.update(refs)
+
+        kept = sorted(needed)
+        renumber = dict((index, new) for new, index in enumerate(kept))
+        calls = []
+        for index in kept:
+            attr, args = recorder.calls[index]
+            function = functions[index]
+            if function.__name__ not in RUNTIME_FUNCTIONS:
+                raise ValueError("The runtime can not replay {}".format(function.__name__))
+            calls.append((function.__name__,
+                          [self.encode_arg(arg, argtype, renumber)
+                           for arg, argtype in zip(args, function.argtypes)]))
+        return calls, renumber
+
+    def encode_arg(self, arg, argtype, renumber):
+        if arg is None:
+            return ARG_NULL, None
+        if isinstance(arg, tuple):
+            if arg[0] == 'engine':
+                return ARG_ENGINE, None
+            if arg[0] == 'handle':
+                return ARG_HANDLE, renumber[arg[1]]
+            _, ctype, values = arg
+            if ctype == 'c_int':
+                return ARG_INT_ARRAY, values
+            if ctype == 'c_float':
+                return ARG_FLOAT_ARRAY, values
+            if ctype == 'c_void_p':
+                try:
+                    return ARG_HANDLE_ARRAY, [renumber[self.recorder.handles[value]]
+                                              for value in values]
+                except KeyError:
+                    raise ValueError("A recorded pointer array is not made of kernel "
+                                     "creation results")
+            raise ValueError("Recorded arrays of {} can not be exported".format(ctype))
+        if isinstance(arg, (bytes, str)):
+            return ARG_STRING, arg if isinstance(arg, bytes) else arg.encode('utf-8')
+        if argtype in (ct.c_double, ct.c_float):
+            return ARG_DOUBLE, float(arg)
+        if argtype is ct.c_void_p:
+            if arg:
+                raise ValueError("A recorded call takes a pointer the runtime does not "
+                                 "create")
+            return ARG_NULL, None
+        return ARG_INT, int(arg)
+
+
+def pack_string(value):
+    if not isinstance(value, bytes):
+        value = value.encode('utf-8')
+    return struct.pack('<I', len(value)) + value
+
+
+def pack_arg(tag, value):
+    data = struct.pack('<I', tag)
+    if tag == ARG_INT:
+        data += struct.pack('<q', value)
+    elif tag == ARG_DOUBLE:
+        data += struct.pack('<d', value)
+    elif tag == ARG_HANDLE:
+        data += struct.pack('<I', value)
+    elif tag in (ARG_INT_ARRAY, ARG_FLOAT_ARRAY, ARG_HANDLE_ARRAY):
+        element = {ARG_INT_ARRAY: 'i', ARG_FLOAT_ARRAY: 'f', ARG_HANDLE_ARRAY: 'I'}[tag]
+        data += struct.pack('<I{}{}'.format(len(value), element), len(value), *value)
+    elif tag == ARG_STRING:
+        data += pack_string(value)
+    return data
+
+
+def export_inference(computation, recorder, path):
+    """
+    Writes the inference file of a compiled computation to path.
+
+    Arguments:
+        computation: The CPUDeviceComputation.
+        recorder: The MkldnnRecorder of the MKL-DNN passes of the computation.
+        path: The file to write.
+    """
+    exporter = InferenceExporter(computation, recorder)
+    inputs, outputs = exporter.export()
+    buffers, placement = exporter.buffers()
+    calls, renumber = exporter.calls()
+
+    with open(path, 'wb') as f:
+        f.write(MAGIC + struct.pack('<I', FORMAT_VERSION))
+        f.write(struct.pack('<I', len(buffers)))
+        for nbytes, data in buffers:
+            f.write(struct.pack('<qI', nbytes, data is not None))
+            if data is not None:
+                f.write(data)
+        f.write(struct.pack('<I', len(exporter.arrays)))
+        for array, (buffer, offset) in zip(exporter.arrays, placement):
+            f.write(struct.pack('<IqII', buffer, offset, ELEMENT_TYPES[array.dtype],
+                                array.ndim))
+            f.write(struct.pack('<{}q'.format(2 * array.ndim),
+                                *(array.shape + array.strides)))
+        f.write(struct.pack('<I', len(calls)))
+        for name, args in calls:
+            f.write(pack_string(name) + struct.pack('<I', len(args)))
+            for tag, value in args:
+                f.write(pack_arg(tag, value))
+        f.write(struct.pack('<I', len(exporter.kernels)))
+        for name, call in exporter.kernels:
+            f.write(pack_string(name) + struct.pack('<I', renumber[call]))
+        f.write(struct.pack('<I', len(exporter.steps)))
+        for step in exporter.steps:
+            f.write(struct.pack('<IqIdI', step.kind, step.kernel, step.code, step.scalar,
+                                len(step.tensors)))
+            f.write(struct.pack('<{}I'.format(len(step.tensors)), *step.tensors))
+            f.write(struct.pack('<I{}q'.format(len(step.ints)), len(step.ints), *step.ints))
+            f.write(struct.pack('<I{}d'.format(len(step.values)), len(step.values),
+                                *step.values))
+        for ports in (inputs, outputs):
+            f.write(struct.pack('<I', len(ports)))
+            for name, tensor in ports:
+                f.write(pack_string(name) + struct.pack('<I', tensor))
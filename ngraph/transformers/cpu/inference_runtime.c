@@ -0,0 +1,1087 @@
+/*******************************************************************************
+* Copyright 2018 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+/* Standalone runtime of exported inference computations.
+ *
+ * Built from the engine sources into libngraph_inference.so (make
+ * inference_runtime), it executes the files written by
+ * ngraph.transformers.cpu.inference_export without Python. A file holds
+ *
+ *   - the buffers of the computation: its tensor pools, with the contents of
+ *     those holding weights, and scratch buffers that are only allocated,
+ *   - the tensors the steps use, as offset, shape and byte strides in a
+ *     buffer, the same views the generated Python code makes,
+ *   - the create_mkldnn_* calls the MKL-DNN graph passes made, recorded like
+ *     for the compile cache, which are replayed to create the kernels,
+ *   - the steps in exop order: kernel runs, and elementwise, reduction and
+ *     dot ops that the generated code runs with numpy.
+ *
+ * All integers are little-endian. The layout of the file is documented with
+ * the writer in inference_export.py; the step kinds and op codes below must
+ * match the ones there. */
+
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "inference_runtime.h"
+#include "mkldnn_engine.h"
+#include "mkldnn_util.h"
+
+#define INFERENCE_MAGIC "NGINFER1"
+#define INFERENCE_VERSION 1
+#define INFERENCE_MAX_DIMS 8
+#define INFERENCE_MAX_OPERANDS (MKLDNN_MAX_ARGS + 2)
+#define INFERENCE_ALIGNMENT 64
+
+enum {
+  STEP_KERNEL = 0,
+  STEP_COPY,
+  STEP_FILL,
+  STEP_UNARY,
+  STEP_BINARY,
+  STEP_SCALED_SUM,
+  STEP_REDUCE,
+  STEP_ARG_REDUCE,
+  STEP_DOT
+};
+
+enum {
+  UNARY_NEGATIVE = 0,
+  UNARY_ABSOLUTE,
+  UNARY_EXP,
+  UNARY_LOG,
+  UNARY_TANH,
+  UNARY_SQRT,
+  UNARY_SQUARE,
+  UNARY_RECIPROCAL,
+  UNARY_SIGN,
+  UNARY_SIN,
+  UNARY_COS,
+  UNARY_RELU
+};
+
+enum {
+  BINARY_ADD = 0,
+  BINARY_SUBTRACT,
+  BINARY_MULTIPLY,
+  BINARY_DIVIDE,
+  BINARY_MAXIMUM,
+  BINARY_MINIMUM,
+  BINARY_POWER,
+  BINARY_EQUAL,
+  BINARY_NOT_EQUAL,
+  BINARY_GREATER,
+  BINARY_GREATER_EQUAL,
+  BINARY_LESS,
+  BINARY_LESS_EQUAL,
+  BINARY_MOD,
+  BINARY_FLOOR_DIVIDE
+};
+
+enum { REDUCE_SUM = 0, REDUCE_PROD, REDUCE_MAX, REDUCE_MIN };
+
+enum { ARG_REDUCE_MAX = 0, ARG_REDUCE_MIN };
+
+/* Arguments of recorded calls */
+enum {
+  ARG_NULL = 0,
+  ARG_INT,
+  ARG_DOUBLE,
+  ARG_ENGINE,
+  ARG_HANDLE,
+  ARG_INT_ARRAY,
+  ARG_FLOAT_ARRAY,
+  ARG_HANDLE_ARRAY,
+  ARG_STRING
+};
+
+typedef union {
+  long long i;
+  double d;
+  void *p;
+} call_value;
+
+typedef struct {
+  char *data;
+  int type;
+  int ndim;
+  long long shape[INFERENCE_MAX_DIMS];
+  long long strides[INFERENCE_MAX_DIMS]; /* in bytes */
+} inference_tensor;
+
+typedef struct {
+  int kind;
+  int kernel;
+  int code;
+  double scalar;
+  int num_tensors;
+  inference_tensor **tensors;
+  int num_ints;
+  long long *ints;
+  int num_values;
+  double *values;
+} inference_step;
+
+typedef struct {
+  char *name;
+  inference_tensor *tensor;
+} inference_port;
+
+typedef void (*destroy_fn)(void *);
+
+struct inference_model {
+  mkldnn_engine_t engine;
+  int num_buffers;
+  void **buffers;
+  size_t *buffer_sizes;
+  int num_tensors;
+  inference_tensor *tensors;
+  int num_results;
+  void **results;          /* of the replayed calls */
+  destroy_fn *destructors; /* of the results, in reverse call order */
+  int num_arrays;
+  void **arrays;           /* arguments of the replayed calls */
+  int num_kernels;
+  mkldnn_opkernel_t *kernels;
+  int num_steps;
+  inference_step *steps;
+  int num_inputs;
+  inference_port *inputs;
+  int num_outputs;
+  inference_port *outputs;
+};
+
+static __thread char error_message[512];
+
+const char *inference_model_error(void) { return error_message; }
+
+static void set_error(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vsnprintf(error_message, sizeof(error_message), format, args);
+  va_end(args);
+}
+
+/* Reading the file */
+
+typedef struct {
+  const char *data;
+  size_t size;
+  size_t pos;
+  int failed;
+} reader;
+
+static const void *read_bytes(reader *r, size_t n) {
+  if (r->failed || n > r->size - r->pos) {
+    if (!r->failed) set_error("truncated inference model");
+    r->failed = 1;
+    return NULL;
+  }
+  const void *p = r->data + r->pos;
+  r->pos += n;
+  return p;
+}
+
+static uint32_t read_u32(reader *r) {
+  uint32_t v = 0;
+  const void *p = read_bytes(r, sizeof(v));
+  if (p) memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static int64_t read_i64(reader *r) {
+  int64_t v = 0;
+  const void *p = read_bytes(r, sizeof(v));
+  if (p) memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static double read_f64(reader *r) {
+  double v = 0;
+  const void *p = read_bytes(r, sizeof(v));
+  if (p) memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static char *read_string(reader *r) {
+  uint32_t n = read_u32(r);
+  const char *p = read_bytes(r, n);
+  if (!p) return NULL;
+  char *s = malloc(n + 1);
+  memcpy(s, p, n);
+  s[n] = '\0';
+  return s;
+}
+
+/* Index read from the file, checked against count */
+static int read_index(reader *r, int count, const char *what) {
+  uint32_t index = read_u32(r);
+  if (!r->failed && index >= (uint32_t)count) {
+    set_error("%s %u out of range", what, index);
+    r->failed = 1;
+  }
+  return (int)index;
+}
+
+/* Elements */
+
+static size_t type_size(int type) {
+  switch (type) {
+    case INFERENCE_FLOAT32: return 4;
+    case INFERENCE_FLOAT64: return 8;
+    case INFERENCE_INT32: return 4;
+    case INFERENCE_INT64: return 8;
+    case INFERENCE_UINT8: return 1;
+    default: return 0;
+  }
+}
+
+static double load_element(const char *p, int type) {
+  switch (type) {
+    case INFERENCE_FLOAT32: return *(const float *)p;
+    case INFERENCE_FLOAT64: return *(const double *)p;
+    case INFERENCE_INT32: return *(const int32_t *)p;
+    case INFERENCE_INT64: return (double)*(const int64_t *)p;
+    default: return *(const uint8_t *)p;
+  }
+}
+
+static void store_element(char *p, int type, double v) {
+  switch (type) {
+    case INFERENCE_FLOAT32: *(float *)p = (float)v; break;
+    case INFERENCE_FLOAT64: *(double *)p = v; break;
+    case INFERENCE_INT32: *(int32_t *)p = (int32_t)v; break;
+    case INFERENCE_INT64: *(int64_t *)p = (int64_t)v; break;
+    default: *(uint8_t *)p = (uint8_t)v;
+  }
+}
+
+static long long element_count(int ndim, const long long *shape) {
+  long long count = 1;
+  for (int d = 0; d < ndim; d++) count *= shape[d];
+  return count;
+}
+
+typedef void (*element_fn)(char **ptrs, void *arg);
+
+/* Calls fn with the addresses of the elements of the n tensors at every index
+ * of shape, in C order. The first ndim strides of each tensor are used, so
+ * broadcast operands have zero strides and a tensor with more dimensions is
+ * walked over its leading ones. */
+static void for_each_element(int n, inference_tensor *const *tensors,
+                             int ndim, const long long *shape, element_fn fn,
+                             void *arg) {
+  long long index[INFERENCE_MAX_DIMS] = {0};
+  char *ptrs[INFERENCE_MAX_OPERANDS];
+  long long count = element_count(ndim, shape);
+  for (int i = 0; i < n; i++) ptrs[i] = tensors[i]->data;
+  for (long long e = 0; e < count; e++) {
+    fn(ptrs, arg);
+    for (int d = ndim - 1; d >= 0; d--) {
+      if (++index[d] < shape[d]) {
+        for (int i = 0; i < n; i++) ptrs[i] += tensors[i]->strides[d];
+        break;
+      }
+      index[d] = 0;
+      for (int i = 0; i < n; i++)
+        ptrs[i] -= tensors[i]->strides[d] * (shape[d] - 1);
+    }
+  }
+}
+
+/* Dense copies between tensors and the arrays of the API */
+
+typedef struct {
+  char *dense;
+  size_t size;
+  int to_tensor;
+} dense_copy;
+
+static void copy_dense_element(char **ptrs, void *arg) {
+  dense_copy *c = arg;
+  if (c->to_tensor)
+    memcpy(ptrs[0], c->dense, c->size);
+  else
+    memcpy(c->dense, ptrs[0], c->size);
+  c->dense += c->size;
+}
+
+static size_t tensor_size(const inference_tensor *t) {
+  return element_count(t->ndim, t->shape) * type_size(t->type);
+}
+
+/* Steps */
+
+typedef struct {
+  const inference_step *step;
+  int types[INFERENCE_MAX_OPERANDS];
+} element_args;
+
+static void copy_element(char **ptrs, void *arg) {
+  element_args *a = arg;
+  if (a->types[0] == a->types[1])
+    memcpy(ptrs[0], ptrs[1], type_size(a->types[0]));
+  else
+    store_element(ptrs[0], a->types[0], load_element(ptrs[1], a->types[1]));
+}
+
+static void fill_element(char **ptrs, void *arg) {
+  element_args *a = arg;
+  store_element(ptrs[0], a->types[0], a->step->scalar);
+}
+
+static double sign(double x) { return (x > 0) - (x < 0); }
+
+static void unary_element(char **ptrs, void *arg) {
+  element_args *a = arg;
+  double x = load_element(ptrs[1], a->types[1]);
+  double y;
+  switch (a->step->code) {
+    case UNARY_NEGATIVE: y = -x; break;
+    case UNARY_ABSOLUTE: y = fabs(x); break;
+    case UNARY_EXP: y = exp(x); break;
+    case UNARY_LOG: y = log(x); break;
+    case UNARY_TANH: y = tanh(x); break;
+    case UNARY_SQRT: y = sqrt(x); break;
+    case UNARY_SQUARE: y = x * x; break;
+    case UNARY_RECIPROCAL: y = 1.0 / x; break;
+    case UNARY_SIGN: y = sign(x); break;
+    case UNARY_SIN: y = sin(x); break;
+    case UNARY_COS: y = cos(x); break;
+    default: y = x > 0 ? x : a->step->scalar * x; /* UNARY_RELU */
+  }
+  store_element(ptrs[0], a->types[0], y);
+}
+
+static void binary_element(char **ptrs, void *arg) {
+  element_args *a = arg;
+  double x = load_element(ptrs[1], a->types[1]);
+  double y = load_element(ptrs[2], a->types[2]);
+  double z;
+  switch (a->step->code) {
+    case BINARY_ADD: z = x + y; break;
+    case BINARY_SUBTRACT: z = x - y; break;
+    case BINARY_MULTIPLY: z = x * y; break;
+    case BINARY_DIVIDE: z = x / y; break;
+    case BINARY_MAXIMUM: z = x > y ? x : y; break;
+    case BINARY_MINIMUM: z = x < y ? x : y; break;
+    case BINARY_POWER: z = pow(x, y); break;
+    case BINARY_EQUAL: z = x == y; break;
+    case BINARY_NOT_EQUAL: z = x != y; break;
+    case BINARY_GREATER: z = x > y; break;
+    case BINARY_GREATER_EQUAL: z = x >= y; break;
+    case BINARY_LESS: z = x < y; break;
+    case BINARY_LESS_EQUAL: z = x <= y; break;
+    case BINARY_MOD:
+      /* numpy semantics: the result has the sign of the divisor */
+      z = fmod(x, y);
+      if (z != 0 && ((z < 0) != (y < 0))) z += y;
+      break;
+    default: z = floor(x / y); /* BINARY_FLOOR_DIVIDE */
+  }
+  store_element(ptrs[0], a->types[0], z);
+}
+
+static void scaled_sum_element(char **ptrs, void *arg) {
+  element_args *a = arg;
+  double sum = 0;
+  for (int i = 1; i < a->step->num_tensors; i++)
+    sum += a->step->values[i - 1] * load_element(ptrs[i], a->types[i]);
+  store_element(ptrs[0], a->types[0], sum);
+}
+
+typedef struct {
+  int code;
+  int type;
+  long long index;
+  long long best_index;
+  double acc;
+} reduction;
+
+static void reduce_inner_element(char **ptrs, void *arg) {
+  reduction *r = arg;
+  double x = load_element(ptrs[0], r->type);
+  if (r->index == 0) {
+    r->acc = x;
+  } else {
+    switch (r->code) {
+      case REDUCE_SUM: r->acc += x; break;
+      case REDUCE_PROD: r->acc *= x; break;
+      case REDUCE_MAX: if (x > r->acc) r->acc = x; break;
+      default: if (x < r->acc) r->acc = x; /* REDUCE_MIN */
+    }
+  }
+  r->index++;
+}
+
+static void arg_reduce_inner_element(char **ptrs, void *arg) {
+  reduction *r = arg;
+  double x = load_element(ptrs[0], r->type);
+  /* The first of equal extremes, like numpy */
+  if (r->index == 0 || (r->code == ARG_REDUCE_MAX ? x > r->acc : x < r->acc)) {
+    r->acc = x;
+    r->best_index = r->index;
+  }
+  r->index++;
+}
+
+/* x has the dimensions of the output followed by the reduced ones */
+static void reduce_element(char **ptrs, void *arg) {
+  element_args *a = arg;
+  const inference_step *step = a->step;
+  inference_tensor *out = step->tensors[0];
+  inference_tensor inner = *step->tensors[1];
+  int outer = out->ndim;
+  inner.data = ptrs[1];
+  inner.ndim -= outer;
+  memmove(inner.shape, inner.shape + outer, inner.ndim * sizeof(long long));
+  memmove(inner.strides, inner.strides + outer,
+          inner.ndim * sizeof(long long));
+  inference_tensor *tensors[] = {&inner};
+  reduction r = {step->code, inner.type, 0, 0, 0.0};
+  if (step->kind == STEP_REDUCE) {
+    for_each_element(1, tensors, inner.ndim, inner.shape, reduce_inner_element,
+                     &r);
+    store_element(ptrs[0], a->types[0], r.acc);
+  } else {
+    for_each_element(1, tensors, inner.ndim, inner.shape,
+                     arg_reduce_inner_element, &r);
+    store_element(ptrs[0], a->types[0], (double)r.best_index);
+  }
+}
+
+/* out (m, n) = x (m, k) . y (k, n) [+ bias, broadcast to (m, n)] */
+static void run_dot(const inference_step *step) {
+  const inference_tensor *out = step->tensors[0];
+  const inference_tensor *x = step->tensors[1];
+  const inference_tensor *y = step->tensors[2];
+  const inference_tensor *bias =
+      step->num_tensors > 3 ? step->tensors[3] : NULL;
+  long long m = out->shape[0], n = out->shape[1], k = x->shape[1];
+  for (long long i = 0; i < m; i++) {
+    for (long long j = 0; j < n; j++) {
+      double acc = bias ? load_element(bias->data + i * bias->strides[0] +
+                                           j * bias->strides[1],
+                                       bias->type)
+                        : 0.0;
+      for (long long l = 0; l < k; l++)
+        acc += load_element(x->data + i * x->strides[0] + l * x->strides[1],
+                            x->type) *
+               load_element(y->data + l * y->strides[0] + j * y->strides[1],
+                            y->type);
+      store_element(out->data + i * out->strides[0] + j * out->strides[1],
+                    out->type, acc);
+    }
+  }
+}
+
+static void run_kernel(inference_model *model, const inference_step *step) {
+  mkldnn_opkernel_t kernel = model->kernels[step->kernel];
+  int num_inputs = (int)step->ints[0];
+  for (int i = 0; i < step->num_tensors; i++) {
+    if (i < num_inputs)
+      set_input_tensor_data_handle(kernel, step->tensors[i]->data, i);
+    else
+      set_output_tensor_data_handle(kernel, step->tensors[i]->data,
+                                    i - num_inputs);
+  }
+  run_mkldnn_opkernel(kernel, 0);
+}
+
+static void run_step(inference_model *model, const inference_step *step) {
+  element_args args;
+  element_fn fn;
+  args.step = step;
+  for (int i = 0; i < step->num_tensors; i++)
+    args.types[i] = step->tensors[i]->type;
+  switch (step->kind) {
+    case STEP_KERNEL: run_kernel(model, step); return;
+    case STEP_DOT: run_dot(step); return;
+    case STEP_COPY: fn = copy_element; break;
+    case STEP_FILL: fn = fill_element; break;
+    case STEP_UNARY: fn = unary_element; break;
+    case STEP_BINARY: fn = binary_element; break;
+    case STEP_SCALED_SUM: fn = scaled_sum_element; break;
+    default: fn = reduce_element; /* STEP_REDUCE, STEP_ARG_REDUCE */
+  }
+  inference_tensor *out = step->tensors[0];
+  /* Reductions walk x over the dimensions of the output only */
+  int n = step->kind == STEP_REDUCE || step->kind == STEP_ARG_REDUCE
+              ? 2 : step->num_tensors;
+  for_each_element(n, step->tensors, out->ndim, out->shape, fn, &args);
+}
+
+/* Replaying the recorded kernel creation calls */
+
+static void delete_layout(void *md) { delete_mkldnn_layout(md); }
+
+static void delete_kernel(void *kernel) { delete_mkldnn_opkernel(kernel); }
+
+static void *call_create_empty_kernel(call_value *a) {
+  return create_empty_kernel((int)a[0].i);
+}
+
+static void *call_create_layout(call_value *a) {
+  return create_mkldnn_layout_descriptor(a[0].p, (int)a[1].i, a[2].p, a[3].p,
+                                         (mkldnn_data_type_t)a[4].i,
+                                         (mkldnn_memory_format_t)a[5].i);
+}
+
+static void *call_reorder_axes(call_value *a) {
+  return mkldnn_reorder_axes(a[0].p, a[1].p);
+}
+
+static void *call_flatten_axes(call_value *a) {
+  return mkldnn_flatten_axes(a[0].p, a[1].p);
+}
+
+static void *call_output_layout(call_value *a) {
+  return query_opkernel_layout(a[0].p, (int)a[1].i);
+}
+
+static void *call_add_kernel(call_value *a) {
+  create_mkldnn_add_kernel(a[0].p, (int)a[1].i, (int)a[2].i, (int)a[3].i,
+                           a[4].p, a[5].p, a[6].p, a[7].p, a[8].p, (int)a[9].i,
+                           (mkldnn_data_type_t)a[10].i, a[11].p);
+  return NULL;
+}
+
+static void *call_sum_kernel(call_value *a) {
+  create_mkldnn_sum_kernel(a[0].p, (int)a[1].i, a[2].p, (int)a[3].i, a[4].p,
+                           a[5].p, (int)a[6].i, (mkldnn_data_type_t)a[7].i,
+                           a[8].p);
+  return NULL;
+}
+
+static void *call_binary_eltwise_kernel(call_value *a) {
+  create_mkldnn_binary_eltwise_kernel(
+      a[0].p, (int)a[1].i, a[2].p, a[3].p, a[4].p, a[5].p, a[6].p, a[7].p,
+      a[8].p, (int)a[9].i, (mkldnn_data_type_t)a[10].i, a[11].p);
+  return NULL;
+}
+
+static void *call_batchnorm_fprop_kernel(call_value *a) {
+  create_mkldnn_batchnorm_fprop_primitives(
+      a[0].p, (int)a[1].i, (int)a[2].i, (int)a[3].i, (int)a[4].i, (int)a[5].i,
+      (int)a[6].i, (int)a[7].i, a[8].p, a[9].p, a[10].p, a[11].d, a[12].p,
+      a[13].p, (mkldnn_data_type_t)a[14].i, a[15].p);
+  return NULL;
+}
+
+static void *call_conv_fprop_kernel(call_value *a) {
+  create_mkldnn_conv_fprop_kernel(
+      a[0].p, (int)a[1].i, (int)a[2].i, (int)a[3].i, (int)a[4].i, a[5].p,
+      a[6].p, a[7].p, a[8].p, a[9].p, a[10].p, a[11].p, a[12].p, a[13].p,
+      (mkldnn_data_type_t)a[14].i, a[15].p);
+  return NULL;
+}
+
+static void *call_innerproduct_fprop_kernel(call_value *a) {
+  create_mkldnn_innerproduct_fprop_kernel(
+      a[0].p, (int)a[1].i, (int)a[2].i, (int)a[3].i, (int)a[4].i, a[5].p,
+      a[6].p, a[7].p, a[8].p, a[9].p, a[10].p, a[11].p,
+      (mkldnn_data_type_t)a[12].i, a[13].p);
+  return NULL;
+}
+
+static void *call_pool_fprop_kernel(call_value *a) {
+  create_mkldnn_pool_fprop_kernel(a[0].p, (int)a[1].i, (int)a[2].i, a[3].p,
+                                  a[4].p, a[5].p, a[6].p, a[7].p, (int)a[8].i,
+                                  a[9].p, (mkldnn_data_type_t)a[10].i,
+                                  a[11].p);
+  return NULL;
+}
+
+static void *call_relu_fprop_kernel(call_value *a) {
+  create_mkldnn_relu_fprop_kernel(a[0].p, (int)a[1].i, a[2].d, a[3].p,
+                                  (mkldnn_data_type_t)a[4].i, a[5].p);
+  return NULL;
+}
+
+static void *call_reorder_kernel(call_value *a) {
+  create_mkldnn_reorder_kernel(a[0].p, (int)a[1].i, a[2].p,
+                               (mkldnn_data_type_t)a[3].i, a[4].p, a[5].p,
+                               a[6].p);
+  return NULL;
+}
+
+typedef struct {
+  const char *name;
+  int num_args;
+  void *(*call)(call_value *args);
+  destroy_fn destroy;
+} replay_function;
+
+/* The engine functions of the MKL-DNN passes of inference computations, keep
+ * in sync with RUNTIME_FUNCTIONS in inference_export.py */
+static const replay_function replay_functions[] = {
+    {"create_empty_kernel", 1, call_create_empty_kernel, delete_kernel},
+    {"create_mkldnn_layout_descriptor", 6, call_create_layout, delete_layout},
+    {"mkldnn_reorder_axes", 2, call_reorder_axes, delete_layout},
+    {"mkldnn_flatten_axes", 2, call_flatten_axes, delete_layout},
+    {"query_opkernel_layout", 2, call_output_layout, NULL},
+    {"create_mkldnn_add_kernel", 12, call_add_kernel, NULL},
+    {"create_mkldnn_sum_kernel", 9, call_sum_kernel, NULL},
+    {"create_mkldnn_binary_eltwise_kernel", 12, call_binary_eltwise_kernel,
+     NULL},
+    {"create_mkldnn_batchnorm_fprop_primitives", 16,
+     call_batchnorm_fprop_kernel, NULL},
+    {"create_mkldnn_conv_fprop_kernel", 16, call_conv_fprop_kernel, NULL},
+    {"create_mkldnn_innerproduct_fprop_kernel", 14,
+     call_innerproduct_fprop_kernel, NULL},
+    {"create_mkldnn_pool_fprop_kernel", 12, call_pool_fprop_kernel, NULL},
+    {"create_mkldnn_relu_fprop_kernel", 6, call_relu_fprop_kernel, NULL},
+    {"create_mkldnn_reorder_kernel", 7, call_reorder_kernel, NULL},
+};
+
+#define MAX_CALL_ARGS 16
+
+static void *keep_array(inference_model *model, size_t bytes) {
+  void *array = malloc(bytes ? bytes : 1);
+  model->arrays[model->num_arrays++] = array;
+  return array;
+}
+
+static int read_call_arg(reader *r, inference_model *model, int call,
+                         call_value *value) {
+  uint32_t tag = read_u32(r);
+  uint32_t n;
+  switch (tag) {
+    case ARG_NULL: value->p = NULL; break;
+    case ARG_INT: value->i = read_i64(r); break;
+    case ARG_DOUBLE: value->d = read_f64(r); break;
+    case ARG_ENGINE: value->p = model->engine; break;
+    case ARG_HANDLE: {
+      int result = read_index(r, call, "call result");
+      if (r->failed) return 0;
+      value->p = model->results[result];
+      break;
+    }
+    case ARG_INT_ARRAY:
+    case ARG_FLOAT_ARRAY:
+    case ARG_HANDLE_ARRAY: {
+      n = read_u32(r);
+      size_t element = tag == ARG_HANDLE_ARRAY ? sizeof(void *) : 4;
+      if (r->failed || n > r->size / 4) {
+        set_error("bad call argument array");
+        r->failed = 1;
+        return 0;
+      }
+      char *array = keep_array(model, n * element);
+      for (uint32_t i = 0; i < n; i++) {
+        if (tag == ARG_HANDLE_ARRAY) {
+          int result = read_index(r, call, "call result");
+          if (r->failed) return 0;
+          ((void **)array)[i] = model->results[result];
+        } else {
+          const void *p = read_bytes(r, 4);
+          if (p) memcpy(array + i * element, p, 4);
+        }
+      }
+      value->p = array;
+      break;
+    }
+    case ARG_STRING: {
+      char *s = read_string(r);
+      if (s) model->arrays[model->num_arrays++] = s;
+      value->p = s;
+      break;
+    }
+    default:
+      set_error("unknown call argument kind %u", tag);
+      r->failed = 1;
+  }
+  return !r->failed;
+}
+
+static int replay_calls(reader *r, inference_model *model) {
+  uint32_t num_calls = read_u32(r);
+  if (r->failed) return 0;
+  model->results = calloc(num_calls ? num_calls : 1, sizeof(void *));
+  model->destructors = calloc(num_calls ? num_calls : 1, sizeof(destroy_fn));
+  /* At most one array per argument */
+  model->arrays = calloc((size_t)num_calls * MAX_CALL_ARGS + 1, sizeof(void *));
+  if (num_calls) model->engine = init_mkldnn_engine();
+  for (uint32_t c = 0; c < num_calls; c++) {
+    char *name = read_string(r);
+    uint32_t num_args = read_u32(r);
+    if (r->failed) {
+      free(name);
+      return 0;
+    }
+    const replay_function *fn = NULL;
+    for (size_t i = 0; i < sizeof(replay_functions) / sizeof(*replay_functions);
+         i++)
+      if (!strcmp(replay_functions[i].name, name)) fn = &replay_functions[i];
+    if (!fn || (int)num_args != fn->num_args) {
+      set_error("can not replay %s with %u arguments", name, num_args);
+      free(name);
+      return 0;
+    }
+    free(name);
+    call_value args[MAX_CALL_ARGS];
+    for (uint32_t i = 0; i < num_args; i++)
+      if (!read_call_arg(r, model, (int)c, &args[i])) return 0;
+    model->results[c] = fn->call(args);
+    model->destructors[c] = fn->destroy;
+    model->num_results = c + 1;
+  }
+  return 1;
+}
+
+/* Loading */
+
+static int read_buffers(reader *r, inference_model *model) {
+  uint32_t n = read_u32(r);
+  if (r->failed) return 0;
+  model->buffers = calloc(n ? n : 1, sizeof(void *));
+  model->buffer_sizes = calloc(n ? n : 1, sizeof(size_t));
+  for (uint32_t b = 0; b < n; b++) {
+    uint64_t nbytes = (uint64_t)read_i64(r);
+    uint32_t has_data = read_u32(r);
+    const void *data = has_data ? read_bytes(r, nbytes) : NULL;
+    if (r->failed) return 0;
+    if (nbytes > INT64_MAX / 2) {
+      set_error("buffer %u of %llu bytes is too large", b,
+                (unsigned long long)nbytes);
+      return 0;
+    }
+    /* Temporaries are accounted like the pools of the transformer */
+    model->buffers[b] = alloc_tracked_memory(
+        nbytes ? nbytes : 1, INFERENCE_ALIGNMENT,
+        has_data ? ENGINE_MEM_PERSISTENT : ENGINE_MEM_TEMPORARY);
+    model->buffer_sizes[b] = nbytes;
+    model->num_buffers = b + 1;
+    if (data)
+      memcpy(model->buffers[b], data, nbytes);
+    else
+      memset(model->buffers[b], 0, nbytes);
+  }
+  return 1;
+}
+
+/* Whether the elements of t at offset lie within a buffer of nbytes bytes,
+ * which is at most INT64_MAX / 2 */
+static int tensor_in_buffer(const inference_tensor *t, int64_t offset,
+                            size_t nbytes) {
+  if (offset < 0 || (uint64_t)offset > nbytes) return 0;
+  for (int d = 0; d < t->ndim; d++) {
+    if (t->shape[d] < 0) return 0;
+    if (t->shape[d] == 0) return 1;
+  }
+  /* The first byte the tensor reaches and the byte after the last one */
+  int64_t low = offset, high = offset + (int64_t)type_size(t->type);
+  for (int d = 0; d < t->ndim; d++) {
+    long long stride = t->strides[d];
+    if (t->shape[d] == 1 || !stride) continue;
+    if (stride == LLONG_MIN) return 0;
+    long long magnitude = stride < 0 ? -stride : stride;
+    if (t->shape[d] - 1 > (int64_t)nbytes / magnitude) return 0;
+    int64_t span = (t->shape[d] - 1) * stride;
+    if (span < 0)
+      low += span;
+    else
+      high += span;
+    if (low < 0 || high > (int64_t)nbytes) return 0;
+  }
+  return high <= (int64_t)nbytes;
+}
+
+static int read_tensors(reader *r, inference_model *model) {
+  uint32_t n = read_u32(r);
+  if (r->failed) return 0;
+  model->tensors = calloc(n ? n : 1, sizeof(inference_tensor));
+  model->num_tensors = n;
+  for (uint32_t i = 0; i < n; i++) {
+    inference_tensor *t = &model->tensors[i];
+    int buffer = read_index(r, model->num_buffers, "buffer");
+    int64_t offset = read_i64(r);
+    t->type = (int)read_u32(r);
+    t->ndim = (int)read_u32(r);
+    if (r->failed) return 0;
+    if (t->ndim > INFERENCE_MAX_DIMS || !type_size(t->type)) {
+      set_error("tensor %u has %d dimensions of type %d", i, t->ndim, t->type);
+      return 0;
+    }
+    for (int d = 0; d < t->ndim; d++) t->shape[d] = read_i64(r);
+    for (int d = 0; d < t->ndim; d++) t->strides[d] = read_i64(r);
+    if (r->failed) return 0;
+    if (!tensor_in_buffer(t, offset, model->buffer_sizes[buffer])) {
+      set_error("tensor %u runs past buffer %d", i, buffer);
+      return 0;
+    }
+    t->data = (char *)model->buffers[buffer] + offset;
+  }
+  return !r->failed;
+}
+
+static int read_kernels(reader *r, inference_model *model) {
+  uint32_t n = read_u32(r);
+  if (r->failed) return 0;
+  model->kernels = calloc(n ? n : 1, sizeof(mkldnn_opkernel_t));
+  model->num_kernels = n;
+  for (uint32_t k = 0; k < n; k++) {
+    free(read_string(r));
+    int call = read_index(r, model->num_results, "kernel call");
+    if (r->failed) return 0;
+    model->kernels[k] = model->results[call];
+  }
+  return !r->failed;
+}
+
+static int read_steps(reader *r, inference_model *model) {
+  uint32_t n = read_u32(r);
+  if (r->failed) return 0;
+  model->steps = calloc(n ? n : 1, sizeof(inference_step));
+  model->num_steps = n;
+  for (uint32_t s = 0; s < n; s++) {
+    inference_step *step = &model->steps[s];
+    step->kind = (int)read_u32(r);
+    step->kernel = (int)read_i64(r);
+    step->code = (int)read_u32(r);
+    step->scalar = read_f64(r);
+    step->num_tensors = (int)read_u32(r);
+    if (r->failed) return 0;
+    if (step->num_tensors < 1 || step->num_tensors > INFERENCE_MAX_OPERANDS) {
+      set_error("step %u has %d tensors", s, step->num_tensors);
+      return 0;
+    }
+    step->tensors = calloc(step->num_tensors, sizeof(inference_tensor *));
+    for (int i = 0; i < step->num_tensors; i++) {
+      int tensor = read_index(r, model->num_tensors, "tensor");
+      if (r->failed) return 0;
+      step->tensors[i] = &model->tensors[tensor];
+    }
+    step->num_ints = (int)read_u32(r);
+    if (r->failed || (uint32_t)step->num_ints > r->size / 8) return 0;
+    step->ints = calloc(step->num_ints + 1, sizeof(long long));
+    for (int i = 0; i < step->num_ints; i++) step->ints[i] = read_i64(r);
+    step->num_values = (int)read_u32(r);
+    if (r->failed || (uint32_t)step->num_values > r->size / 8) return 0;
+    step->values = calloc(step->num_values + 1, sizeof(double));
+    for (int i = 0; i < step->num_values; i++) step->values[i] = read_f64(r);
+    if (r->failed) return 0;
+    if (step->kind == STEP_KERNEL &&
+        (step->kernel < 0 || step->kernel >= model->num_kernels ||
+         step->num_ints < 1)) {
+      set_error("step %u runs a kernel that is not in the model", s);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int read_ports(reader *r, inference_model *model, int *count,
+                      inference_port **ports) {
+  uint32_t n = read_u32(r);
+  if (r->failed) return 0;
+  *ports = calloc(n ? n : 1, sizeof(inference_port));
+  *count = n;
+  for (uint32_t i = 0; i < n; i++) {
+    (*ports)[i].name = read_string(r);
+    int tensor = read_index(r, model->num_tensors, "tensor");
+    if (r->failed) return 0;
+    (*ports)[i].tensor = &model->tensors[tensor];
+  }
+  return !r->failed;
+}
+
+inference_model *load_inference_model(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    set_error("can not open %s", path);
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char *data = malloc(size > 0 ? size : 1);
+  size_t got = fread(data, 1, size, f);
+  fclose(f);
+
+  reader r = {data, got, 0, 0};
+  inference_model *model = calloc(1, sizeof(inference_model));
+  const char *magic = read_bytes(&r, strlen(INFERENCE_MAGIC));
+  uint32_t version = read_u32(&r);
+  int ok = !r.failed && !memcmp(magic, INFERENCE_MAGIC, strlen(INFERENCE_MAGIC));
+  if (!ok) {
+    set_error("%s is not an exported inference computation", path);
+  } else if (version != INFERENCE_VERSION) {
+    set_error("%s has version %u, expected %d", path, version,
+              INFERENCE_VERSION);
+    ok = 0;
+  }
+  ok = ok && read_buffers(&r, model) && read_tensors(&r, model) &&
+       replay_calls(&r, model) && read_kernels(&r, model) &&
+       read_steps(&r, model) &&
+       read_ports(&r, model, &model->num_inputs, &model->inputs) &&
+       read_ports(&r, model, &model->num_outputs, &model->outputs);
+  free(data);
+  if (!ok) {
+    free_inference_model(model);
+    return NULL;
+  }
+  return model;
+}
+
+void free_inference_model(inference_model *model) {
+  if (!model) return;
+  for (int i = 0; i < model->num_inputs; i++) free(model->inputs[i].name);
+  for (int i = 0; i < model->num_outputs; i++) free(model->outputs[i].name);
+  free(model->inputs);
+  free(model->outputs);
+  for (int s = 0; s < model->num_steps; s++) {
+    free(model->steps[s].tensors);
+    free(model->steps[s].ints);
+    free(model->steps[s].values);
+  }
+  free(model->steps);
+  free(model->kernels);
+  /* Kernels before the layouts they were created from */
+  for (int c = model->num_results - 1; c >= 0; c--)
+    if (model->destructors[c] && model->results[c])
+      model->destructors[c](model->results[c]);
+  for (int i = 0; i < model->num_arrays; i++) free(model->arrays[i]);
+  free(model->arrays);
+  free(model->results);
+  free(model->destructors);
+  if (model->engine) destroy_mkldnn_engine(model->engine);
+  free(model->tensors);
+  for (int b = 0; b < model->num_buffers; b++) free_memory(model->buffers[b]);
+  free(model->buffers);
+  free(model->buffer_sizes);
+  free(model);
+}
+
+/* API */
+
+int inference_model_num_inputs(const inference_model *model) {
+  return model->num_inputs;
+}
+
+int inference_model_num_outputs(const inference_model *model) {
+  return model->num_outputs;
+}
+
+static int port_index(const inference_port *ports, int count,
+                      const char *name) {
+  for (int i = 0; i < count; i++)
+    if (!strcmp(ports[i].name, name)) return i;
+  return -1;
+}
+
+int inference_input_index(const inference_model *model, const char *name) {
+  return port_index(model->inputs, model->num_inputs, name);
+}
+
+int inference_output_index(const inference_model *model, const char *name) {
+  return port_index(model->outputs, model->num_outputs, name);
+}
+
+static const inference_tensor *port_tensor(const inference_port *ports,
+                                           int count, int index) {
+  if (index < 0 || index >= count) {
+    set_error("no port %d", index);
+    return NULL;
+  }
+  return ports[index].tensor;
+}
+
+const char *inference_input_name(const inference_model *model, int index) {
+  if (!port_tensor(model->inputs, model->num_inputs, index)) return NULL;
+  return model->inputs[index].name;
+}
+
+const char *inference_output_name(const inference_model *model, int index) {
+  if (!port_tensor(model->outputs, model->num_outputs, index)) return NULL;
+  return model->outputs[index].name;
+}
+
+static int tensor_shape(const inference_tensor *t, long long *shape) {
+  if (!t) return -1;
+  if (shape) memcpy(shape, t->shape, t->ndim * sizeof(long long));
+  return t->ndim;
+}
+
+int inference_input_shape(const inference_model *model, int index,
+                          long long *shape) {
+  return tensor_shape(port_tensor(model->inputs, model->num_inputs, index),
+                      shape);
+}
+
+int inference_output_shape(const inference_model *model, int index,
+                           long long *shape) {
+  return tensor_shape(port_tensor(model->outputs, model->num_outputs, index),
+                      shape);
+}
+
+int inference_input_type(const inference_model *model, int index) {
+  const inference_tensor *t =
+      port_tensor(model->inputs, model->num_inputs, index);
+  return t ? t->type : -1;
+}
+
+int inference_output_type(const inference_model *model, int index) {
+  const inference_tensor *t =
+      port_tensor(model->outputs, model->num_outputs, index);
+  return t ? t->type : -1;
+}
+
+size_t inference_input_size(const inference_model *model, int index) {
+  const inference_tensor *t =
+      port_tensor(model->inputs, model->num_inputs, index);
+  return t ? tensor_size(t) : 0;
+}
+
+size_t inference_output_size(const inference_model *model, int index) {
+  const inference_tensor *t =
+      port_tensor(model->outputs, model->num_outputs, index);
+  return t ? tensor_size(t) : 0;
+}
+
+static int copy_dense(inference_tensor *t, void *data, size_t nbytes,
+                      int to_tensor) {
+  if (!t) return -1;
+  if (nbytes != tensor_size(t)) {
+    set_error("expected %zu bytes, got %zu", tensor_size(t), nbytes);
+    return -1;
+  }
+  dense_copy c = {data, type_size(t->type), to_tensor};
+  for_each_element(1, &t, t->ndim, t->shape, copy_dense_element, &c);
+  return 0;
+}
+
+int bind_inference_input(inference_model *model, int index, const void *data,
+                         size_t nbytes) {
+  return copy_dense(
+      (inference_tensor *)port_tensor(model->inputs, model->num_inputs, index),
+      (void *)data, nbytes, 1);
+}
+
+int run_inference_model(inference_model *model) {
+  for (int s = 0; s < model->num_steps; s++) run_step(model, &model->steps[s]);
+  return 0;
+}
+
+int fetch_inference_output(const inference_model *model, int index,
+                           void *data, size_t nbytes) {
+  return copy_dense(
+      (inference_tensor *)port_tensor(model->outputs, model->num_outputs, index),
+      data, nbytes, 0);
+}
@@ -0,0 +1,105 @@
+/*******************************************************************************
+* Copyright 2018 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+#ifndef INFERENCE_RUNTIME_H
+#define INFERENCE_RUNTIME_H
+
+/* Runs computations exported with CPUDeviceComputation.export_inference()
+ * without Python, see inference_runtime.c:
+ *
+ *   inference_model *model = load_inference_model("model.ngi");
+ *   if (!model) fprintf(stderr, "%s\n", inference_model_error());
+ *   bind_inference_input(model, 0, images, sizeof(images));
+ *   run_inference_model(model);
+ *   fetch_inference_output(model, 0, scores, sizeof(scores));
+ *   free_inference_model(model);
+ *
+ * Inputs and outputs are dense C order arrays of the shape and element type
+ * the query functions report. A model is not safe to use from several threads
+ * at once; load one model per thread instead. */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct inference_model inference_model;
+
+/* Element types of inputs and outputs */
+enum {
+  INFERENCE_FLOAT32 = 0,
+  INFERENCE_FLOAT64,
+  INFERENCE_INT32,
+  INFERENCE_INT64,
+  INFERENCE_UINT8
+};
+
+/* Returns NULL on failure, see inference_model_error() */
+inference_model *load_inference_model(const char *path);
+
+void free_inference_model(inference_model *model);
+
+/* Message of the last failed call of this thread */
+const char *inference_model_error(void);
+
+int inference_model_num_inputs(const inference_model *model);
+
+int inference_model_num_outputs(const inference_model *model);
+
+/* Index of the input or output named name, or -1 */
+int inference_input_index(const inference_model *model, const char *name);
+
+int inference_output_index(const inference_model *model, const char *name);
+
+const char *inference_input_name(const inference_model *model, int index);
+
+const char *inference_output_name(const inference_model *model, int index);
+
+/* Number of dimensions; the lengths are stored to shape if it is not NULL */
+int inference_input_shape(const inference_model *model, int index,
+                          long long *shape);
+
+int inference_output_shape(const inference_model *model, int index,
+                           long long *shape);
+
+int inference_input_type(const inference_model *model, int index);
+
+int inference_output_type(const inference_model *model, int index);
+
+/* Size in bytes of the dense array of an input or output */
+size_t inference_input_size(const inference_model *model, int index);
+
+size_t inference_output_size(const inference_model *model, int index);
+
+/* Copies the dense array data of nbytes bytes into input index. Returns 0, or
+ * -1 if index or nbytes are wrong. */
+int bind_inference_input(inference_model *model, int index, const void *data,
+                         size_t nbytes);
+
+/* Runs the computation once on the bound inputs. Returns 0. */
+int run_inference_model(inference_model *model);
+
+/* Copies output index of the last run to the dense array data of nbytes
+ * bytes. Returns 0, or -1 if index or nbytes are wrong. */
+int fetch_inference_output(const inference_model *model, int index, void *data,
+                           size_t nbytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
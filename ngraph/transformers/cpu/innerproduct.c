@@ -257,16 +257,14 @@ mkldnn_primitive_t mkldnn_memory_prim_bias;
     ip_srcs[0] = mkldnn_primitive_at(mkldnn_memory_prim_weights, 0);
     ip_srcs[1] = mkldnn_primitive_at(mkldnn_memory_prim_src, 0);
     ip_srcs[2] = mkldnn_primitive_at(mkldnn_memory_prim_bias, 0); 
-    MKL_CHECK(mkldnn_primitive_create(&opkernel->op_prim, opkernel->op_desc,
-                                      ip_srcs, ip_dsts));
+    create_opkernel_primitive(opkernel, ip_srcs, 3, ip_dsts, 1);
   }
   else
   {
     mkldnn_primitive_at_t ip_srcs[] = {
         mkldnn_primitive_at(mkldnn_memory_prim_weights, 0),
         mkldnn_primitive_at(mkldnn_memory_prim_src, 0)};
-    MKL_CHECK(mkldnn_primitive_create(&opkernel->op_prim, opkernel->op_desc,
-                                      ip_srcs, ip_dsts));
+    create_opkernel_primitive(opkernel, ip_srcs, 2, ip_dsts, 1);
   }
 
 
@@ -279,7 +277,7 @@ mkldnn_primitive_t mkldnn_memory_prim_bias;
     if (opkernel->reorder_i[2])
       opkernel->net[opkernel->net_size++] = opkernel->reorder_i[2]; 
   }
-  opkernel->net[opkernel->net_size++] = opkernel->op_prim;
+  opkernel->net[opkernel->net_size++] = NULL; /* op_prim */
   if (opkernel->reorder_o[0])
     opkernel->net[opkernel->net_size++] = opkernel->reorder_o[0];
 }
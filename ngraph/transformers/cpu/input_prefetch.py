@@ -0,0 +1,132 @@
+# ******************************************************************************
+# Copyright 2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+"""
+Prefetching of the batches InputOps read from a data loader.
+
+A background thread loads the next batches while the current step runs and
+copies them into sets of aligned buffers (slots), so that the step only waits
+when the loader falls behind. A slot is handed back to the thread at the next
+step boundary, once the computation has copied its inputs out of it.
+"""
+from __future__ import division
+
+import threading
+
+import numpy as np
+from monotonic import monotonic
+from six.moves import queue
+
+# Batches loaded ahead of the one in use
+DEFAULT_PREFETCH_DEPTH = 2
+
+_STOP = object()
+
+
+class InputPrefetcher(object):
+    """
+    Loads the batches of loader, dicts of label to array, depth batches ahead of
+    the one in use. With depth 0 batches are loaded synchronously by next_batch.
+
+    Arguments:
+        loader: Iterator of batches.
+        depth: Batches loaded ahead.
+        alloc: alloc(element_count, dtype=dtype) returns a flat buffer for a slot.
+        stats: Dict updated with the batches consumed ('batches'), the steps that
+            waited for their batch ('stalls') and the time they waited
+            ('stall_seconds').
+    """
+
+    def __init__(self, loader, depth=DEFAULT_PREFETCH_DEPTH, alloc=None, stats=None):
+        self.loader = loader
+        self.depth = depth
+        self.alloc = alloc or (lambda element_count, dtype: np.empty(element_count, dtype))
+        self.stats = stats if stats is not None else dict()
+        for key, value in (('batches', 0), ('stalls', 0), ('stall_seconds', 0.0)):
+            self.stats.setdefault(key, value)
+        self.current = None
+        self.error = None
+        self.stopping = False
+        self.thread = None
+        if depth > 0:
+            # Slots to fill; None until the thread allocates it for the first batch
+            self.free = queue.Queue()
+            self.ready = queue.Queue()
+            for _ in range(depth):
+                self.free.put(None)
+            self.thread = threading.Thread(target=self.fill)
+            self.thread.daemon = True
+            self.thread.start()
+
+    def copy_to_slot(self, batch, slot):
+        """
+        Copies batch into slot, (re)allocating the buffers that do not match it.
+        """
+        slot = dict() if slot is None else slot
+        for label, value in batch.items():
+            value = np.asarray(value)
+            buffer = slot.get(label)
+            if buffer is None or buffer.shape != value.shape or buffer.dtype != value.dtype:
+                buffer = self.alloc(value.size, dtype=value.dtype).reshape(value.shape)
+                slot[label] = buffer
+            np.copyto(buffer, value)
+        return slot
+
+    def fill(self):
+        while True:
+            slot = self.free.get()
+            if slot is _STOP or self.stopping:
+                return
+            try:
+                batch = next(self.loader)
+            except BaseException as e:
+                # Raised by next_batch, StopIteration included
+                self.ready.put(e)
+                return
+            self.ready.put(self.copy_to_slot(batch, slot))
+
+    def next_batch(self):
+        """
+        Returns the next batch, a dict of label to array valid until the next call.
+        """
+        if self.error is not None:
+            raise self.error
+        start = monotonic()
+        if self.thread is None:
+            self.current = self.copy_to_slot(next(self.loader), self.current)
+            stalled = True
+        else:
+            # Step boundary: the previous batch has been consumed, its slot can be refilled
+            self.free.put(self.current)
+            stalled = self.ready.empty()
+            item = self.ready.get()
+            if isinstance(item, BaseException):
+                # The thread has stopped; later calls raise the same
+                self.current = None
+                self.error = item
+                raise item
+            self.current = item
+        if stalled:
+            self.stats['stalls'] += 1
+            self.stats['stall_seconds'] += monotonic() - start
+        self.stats['batches'] += 1
+        return self.current
+
+    def close(self):
+        if self.thread is not None:
+            self.stopping = True
+            self.free.put(_STOP)
+            self.thread.join()
+            self.thread = None
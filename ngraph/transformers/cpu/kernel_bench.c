@@ -0,0 +1,868 @@
+/*******************************************************************************
+* Copyright 2017-2018 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+/* Standalone microbenchmark of the engine kernels.
+ *
+ * Built from the same sources as mkldnn_engine.so (make kernel_bench), it
+ * creates every create_mkldnn_* kernel for the layers of ResNet-50, VGG-16 and
+ * Inception-v3, with the inputs in native layouts (what the transformer hands
+ * a kernel that follows non-MKL ops) or in the layouts the kernel prefers
+ * (a kernel that follows other MKL ops), and reports per call time, GFLOP/s,
+ * the split between input/output reorders and compute and the memory used,
+ * as JSON. A JSON file written by an earlier run can be given as baseline;
+ * results slower than it by more than the threshold are flagged and make the
+ * exit status 1. */
+
+#include <math.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "mkldnn_engine.h"
+#include "mkldnn_util.h"
+
+typedef struct {
+  const char *net;
+  const char *name;
+  int c, h, w, k, r, s, stride, pad_h, pad_w;
+} conv_layer;
+
+typedef struct {
+  const char *net;
+  const char *name;
+  int c, h, w, r, s, stride, pad, pool_type;
+} pool_layer;
+
+typedef struct {
+  const char *net;
+  const char *name;
+  int c, k;
+} fc_layer;
+
+static const conv_layer conv_layers[] = {
+    {"resnet50", "conv1", 3, 224, 224, 64, 7, 7, 2, 3, 3},
+    {"resnet50", "res2a_branch1", 64, 56, 56, 256, 1, 1, 1, 0, 0},
+    {"resnet50", "res2a_branch2a", 64, 56, 56, 64, 1, 1, 1, 0, 0},
+    {"resnet50", "res2a_branch2b", 64, 56, 56, 64, 3, 3, 1, 1, 1},
+    {"resnet50", "res2b_branch2a", 256, 56, 56, 64, 1, 1, 1, 0, 0},
+    {"resnet50", "res3a_branch1", 256, 56, 56, 512, 1, 1, 2, 0, 0},
+    {"resnet50", "res3a_branch2a", 256, 56, 56, 128, 1, 1, 2, 0, 0},
+    {"resnet50", "res3a_branch2b", 128, 28, 28, 128, 3, 3, 1, 1, 1},
+    {"resnet50", "res3a_branch2c", 128, 28, 28, 512, 1, 1, 1, 0, 0},
+    {"resnet50", "res3b_branch2a", 512, 28, 28, 128, 1, 1, 1, 0, 0},
+    {"resnet50", "res4a_branch1", 512, 28, 28, 1024, 1, 1, 2, 0, 0},
+    {"resnet50", "res4a_branch2a", 512, 28, 28, 256, 1, 1, 2, 0, 0},
+    {"resnet50", "res4a_branch2b", 256, 14, 14, 256, 3, 3, 1, 1, 1},
+    {"resnet50", "res4a_branch2c", 256, 14, 14, 1024, 1, 1, 1, 0, 0},
+    {"resnet50", "res4b_branch2a", 1024, 14, 14, 256, 1, 1, 1, 0, 0},
+    {"resnet50", "res5a_branch1", 1024, 14, 14, 2048, 1, 1, 2, 0, 0},
+    {"resnet50", "res5a_branch2a", 1024, 14, 14, 512, 1, 1, 2, 0, 0},
+    {"resnet50", "res5a_branch2b", 512, 7, 7, 512, 3, 3, 1, 1, 1},
+    {"resnet50", "res5a_branch2c", 512, 7, 7, 2048, 1, 1, 1, 0, 0},
+    {"resnet50", "res5b_branch2a", 2048, 7, 7, 512, 1, 1, 1, 0, 0},
+    {"vgg16", "conv1_1", 3, 224, 224, 64, 3, 3, 1, 1, 1},
+    {"vgg16", "conv1_2", 64, 224, 224, 64, 3, 3, 1, 1, 1},
+    {"vgg16", "conv2_1", 64, 112, 112, 128, 3, 3, 1, 1, 1},
+    {"vgg16", "conv2_2", 128, 112, 112, 128, 3, 3, 1, 1, 1},
+    {"vgg16", "conv3_1", 128, 56, 56, 256, 3, 3, 1, 1, 1},
+    {"vgg16", "conv3_2", 256, 56, 56, 256, 3, 3, 1, 1, 1},
+    {"vgg16", "conv4_1", 256, 28, 28, 512, 3, 3, 1, 1, 1},
+    {"vgg16", "conv4_2", 512, 28, 28, 512, 3, 3, 1, 1, 1},
+    {"vgg16", "conv5_1", 512, 14, 14, 512, 3, 3, 1, 1, 1},
+    {"inception_v3", "conv2d_1a_3x3", 3, 299, 299, 32, 3, 3, 2, 0, 0},
+    {"inception_v3", "conv2d_2a_3x3", 32, 149, 149, 32, 3, 3, 1, 0, 0},
+    {"inception_v3", "conv2d_2b_3x3", 32, 147, 147, 64, 3, 3, 1, 1, 1},
+    {"inception_v3", "conv2d_3b_1x1", 64, 73, 73, 80, 1, 1, 1, 0, 0},
+    {"inception_v3", "conv2d_4a_3x3", 80, 73, 73, 192, 3, 3, 1, 0, 0},
+    {"inception_v3", "mixed_5b_1x1", 192, 35, 35, 64, 1, 1, 1, 0, 0},
+    {"inception_v3", "mixed_5b_5x5", 48, 35, 35, 64, 5, 5, 1, 2, 2},
+    {"inception_v3", "mixed_5b_3x3", 64, 35, 35, 96, 3, 3, 1, 1, 1},
+    {"inception_v3", "mixed_6a_3x3", 288, 35, 35, 384, 3, 3, 2, 0, 0},
+    {"inception_v3", "mixed_6b_1x1", 768, 17, 17, 192, 1, 1, 1, 0, 0},
+    {"inception_v3", "mixed_6b_1x7", 128, 17, 17, 128, 1, 7, 1, 0, 3},
+    {"inception_v3", "mixed_6b_7x1", 128, 17, 17, 192, 7, 1, 1, 3, 0},
+    {"inception_v3", "mixed_7a_3x3", 192, 17, 17, 320, 3, 3, 2, 0, 0},
+    {"inception_v3", "mixed_7b_1x1", 1280, 8, 8, 320, 1, 1, 1, 0, 0},
+    {"inception_v3", "mixed_7b_1x3", 384, 8, 8, 384, 1, 3, 1, 0, 1},
+    {"inception_v3", "mixed_7b_3x3", 448, 8, 8, 384, 3, 3, 1, 1, 1},
+};
+
+static const pool_layer pool_layers[] = {
+    {"resnet50", "pool1", 64, 112, 112, 3, 3, 2, 1, 0},
+    {"resnet50", "pool5", 2048, 7, 7, 7, 7, 1, 0, 1},
+    {"vgg16", "pool1", 64, 224, 224, 2, 2, 2, 0, 0},
+    {"vgg16", "pool3", 256, 56, 56, 2, 2, 2, 0, 0},
+    {"vgg16", "pool5", 512, 14, 14, 2, 2, 2, 0, 0},
+    {"inception_v3", "maxpool_3a_3x3", 64, 147, 147, 3, 3, 2, 0, 0},
+    {"inception_v3", "mixed_5b_pool", 192, 35, 35, 3, 3, 1, 1, 1},
+    {"inception_v3", "avgpool_8x8", 2048, 8, 8, 8, 8, 1, 0, 1},
+};
+
+static const fc_layer fc_layers[] = {
+    {"resnet50", "fc1000", 2048, 1000},
+    {"vgg16", "fc6", 25088, 4096},
+    {"vgg16", "fc7", 4096, 4096},
+    {"vgg16", "fc8", 4096, 1000},
+    {"inception_v3", "logits", 2048, 1000},
+};
+
+#define NUM_ELEMS(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+/* Layer table a kernel is swept over; TABLE_ACT is the set of distinct
+ * convolution output shapes */
+enum { TABLE_CONV, TABLE_POOL, TABLE_FC, TABLE_ACT };
+
+enum {
+  K_CONV_FPROP,
+  K_CONV_BPROP_DATA,
+  K_CONV_BPROP_WEIGHTS,
+  K_INNERPRODUCT_FPROP,
+  K_POOL_FPROP,
+  K_POOL_BPROP,
+  K_RELU_FPROP,
+  K_RELU_BPROP,
+  K_BATCHNORM_FPROP,
+  K_BATCHNORM_BPROP,
+  K_ADD,
+  K_SUM,
+  K_BINARY_ELTWISE,
+  K_REORDER,
+  NUM_KERNELS
+};
+
+typedef struct {
+  const char *name;
+  int table;
+  /* Bit i set: input i is an activation, given an MKL layout in mkl mode */
+  unsigned act_inputs;
+  /* Bit i set: the kernel needs a descriptor for input i in native mode */
+  unsigned md_inputs;
+} kernel_info;
+
+static const kernel_info kernels[NUM_KERNELS] = {
+    {"conv_fprop", TABLE_CONV, 0x1, 0x0},
+    {"conv_bprop_data", TABLE_CONV, 0x1, 0x0},
+    {"conv_bprop_weights", TABLE_CONV, 0x3, 0x0},
+    {"innerproduct_fprop", TABLE_FC, 0x0, 0x0},
+    {"pool_fprop", TABLE_POOL, 0x1, 0x0},
+    {"pool_bprop", TABLE_POOL, 0x1, 0x0},
+    {"relu_fprop", TABLE_ACT, 0x1, 0x0},
+    {"relu_bprop", TABLE_ACT, 0x3, 0x0},
+    {"batchnorm_fprop", TABLE_ACT, 0x1, 0x1},
+    {"batchnorm_bprop", TABLE_ACT, 0x9, 0x9},
+    {"add", TABLE_ACT, 0x3, 0x3},
+    {"sum", TABLE_ACT, 0x7, 0x7},
+    {"binary_eltwise", TABLE_ACT, 0x1, 0x1},
+    {"reorder", TABLE_ACT, 0x1, 0x1},
+};
+
+enum { LAYOUT_NATIVE, LAYOUT_MKL, NUM_LAYOUTS };
+
+static const char *layout_names[NUM_LAYOUTS] = {"native", "mkl"};
+
+typedef struct {
+  int kernel;
+  int layout;
+  const char *net;
+  const char *layer;
+  int n, c, h, w, k, r, s, stride, pad_h, pad_w, p, q, pool_type;
+} bench_case;
+
+typedef struct {
+  double time_ms, min_ms, stddev_ms;
+  double compute_ms, reorder_ms;
+  int num_reorders;
+  double flops, io_bytes, internal_bytes;
+  char *impl;
+} bench_result;
+
+typedef struct {
+  int num;
+  char **ids;
+  double *times;
+} bench_baseline;
+
+typedef struct {
+  mkldnn_engine_t engine;
+  int warmup;
+  int iters;
+  int breakdown;
+} bench_ctx;
+
+static double now_ms(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e3 + t.tv_nsec * 1e-6;
+}
+
+/* Whether name is in the comma separated list; a NULL list has everything */
+static int list_contains(const char *list, const char *name) {
+  if (!list) return 1;
+  size_t len = strlen(name);
+  const char *p = list;
+  while (*p) {
+    const char *end = strchr(p, ',');
+    size_t item_len = end ? (size_t)(end - p) : strlen(p);
+    if (item_len == len && strncmp(p, name, len) == 0) return 1;
+    if (!end) break;
+    p = end + 1;
+  }
+  return 0;
+}
+
+static int out_size(int in, int window, int stride, int pad) {
+  return (in + 2 * pad - window) / stride + 1;
+}
+
+/* Appends the cases of one kernel and layout for the layers of the selected
+ * nets; returns the new number of cases */
+static int add_cases(bench_case *cases, int num_cases, int kernel, int layout,
+                     int batch, const char *nets) {
+  bench_case bc;
+  memset(&bc, 0, sizeof(bc));
+  bc.kernel = kernel;
+  bc.layout = layout;
+  bc.n = batch;
+  switch (kernels[kernel].table) {
+    case TABLE_CONV:
+      for (int i = 0; i < NUM_ELEMS(conv_layers); i++) {
+        const conv_layer *l = &conv_layers[i];
+        if (!list_contains(nets, l->net)) continue;
+        bc.net = l->net;
+        bc.layer = l->name;
+        bc.c = l->c, bc.h = l->h, bc.w = l->w, bc.k = l->k;
+        bc.r = l->r, bc.s = l->s, bc.stride = l->stride;
+        bc.pad_h = l->pad_h, bc.pad_w = l->pad_w;
+        bc.p = out_size(l->h, l->r, l->stride, l->pad_h);
+        bc.q = out_size(l->w, l->s, l->stride, l->pad_w);
+        cases[num_cases++] = bc;
+      }
+      break;
+    case TABLE_POOL:
+      for (int i = 0; i < NUM_ELEMS(pool_layers); i++) {
+        const pool_layer *l = &pool_layers[i];
+        if (!list_contains(nets, l->net)) continue;
+        bc.net = l->net;
+        bc.layer = l->name;
+        bc.c = l->c, bc.h = l->h, bc.w = l->w, bc.k = l->c;
+        bc.r = l->r, bc.s = l->s, bc.stride = l->stride;
+        bc.pad_h = l->pad, bc.pad_w = l->pad;
+        bc.p = out_size(l->h, l->r, l->stride, l->pad);
+        bc.q = out_size(l->w, l->s, l->stride, l->pad);
+        bc.pool_type = l->pool_type;
+        cases[num_cases++] = bc;
+      }
+      break;
+    case TABLE_FC:
+      for (int i = 0; i < NUM_ELEMS(fc_layers); i++) {
+        const fc_layer *l = &fc_layers[i];
+        if (!list_contains(nets, l->net)) continue;
+        bc.net = l->net;
+        bc.layer = l->name;
+        bc.c = l->c, bc.k = l->k;
+        bc.h = bc.w = bc.r = bc.s = bc.stride = bc.p = bc.q = 1;
+        cases[num_cases++] = bc;
+      }
+      break;
+    case TABLE_ACT:
+      for (int i = 0; i < NUM_ELEMS(conv_layers); i++) {
+        const conv_layer *l = &conv_layers[i];
+        if (!list_contains(nets, l->net)) continue;
+        int p = out_size(l->h, l->r, l->stride, l->pad_h);
+        int q = out_size(l->w, l->s, l->stride, l->pad_w);
+        int seen = 0;
+        for (int j = 0; j < i && !seen; j++) {
+          const conv_layer *o = &conv_layers[j];
+          seen = strcmp(o->net, l->net) == 0 && o->k == l->k &&
+                 out_size(o->h, o->r, o->stride, o->pad_h) == p &&
+                 out_size(o->w, o->s, o->stride, o->pad_w) == q;
+        }
+        if (seen) continue;
+        bc.net = l->net;
+        bc.layer = l->name;
+        bc.c = bc.k = l->k, bc.h = bc.p = p, bc.w = bc.q = q;
+        bc.r = bc.s = bc.stride = 1;
+        cases[num_cases++] = bc;
+      }
+      break;
+  }
+  return num_cases;
+}
+
+/* Sizes of activation input index of the kernel in MKL (NCHW) order */
+static void act_input_sizes(const bench_case *bc, int index, int *sizes) {
+  int src[] = {bc->n, bc->c, bc->h, bc->w};
+  int dst[] = {bc->n, bc->k, bc->p, bc->q};
+  int from_dst = (bc->kernel == K_CONV_BPROP_DATA && index == 0) ||
+                 (bc->kernel == K_CONV_BPROP_WEIGHTS && index == 0) ||
+                 (bc->kernel == K_POOL_BPROP && index == 0);
+  memcpy(sizes, from_dst ? dst : src, sizeof(src));
+}
+
+static void init_act_md(mkldnn_memory_desc_t *md, int *sizes, int layout) {
+  mkldnn_memory_format_t fmt = mkldnn_chwn;
+  if (layout == LAYOUT_MKL)
+    fmt = sizes[1] % 16 == 0 ? mkldnn_nChw16c
+                             : sizes[1] % 8 == 0 ? mkldnn_nChw8c : mkldnn_nchw;
+  MKL_CHECK(mkldnn_memory_desc_init(md, 4, sizes, mkldnn_f32, fmt));
+}
+
+/* Creates the kernel of a case with md[i] describing input i (NULL for the
+ * default native layout). Backward kernels get their forward kernel created
+ * into *fprop. */
+static mkldnn_opkernel_t create_case_kernel(const bench_ctx *ctx,
+                                            const bench_case *bc,
+                                            mkldnn_memory_desc_t **md,
+                                            mkldnn_opkernel_t *fprop) {
+  mkldnn_engine_t engine = ctx->engine;
+  mkldnn_opkernel_t kernel = create_empty_kernel(0);
+  int src[] = {bc->n, bc->c, bc->h, bc->w};
+  int dst[] = {bc->n, bc->k, bc->p, bc->q};
+  int weights[] = {bc->k, bc->c, bc->r, bc->s};
+  int bias[] = {bc->k};
+  int window[] = {bc->r, bc->s};
+  int strides[] = {bc->stride, bc->stride};
+  int padding[] = {bc->pad_h, bc->pad_w};
+  int dilates[] = {0, 0};
+  int elems = bc->n * bc->c * bc->h * bc->w;
+
+  *fprop = NULL;
+  switch (bc->kernel) {
+    case K_CONV_FPROP:
+      create_mkldnn_conv_fprop_kernel(engine, 4, 4, 1, 4, src, weights, bias,
+                                      dst, strides, padding, dilates, md[0],
+                                      md[1], mkldnn_f32, kernel);
+      break;
+    case K_CONV_BPROP_DATA:
+      create_mkldnn_conv_bprop_data_kernel(engine, 4, 4, 4, dst, weights, src,
+                                           strides, padding, dilates, md[0],
+                                           md[1], mkldnn_f32, kernel);
+      break;
+    case K_CONV_BPROP_WEIGHTS:
+      create_mkldnn_conv_bprop_weights_kernel(
+          engine, 4, 4, 1, 4, dst, weights, bias, src, strides, padding,
+          dilates, md[0], NULL, md[1], mkldnn_f32, kernel);
+      break;
+    case K_INNERPRODUCT_FPROP: {
+      int fc_src[] = {bc->n, bc->c};
+      int fc_weights[] = {bc->k, bc->c};
+      int fc_dst[] = {bc->n, bc->k};
+      create_mkldnn_innerproduct_fprop_kernel(
+          engine, 2, 2, 1, 2, fc_src, fc_weights, bias, fc_dst, md[0], md[1],
+          NULL, mkldnn_f32, kernel);
+      break;
+    }
+    case K_POOL_FPROP:
+      create_mkldnn_pool_fprop_kernel(engine, 4, 4, src, window, dst, strides,
+                                      padding, bc->pool_type, md[0],
+                                      mkldnn_f32, kernel);
+      break;
+    case K_POOL_BPROP: {
+      mkldnn_memory_desc_t fprop_md;
+      mkldnn_memory_desc_t *fprop_src_md = NULL;
+      if (bc->layout == LAYOUT_MKL) {
+        init_act_md(&fprop_md, src, LAYOUT_MKL);
+        fprop_src_md = &fprop_md;
+      }
+      *fprop = create_empty_kernel(0);
+      create_mkldnn_pool_fprop_kernel(engine, 4, 4, src, window, dst, strides,
+                                      padding, bc->pool_type, fprop_src_md,
+                                      mkldnn_f32, *fprop);
+      create_mkldnn_pool_bprop_kernel(engine, 4, 4, dst, window, src, strides,
+                                      padding, bc->pool_type, md[0],
+                                      mkldnn_f32, *fprop, kernel);
+      break;
+    }
+    case K_RELU_FPROP:
+      create_mkldnn_relu_fprop_kernel(engine, elems, 0.0, md[0], mkldnn_f32,
+                                      kernel);
+      break;
+    case K_RELU_BPROP:
+      create_mkldnn_relu_bprop_kernel(engine, elems, 0.0, md[0], md[1],
+                                      mkldnn_f32, kernel);
+      break;
+    case K_BATCHNORM_FPROP: {
+      int bn_weights[] = {2, bc->c};
+      create_mkldnn_batchnorm_fprop_primitives(
+          engine, 4, 4, 2, 1, 1, bc->c, bc->c, src, bn_weights, src, 1e-5,
+          md[0], NULL, mkldnn_f32, kernel);
+      break;
+    }
+    case K_BATCHNORM_BPROP: {
+      int bn_weights[] = {2, bc->c};
+      *fprop = create_empty_kernel(0);
+      create_mkldnn_batchnorm_fprop_primitives(
+          engine, 4, 4, 2, 1, 1, bc->c, bc->c, src, bn_weights, src, 1e-5,
+          md[0], NULL, mkldnn_f32, *fprop);
+      create_mkldnn_batchnorm_bprop_primitives(
+          engine, 4, 4, 2, 1, 1, src, src, bn_weights, bc->c, bc->c, 1e-5,
+          md[0], NULL, NULL, NULL, md[3], mkldnn_f32, *fprop, kernel);
+      break;
+    }
+    case K_ADD:
+      create_mkldnn_add_kernel(engine, 4, 4, 4, src, src, src, md[0], md[1], 2,
+                               mkldnn_f32, kernel);
+      break;
+    case K_SUM: {
+      float scales[] = {1.0f, -0.5f, 0.25f};
+      create_mkldnn_sum_kernel(engine, 4, src, 3, md, scales, 0, mkldnn_f32,
+                               kernel);
+      break;
+    }
+    case K_BINARY_ELTWISE: {
+      /* Multiply by a per-channel tensor, e.g. a scale */
+      int channel[] = {1, bc->c, 1, 1};
+      int src_strides[] = {bc->c * bc->h * bc->w, bc->h * bc->w, bc->w, 1};
+      int channel_strides[] = {bc->c, 1, 1, 1};
+      if (!create_mkldnn_binary_eltwise_kernel(
+              engine, 4, src, src, src_strides, md[0], channel,
+              channel_strides, NULL, 2, mkldnn_f32, kernel)) {
+        free(kernel);
+        return NULL;
+      }
+      break;
+    }
+    case K_REORDER: {
+      /* Native inputs enter the MKL layout, MKL inputs return to native */
+      mkldnn_memory_desc_t out_md;
+      init_act_md(&out_md, src,
+                  bc->layout == LAYOUT_MKL ? LAYOUT_NATIVE : LAYOUT_MKL);
+      create_mkldnn_reorder_kernel(engine, 4, src, mkldnn_f32, md[0], &out_md,
+                                   kernel);
+      break;
+    }
+  }
+  return kernel;
+}
+
+static void delete_kernel(mkldnn_opkernel_t kernel) {
+  if (!kernel) return;
+  delete_mkldnn_opkernel(kernel);
+  free(kernel);
+}
+
+/* Creates the kernel of a case in its layout mode. In mkl mode activations
+ * get blocked layouts and every other input that the kernel would reorder is
+ * given the layout the kernel converts it to, so that no input reorders are
+ * left (outputs keep the layout the primitive picks). */
+static mkldnn_opkernel_t build_case(const bench_ctx *ctx, const bench_case *bc,
+                                    mkldnn_opkernel_t *fprop) {
+  mkldnn_memory_desc_t mds[MKLDNN_MAX_ARGS];
+  mkldnn_memory_desc_t *md[MKLDNN_MAX_ARGS];
+  const kernel_info *info = &kernels[bc->kernel];
+
+  for (int i = 0; i < MKLDNN_MAX_ARGS; i++) {
+    md[i] = NULL;
+    unsigned bit = 1u << i;
+    int needs_md = (info->md_inputs & bit) ||
+                   (bc->layout == LAYOUT_MKL && (info->act_inputs & bit));
+    if (!needs_md) continue;
+    int sizes[4];
+    act_input_sizes(bc, i, sizes);
+    init_act_md(&mds[i], sizes, bc->layout);
+    md[i] = &mds[i];
+  }
+
+  mkldnn_opkernel_t kernel = create_case_kernel(ctx, bc, md, fprop);
+  if (!kernel || bc->layout != LAYOUT_MKL || kernel->run_custom)
+    return kernel;
+
+  wait_kernel_build(kernel);
+  int rebuild = 0;
+  for (int i = 0; i < kernel->num_inputs; i++) {
+    if (!kernel->reorder_i[i]) continue;
+    mds[i] =
+        *mkldnn_primitive_desc_query_memory_d(kernel->internal_inputs[i].desc);
+    md[i] = &mds[i];
+    rebuild = 1;
+  }
+  if (!rebuild) return kernel;
+  delete_kernel(kernel);
+  delete_kernel(*fprop);
+  return create_case_kernel(ctx, bc, md, fprop);
+}
+
+static size_t tensor_bytes(const mkldnn_tensor *tensor) {
+  return mkldnn_memory_primitive_desc_get_size(tensor->desc);
+}
+
+static void *alloc_tensor_buffer(const mkldnn_tensor *tensor, int fill,
+                                 float value) {
+  size_t size = tensor_bytes(tensor);
+  void *buf;
+  alloc_aligned_memory(&buf, (size + 3) / 4, mkldnn_f32, 64);
+  memset(buf, 0, size);
+  const mkldnn_memory_desc_t *md =
+      mkldnn_primitive_desc_query_memory_d(tensor->desc);
+  if (fill && md->data_type == mkldnn_f32) {
+    float *data = (float *)buf;
+    for (size_t i = 0; i < size / 4; i++)
+      data[i] = value != 0.0f ? value
+                              : (float)((int)(i * 7919 % 2001) - 1000) * 1e-3f;
+  }
+  return buf;
+}
+
+/* Nominal floating point operations of one call of the kernel */
+static double case_flops(const bench_case *bc) {
+  double n = bc->n;
+  double elems = n * bc->c * bc->h * bc->w;
+  switch (bc->kernel) {
+    case K_CONV_FPROP:
+    case K_CONV_BPROP_DATA:
+    case K_CONV_BPROP_WEIGHTS:
+      return 2.0 * n * bc->k * bc->c * bc->r * bc->s * bc->p * bc->q;
+    case K_INNERPRODUCT_FPROP:
+      return 2.0 * n * bc->c * bc->k;
+    case K_POOL_FPROP:
+    case K_POOL_BPROP:
+      return n * bc->c * bc->p * bc->q * bc->r * bc->s;
+    case K_RELU_FPROP:
+    case K_RELU_BPROP:
+    case K_ADD:
+    case K_BINARY_ELTWISE:
+      return elems;
+    case K_BATCHNORM_FPROP:
+      /* mean, variance, then scale and shift */
+      return 5.0 * elems;
+    case K_BATCHNORM_BPROP:
+      return 8.0 * elems;
+    case K_SUM:
+      return 5.0 * elems;
+    default:
+      return 0.0;
+  }
+}
+
+/* Time of one primitive of the kernel net run on its own stream */
+static double time_primitive(mkldnn_primitive_t prim, int warmup, int iters) {
+  mkldnn_stream_t stream;
+  mkldnn_primitive_t error_primitive;
+  MKL_CHECK(mkldnn_stream_create(&stream, mkldnn_eager));
+  MKL_CHECK(mkldnn_stream_submit(stream, 1, &prim, &error_primitive));
+  MKL_CHECK(mkldnn_stream_wait(stream, 1, NULL));
+  for (int i = 1; i < warmup; i++) {
+    MKL_CHECK(mkldnn_stream_rerun(stream, &error_primitive));
+    MKL_CHECK(mkldnn_stream_wait(stream, 1, NULL));
+  }
+  double start = now_ms();
+  for (int i = 0; i < iters; i++) {
+    MKL_CHECK(mkldnn_stream_rerun(stream, &error_primitive));
+    MKL_CHECK(mkldnn_stream_wait(stream, 1, NULL));
+  }
+  double elapsed = (now_ms() - start) / iters;
+  MKL_CHECK(mkldnn_stream_destroy(stream));
+  return elapsed;
+}
+
+/* Creates, runs and deletes the kernel of one case; returns 0 if the engine
+ * does not implement the case */
+static int run_case(const bench_ctx *ctx, const bench_case *bc,
+                    bench_result *res) {
+  mkldnn_opkernel_t fprop;
+  mkldnn_opkernel_t kernel = build_case(ctx, bc, &fprop);
+  if (!kernel) return 0;
+  wait_kernel_build(kernel);
+
+  void *inputs[MKLDNN_MAX_ARGS];
+  void *outputs[MKLDNN_MAX_ARGS];
+  memset(res, 0, sizeof(*res));
+  for (int i = 0; i < kernel->num_inputs; i++) {
+    /* batchnorm bprop variance must be positive */
+    float value = bc->kernel == K_BATCHNORM_BPROP && i == 2 ? 1.0f : 0.0f;
+    inputs[i] = alloc_tensor_buffer(&kernel->inputs[i], 1, value);
+    set_input_tensor_data_handle(kernel, inputs[i], i);
+    res->io_bytes += tensor_bytes(&kernel->inputs[i]);
+    if (kernel->reorder_i[i]) {
+      res->internal_bytes += tensor_bytes(&kernel->internal_inputs[i]);
+      res->num_reorders++;
+    }
+  }
+  for (int i = 0; i < kernel->num_outputs; i++) {
+    outputs[i] = alloc_tensor_buffer(&kernel->outputs[i], 0, 0.0f);
+    set_output_tensor_data_handle(kernel, outputs[i], i);
+    res->io_bytes += tensor_bytes(&kernel->outputs[i]);
+    if (kernel->reorder_o[i]) {
+      res->internal_bytes += tensor_bytes(&kernel->internal_outputs[i]);
+      res->num_reorders++;
+    }
+  }
+
+  for (int i = 0; i < ctx->warmup; i++) run_mkldnn_opkernel(kernel, 0);
+  double sum = 0.0, sum_sq = 0.0, min = INFINITY;
+  for (int i = 0; i < ctx->iters; i++) {
+    double start = now_ms();
+    run_mkldnn_opkernel(kernel, 0);
+    double t = now_ms() - start;
+    sum += t;
+    sum_sq += t * t;
+    if (t < min) min = t;
+  }
+  res->time_ms = sum / ctx->iters;
+  res->min_ms = min;
+  res->stddev_ms =
+      sqrt(fmax(sum_sq / ctx->iters - res->time_ms * res->time_ms, 0.0));
+
+  if (bc->kernel == K_REORDER) {
+    res->reorder_ms = res->time_ms;
+    res->num_reorders = 1;
+  } else if (kernel->run_custom || !ctx->breakdown) {
+    res->compute_ms = res->time_ms;
+  } else {
+    for (int i = 0; i < kernel->net_size; i++) {
+      double t = time_primitive(kernel->net[i], ctx->warmup, ctx->iters);
+      if (kernel->net[i] == kernel->op_prim)
+        res->compute_ms += t;
+      else
+        res->reorder_ms += t;
+    }
+  }
+  res->flops = case_flops(bc);
+  /* The impl string belongs to the primitive desc deleted below */
+  const char *impl = query_opkernel_impl_info(kernel);
+  res->impl = strdup(impl ? impl : "");
+
+  int num_inputs = kernel->num_inputs;
+  int num_outputs = kernel->num_outputs;
+  delete_kernel(kernel);
+  delete_kernel(fprop);
+  for (int i = 0; i < num_inputs; i++) free_memory(inputs[i]);
+  for (int i = 0; i < num_outputs; i++) free_memory(outputs[i]);
+  return 1;
+}
+
+/* Reads the "id" and "time_ms" of every result line of a file written by an
+ * earlier run */
+static void load_baseline(const char *path, bench_baseline *baseline) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "cannot open baseline %s\n", path);
+    exit(2);
+  }
+  int capacity = 0;
+  char line[4096];
+  while (fgets(line, sizeof(line), f)) {
+    char *id = strstr(line, "\"id\": \"");
+    char *time = strstr(line, "\"time_ms\": ");
+    if (!id || !time) continue;
+    id += strlen("\"id\": \"");
+    char *end = strchr(id, '"');
+    if (!end) continue;
+    if (baseline->num == capacity) {
+      capacity = capacity ? 2 * capacity : 256;
+      baseline->ids =
+          (char **)realloc(baseline->ids, capacity * sizeof(char *));
+      baseline->times =
+          (double *)realloc(baseline->times, capacity * sizeof(double));
+    }
+    baseline->ids[baseline->num] = strndup(id, end - id);
+    baseline->times[baseline->num] =
+        strtod(time + strlen("\"time_ms\": "), NULL);
+    baseline->num++;
+  }
+  fclose(f);
+}
+
+static double baseline_time(const bench_baseline *baseline, const char *id) {
+  for (int i = 0; i < baseline->num; i++) {
+    if (strcmp(baseline->ids[i], id) == 0) return baseline->times[i];
+  }
+  return -1.0;
+}
+
+static void write_json_string(FILE *out, const char *str) {
+  fputc('"', out);
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\')
+      fprintf(out, "\\%c", *str);
+    else if ((unsigned char)*str < 0x20)
+      fprintf(out, "\\u%04x", *str);
+    else
+      fputc(*str, out);
+  }
+  fputc('"', out);
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  --nets LIST       comma separated nets (resnet50,vgg16,"
+          "inception_v3)\n"
+          "  --kernels LIST    comma separated kernels (default: all)\n"
+          "  --layouts LIST    native,mkl (default: both)\n"
+          "  --batch N         minibatch size (default: 32)\n"
+          "  --iters N         timed calls per case (default: 20)\n"
+          "  --warmup N        untimed calls per case (default: 3)\n"
+          "  --no-breakdown    skip timing reorders and compute separately\n"
+          "  --output FILE     write JSON to FILE instead of stdout\n"
+          "  --baseline FILE   compare with the JSON of an earlier run\n"
+          "  --threshold PCT   slowdown flagged as regression (default: 10)\n"
+          "  --list            print the cases without running them\n",
+          prog);
+  fprintf(stderr, "kernels:");
+  for (int k = 0; k < NUM_KERNELS; k++) fprintf(stderr, " %s", kernels[k].name);
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+  const char *nets = NULL, *kernel_list = NULL, *layouts = NULL;
+  const char *output = NULL, *baseline_path = NULL;
+  int batch = 32, list_only = 0;
+  double threshold = 10.0;
+  bench_ctx ctx = {NULL, 3, 20, 1};
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    int has_value = i + 1 < argc;
+    if (strcmp(arg, "--nets") == 0 && has_value)
+      nets = argv[++i];
+    else if (strcmp(arg, "--kernels") == 0 && has_value)
+      kernel_list = argv[++i];
+    else if (strcmp(arg, "--layouts") == 0 && has_value)
+      layouts = argv[++i];
+    else if (strcmp(arg, "--batch") == 0 && has_value)
+      batch = atoi(argv[++i]);
+    else if (strcmp(arg, "--iters") == 0 && has_value)
+      ctx.iters = atoi(argv[++i]);
+    else if (strcmp(arg, "--warmup") == 0 && has_value)
+      ctx.warmup = atoi(argv[++i]);
+    else if (strcmp(arg, "--no-breakdown") == 0)
+      ctx.breakdown = 0;
+    else if (strcmp(arg, "--output") == 0 && has_value)
+      output = argv[++i];
+    else if (strcmp(arg, "--baseline") == 0 && has_value)
+      baseline_path = argv[++i];
+    else if (strcmp(arg, "--threshold") == 0 && has_value)
+      threshold = atof(argv[++i]);
+    else if (strcmp(arg, "--list") == 0)
+      list_only = 1;
+    else {
+      usage(argv[0]);
+      return strcmp(arg, "--help") == 0 ? 0 : 2;
+    }
+  }
+  if (batch < 1 || ctx.iters < 1 || ctx.warmup < 1) {
+    fprintf(stderr, "--batch, --iters and --warmup must be positive\n");
+    return 2;
+  }
+
+  int max_cases = NUM_KERNELS * NUM_LAYOUTS *
+                  (NUM_ELEMS(conv_layers) + NUM_ELEMS(pool_layers) +
+                   NUM_ELEMS(fc_layers));
+  bench_case *cases = (bench_case *)malloc(max_cases * sizeof(bench_case));
+  int num_cases = 0;
+  for (int k = 0; k < NUM_KERNELS; k++) {
+    if (!list_contains(kernel_list, kernels[k].name)) continue;
+    for (int l = 0; l < NUM_LAYOUTS; l++) {
+      if (!list_contains(layouts, layout_names[l])) continue;
+      num_cases = add_cases(cases, num_cases, k, l, batch, nets);
+    }
+  }
+
+  char id[256];
+  if (list_only) {
+    for (int i = 0; i < num_cases; i++) {
+      const bench_case *bc = &cases[i];
+      printf("%s/%s/%s/%s/n%d\n", bc->net, bc->layer, kernels[bc->kernel].name,
+             layout_names[bc->layout], bc->n);
+    }
+    free(cases);
+    return 0;
+  }
+
+  bench_baseline baseline = {0, NULL, NULL};
+  if (baseline_path) load_baseline(baseline_path, &baseline);
+  FILE *out = output ? fopen(output, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "cannot open %s\n", output);
+    return 2;
+  }
+
+  int threads = 1;
+#ifdef _OPENMP
+  threads = omp_get_max_threads();
+#endif
+  ctx.engine = init_mkldnn_engine();
+  fprintf(out, "{\n  \"threads\": %d,\n  \"batch\": %d,\n", threads, batch);
+  fprintf(out, "  \"iters\": %d,\n  \"warmup\": %d,\n", ctx.iters, ctx.warmup);
+  fprintf(out, "  \"results\": [");
+
+  int num_results = 0, regressions = 0;
+  for (int i = 0; i < num_cases; i++) {
+    const bench_case *bc = &cases[i];
+    bench_result res;
+    snprintf(id, sizeof(id), "%s/%s/%s/%s/n%d", bc->net, bc->layer,
+             kernels[bc->kernel].name, layout_names[bc->layout], bc->n);
+    fprintf(stderr, "[%d/%d] %s\n", i + 1, num_cases, id);
+    if (!run_case(&ctx, bc, &res)) {
+      fprintf(stderr, "  not supported, skipped\n");
+      continue;
+    }
+
+    /* One result per line; load_baseline() relies on it */
+    fprintf(out, "%s\n    {\"id\": ", num_results++ ? "," : "");
+    write_json_string(out, id);
+    fprintf(out, ", \"net\": \"%s\", \"layer\": \"%s\", \"kernel\": \"%s\", "
+                 "\"layout\": \"%s\", ",
+            bc->net, bc->layer, kernels[bc->kernel].name,
+            layout_names[bc->layout]);
+    fprintf(out, "\"shape\": {\"n\": %d, \"c\": %d, \"h\": %d, \"w\": %d, "
+                 "\"k\": %d, \"r\": %d, \"s\": %d, \"stride\": %d, "
+                 "\"pad_h\": %d, \"pad_w\": %d}, \"impl\": ",
+            bc->n, bc->c, bc->h, bc->w, bc->k, bc->r, bc->s, bc->stride,
+            bc->pad_h, bc->pad_w);
+    write_json_string(out, res.impl);
+    fprintf(out, ", \"time_ms\": %.4f, \"min_ms\": %.4f, \"stddev_ms\": %.4f, "
+                 "\"compute_ms\": %.4f, \"reorder_ms\": %.4f, "
+                 "\"num_reorders\": %d, ",
+            res.time_ms, res.min_ms, res.stddev_ms, res.compute_ms,
+            res.reorder_ms, res.num_reorders);
+    fprintf(out, "\"gflops\": %.2f, \"gbytes_per_s\": %.2f, "
+                 "\"io_bytes\": %.0f, \"internal_bytes\": %.0f, "
+                 "\"footprint_bytes\": %.0f",
+            res.flops / (res.time_ms * 1e6),
+            (res.io_bytes + res.internal_bytes) / (res.time_ms * 1e6),
+            res.io_bytes, res.internal_bytes,
+            res.io_bytes + res.internal_bytes);
+    double base_ms = baseline_time(&baseline, id);
+    if (base_ms > 0.0) {
+      double change = (res.time_ms - base_ms) / base_ms * 100.0;
+      int regression = change > threshold;
+      regressions += regression;
+      fprintf(out, ", \"baseline_ms\": %.4f, \"change_pct\": %.1f, "
+                   "\"regression\": %s",
+              base_ms, change, regression ? "true" : "false");
+      if (regression)
+        fprintf(stderr, "  REGRESSION: %.4f ms vs %.4f ms (%+.1f%%)\n",
+                res.time_ms, base_ms, change);
+    }
+    fprintf(out, "}");
+    fflush(out);
+    free(res.impl);
+  }
+  fprintf(out, "\n  ],\n  \"regressions\": %d\n}\n", regressions);
+
+  if (out != stdout) fclose(out);
+  destroy_mkldnn_engine(ctx.engine);
+  for (int i = 0; i < baseline.num; i++) free(baseline.ids[i]);
+  free(baseline.ids);
+  free(baseline.times);
+  free(cases);
+  if (regressions)
+    fprintf(stderr, "%d regression(s) above %.1f%%\n", regressions, threshold);
+  return regressions ? 1 : 0;
+}
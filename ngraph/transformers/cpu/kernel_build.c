@@ -0,0 +1,236 @@
+/*******************************************************************************
+* Copyright 2017-2018 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+/*
+ * Background creation of op kernel primitives.
+ *
+ * A kernel builder first creates the primitive descriptor of the op. That is
+ * all the graph passes need, since every output layout is a query on it.
+ * Creating the primitive itself is where MKL-DNN generates JIT code, so the
+ * builders hand it to create_opkernel_primitive(), which queues the kernel for
+ * a pool of build threads, and append a NULL placeholder for it to the net.
+ * A build thread may be writing op_prim at that point, so only
+ * wait_kernel_build() reads it.
+ *
+ * wait_kernel_build() is called before a kernel is first run, printed or
+ * deleted. It builds the kernel inline if no thread has picked it up yet,
+ * otherwise waits for it, then patches the net.
+ *
+ * The pool is shared by every transformer in the process, which take a
+ * reference with start_kernel_build_threads() and drop it with
+ * stop_kernel_build_threads(). Dropping the last one stops and joins the
+ * threads; kernels still queued then are built inline by wait_kernel_build().
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "mkldnn_engine.h"
+#include "mkldnn_util.h"
+
+#define MAX_KERNEL_BUILD_THREADS 64
+
+enum {
+  KERNEL_BUILD_DONE = 0, /* op_prim created and in the net */
+  KERNEL_BUILD_QUEUED,   /* waiting for or being built by a build thread */
+  KERNEL_BUILD_CREATED   /* op_prim created, net not yet patched */
+};
+
+static pthread_mutex_t build_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t build_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t build_created = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t build_stopped = PTHREAD_COND_INITIALIZER;
+static mkldnn_opkernel_t build_head = NULL;
+static mkldnn_opkernel_t build_tail = NULL;
+static pthread_t build_threads[MAX_KERNEL_BUILD_THREADS];
+static int num_build_threads = 0;
+static int stop_build_threads = 0;
+static int build_users = 0;
+
+static void build_primitive(mkldnn_opkernel_t opkernel) {
+  MKL_CHECK(mkldnn_primitive_create(&opkernel->op_prim, opkernel->op_desc,
+                                    opkernel->build_srcs,
+                                    opkernel->build_dsts));
+}
+
+static void *kernel_build_thread(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&build_mutex);
+  for (;;) {
+    while (!build_head && !stop_build_threads)
+      pthread_cond_wait(&build_queued, &build_mutex);
+    if (stop_build_threads) break;
+    mkldnn_opkernel_t opkernel = build_head;
+    build_head = opkernel->next_build;
+    if (!build_head) build_tail = NULL;
+    pthread_mutex_unlock(&build_mutex);
+
+    build_primitive(opkernel);
+
+    pthread_mutex_lock(&build_mutex);
+    opkernel->build_state = KERNEL_BUILD_CREATED;
+    pthread_cond_broadcast(&build_created);
+  }
+  pthread_mutex_unlock(&build_mutex);
+  return NULL;
+}
+
+void start_kernel_build_threads(int num_threads) {
+  pthread_mutex_lock(&build_mutex);
+  /* Threads of a pool being stopped would exit right away */
+  while (stop_build_threads) pthread_cond_wait(&build_stopped, &build_mutex);
+  build_users++;
+  if (num_threads > MAX_KERNEL_BUILD_THREADS)
+    num_threads = MAX_KERNEL_BUILD_THREADS;
+  while (num_build_threads < num_threads) {
+    if (pthread_create(&build_threads[num_build_threads], NULL,
+                       kernel_build_thread, NULL) != 0)
+      break;
+    num_build_threads++;
+  }
+  pthread_mutex_unlock(&build_mutex);
+}
+
+void stop_kernel_build_threads(void) {
+  pthread_t threads[MAX_KERNEL_BUILD_THREADS];
+  pthread_mutex_lock(&build_mutex);
+  if (build_users > 0 && --build_users > 0) {
+    pthread_mutex_unlock(&build_mutex);
+    return;
+  }
+  int num_threads = num_build_threads;
+  memcpy(threads, build_threads, num_threads * sizeof(pthread_t));
+  num_build_threads = 0;
+  stop_build_threads = 1;
+  pthread_cond_broadcast(&build_queued);
+  pthread_mutex_unlock(&build_mutex);
+
+  /* A thread finishes the kernel it is building before it exits */
+  for (int i = 0; i < num_threads; i++) pthread_join(threads[i], NULL);
+
+  pthread_mutex_lock(&build_mutex);
+  stop_build_threads = 0;
+  pthread_cond_broadcast(&build_stopped);
+  pthread_mutex_unlock(&build_mutex);
+}
+
+void create_opkernel_primitive(mkldnn_opkernel_t opkernel,
+                               const mkldnn_primitive_at_t *srcs, int num_srcs,
+                               const const_mkldnn_primitive_t *dsts,
+                               int num_dsts) {
+  MKL_CHECK_TRUE(num_srcs <= MKLDNN_MAX_ARGS && num_dsts <= MKLDNN_MAX_ARGS);
+  memcpy(opkernel->build_srcs, srcs, num_srcs * sizeof(*srcs));
+  memcpy(opkernel->build_dsts, dsts, num_dsts * sizeof(*dsts));
+  opkernel->num_build_srcs = num_srcs;
+  opkernel->num_build_dsts = num_dsts;
+
+  pthread_mutex_lock(&build_mutex);
+  if (num_build_threads == 0) {
+    pthread_mutex_unlock(&build_mutex);
+    build_primitive(opkernel);
+    /* The net is still patched by wait_kernel_build() */
+    opkernel->build_state = KERNEL_BUILD_CREATED;
+    return;
+  }
+  opkernel->op_prim = NULL;
+  opkernel->build_state = KERNEL_BUILD_QUEUED;
+  opkernel->next_build = NULL;
+  if (build_tail)
+    build_tail->next_build = opkernel;
+  else
+    build_head = opkernel;
+  build_tail = opkernel;
+  pthread_cond_signal(&build_queued);
+  pthread_mutex_unlock(&build_mutex);
+}
+
+void wait_kernel_build(mkldnn_opkernel_t opkernel) {
+  if (__atomic_load_n(&opkernel->build_state, __ATOMIC_ACQUIRE) ==
+      KERNEL_BUILD_DONE)
+    return;
+
+  pthread_mutex_lock(&build_mutex);
+  if (opkernel->build_state == KERNEL_BUILD_QUEUED) {
+    /* Still in the queue: take it and build it here rather than wait */
+    mkldnn_opkernel_t prev = NULL;
+    mkldnn_opkernel_t it = build_head;
+    while (it && it != opkernel) {
+      prev = it;
+      it = it->next_build;
+    }
+    if (it) {
+      if (prev)
+        prev->next_build = opkernel->next_build;
+      else
+        build_head = opkernel->next_build;
+      if (build_tail == opkernel) build_tail = prev;
+      pthread_mutex_unlock(&build_mutex);
+      build_primitive(opkernel);
+      pthread_mutex_lock(&build_mutex);
+      opkernel->build_state = KERNEL_BUILD_CREATED;
+    }
+  }
+  while (opkernel->build_state == KERNEL_BUILD_QUEUED)
+    pthread_cond_wait(&build_created, &build_mutex);
+  pthread_mutex_unlock(&build_mutex);
+
+  for (int i = 0; i < opkernel->net_size; i++) {
+    if (!opkernel->net[i]) opkernel->net[i] = opkernel->op_prim;
+  }
+  __atomic_store_n(&opkernel->build_state, KERNEL_BUILD_DONE, __ATOMIC_RELEASE);
+}
+
+/* Runs the kernel once on zeroed scratch buffers so its JIT code, internal
+ * conversion buffers and MKL-DNN scratchpads are faulted in before the first
+ * real call. The caller's data handles are restored afterwards. */
+void warmup_opkernel(mkldnn_opkernel_t opkernel) {
+  void *saved_inputs[MKLDNN_MAX_ARGS];
+  void *saved_outputs[MKLDNN_MAX_ARGS];
+  void *scratch_inputs[MKLDNN_MAX_ARGS];
+  void *scratch_outputs[MKLDNN_MAX_ARGS];
+
+  wait_kernel_build(opkernel);
+  for (int i = 0; i < opkernel->num_inputs; i++) {
+    size_t size = mkldnn_memory_primitive_desc_get_size(opkernel->inputs[i].desc);
+    scratch_inputs[i] = alloc_tracked_memory(size, 64, ENGINE_MEM_WORKSPACE);
+    memset(scratch_inputs[i], 0, size);
+    MKL_CHECK(mkldnn_memory_get_data_handle(opkernel->inputs[i].prim,
+                                            &saved_inputs[i]));
+    MKL_CHECK(mkldnn_memory_set_data_handle(opkernel->inputs[i].prim,
+                                            scratch_inputs[i]));
+  }
+  for (int i = 0; i < opkernel->num_outputs; i++) {
+    size_t size = mkldnn_memory_primitive_desc_get_size(opkernel->outputs[i].desc);
+    scratch_outputs[i] = alloc_tracked_memory(size, 64, ENGINE_MEM_WORKSPACE);
+    MKL_CHECK(mkldnn_memory_get_data_handle(opkernel->outputs[i].prim,
+                                            &saved_outputs[i]));
+    MKL_CHECK(mkldnn_memory_set_data_handle(opkernel->outputs[i].prim,
+                                            scratch_outputs[i]));
+  }
+
+  run_mkldnn_opkernel(opkernel, 0);
+
+  for (int i = 0; i < opkernel->num_inputs; i++) {
+    MKL_CHECK(mkldnn_memory_set_data_handle(opkernel->inputs[i].prim,
+                                            saved_inputs[i]));
+    free_memory(scratch_inputs[i]);
+  }
+  for (int i = 0; i < opkernel->num_outputs; i++) {
+    MKL_CHECK(mkldnn_memory_set_data_handle(opkernel->outputs[i].prim,
+                                            saved_outputs[i]));
+    free_memory(scratch_outputs[i]);
+  }
+}
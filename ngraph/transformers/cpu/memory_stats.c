@@ -0,0 +1,180 @@
+/*******************************************************************************
+* Copyright 2018 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+/*
+ * Memory accounting.
+ *
+ * Every buffer the engine allocates goes through alloc_tracked_memory(),
+ * which stores its size and category in a header in front of the buffer, and
+ * is released with free_memory(). Memory allocated outside the engine (the
+ * graph tensor pools of the transformer) is added with account_memory().
+ *
+ * Current and peak bytes are kept per category and in total with atomics,
+ * since gemm convolution allocates its workspaces from OpenMP threads. A mark
+ * is a further total peak that a caller starts with begin_memory_mark() to
+ * measure the high-water mark of a single computation call without losing the
+ * process peak. Calls on different threads use different marks; the memory
+ * their kernels allocate at the same time counts towards each of them.
+ *
+ * Memory allocated inside MKL-DNN primitives is not visible here.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "mkldnn_engine.h"
+#include "mkldnn_util.h"
+
+typedef struct {
+  size_t bytes;
+  int category;
+  int offset; /* from the start of the allocated block to the buffer */
+} tracked_header;
+
+static long long current_bytes[ENGINE_MEM_NUM_CATEGORIES];
+static long long peak_bytes[ENGINE_MEM_NUM_CATEGORIES];
+static long long total_current = 0;
+static long long total_peak = 0;
+
+#define MAX_MEMORY_MARKS 64
+static unsigned long long active_marks = 0; /* bit i: mark i in use */
+static long long mark_starts[MAX_MEMORY_MARKS];
+static long long mark_peaks[MAX_MEMORY_MARKS];
+
+static void update_peak(long long *peak, long long value) {
+  long long old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+  while (value > old &&
+         !__atomic_compare_exchange_n(peak, &old, value, 1, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED))
+    ;
+}
+
+void account_memory(int category, long long bytes) {
+  MKL_CHECK_TRUE(category >= 0 && category < ENGINE_MEM_NUM_CATEGORIES);
+  long long current =
+      __atomic_add_fetch(&current_bytes[category], bytes, __ATOMIC_RELAXED);
+  long long total = __atomic_add_fetch(&total_current, bytes, __ATOMIC_RELAXED);
+  if (bytes > 0) {
+    update_peak(&peak_bytes[category], current);
+    update_peak(&total_peak, total);
+    unsigned long long marks =
+        __atomic_load_n(&active_marks, __ATOMIC_ACQUIRE);
+    while (marks) {
+      update_peak(&mark_peaks[__builtin_ctzll(marks)], total);
+      marks &= marks - 1;
+    }
+  }
+}
+
+void *alloc_tracked_memory(size_t bytes, size_t alignment, int category) {
+  if (alignment < sizeof(void *)) alignment = sizeof(void *);
+  size_t offset = alignment;
+  while (offset < sizeof(tracked_header)) offset += alignment;
+
+  void *block;
+  int status = posix_memalign(&block, alignment, bytes + offset);
+  if (status == EINVAL) {
+    printf("The value of the alignment parameter is not a power of two or "
+           "is not a multiple of sizeof(void *)\n");
+    exit(2);
+  } else if (status != 0) {
+    printf("Memory allocation failure. Could not allocate %zu bytes\n", bytes);
+    exit(2);
+  }
+
+  char *buf = (char *)block + offset;
+  tracked_header *header = (tracked_header *)buf - 1;
+  header->bytes = bytes;
+  header->category = category;
+  header->offset = (int)offset;
+  account_memory(category, (long long)bytes);
+  return buf;
+}
+
+void free_memory(void *buf) {
+  if (!buf) return;
+  tracked_header *header = (tracked_header *)buf - 1;
+  account_memory(header->category, -(long long)header->bytes);
+  free((char *)buf - header->offset);
+}
+
+size_t tracked_memory_size(void *buf) {
+  return buf ? ((tracked_header *)buf - 1)->bytes : 0;
+}
+
+/* Bytes of the internal (reordered) tensors owned by the kernel */
+long long query_opkernel_memory(mkldnn_opkernel_t opkernel) {
+  long long bytes = 0;
+  for (int i = 0; i < opkernel->num_inputs; i++) {
+    if (opkernel->reorder_i[i] &&
+        !(opkernel->shared_internal_inputs & (1u << i)))
+      bytes += tracked_memory_size(opkernel->internal_inputs[i].buffer);
+  }
+  for (int i = 0; i < opkernel->num_outputs; i++) {
+    if (opkernel->reorder_o[i])
+      bytes += tracked_memory_size(opkernel->internal_outputs[i].buffer);
+  }
+  return bytes;
+}
+
+/* Fills out with the total current and peak bytes followed by the current and
+ * peak bytes of every category. */
+void query_memory_stats(long long *out) {
+  out[0] = __atomic_load_n(&total_current, __ATOMIC_RELAXED);
+  out[1] = __atomic_load_n(&total_peak, __ATOMIC_RELAXED);
+  for (int i = 0; i < ENGINE_MEM_NUM_CATEGORIES; i++) {
+    out[2 + 2 * i] = __atomic_load_n(&current_bytes[i], __ATOMIC_RELAXED);
+    out[3 + 2 * i] = __atomic_load_n(&peak_bytes[i], __ATOMIC_RELAXED);
+  }
+}
+
+/* Lowers all peaks to the current values */
+void reset_memory_peaks(void) {
+  for (int i = 0; i < ENGINE_MEM_NUM_CATEGORIES; i++)
+    __atomic_store_n(&peak_bytes[i],
+                     __atomic_load_n(&current_bytes[i], __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+  __atomic_store_n(&total_peak,
+                   __atomic_load_n(&total_current, __ATOMIC_RELAXED),
+                   __ATOMIC_RELAXED);
+}
+
+/* Starts a high-water mark at the current total. Returns the mark, or -1 if
+ * all MAX_MEMORY_MARKS are in use. */
+int begin_memory_mark(void) {
+  unsigned long long marks = __atomic_load_n(&active_marks, __ATOMIC_RELAXED);
+  int mark;
+  do {
+    if (!~marks) return -1;
+    mark = __builtin_ctzll(~marks);
+  } while (!__atomic_compare_exchange_n(&active_marks, &marks,
+                                        marks | (1ull << mark), 1,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+  long long total = __atomic_load_n(&total_current, __ATOMIC_RELAXED);
+  mark_starts[mark] = total;
+  __atomic_store_n(&mark_peaks[mark], total, __ATOMIC_RELAXED);
+  return mark;
+}
+
+/* Ends a mark of begin_memory_mark(). Returns the most memory allocated on top
+ * of the total at its start, 0 for mark -1. */
+long long end_memory_mark(int mark) {
+  if (mark < 0 || mark >= MAX_MEMORY_MARKS) return 0;
+  long long peak = __atomic_load_n(&mark_peaks[mark], __ATOMIC_RELAXED);
+  long long start = mark_starts[mark];
+  __atomic_and_fetch(&active_marks, ~(1ull << mark), __ATOMIC_RELEASE);
+  return peak - start;
+}
@@ -0,0 +1,175 @@
+# ******************************************************************************
+# Copyright 2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+"""
+Checkpoints of variables in the layout the MKL-DNN kernels read them in.
+
+A checkpoint holds one or more blobs per tensor: the tensor in its native layout,
+and a copy packed in the internal layout of the kernels that reorder it. The file
+is a header (magic, index length, JSON index) followed by the page aligned blobs,
+so a loaded checkpoint is mapped read-only and the kernels read the packed blobs
+in place: loading does no reorders and the pages are shared between processes
+serving the same model.
+"""
+from __future__ import division
+
+import binascii
+import json
+import mmap
+import os
+import struct
+import tempfile
+
+import numpy as np
+
+MAGIC = b'NGMKLCKP'
+FORMAT_VERSION = 1
+ALIGNMENT = mmap.PAGESIZE
+
+
+def align(offset, alignment=ALIGNMENT):
+    return (offset + alignment - 1) // alignment * alignment
+
+
+class Blob(object):
+    """
+    One blob of a tensor to write.
+
+    Arguments:
+        nbytes: Size of the blob.
+        fill: fill(view) writes the blob to the writable uint8 array view.
+        layout: Memory descriptor bytes of the layout, None for the native layout.
+        kernels: [(kernel name, input index)] of the kernels reading the layout.
+    """
+    def __init__(self, nbytes, fill, layout=None, kernels=()):
+        self.nbytes = nbytes
+        self.fill = fill
+        self.layout = layout
+        self.kernels = list(kernels)
+
+
+def write_checkpoint(path, tensors, md_size):
+    """
+    Writes a checkpoint.
+
+    Arguments:
+        path: File to write, replaced once complete. It gets the permissions of a
+            file created with open(), so other users can map it if the umask allows.
+        tensors: {name: (shape, dtype, [Blob])}.
+        md_size: Size of the memory descriptors of the packed layouts.
+    """
+    index = {'version': FORMAT_VERSION, 'alignment': ALIGNMENT, 'md_size': md_size,
+             'tensors': dict()}
+    blobs = []
+    offset = 0
+    for name, (shape, dtype, tensor_blobs) in sorted(tensors.items()):
+        entries = []
+        for blob in tensor_blobs:
+            entries.append({'layout': None if blob.layout is None
+                            else binascii.hexlify(blob.layout).decode('ascii'),
+                            'offset': offset,
+                            'nbytes': blob.nbytes,
+                            'kernels': [list(kernel) for kernel in blob.kernels]})
+            blobs.append((offset, blob))
+            offset = align(offset + blob.nbytes)
+        index['tensors'][name] = {'shape': list(shape), 'dtype': np.dtype(dtype).str,
+                                  'blobs': entries}
+    header = json.dumps(index, sort_keys=True).encode('utf-8')
+    header = MAGIC + struct.pack('<Q', len(header)) + header
+    data_start = align(len(header))
+
+    directory = os.path.dirname(os.path.abspath(path))
+    fd, temp_path = tempfile.mkstemp(dir=directory, suffix='.tmp')
+    try:
+        with os.fdopen(fd, 'r+b') as f:
+            # mkstemp creates the file private to its owner
+            umask = os.umask(0)
+            os.umask(umask)
+            os.fchmod(f.fileno(), 0o666 & ~umask)
+            f.write(header)
+            f.truncate(data_start + offset)
+            if offset:
+                # Blobs are packed straight into the pages of the file
+                mapping = mmap.mmap(f.fileno(), data_start + offset)
+                try:
+                    data = np.frombuffer(mapping, dtype=np.uint8)
+                    for blob_offset, blob in blobs:
+                        start = data_start + blob_offset
+                        blob.fill(data[start:start + blob.nbytes])
+                    del data
+                    mapping.flush()
+                finally:
+                    mapping.close()
+        os.rename(temp_path, path)
+    except BaseException:
+        os.remove(temp_path)
+        raise
+
+
+class Checkpoint(object):
+    """
+    A checkpoint mapped read-only. The arrays returned by blob() view the mapping
+    and stay valid until close().
+    """
+    def __init__(self, path):
+        self.path = path
+        with open(path, 'rb') as f:
+            if f.read(len(MAGIC)) != MAGIC:
+                raise ValueError("{} is not an MKL checkpoint".format(path))
+            header_size, = struct.unpack('<Q', f.read(8))
+            self.index = json.loads(f.read(header_size).decode('utf-8'))
+            if self.index['version'] != FORMAT_VERSION:
+                raise ValueError("{} has format version {}, expected {}".format(
+                    path, self.index['version'], FORMAT_VERSION))
+            self.data_start = align(len(MAGIC) + 8 + header_size, self.index['alignment'])
+            size = os.fstat(f.fileno()).st_size
+            self.mapping = mmap.mmap(f.fileno(), size, access=mmap.ACCESS_READ) \
+                if size else None
+        self.data = np.frombuffer(self.mapping, dtype=np.uint8) \
+            if self.mapping is not None else np.empty(0, dtype=np.uint8)
+
+    @property
+    def md_size(self):
+        return self.index['md_size']
+
+    @property
+    def tensors(self):
+        return self.index['tensors']
+
+    def blob(self, entry):
+        """
+        The read-only uint8 array of a blob entry of the index.
+        """
+        start = self.data_start + entry['offset']
+        return self.data[start:start + entry['nbytes']]
+
+    @staticmethod
+    def layout(entry):
+        """
+        The memory descriptor bytes of a blob entry, None for the native layout.
+        """
+        if entry['layout'] is None:
+            return None
+        return binascii.unhexlify(entry['layout'])
+
+    def close(self):
+        self.data = None
+        if self.mapping is not None:
+            try:
+                self.mapping.close()
+            except BufferError:
+                # Arrays returned by blob() are still alive, the mapping goes with them
+                pass
+            self.mapping = None
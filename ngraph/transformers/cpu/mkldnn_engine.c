@@ -18,6 +18,10 @@
 #include "mkldnn_engine.h"
 #include "mkldnn_util.h"
 #include <errno.h>
+#include <pthread.h>
+
+/* Serializes the reorders of inputs shared by kernel contexts */
+static pthread_mutex_t context_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 mkldnn_engine_t init_mkldnn_engine(void) {
   mkldnn_engine_t engine;
@@ -297,6 +301,22 @@ mkldnn_opkernel_t create_empty_kernel(int id) {
   op_kernel->num_outputs = 0;
   op_kernel->net_size = 0;
   op_kernel->stream = NULL;
+  op_kernel->build_state = 0;
+  op_kernel->next_build = NULL;
+  op_kernel->op_desc = NULL;
+  op_kernel->op_prim = NULL;
+  op_kernel->run_custom = NULL;
+  op_kernel->custom_data = NULL;
+  op_kernel->custom_impl_info = NULL;
+  op_kernel->counters = NULL;
+  op_kernel->shared_internal_inputs = 0;
+  op_kernel->context_of = NULL;
+  op_kernel->context_inputs_ready = 0;
+  op_kernel->prepacked_inputs = 0;
+  for (int i = 0; i < MKLDNN_MAX_ARGS; i++) {
+    op_kernel->reorder_i[i] = NULL;
+    op_kernel->reorder_o[i] = NULL;
+  }
 
   return op_kernel;
 }
@@ -310,29 +330,236 @@ void delete_mkldnn_tensor(mkldnn_tensor *tensor) {
   MKL_CHECK(mkldnn_primitive_destroy(tensor->prim));
 }
 
+/* Contexts only own the primitives of their tensors */
+static void delete_opkernel_tensor(mkldnn_opkernel_t opkernel,
+                                   mkldnn_tensor *tensor) {
+  if (opkernel->context_of)
+    MKL_CHECK(mkldnn_primitive_destroy(tensor->prim));
+  else
+    delete_mkldnn_tensor(tensor);
+}
+
 void delete_mkldnn_opkernel(mkldnn_opkernel_t opkernel) {
+  wait_kernel_build(opkernel);
   for (int i = 0; i < opkernel->num_inputs; i++) {
-    delete_mkldnn_tensor(&opkernel->inputs[i]);
+    delete_opkernel_tensor(opkernel, &opkernel->inputs[i]);
     if (opkernel->reorder_i[i]) {
-      delete_mkldnn_tensor(&opkernel->internal_inputs[i]);
+      delete_opkernel_tensor(opkernel, &opkernel->internal_inputs[i]);
       MKL_CHECK(mkldnn_primitive_destroy(opkernel->reorder_i[i]));
-      free(opkernel->internal_inputs[i].buffer);
+      if (!(opkernel->shared_internal_inputs & (1u << i)))
+        free_memory(opkernel->internal_inputs[i].buffer);
     }
   }
   for (int i = 0; i < opkernel->num_outputs; i++) {
-    delete_mkldnn_tensor(&opkernel->outputs[i]);
+    delete_opkernel_tensor(opkernel, &opkernel->outputs[i]);
     if (opkernel->reorder_o[i]) {
-      delete_mkldnn_tensor(&opkernel->internal_outputs[i]);
+      delete_opkernel_tensor(opkernel, &opkernel->internal_outputs[i]);
       MKL_CHECK(mkldnn_primitive_destroy(opkernel->reorder_o[i]));
-      free(opkernel->internal_outputs[i].buffer);
+      free_memory(opkernel->internal_outputs[i].buffer);
     }
   }
-  MKL_CHECK(mkldnn_primitive_desc_destroy(opkernel->op_desc));
-  MKL_CHECK(mkldnn_primitive_destroy(opkernel->op_prim));
+  if (opkernel->op_desc && !opkernel->context_of)
+    MKL_CHECK(mkldnn_primitive_desc_destroy(opkernel->op_desc));
+  if (opkernel->op_prim)
+    MKL_CHECK(mkldnn_primitive_destroy(opkernel->op_prim));
+  if (!opkernel->context_of)
+    free(opkernel->custom_data);
+  delete_opkernel_counters(opkernel);
   if (opkernel->stream)
     MKL_CHECK(mkldnn_stream_destroy(opkernel->stream));
 }
 
+int share_opkernel_internal_input(mkldnn_opkernel_t opkernel, int index,
+                                  mkldnn_opkernel_t owner, int owner_index) {
+  if (opkernel == owner || !opkernel->reorder_i[index] ||
+      !owner->reorder_i[owner_index])
+    return 0;
+  if (opkernel->shared_internal_inputs & (1u << index)) return 1;
+  if (!mkldnn_memory_primitive_desc_equal(
+          opkernel->internal_inputs[index].desc,
+          owner->internal_inputs[owner_index].desc))
+    return 0;
+
+  void *buffer = owner->internal_inputs[owner_index].buffer;
+  free_memory(opkernel->internal_inputs[index].buffer);
+  opkernel->internal_inputs[index].buffer = buffer;
+  MKL_CHECK(mkldnn_memory_set_data_handle(opkernel->internal_inputs[index].prim,
+                                          buffer));
+  opkernel->shared_internal_inputs |= 1u << index;
+  return 1;
+}
+
+/* The primitive of context that corresponds to primitive prim of its kernel,
+ * or NULL if prim is not one of the kernel's. Passing the kernel as context
+ * checks that the kernel can be copied. */
+static mkldnn_primitive_t context_primitive(mkldnn_opkernel_t opkernel,
+                                            mkldnn_opkernel_t context,
+                                            const_mkldnn_primitive_t prim) {
+  if (prim && prim == opkernel->op_prim) return context->op_prim;
+  for (int i = 0; i < opkernel->num_inputs; i++) {
+    if (prim == opkernel->inputs[i].prim) return context->inputs[i].prim;
+    if (!opkernel->reorder_i[i]) continue;
+    if (prim == opkernel->internal_inputs[i].prim)
+      return context->internal_inputs[i].prim;
+    if (prim == opkernel->reorder_i[i]) return context->reorder_i[i];
+  }
+  for (int i = 0; i < opkernel->num_outputs; i++) {
+    if (prim == opkernel->outputs[i].prim) return context->outputs[i].prim;
+    if (!opkernel->reorder_o[i]) continue;
+    if (prim == opkernel->internal_outputs[i].prim)
+      return context->internal_outputs[i].prim;
+    if (prim == opkernel->reorder_o[i]) return context->reorder_o[i];
+  }
+  return NULL;
+}
+
+static void copy_context_tensor(const mkldnn_tensor *tensor,
+                                mkldnn_tensor *copy) {
+  *copy = *tensor;
+  MKL_CHECK(mkldnn_primitive_create(&copy->prim, copy->desc, NULL, NULL));
+}
+
+static void alloc_context_buffer(mkldnn_tensor *tensor) {
+  tensor->buffer = alloc_tracked_memory(
+      mkldnn_memory_primitive_desc_get_size(tensor->desc), 64,
+      ENGINE_MEM_REORDER);
+  MKL_CHECK(mkldnn_memory_set_data_handle(tensor->prim, tensor->buffer));
+}
+
+static void copy_context_reorder(mkldnn_primitive_t reorder,
+                                 mkldnn_primitive_t src, mkldnn_primitive_t dst,
+                                 mkldnn_primitive_t *copy) {
+  const_mkldnn_primitive_desc_t reorder_pd;
+  MKL_CHECK(mkldnn_primitive_get_primitive_desc(reorder, &reorder_pd));
+  mkldnn_primitive_at_t srcs[] = {mkldnn_primitive_at(src, 0)};
+  const_mkldnn_primitive_t dsts[] = {dst};
+  MKL_CHECK(mkldnn_primitive_create(copy, reorder_pd, srcs, dsts));
+}
+
+mkldnn_opkernel_t create_opkernel_context(mkldnn_opkernel_t opkernel,
+                                          unsigned shared_inputs) {
+  wait_kernel_build(opkernel);
+  if (opkernel->context_of) return NULL;
+  for (int i = 0; i < opkernel->num_build_srcs; i++)
+    if (!context_primitive(opkernel, opkernel,
+                           opkernel->build_srcs[i].primitive))
+      return NULL;
+  for (int i = 0; i < opkernel->num_build_dsts; i++)
+    if (!context_primitive(opkernel, opkernel, opkernel->build_dsts[i]))
+      return NULL;
+  for (int i = 0; i < opkernel->net_size; i++)
+    if (!context_primitive(opkernel, opkernel, opkernel->net[i]))
+      return NULL;
+
+  mkldnn_opkernel_t context = create_empty_kernel(opkernel->id);
+  context->context_of = opkernel;
+  context->num_inputs = opkernel->num_inputs;
+  context->num_outputs = opkernel->num_outputs;
+  context->op_desc = opkernel->op_desc;
+  context->run_custom = opkernel->run_custom;
+  context->custom_data = opkernel->custom_data;
+  context->custom_impl_info = opkernel->custom_impl_info;
+
+  for (int i = 0; i < opkernel->num_inputs; i++) {
+    copy_context_tensor(&opkernel->inputs[i], &context->inputs[i]);
+    if (!opkernel->reorder_i[i]) continue;
+    copy_context_tensor(&opkernel->internal_inputs[i],
+                        &context->internal_inputs[i]);
+    if (opkernel->prepacked_inputs & (1u << i)) {
+      /* Reads the prepacked data bound to opkernel and is never reordered */
+      void *buffer;
+      MKL_CHECK(mkldnn_memory_get_data_handle(opkernel->internal_inputs[i].prim,
+                                              &buffer));
+      MKL_CHECK(mkldnn_memory_set_data_handle(context->internal_inputs[i].prim,
+                                              buffer));
+      context->shared_internal_inputs |= 1u << i;
+      context->prepacked_inputs |= 1u << i;
+    } else if (shared_inputs & (1u << i)) {
+      /* The copied tensor still points at the buffer of opkernel */
+      mkldnn_tensor *tensor = &context->internal_inputs[i];
+      MKL_CHECK(mkldnn_memory_set_data_handle(tensor->prim, tensor->buffer));
+      context->shared_internal_inputs |= 1u << i;
+    } else {
+      alloc_context_buffer(&context->internal_inputs[i]);
+    }
+    copy_context_reorder(opkernel->reorder_i[i], context->inputs[i].prim,
+                         context->internal_inputs[i].prim,
+                         &context->reorder_i[i]);
+  }
+  for (int i = 0; i < opkernel->num_outputs; i++) {
+    copy_context_tensor(&opkernel->outputs[i], &context->outputs[i]);
+    if (!opkernel->reorder_o[i]) continue;
+    copy_context_tensor(&opkernel->internal_outputs[i],
+                        &context->internal_outputs[i]);
+    alloc_context_buffer(&context->internal_outputs[i]);
+    copy_context_reorder(opkernel->reorder_o[i],
+                         context->internal_outputs[i].prim,
+                         context->outputs[i].prim, &context->reorder_o[i]);
+  }
+
+  if (opkernel->op_prim) {
+    mkldnn_primitive_at_t srcs[MKLDNN_MAX_ARGS];
+    const_mkldnn_primitive_t dsts[MKLDNN_MAX_ARGS];
+    for (int i = 0; i < opkernel->num_build_srcs; i++)
+      srcs[i] = mkldnn_primitive_at(
+          context_primitive(opkernel, context,
+                            opkernel->build_srcs[i].primitive),
+          opkernel->build_srcs[i].output_index);
+    for (int i = 0; i < opkernel->num_build_dsts; i++)
+      dsts[i] = context_primitive(opkernel, context, opkernel->build_dsts[i]);
+    MKL_CHECK(mkldnn_primitive_create(&context->op_prim, opkernel->op_desc,
+                                      srcs, dsts));
+  }
+
+  /* Shared inputs are reordered outside the net, once for all contexts */
+  for (int i = 0; i < opkernel->net_size; i++) {
+    mkldnn_primitive_t prim = context_primitive(opkernel, context,
+                                                opkernel->net[i]);
+    int shared = 0;
+    for (int j = 0; j < context->num_inputs; j++)
+      shared |= prim == context->reorder_i[j] &&
+                (context->shared_internal_inputs & (1u << j));
+    if (!shared) context->net[context->net_size++] = prim;
+  }
+  return context;
+}
+
+void reset_opkernel_contexts(mkldnn_opkernel_t opkernel) {
+  pthread_mutex_lock(&context_mutex);
+  __atomic_store_n(&opkernel->context_inputs_ready, 0, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&context_mutex);
+}
+
+/* Runs the reorders of the shared inputs of a context that no context has run
+ * since they were created or reset */
+static void prepare_context_inputs(mkldnn_opkernel_t context) {
+  mkldnn_opkernel_t opkernel = context->context_of;
+  unsigned shared = context->shared_internal_inputs & ~context->prepacked_inputs;
+  if ((__atomic_load_n(&opkernel->context_inputs_ready, __ATOMIC_ACQUIRE) &
+       shared) == shared)
+    return;
+
+  pthread_mutex_lock(&context_mutex);
+  mkldnn_primitive_t reorders[MKLDNN_MAX_ARGS];
+  int num_reorders = 0;
+  for (int i = 0; i < context->num_inputs; i++)
+    if ((shared & (1u << i)) &&
+        !(opkernel->context_inputs_ready & (1u << i)))
+      reorders[num_reorders++] = context->reorder_i[i];
+  if (num_reorders) {
+    mkldnn_stream_t stream;
+    mkldnn_primitive_t error_primitive;
+    MKL_CHECK(mkldnn_stream_create(&stream, mkldnn_eager));
+    MKL_CHECK(mkldnn_stream_submit(stream, num_reorders, reorders,
+                                   &error_primitive));
+    MKL_CHECK(mkldnn_stream_wait(stream, num_reorders, NULL));
+    MKL_CHECK(mkldnn_stream_destroy(stream));
+  }
+  __atomic_store_n(&opkernel->context_inputs_ready,
+                   opkernel->context_inputs_ready | shared, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&context_mutex);
+}
+
 void set_input_tensor_data_handle(mkldnn_opkernel_t opkernel, void *buffer,
                                   int index) {
   MKL_CHECK(
@@ -348,9 +575,9 @@ void set_output_tensor_data_handle(mkldnn_opkernel_t opkernel, void *buffer,
 void print_mkldnn_opkernel(mkldnn_opkernel_t opkernel) {
   void *buf;
   char *str_buf;
+  wait_kernel_build(opkernel);
   printf("ID: %d\n", opkernel->id);
-  MKL_CHECK(mkldnn_primitive_desc_query(opkernel->op_desc, mkldnn_query_impl_info_str, 0, &str_buf));
-  printf("Impl: %s\n", str_buf);
+  printf("Impl: %s\n", query_opkernel_impl_info(opkernel));
   printf(" INPUTS\n");
   for (int i = 0; i < opkernel->num_inputs; i++) {
     mkldnn_memory_desc_t md =
@@ -395,8 +622,17 @@ void run_mkldnn_opkernel(mkldnn_opkernel_t opkernel, int verbose) {
     clock_gettime(CLOCK_REALTIME, &start);
   }
   mkldnn_primitive_t error_primitive;
-  mkldnn_status_t s;
-  if (!opkernel->stream) {
+  mkldnn_status_t s = mkldnn_success;
+  int counted = opkernel_counters_enabled();
+  thread_runtime_enter();
+  if (opkernel->shared_internal_inputs && opkernel->context_of)
+    prepare_context_inputs(opkernel);
+  if (counted) {
+    run_opkernel_counted(opkernel);
+  } else if (opkernel->run_custom) {
+    opkernel->run_custom(opkernel);
+  } else if (!opkernel->stream) {
+    wait_kernel_build(opkernel);
     MKL_CHECK(mkldnn_stream_create(&opkernel->stream, mkldnn_eager));
     s = mkldnn_stream_submit(opkernel->stream, opkernel->net_size,
                              opkernel->net, &error_primitive);
@@ -410,7 +646,9 @@ void run_mkldnn_opkernel(mkldnn_opkernel_t opkernel, int verbose) {
         __FILE__, __LINE__, s, error_primitive);
     exit(2);
   }
-  MKL_CHECK(mkldnn_stream_wait(opkernel->stream, opkernel->net_size, NULL));
+  if (opkernel->stream && !counted)
+    MKL_CHECK(mkldnn_stream_wait(opkernel->stream, opkernel->net_size, NULL));
+  thread_runtime_exit();
   if (verbose) {
     clock_gettime(CLOCK_REALTIME, &end);
     printf("\nOpkernel%d Exec start: %lld.%lld s end: %lld.%lld s time_taken: "
@@ -429,6 +667,39 @@ mkldnn_memory_desc_t* query_opkernel_layout(mkldnn_opkernel_t opkernel,
   return md;
 }
 
+mkldnn_memory_desc_t* query_opkernel_input_layout(mkldnn_opkernel_t opkernel,
+                                                  int index) {
+  assert(index < opkernel->num_inputs);
+  mkldnn_memory_desc_t* md =
+      mkldnn_primitive_desc_query_memory_d(opkernel->inputs[index].desc);
+  return md;
+}
+
+const char* query_opkernel_impl_info(mkldnn_opkernel_t opkernel) {
+  const char *str_buf;
+  if (opkernel->custom_impl_info)
+    return opkernel->custom_impl_info;
+  MKL_CHECK(mkldnn_primitive_desc_query(opkernel->op_desc,
+                                        mkldnn_query_impl_info_str, 0, &str_buf));
+  return str_buf;
+}
+
+/* Returns 1 if output out_index may be given the same data handle as input
+ * in_index. Either the input is reordered to an internal buffer before the op
+ * runs, or it has exactly the memory layout of the output so that the
+ * elementwise kernels read every element before writing it. */
+int opkernel_inplace_compatible(mkldnn_opkernel_t opkernel, int in_index,
+                                int out_index) {
+  if (in_index >= opkernel->num_inputs || out_index >= opkernel->num_outputs)
+    return 0;
+  if (mkldnn_memory_primitive_desc_get_size(opkernel->inputs[in_index].desc) !=
+      mkldnn_memory_primitive_desc_get_size(opkernel->outputs[out_index].desc))
+    return 0;
+  if (opkernel->reorder_i[in_index]) return 1;
+  return mkldnn_memory_primitive_desc_equal(opkernel->inputs[in_index].desc,
+                                            opkernel->outputs[out_index].desc);
+}
+
 void create_mkldnn_reorder_kernel(mkldnn_engine_t engine, int ndims, int *dims,
                                   mkldnn_data_type_t data_type,
                                   mkldnn_memory_desc_t* input_md,
@@ -443,18 +714,16 @@ void create_mkldnn_reorder_kernel(mkldnn_engine_t engine, int ndims, int *dims,
       &opkernel->op_desc, opkernel->inputs[0].desc, opkernel->outputs[0].desc));
   mkldnn_primitive_at_t inputs[] = {opkernel->inputs[0].prim};
   const_mkldnn_primitive_t outputs[] = {opkernel->outputs[0].prim};
-  MKL_CHECK(mkldnn_primitive_create(&opkernel->op_prim, opkernel->op_desc,
-                                    inputs, outputs));
+  create_opkernel_primitive(opkernel, inputs, 1, outputs, 1);
   opkernel->num_inputs = 1;
   opkernel->num_outputs = 1;
   opkernel->reorder_i[0] = NULL;
   opkernel->reorder_o[0] = NULL;
-  opkernel->net[opkernel->net_size++] = opkernel->op_prim;
+  opkernel->net[opkernel->net_size++] = NULL; /* op_prim */
 }
 
 void alloc_aligned_memory(void **buf, size_t size,
                            mkldnn_data_type_t data_type, size_t alignment) {
-  size_t size_to_alloc;
   switch (data_type) {
   case mkldnn_f32:
   case mkldnn_s32:
@@ -462,18 +731,8 @@ void alloc_aligned_memory(void **buf, size_t size,
     // allocates memory with the specified alignment
     // sizeof(mkldnn_f32) = 4, should be used while calculating the
     // total allocation size as below.
-    size_to_alloc = size * 4;
-    int _status = posix_memalign(buf, alignment, size_to_alloc);
-    if (_status == 0) {
-      return;
-    } else if (_status == EINVAL) {
-      printf("The value of the alignment parameter is not a power of two or \
-                          is not a multiple of sizeof(void *)");
-    } else if (_status = ENOMEM) {
-      printf("There is insufficient memory available with the requested "
-             "alignment");
-    }
-    exit(2);
+    *buf = alloc_tracked_memory(size * 4, alignment, ENGINE_MEM_REORDER);
+    return;
   default:
     assert(0);
     ;
@@ -481,17 +740,10 @@ void alloc_aligned_memory(void **buf, size_t size,
 }
 
 void *alloc_memory(size_t size, mkldnn_data_type_t data_type) {
-  void *buf;
   switch (data_type) {
   case mkldnn_f32:
   case mkldnn_s32:
-    buf = malloc(size * 4);
-    if (buf == NULL) {
-      printf("Memory allocation failure. Could not allocate %lld bytes\n",
-             size * 4);
-      exit(2);
-    }
-    return buf;
+    return alloc_tracked_memory(size * 4, 64, ENGINE_MEM_REORDER);
   default:
     assert(0);
     ;
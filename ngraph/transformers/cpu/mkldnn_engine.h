@@ -27,6 +27,35 @@ void alloc_aligned_memory(void **buf, size_t size,
 
 void* alloc_memory(size_t size, mkldnn_data_type_t data_type);
 
+/* Categories of memory accounting, see memory_stats.c */
+enum {
+  ENGINE_MEM_REORDER = 0, /* internal tensors kernels reorder into and from */
+  ENGINE_MEM_WORKSPACE,   /* scratch of kernel runs, autotuning and warmup */
+  ENGINE_MEM_TEMPORARY,   /* graph temporaries, added by the transformer */
+  ENGINE_MEM_PERSISTENT,  /* persistent graph tensors, ditto */
+  ENGINE_MEM_NUM_CATEGORIES
+};
+
+/* Buffers from alloc_tracked_memory(), alloc_aligned_memory() and
+ * alloc_memory() are counted until they are released with free_memory(). */
+void *alloc_tracked_memory(size_t bytes, size_t alignment, int category);
+
+void free_memory(void *buf);
+
+size_t tracked_memory_size(void *buf);
+
+void account_memory(int category, long long bytes);
+
+long long query_opkernel_memory(mkldnn_opkernel_t opkernel);
+
+void query_memory_stats(long long *out);
+
+void reset_memory_peaks(void);
+
+int begin_memory_mark(void);
+
+long long end_memory_mark(int mark);
+
 void set_mkl_dimensions(char *primitive_name, int *primitive_src_sizes,
                         int *primitive_dst_sizes, int *primitive_weights_sizes,
                         int *primitive_strides, int *primitive_padding,
@@ -44,6 +73,35 @@ void create_mkldnn_memory_primitive(uint32_t n_dim, const int *dims,
                                     mkldnn_engine_t engine, float *data,
                                     mkldnn_primitive_t *memory);
 
+mkldnn_memory_desc_t *create_mkldnn_layout_descriptor(
+    mkldnn_engine_t engine, int ndims, const int *dim_sizes,
+    const int *dim_strides, mkldnn_data_type_t data_type,
+    mkldnn_memory_format_t fmt);
+
+void delete_mkldnn_layout(mkldnn_memory_desc_t *md);
+
+mkldnn_memory_desc_t *mkldnn_reorder_axes(mkldnn_memory_desc_t *in_md,
+                                          int *axis_order);
+
+mkldnn_memory_desc_t *mkldnn_flatten_axes(mkldnn_memory_desc_t *in_md,
+                                          int *flatten_map);
+
+int mkldnn_compare_memdesc(mkldnn_memory_desc_t *lhs,
+                           mkldnn_memory_desc_t *rhs);
+
+mkldnn_memory_desc_t *query_opkernel_layout(mkldnn_opkernel_t opkernel,
+                                            int index);
+
+mkldnn_memory_desc_t *query_opkernel_input_layout(mkldnn_opkernel_t opkernel,
+                                                  int index);
+
+void create_mkldnn_tensor_from_md(int ndims, const int *dim_sizes,
+                                  mkldnn_memory_desc_t *md,
+                                  mkldnn_engine_t engine,
+                                  mkldnn_tensor *tensor);
+
+void delete_mkldnn_tensor(mkldnn_tensor *tensor);
+
 void create_mkldnn_reorder_primitive(
     mkldnn_primitive_t *user_memory,               /** in */
     const_mkldnn_primitive_desc_t *prim_memory_pd, /** in */
@@ -52,5 +110,255 @@ void create_mkldnn_reorder_primitive(
     mkldnn_primitive_t *reorder      /** out: reorder primitive created */
     );
 
+/* Creates the primitive descriptor for a convolution from one op descriptor
+ * per candidate algorithm. candidates[0] is used unless autotuning is on,
+ * in which case the fastest implementation is chosen and persisted. */
+mkldnn_primitive_desc_t create_conv_primitive_desc(
+    mkldnn_engine_t engine, const mkldnn_convolution_desc_t *candidates,
+    int num_candidates);
+
+void set_conv_autotune(const char *table_path, int enable);
+
+/* Creates opkernel->op_prim from opkernel->op_desc. With kernel build threads
+ * running the primitive (and its JIT code) is created in the background. The
+ * builder appends NULL to the net in place of op_prim, which
+ * wait_kernel_build() fills in. */
+void create_opkernel_primitive(mkldnn_opkernel_t opkernel,
+                               const mkldnn_primitive_at_t *srcs, int num_srcs,
+                               const const_mkldnn_primitive_t *dsts,
+                               int num_dsts);
+
+/* Takes a reference to the process-wide pool of build threads, growing it to
+ * num_threads. stop_kernel_build_threads() drops the reference, and the last
+ * one stops the pool. */
+void start_kernel_build_threads(int num_threads);
+
+void stop_kernel_build_threads(void);
+
+void wait_kernel_build(mkldnn_opkernel_t opkernel);
+
+void warmup_opkernel(mkldnn_opkernel_t opkernel);
+
+void run_mkldnn_opkernel(mkldnn_opkernel_t opkernel, int verbose);
+
+const char *query_opkernel_impl_info(mkldnn_opkernel_t opkernel);
+
+/* Per primitive time and hardware counters of kernel runs, see
+ * perf_counters.c */
+int enable_opkernel_counters(int enable);
+
+int opkernel_counters_enabled(void);
+
+void run_opkernel_counted(mkldnn_opkernel_t opkernel);
+
+void reset_opkernel_counters(mkldnn_opkernel_t opkernel);
+
+void delete_opkernel_counters(mkldnn_opkernel_t opkernel);
+
+long long query_opkernel_counters(mkldnn_opkernel_t opkernel, int entry,
+                                  double *out);
+
+/* Threads of kernel runs, see thread_runtime.c */
+enum {
+  THREAD_STAT_IDLE_NS = 0,   /* teams idle between the kernel runs of callers */
+  THREAD_STAT_IDLE_GAPS,     /* number of such gaps */
+  THREAD_STAT_WAKEUP_NS,     /* team wakeup time, with thread counters */
+  THREAD_STAT_WAKEUPS,       /* number of wakeups measured */
+  THREAD_STAT_MAX_WAKEUP_NS, /* longest wakeup */
+  THREAD_STAT_KERNEL_RUNS,
+  THREAD_NUM_STATS
+};
+
+/* num_threads <= 0 uses the cpus of the list, or all; spin_us < 0 keeps the
+ * spin time of the OpenMP runtime */
+void configure_thread_runtime(int num_threads, int callers, const int *cpus,
+                              int num_cpus, int spin_us);
+
+int query_thread_team_size(void);
+
+void thread_runtime_enter(void);
+
+void thread_runtime_exit(void);
+
+void enable_thread_counters(int enable);
+
+void query_thread_stats(long long *out);
+
+void reset_thread_stats(void);
+
+/* Kernels accept identical input and output data handles when this returns 1
+ * for the pair; the memory planner then lets the output reuse the input. */
+int opkernel_inplace_compatible(mkldnn_opkernel_t opkernel, int in_index,
+                                int out_index);
+
+int create_mkldnn_binary_eltwise_kernel(
+    mkldnn_engine_t engine, int ndims, int *dst_sizes, int *src1_sizes,
+    int *src1_strides, mkldnn_memory_desc_t *src1_md, int *src2_sizes,
+    int *src2_strides, mkldnn_memory_desc_t *src2_md, int alg,
+    mkldnn_data_type_t data_type, mkldnn_opkernel_t opkernel);
+
+/* dst = sum(scales[i] * src[i]) in the layout of src[primary]; inputs in
+ * other layouts are reordered to it first. */
+void create_mkldnn_sum_kernel(mkldnn_engine_t engine, int ndims, int *sizes,
+                              int num_inputs, mkldnn_memory_desc_t **src_mds,
+                              float *scales, int primary,
+                              mkldnn_data_type_t data_type,
+                              mkldnn_opkernel_t opkernel);
+
+void create_mkldnn_add_kernel(mkldnn_engine_t engine, int src1_dims,
+                              int src2_dims, int dst_dims, int *src1_sizes,
+                              int *src2_sizes, int *dst_sizes,
+                              mkldnn_memory_desc_t *src1_md,
+                              mkldnn_memory_desc_t *src2_md,
+                              int num_matrix_to_add,
+                              mkldnn_data_type_t data_type,
+                              mkldnn_opkernel_t opkernel);
+
+void create_mkldnn_conv_fprop_kernel(
+    mkldnn_engine_t engine, int src_dims, int weights_dims, int bias_dims,
+    int dst_dims, int *src_sizes, int *weights_sizes, int *bias_sizes,
+    int *dst_sizes, int *strides, int *padding, int *dilates,
+    mkldnn_memory_desc_t *input_src_md, mkldnn_memory_desc_t *input_weights_md,
+    mkldnn_data_type_t data_type, mkldnn_opkernel_t opkernel);
+
+void create_mkldnn_conv_bprop_data_kernel(
+    mkldnn_engine_t engine, int src_dims, int weights_dims, int dst_dims,
+    int *src_sizes, int *weights_sizes, int *dst_sizes, int *strides,
+    int *padding, int *dilates, mkldnn_memory_desc_t *input_src_md,
+    mkldnn_memory_desc_t *input_weights_md, mkldnn_data_type_t data_type,
+    mkldnn_opkernel_t opkernel);
+
+void create_mkldnn_conv_bprop_weights_kernel(
+    mkldnn_engine_t engine, int src_dims, int weights_dims, int bias_dims,
+    int dst_dims, int *src_sizes, int *weights_sizes, int *bias_sizes,
+    int *dst_sizes, int *strides, int *padding, int *dilates,
+    mkldnn_memory_desc_t *input_src_md, mkldnn_memory_desc_t *output_weights_md,
+    mkldnn_memory_desc_t *input_dst_md, mkldnn_data_type_t data_type,
+    mkldnn_opkernel_t opkernel);
+
+void create_mkldnn_innerproduct_fprop_kernel(
+    mkldnn_engine_t engine, int src_dims, int weights_dims, int bias_dims,
+    int dst_dims, int *src_sizes, int *weights_sizes, int *bias_sizes,
+    int *dst_sizes, mkldnn_memory_desc_t *input_src_md,
+    mkldnn_memory_desc_t *input_weights_md, mkldnn_memory_desc_t *input_bias_md,
+    mkldnn_data_type_t data_type, mkldnn_opkernel_t opkernel);
+
+void create_mkldnn_pool_fprop_kernel(mkldnn_engine_t engine, int src_dims,
+                                     int dst_dims, int *src_sizes,
+                                     int *kernel_sizes, int *dst_sizes,
+                                     int *strides, int *padding, int pool_type,
+                                     mkldnn_memory_desc_t *input_src_md,
+                                     mkldnn_data_type_t data_type,
+                                     mkldnn_opkernel_t opkernel);
+
+void create_mkldnn_pool_bprop_kernel(mkldnn_engine_t engine, int src_dims,
+                                     int dst_dims, int *src_sizes,
+                                     int *kernel_sizes, int *dst_sizes,
+                                     int *strides, int *padding, int pool_type,
+                                     mkldnn_memory_desc_t *input_src_md,
+                                     mkldnn_data_type_t data_type,
+                                     mkldnn_opkernel_t fprop_opkernel,
+                                     mkldnn_opkernel_t opkernel);
+
+void create_mkldnn_relu_fprop_kernel(mkldnn_engine_t engine, int src_size,
+                                     double slope,
+                                     mkldnn_memory_desc_t *input_src_md,
+                                     mkldnn_data_type_t data_type,
+                                     mkldnn_opkernel_t opkernel);
+
+void create_mkldnn_relu_bprop_kernel(mkldnn_engine_t engine, int src_size,
+                                     double slope,
+                                     mkldnn_memory_desc_t *input_fprop_src_md,
+                                     mkldnn_memory_desc_t *input_error_md,
+                                     mkldnn_data_type_t data_type,
+                                     mkldnn_opkernel_t opkernel);
+
+void create_mkldnn_batchnorm_fprop_primitives(
+    mkldnn_engine_t engine, int src_dims, int dst_dims, int weights_dims,
+    int mean_dims, int variance_dims, int mean_sizes, int variance_sizes,
+    int *batchnorm_src_sizes, int *batchnorm_weights_sizes,
+    int *batchnorm_dst_sizes, double epsilon, mkldnn_memory_desc_t *input_src_md,
+    mkldnn_memory_desc_t *input_weights_md, mkldnn_data_type_t data_type,
+    mkldnn_opkernel_t opkernel);
+
+void create_mkldnn_batchnorm_bprop_primitives(
+    mkldnn_engine_t engine, int src_dims, int dst_dims, int weights_dims,
+    int mean_dims, int variance_dims, int *batchnorm_src_sizes,
+    int *batchnorm_dst_sizes, int *batchnorm_weights_sizes, int mean_sizes,
+    int variance_sizes, double epsilon, mkldnn_memory_desc_t *input_fprop_src_md,
+    mkldnn_memory_desc_t *input_weights_md, mkldnn_memory_desc_t *input_mean_md,
+    mkldnn_memory_desc_t *input_variance_md,
+    mkldnn_memory_desc_t *input_error_md, mkldnn_data_type_t data_type,
+    mkldnn_opkernel_t fprop_kernel, mkldnn_opkernel_t opkernel);
+
+void create_mkldnn_reorder_kernel(mkldnn_engine_t engine, int ndims, int *dims,
+                                  mkldnn_data_type_t data_type,
+                                  mkldnn_memory_desc_t *input_md,
+                                  mkldnn_memory_desc_t *output_md,
+                                  mkldnn_opkernel_t opkernel);
+
+mkldnn_opkernel_t create_empty_kernel(int id);
+
+/* Makes input 'index' of the kernel reorder into the internal buffer of input
+ * 'owner_index' of owner, if both reorder to the same layout, and frees its
+ * own. Meant for persistent tensors such as weights that kernels of several
+ * computations reorder identically: every kernel reruns its reorder right
+ * before the op, so kernels that do not run concurrently can share the copy.
+ * Returns 1 if the buffer is shared. */
+int share_opkernel_internal_input(mkldnn_opkernel_t opkernel, int index,
+                                  mkldnn_opkernel_t owner, int owner_index);
+
+/* Returns a copy of the kernel for running it concurrently with the kernel
+ * and its other copies, or NULL if the kernel can not be copied. The copy
+ * shares the descriptors and kernel data of opkernel and has its own memory
+ * primitives, op and reorder primitives, stream and internal buffers, except
+ * for the inputs in the shared_inputs mask (e.g. weights): these use the
+ * internal buffer of opkernel and are reordered by the first copy that runs
+ * after the copies were created or reset_opkernel_contexts() was called.
+ * Copies are deleted with delete_mkldnn_opkernel(). */
+mkldnn_opkernel_t create_opkernel_context(mkldnn_opkernel_t opkernel,
+                                          unsigned shared_inputs);
+
+/* Makes the next copy of opkernel that runs reorder the shared inputs again,
+ * e.g. after the weights were updated */
+void reset_opkernel_contexts(mkldnn_opkernel_t opkernel);
+
+/* Inputs in the layout of the kernel, e.g. weights mapped from a checkpoint,
+ * see prepacked_inputs.c. The prepacked size and layout of an input are 0 and
+ * NULL if the kernel does not reorder it. */
+size_t query_memory_desc_size(void);
+
+size_t query_opkernel_prepacked_size(mkldnn_opkernel_t opkernel, int index);
+
+const mkldnn_memory_desc_t *query_opkernel_prepacked_layout(
+    mkldnn_opkernel_t opkernel, int index);
+
+/* Writes src, in the layout of input index, to dst in the prepacked layout */
+void pack_opkernel_input(mkldnn_opkernel_t opkernel, int index, void *src,
+                         void *dst);
+
+/* Writes src, in layout md, to dst in the layout of input index. Returns 0 if
+ * MKL-DNN can not reorder md to it. */
+int unpack_opkernel_input(mkldnn_opkernel_t opkernel, int index,
+                          const mkldnn_memory_desc_t *md, void *src,
+                          void *dst);
+
+/* Makes the kernel read input index from buffer, data in layout md, instead
+ * of reordering the input on every run. Returns 1 if md is the prepacked
+ * layout of the input. Contexts created afterwards read buffer as well. */
+int bind_opkernel_prepacked_input(mkldnn_opkernel_t opkernel, int index,
+                                  const mkldnn_memory_desc_t *md,
+                                  void *buffer);
+
+void delete_mkldnn_opkernel(mkldnn_opkernel_t opkernel);
+
+void set_input_tensor_data_handle(mkldnn_opkernel_t opkernel, void *buffer,
+                                  int index);
+
+void set_output_tensor_data_handle(mkldnn_opkernel_t opkernel, void *buffer,
+                                   int index);
+
+mkldnn_engine_t init_mkldnn_engine(void);
+
 void destroy_mkldnn_engine(mkldnn_engine_t engine);
 #endif
@@ -35,6 +35,19 @@ typedef struct {
     void* buffer;
 } mkldnn_tensor;
 
+/* cycles, instructions, last level cache misses */
+#define OPKERNEL_NUM_COUNTERS 3
+#define OPKERNEL_COUNTER_FIELDS 7
+
+/* Totals per net primitive of the runs with counters enabled, see
+ * perf_counters.c. Every primitive runs on a stream of its own. */
+typedef struct {
+    long long calls;
+    mkldnn_stream_t streams[MKLDNN_MAX_ARGS];
+    double time_ms[MKLDNN_MAX_ARGS];
+    unsigned long long values[MKLDNN_MAX_ARGS][OPKERNEL_NUM_COUNTERS];
+} opkernel_counters;
+
 struct mkldnn_opkernel {
     int id;   
     int num_inputs;
@@ -53,6 +66,34 @@ struct mkldnn_opkernel {
     int net_size;
     mkldnn_stream_t stream;
     mkldnn_primitive_t net[MKLDNN_MAX_ARGS];
+
+    /* Deferred creation of op_prim by the kernel build threads */
+    int build_state;
+    int num_build_srcs;
+    int num_build_dsts;
+    mkldnn_primitive_at_t build_srcs[MKLDNN_MAX_ARGS];
+    const_mkldnn_primitive_t build_dsts[MKLDNN_MAX_ARGS];
+    struct mkldnn_opkernel *next_build;
+
+    /* Kernels implemented outside MKL-DNN run this instead of the net */
+    void (*run_custom)(struct mkldnn_opkernel *opkernel);
+    void *custom_data;
+    const char *custom_impl_info;
+
+    /* Allocated on the first run with counters enabled */
+    opkernel_counters *counters;
+
+    /* Bit i: internal_inputs[i].buffer belongs to another kernel */
+    unsigned shared_internal_inputs;
+
+    /* Set in a kernel created by create_opkernel_context(): the descriptors,
+     * op_desc and custom_data belong to context_of */
+    struct mkldnn_opkernel *context_of;
+    /* Bit i: the contexts of this kernel have reordered input i */
+    unsigned context_inputs_ready;
+
+    /* Bit i: internal_inputs[i] reads prepacked data, see prepacked_inputs.c */
+    unsigned prepacked_inputs;
 };
 
 typedef struct mkldnn_opkernel* mkldnn_opkernel_t;
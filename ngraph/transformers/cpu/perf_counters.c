@@ -0,0 +1,310 @@
+/*******************************************************************************
+* Copyright 2018 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+/*
+ * Hardware counters per opkernel.
+ *
+ * With counters enabled, run_mkldnn_opkernel() runs every primitive of a
+ * kernel's net on a stream of its own and reads the wall time, cycles,
+ * instructions and last level cache misses around it. Input and output
+ * reorders are therefore accounted separately from the op itself.
+ *
+ * The counters are opened with perf_event_open() for the calling thread with
+ * inherit set, so they also count the OpenMP threads created afterwards;
+ * enable them before the first kernel runs. Where perf events are not
+ * available (other OSes, perf_event_paranoid, containers) only the times are
+ * recorded and the counter values stay 0.
+ *
+ * query_opkernel_counters() also returns the analytical FLOPs and the minimum
+ * bytes moved by each primitive, derived from the kernel shapes, which is
+ * what a roofline report combines with the measured values.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "mkldnn_engine.h"
+#include "mkldnn_util.h"
+
+static int counters_enabled = 0;
+static int counter_fds[OPKERNEL_NUM_COUNTERS] = {-1, -1, -1};
+
+static int open_counter(int index) {
+#ifdef __linux__
+  static const unsigned long long configs[OPKERNEL_NUM_COUNTERS] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES};
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = configs[index];
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  (void)index;
+  return -1;
+#endif
+}
+
+/* Turns per primitive counting on or off. Returns the number of hardware
+ * counters that could be opened (0 to OPKERNEL_NUM_COUNTERS). */
+int enable_opkernel_counters(int enable) {
+  int num_open = 0;
+  for (int i = 0; i < OPKERNEL_NUM_COUNTERS; i++) {
+    if (enable && counter_fds[i] < 0) counter_fds[i] = open_counter(i);
+    if (!enable && counter_fds[i] >= 0) {
+      close(counter_fds[i]);
+      counter_fds[i] = -1;
+    }
+    if (counter_fds[i] >= 0) num_open++;
+  }
+  counters_enabled = enable;
+  return num_open;
+}
+
+int opkernel_counters_enabled(void) { return counters_enabled; }
+
+static void read_counters(unsigned long long *values) {
+  for (int i = 0; i < OPKERNEL_NUM_COUNTERS; i++) {
+    values[i] = 0;
+    if (counter_fds[i] >= 0 &&
+        read(counter_fds[i], &values[i], sizeof(values[i])) !=
+            sizeof(values[i]))
+      values[i] = 0;
+  }
+}
+
+static double elapsed_ms(struct timespec *start, struct timespec *end) {
+  return (end->tv_sec - start->tv_sec) * 1e3 +
+         (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void run_counted_primitive(opkernel_counters *counters, int entry,
+                                  mkldnn_primitive_t primitive) {
+  mkldnn_primitive_t error_primitive;
+  mkldnn_status_t s;
+  if (!counters->streams[entry]) {
+    MKL_CHECK(mkldnn_stream_create(&counters->streams[entry], mkldnn_eager));
+    s = mkldnn_stream_submit(counters->streams[entry], 1, &primitive,
+                             &error_primitive);
+  } else {
+    s = mkldnn_stream_rerun(counters->streams[entry], &error_primitive);
+  }
+  if (s != mkldnn_success) {
+    printf(
+        "[%s:%d] error: mkldnn_stream_submit returns %d, error_primitive: %p\n",
+        __FILE__, __LINE__, s, error_primitive);
+    exit(2);
+  }
+  MKL_CHECK(mkldnn_stream_wait(counters->streams[entry], 1, NULL));
+}
+
+static int num_counter_entries(mkldnn_opkernel_t opkernel) {
+  return opkernel->run_custom ? 1 : opkernel->net_size;
+}
+
+void run_opkernel_counted(mkldnn_opkernel_t opkernel) {
+  wait_kernel_build(opkernel);
+  if (!opkernel->counters)
+    opkernel->counters =
+        (opkernel_counters *)calloc(1, sizeof(opkernel_counters));
+  opkernel_counters *counters = opkernel->counters;
+  for (int i = 0; i < num_counter_entries(opkernel); i++) {
+    unsigned long long before[OPKERNEL_NUM_COUNTERS];
+    unsigned long long after[OPKERNEL_NUM_COUNTERS];
+    struct timespec start, end;
+    read_counters(before);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (opkernel->run_custom)
+      opkernel->run_custom(opkernel);
+    else
+      run_counted_primitive(counters, i, opkernel->net[i]);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    read_counters(after);
+    counters->time_ms[i] += elapsed_ms(&start, &end);
+    for (int c = 0; c < OPKERNEL_NUM_COUNTERS; c++)
+      counters->values[i][c] += after[c] - before[c];
+  }
+  counters->calls++;
+}
+
+void reset_opkernel_counters(mkldnn_opkernel_t opkernel) {
+  opkernel_counters *counters = opkernel->counters;
+  if (!counters) return;
+  counters->calls = 0;
+  memset(counters->time_ms, 0, sizeof(counters->time_ms));
+  memset(counters->values, 0, sizeof(counters->values));
+}
+
+void delete_opkernel_counters(mkldnn_opkernel_t opkernel) {
+  opkernel_counters *counters = opkernel->counters;
+  if (!counters) return;
+  for (int i = 0; i < MKLDNN_MAX_ARGS; i++) {
+    if (counters->streams[i])
+      MKL_CHECK(mkldnn_stream_destroy(counters->streams[i]));
+  }
+  free(counters);
+  opkernel->counters = NULL;
+}
+
+static double md_elems(const mkldnn_memory_desc_t *md) {
+  double elems = 1;
+  for (int i = 0; i < md->ndims; i++) elems *= md->dims[i];
+  return elems;
+}
+
+static double pd_bytes(const_mkldnn_primitive_desc_t pd) {
+  return (double)mkldnn_memory_primitive_desc_get_size(pd);
+}
+
+static const mkldnn_memory_desc_t *op_md(mkldnn_opkernel_t opkernel,
+                                         mkldnn_query_t what,
+                                         mkldnn_query_t diff_what) {
+  const_mkldnn_primitive_desc_t pd =
+      mkldnn_primitive_desc_query_pd(opkernel->op_desc, what, 0);
+  if (!pd) pd = mkldnn_primitive_desc_query_pd(opkernel->op_desc, diff_what, 0);
+  return pd ? mkldnn_primitive_desc_query_memory_d(pd) : NULL;
+}
+
+/* Floating point operations of one run of the op primitive, counting a fused
+ * multiply-add as two. Elementwise ops count one per output element. */
+static double op_flops(mkldnn_opkernel_t opkernel) {
+  if (opkernel->run_custom || !opkernel->op_desc)
+    return opkernel->num_outputs
+               ? md_elems(mkldnn_primitive_desc_query_memory_d(
+                     opkernel->outputs[0].desc))
+               : 0;
+
+  mkldnn_primitive_kind_t kind;
+  MKL_CHECK(mkldnn_primitive_desc_query(
+      opkernel->op_desc, mkldnn_query_primitive_kind, 0, &kind));
+  const mkldnn_memory_desc_t *dst =
+      op_md(opkernel, mkldnn_query_dst_pd, mkldnn_query_diff_dst_pd);
+  const mkldnn_memory_desc_t *src =
+      op_md(opkernel, mkldnn_query_src_pd, mkldnn_query_diff_src_pd);
+  switch (kind) {
+    case mkldnn_convolution:
+    case mkldnn_inner_product: {
+      /* Every weight is used once per output image position */
+      const mkldnn_memory_desc_t *weights = op_md(
+          opkernel, mkldnn_query_weights_pd, mkldnn_query_diff_weights_pd);
+      if (!weights || !dst || dst->ndims < 2) return 0;
+      double positions = md_elems(dst) / dst->dims[1];
+      return 2 * md_elems(weights) * positions;
+    }
+    case mkldnn_pooling: {
+      const mkldnn_pooling_desc_t *pool_desc;
+      MKL_CHECK(mkldnn_primitive_desc_query(
+          opkernel->op_desc, mkldnn_query_pooling_d, 0, &pool_desc));
+      if (!dst) return 0;
+      return md_elems(dst) * pool_desc->kernel[0] * pool_desc->kernel[1];
+    }
+    case mkldnn_batch_normalization: {
+      if (!src) return 0;
+      /* mean, variance and normalize; the backward pass also reduces the
+       * two weight gradients */
+      int backward = op_md(opkernel, mkldnn_query_diff_dst_pd,
+                           mkldnn_query_diff_dst_pd) != NULL;
+      return (backward ? 8 : 5) * md_elems(src);
+    }
+    case mkldnn_sum: {
+      int num_inputs = 0;
+      MKL_CHECK(mkldnn_primitive_desc_query(
+          opkernel->op_desc, mkldnn_query_num_of_inputs_s32, 0, &num_inputs));
+      return dst ? (2 * num_inputs - 1) * md_elems(dst) : 0;
+    }
+    case mkldnn_reorder:
+      return 0;
+    default:
+      return dst ? md_elems(dst) : 0;
+  }
+}
+
+/* Bytes the op primitive reads and writes at least once: every input and
+ * output in the layout the op runs in. */
+static double op_bytes(mkldnn_opkernel_t opkernel) {
+  double bytes = 0;
+  for (int i = 0; i < opkernel->num_inputs; i++) {
+    bytes += pd_bytes(opkernel->reorder_i[i] ? opkernel->internal_inputs[i].desc
+                                             : opkernel->inputs[i].desc);
+  }
+  for (int i = 0; i < opkernel->num_outputs; i++) {
+    bytes += pd_bytes(opkernel->reorder_o[i]
+                          ? opkernel->internal_outputs[i].desc
+                          : opkernel->outputs[i].desc);
+  }
+  return bytes;
+}
+
+/* Bytes read and written by the reorder primitive in the net, or -1 if it is
+ * not one of the kernel's input or output reorders. */
+static double reorder_bytes(mkldnn_opkernel_t opkernel,
+                            mkldnn_primitive_t primitive) {
+  for (int i = 0; i < opkernel->num_inputs; i++) {
+    if (opkernel->reorder_i[i] == primitive)
+      return pd_bytes(opkernel->inputs[i].desc) +
+             pd_bytes(opkernel->internal_inputs[i].desc);
+  }
+  for (int i = 0; i < opkernel->num_outputs; i++) {
+    if (opkernel->reorder_o[i] == primitive)
+      return pd_bytes(opkernel->outputs[i].desc) +
+             pd_bytes(opkernel->internal_outputs[i].desc);
+  }
+  return -1;
+}
+
+/* Totals of net entry 'entry' of the kernel over all counted runs. Fills
+ * out[OPKERNEL_COUNTER_FIELDS] with
+ *   is_reorder, time_ms, cycles, instructions, llc_misses, flops, bytes
+ * where flops and bytes are the analytical counts of a single run. Returns
+ * the number of counted runs, or -1 past the last entry. */
+long long query_opkernel_counters(mkldnn_opkernel_t opkernel, int entry,
+                                  double *out) {
+  wait_kernel_build(opkernel);
+  if (entry < 0 || entry >= num_counter_entries(opkernel)) return -1;
+
+  opkernel_counters *counters = opkernel->counters;
+  out[1] = counters ? counters->time_ms[entry] : 0;
+  for (int c = 0; c < OPKERNEL_NUM_COUNTERS; c++)
+    out[2 + c] = counters ? (double)counters->values[entry][c] : 0;
+
+  double bytes = opkernel->run_custom
+                     ? -1
+                     : reorder_bytes(opkernel, opkernel->net[entry]);
+  if (bytes >= 0) {
+    out[0] = 1;
+    out[5] = 0;
+    out[6] = bytes;
+  } else {
+    mkldnn_primitive_kind_t kind = mkldnn_undefined_primitive;
+    if (opkernel->op_desc && !opkernel->run_custom)
+      MKL_CHECK(mkldnn_primitive_desc_query(
+          opkernel->op_desc, mkldnn_query_primitive_kind, 0, &kind));
+    out[0] = kind == mkldnn_reorder;
+    out[5] = op_flops(opkernel);
+    out[6] = op_bytes(opkernel);
+  }
+  return counters ? counters->calls : 0;
+}
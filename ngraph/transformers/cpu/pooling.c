@@ -126,11 +126,11 @@ void create_mkldnn_pool_fprop_kernel(mkldnn_engine_t engine, int src_dims,
       mkldnn_primitive_at(mkldnn_memory_prim_src, 0)};
 
   /* create a pooling primitive */
-  MKL_CHECK(mkldnn_primitive_create(&opkernel->op_prim, opkernel->op_desc,
-                                    pool_srcs, pool_dsts));
+  create_opkernel_primitive(opkernel, pool_srcs, 1, pool_dsts,
+                            pool_type == 0 ? 2 : 1);
   if (opkernel->reorder_i[0])
       opkernel->net[opkernel->net_size++] = opkernel->reorder_i[0];
-  opkernel->net[opkernel->net_size++] = opkernel->op_prim;
+  opkernel->net[opkernel->net_size++] = NULL; /* op_prim */
 }
 
 void create_mkldnn_pool_bprop_kernel(mkldnn_engine_t engine, int src_dims,
@@ -241,13 +241,12 @@ void create_mkldnn_pool_bprop_kernel(mkldnn_engine_t engine, int src_dims,
   pool_srcs[0] = mkldnn_primitive_at(mkldnn_memory_prim_src, 0);
   if (pool_type == 0)
     pool_srcs[1] = mkldnn_primitive_at(opkernel->inputs[1].prim, 0);
-  mkldnn_primitive_at_t pool_dsts[] = {
-      mkldnn_primitive_at(opkernel->outputs[0].prim, 0)};
+  const_mkldnn_primitive_t pool_dsts[] = {opkernel->outputs[0].prim};
 
   /* create a pooling primitive */
-  MKL_CHECK(mkldnn_primitive_create(&opkernel->op_prim, opkernel->op_desc,
-                                    pool_srcs, pool_dsts));
+  create_opkernel_primitive(opkernel, pool_srcs, pool_type == 0 ? 2 : 1,
+                            pool_dsts, 1);
   if (opkernel->reorder_i[0])
       opkernel->net[opkernel->net_size++] = opkernel->reorder_i[0];
-  opkernel->net[opkernel->net_size++] = opkernel->op_prim;
+  opkernel->net[opkernel->net_size++] = NULL; /* op_prim */
 }
@@ -0,0 +1,151 @@
+/*******************************************************************************
+* Copyright 2018 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+/*
+ * Kernel inputs in the layout of the kernel (prepacked).
+ *
+ * Kernels whose input layout differs from the layout their op wants reorder
+ * the input into an internal buffer on every run. For weights that do not
+ * change between runs this reorder can be done once, when the weights are
+ * saved: pack_opkernel_input() writes an input in the internal layout, and
+ * bind_opkernel_prepacked_input() makes the kernel read such data (e.g. a
+ * read-only mapping of a checkpoint) in place of its internal buffer and drops
+ * the reorder from its net. unpack_opkernel_input() converts packed data back
+ * to the layout of the input for the ops that read it natively.
+ *
+ * The internal buffer of a bound kernel is kept, since other kernels may
+ * share it (see share_opkernel_internal_input()), and freed with the kernel.
+ */
+
+#include "mkldnn_engine.h"
+#include "mkldnn_util.h"
+
+static void run_primitive(mkldnn_primitive_t prim) {
+  mkldnn_stream_t stream;
+  mkldnn_primitive_t error_primitive;
+  MKL_CHECK(mkldnn_stream_create(&stream, mkldnn_eager));
+  MKL_CHECK(mkldnn_stream_submit(stream, 1, &prim, &error_primitive));
+  MKL_CHECK(mkldnn_stream_wait(stream, 1, NULL));
+  MKL_CHECK(mkldnn_stream_destroy(stream));
+}
+
+size_t query_memory_desc_size(void) { return sizeof(mkldnn_memory_desc_t); }
+
+size_t query_opkernel_prepacked_size(mkldnn_opkernel_t opkernel, int index) {
+  if (index >= opkernel->num_inputs || !opkernel->reorder_i[index]) return 0;
+  return mkldnn_memory_primitive_desc_get_size(
+      opkernel->internal_inputs[index].desc);
+}
+
+const mkldnn_memory_desc_t *query_opkernel_prepacked_layout(
+    mkldnn_opkernel_t opkernel, int index) {
+  if (!query_opkernel_prepacked_size(opkernel, index)) return NULL;
+  return mkldnn_primitive_desc_query_memory_d(
+      opkernel->internal_inputs[index].desc);
+}
+
+void pack_opkernel_input(mkldnn_opkernel_t opkernel, int index, void *src,
+                         void *dst) {
+  void *saved_src, *saved_dst;
+  assert(query_opkernel_prepacked_size(opkernel, index));
+  wait_kernel_build(opkernel);
+  mkldnn_primitive_t input = opkernel->inputs[index].prim;
+  mkldnn_primitive_t internal = opkernel->internal_inputs[index].prim;
+  MKL_CHECK(mkldnn_memory_get_data_handle(input, &saved_src));
+  MKL_CHECK(mkldnn_memory_get_data_handle(internal, &saved_dst));
+  MKL_CHECK(mkldnn_memory_set_data_handle(input, src));
+  MKL_CHECK(mkldnn_memory_set_data_handle(internal, dst));
+  run_primitive(opkernel->reorder_i[index]);
+  MKL_CHECK(mkldnn_memory_set_data_handle(input, saved_src));
+  MKL_CHECK(mkldnn_memory_set_data_handle(internal, saved_dst));
+}
+
+/* The memory primitive descriptor of md on the engine of the kernel input,
+ * or NULL if MKL-DNN does not accept md */
+static mkldnn_primitive_desc_t create_input_md_desc(
+    mkldnn_opkernel_t opkernel, int index, const mkldnn_memory_desc_t *md) {
+  mkldnn_engine_t engine;
+  mkldnn_primitive_desc_t desc;
+  MKL_CHECK(mkldnn_primitive_desc_query(opkernel->inputs[index].desc,
+                                        mkldnn_query_engine, 0, &engine));
+  if (mkldnn_memory_primitive_desc_create(&desc, md, engine) != mkldnn_success)
+    return NULL;
+  return desc;
+}
+
+int unpack_opkernel_input(mkldnn_opkernel_t opkernel, int index,
+                          const mkldnn_memory_desc_t *md, void *src,
+                          void *dst) {
+  if (index >= opkernel->num_inputs) return 0;
+  mkldnn_primitive_desc_t src_desc = create_input_md_desc(opkernel, index, md);
+  if (!src_desc) return 0;
+  mkldnn_primitive_desc_t reorder_desc;
+  if (mkldnn_reorder_primitive_desc_create(&reorder_desc, src_desc,
+                                           opkernel->inputs[index].desc) !=
+      mkldnn_success) {
+    MKL_CHECK(mkldnn_primitive_desc_destroy(src_desc));
+    return 0;
+  }
+  mkldnn_primitive_t src_memory, dst_memory, reorder;
+  MKL_CHECK(mkldnn_primitive_create(&src_memory, src_desc, NULL, NULL));
+  MKL_CHECK(mkldnn_primitive_create(&dst_memory, opkernel->inputs[index].desc,
+                                    NULL, NULL));
+  MKL_CHECK(mkldnn_memory_set_data_handle(src_memory, src));
+  MKL_CHECK(mkldnn_memory_set_data_handle(dst_memory, dst));
+  mkldnn_primitive_at_t srcs[] = {mkldnn_primitive_at(src_memory, 0)};
+  const_mkldnn_primitive_t dsts[] = {dst_memory};
+  MKL_CHECK(mkldnn_primitive_create(&reorder, reorder_desc, srcs, dsts));
+  run_primitive(reorder);
+  MKL_CHECK(mkldnn_primitive_destroy(reorder));
+  MKL_CHECK(mkldnn_primitive_destroy(dst_memory));
+  MKL_CHECK(mkldnn_primitive_destroy(src_memory));
+  MKL_CHECK(mkldnn_primitive_desc_destroy(reorder_desc));
+  MKL_CHECK(mkldnn_primitive_desc_destroy(src_desc));
+  return 1;
+}
+
+int bind_opkernel_prepacked_input(mkldnn_opkernel_t opkernel, int index,
+                                  const mkldnn_memory_desc_t *md,
+                                  void *buffer) {
+  /* Custom kernels run their reorders themselves */
+  if (opkernel->context_of || opkernel->run_custom ||
+      !query_opkernel_prepacked_size(opkernel, index))
+    return 0;
+  mkldnn_primitive_desc_t desc = create_input_md_desc(opkernel, index, md);
+  if (!desc) return 0;
+  int equal = mkldnn_memory_primitive_desc_equal(
+      desc, opkernel->internal_inputs[index].desc);
+  MKL_CHECK(mkldnn_primitive_desc_destroy(desc));
+  if (!equal) return 0;
+
+  wait_kernel_build(opkernel);
+  MKL_CHECK(mkldnn_memory_set_data_handle(opkernel->internal_inputs[index].prim,
+                                          buffer));
+  if (!(opkernel->prepacked_inputs & (1u << index))) {
+    int net_size = 0;
+    for (int i = 0; i < opkernel->net_size; i++)
+      if (opkernel->net[i] != opkernel->reorder_i[index])
+        opkernel->net[net_size++] = opkernel->net[i];
+    opkernel->net_size = net_size;
+    opkernel->prepacked_inputs |= 1u << index;
+    /* The next run submits the net without the reorder */
+    if (opkernel->stream) {
+      MKL_CHECK(mkldnn_stream_destroy(opkernel->stream));
+      opkernel->stream = NULL;
+    }
+  }
+  return 1;
+}
@@ -63,9 +63,8 @@ void create_mkldnn_relu_fprop_kernel(mkldnn_engine_t engine, int src_size,
   mkldnn_primitive_at_t relu_srcs[] = {
       mkldnn_primitive_at(opkernel->inputs[0].prim, 0)};
 
-  MKL_CHECK(mkldnn_primitive_create(&opkernel->op_prim, opkernel->op_desc,
-                                    relu_srcs, relu_dsts));
-  opkernel->net[opkernel->net_size++] = opkernel->op_prim;
+  create_opkernel_primitive(opkernel, relu_srcs, 1, relu_dsts, 1);
+  opkernel->net[opkernel->net_size++] = NULL; /* op_prim */
 }
 
 void create_mkldnn_relu_bprop_kernel(mkldnn_engine_t engine, int src_size,
@@ -195,11 +194,10 @@ void create_mkldnn_relu_bprop_kernel(mkldnn_engine_t engine, int src_size,
       mkldnn_primitive_at(mkldnn_memory_prim_src, 0),
   };
 
-  MKL_CHECK(mkldnn_primitive_create(&opkernel->op_prim, opkernel->op_desc,
-                                    relu_srcs, relu_dsts));
+  create_opkernel_primitive(opkernel, relu_srcs, 2, relu_dsts, 1);
   if (opkernel->reorder_i[0])
     opkernel->net[opkernel->net_size++] = opkernel->reorder_i[0];
   if (opkernel->reorder_i[1])
     opkernel->net[opkernel->net_size++] = opkernel->reorder_i[1];
-  opkernel->net[opkernel->net_size++] = opkernel->op_prim;
+  opkernel->net[opkernel->net_size++] = NULL; /* op_prim */
 }
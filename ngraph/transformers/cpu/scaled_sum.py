@@ -0,0 +1,36 @@
+# ******************************************************************************
+# Copyright 2017-2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+from ngraph.op_graph.op_graph import ElementWiseOp
+
+
+class ScaledSumOp(ElementWiseOp):
+    """
+    sum(scales[i] * args[i]) over args with the axes of the result.
+
+    Created by CPUSumFusion from trees of adds, subtracts, negations and
+    multiplications by scalar constants so that they run as one pass over memory.
+
+    Arguments:
+        args: Tensors to sum, all with the same axes.
+        scales: One float scale per arg.
+    """
+    def __init__(self, args, scales, **kwargs):
+        assert len(args) == len(scales)
+        super(ScaledSumOp, self).__init__(args=args, axes=args[0].axes, **kwargs)
+        self.scales = tuple(float(scale) for scale in scales)
+
+    def copy_with_new_args(self, args):
+        return type(self)(args, self.scales, dtype=self.dtype)
@@ -0,0 +1,478 @@
+# ******************************************************************************
+# Copyright 2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+"""
+Collectives between the processes of one host over POSIX shared memory.
+
+Implements the part of the MLSL Python API that HetrLocals uses (MLSL, its
+distributions, DataType, ReductionType, GroupType and close()), so that
+HETR_COLLECTIVES=shm runs the CPUMlsl* ops of data parallel training without the
+MLSL runtime when all processes share a host.
+
+The processes map one segment with a slot of HETR_SHM_SLOT_BYTES per process.
+Every collective copies its input through the slots in chunks of at most a slot,
+separated by a barrier in which every process only stores its own arrival phase
+and spins until all phases reached its own; no locks or atomic read-modify-write
+are needed. Allreduce splits every chunk into one part per process: each process
+sums its part over all slots (reduce-scatter) and then copies every part from its
+owner's slot (allgather).
+
+Collectives run to completion when they are called; wait() returns at once.
+The barrier relies on stores becoming visible in program order (x86).
+
+ShmPipe passes tensors from one process to another in the same way, for the
+stage boundaries of pipeline parallel computations.
+"""
+from __future__ import division
+
+import ctypes
+import errno
+import mmap
+import os
+import time
+import uuid
+
+import numpy as np
+
+SLOT_BYTES = 8 * 1024 * 1024
+# Bytes of the barrier words of every process, so that they are on separate cache lines
+LINE_BYTES = 64
+SPINS_BEFORE_YIELD = 1000
+
+
+class DataType(object):
+    FLOAT = 0
+    DOUBLE = 1
+    BYTE = 2
+
+
+class ReductionType(object):
+    SUM = 0
+    MIN = 1
+    MAX = 2
+
+
+class GroupType(object):
+    DATA = 0
+    MODEL = 1
+    GLOBAL = 2
+
+
+REDUCTIONS = {ReductionType.SUM: np.add,
+              ReductionType.MIN: np.minimum,
+              ReductionType.MAX: np.maximum}
+
+
+def spin_until(condition, check=None):
+    """
+    Spins until condition() is true. Once spinning starts to yield, check() is called
+    every SPINS_BEFORE_YIELD spins and may raise to stop waiting.
+    """
+    spins = 0
+    while not condition():
+        spins += 1
+        if spins >= SPINS_BEFORE_YIELD:
+            time.sleep(0)
+            if check is not None and spins % SPINS_BEFORE_YIELD == 0:
+                check()
+
+
+def process_alive(pid):
+    """
+    False once process pid exited, also while it is a zombie that its parent did not
+    wait for yet.
+    """
+    try:
+        os.kill(pid, 0)
+    except OSError as e:
+        return e.errno != errno.ESRCH
+    try:
+        with open('/proc/{}/stat'.format(pid)) as f:
+            # The state follows the parenthesized command name
+            return f.read().rsplit(')', 1)[1].split()[0] not in ('Z', 'X')
+    except (IOError, OSError, IndexError):
+        return True
+
+
+class ShmSegment(object):
+    """
+    The shared memory of process_count processes: a barrier line per process
+    followed by a slot of slot_bytes per process.
+
+    Arguments:
+        name: Name of the segment in /dev/shm.
+        process_count: The number of processes.
+        slot_bytes: Bytes of every slot.
+        create: True to create the segment, which the other processes then open.
+    """
+
+    def __init__(self, name, process_count, slot_bytes, create=False):
+        self.name = name
+        self.process_count = process_count
+        self.slot_bytes = slot_bytes - slot_bytes % LINE_BYTES
+        self.slots_offset = LINE_BYTES * process_count
+        size = self.slots_offset + self.slot_bytes * process_count
+        flags = os.O_RDWR | (os.O_CREAT | os.O_EXCL if create else 0)
+        fd = os.open(self.path, flags, 0o600)
+        try:
+            if create:
+                os.ftruncate(fd, size)
+            self.map = mmap.mmap(fd, size)
+        finally:
+            os.close(fd)
+        words = np.frombuffer(self.map, dtype=np.int64, count=self.slots_offset // 8)
+        self.phases = words[::LINE_BYTES // 8]
+
+    @property
+    def path(self):
+        return os.path.join('/dev/shm', self.name)
+
+    def unlink(self):
+        """
+        Removes the name of the segment; the mappings stay valid.
+        """
+        try:
+            os.unlink(self.path)
+        except OSError:
+            pass
+
+    def slot(self, index, dtype):
+        """
+        Slot index viewed as a flat array of dtype.
+        """
+        dtype = np.dtype(dtype)
+        return np.frombuffer(self.map, dtype=dtype, count=self.slot_bytes // dtype.itemsize,
+                             offset=self.slots_offset + index * self.slot_bytes)
+
+    def close(self):
+        self.phases = None
+        try:
+            self.map.close()
+        except BufferError:
+            # Arrays still view the segment; it is unmapped when they are freed
+            pass
+
+
+class ShmDistribution(object):
+    """
+    Collectives of one process over a ShmSegment, with the argument order of an MLSL
+    distribution. Buffers are ctypes arrays (see HetrLocals.as_buffer) or numpy arrays;
+    counts are in elements. Returns None as the request.
+
+    Arguments:
+        segment: The ShmSegment.
+        process_idx: The index of this process.
+    """
+
+    def __init__(self, segment, process_idx):
+        self.segment = segment
+        self.process_idx = process_idx
+        self.process_count = segment.process_count
+        self.phase = 0
+
+    def barrier(self):
+        """
+        Returns once every process reached the same barrier.
+        """
+        self.phase += 1
+        phases = self.segment.phases
+        phases[self.process_idx] = self.phase
+        spin_until(lambda: (phases >= self.phase).all())
+
+    @staticmethod
+    def as_array(buf, count=None):
+        if buf is None:
+            return None
+        if not isinstance(buf, np.ndarray):
+            buf = np.ctypeslib.as_array(buf)
+        buf = buf.reshape(-1)
+        return buf if count is None else buf[:count]
+
+    def chunks(self, count, dtype):
+        step = self.segment.slot_bytes // np.dtype(dtype).itemsize
+        for start in range(0, count, step):
+            yield start, min(start + step, count)
+
+    def parts(self, start, stop):
+        """
+        Splits [start, stop) into one part per process.
+        """
+        bounds = np.linspace(start, stop, self.process_count + 1).astype(int)
+        return list(zip(bounds[:-1], bounds[1:]))
+
+    def reduce_scatter(self, send, start, stop, reduction):
+        """
+        Sums chunk [start, stop) of send over all processes into this process's part
+        of its slot. Returns the parts.
+        """
+        dtype = send.dtype
+        own = self.segment.slot(self.process_idx, dtype)
+        own[:stop - start] = send[start:stop]
+        self.barrier()
+        parts = self.parts(start, stop)
+        lo, hi = parts[self.process_idx]
+        lo, hi = lo - start, hi - start
+        for index in range(self.process_count):
+            if index != self.process_idx:
+                reduction(own[lo:hi], self.segment.slot(index, dtype)[lo:hi], out=own[lo:hi])
+        self.barrier()
+        return parts
+
+    def all_reduce(self, send_buf, recv_buf, count, data_type, red_type, group_type):
+        send = self.as_array(send_buf, count)
+        recv = self.as_array(recv_buf, count)
+        for start, stop in self.chunks(count, send.dtype):
+            parts = self.reduce_scatter(send, start, stop, REDUCTIONS[red_type])
+            for index, (lo, hi) in enumerate(parts):
+                recv[lo:hi] = self.segment.slot(index, send.dtype)[lo - start:hi - start]
+            self.barrier()
+        return None
+
+    def reduce(self, send_buf, recv_buf, count, data_type, red_type, root_idx, group_type):
+        send = self.as_array(send_buf, count)
+        recv = self.as_array(recv_buf, count)
+        for start, stop in self.chunks(count, send.dtype):
+            parts = self.reduce_scatter(send, start, stop, REDUCTIONS[red_type])
+            if self.process_idx == root_idx:
+                for index, (lo, hi) in enumerate(parts):
+                    recv[lo:hi] = self.segment.slot(index, send.dtype)[lo - start:hi - start]
+            self.barrier()
+        return None
+
+    def bcast(self, buf, count, data_type, root_idx, group_type):
+        buf = self.as_array(buf, count)
+        slot = self.segment.slot(root_idx, buf.dtype)
+        for start, stop in self.chunks(count, buf.dtype):
+            if self.process_idx == root_idx:
+                slot[:stop - start] = buf[start:stop]
+            self.barrier()
+            if self.process_idx != root_idx:
+                buf[start:stop] = slot[:stop - start]
+            self.barrier()
+        return None
+
+    def gather(self, send_buf, send_count, recv_buf, data_type, root_idx, group_type):
+        send = self.as_array(send_buf, send_count)
+        recv = self.as_array(recv_buf)
+        own = self.segment.slot(self.process_idx, send.dtype)
+        for start, stop in self.chunks(send_count, send.dtype):
+            own[:stop - start] = send[start:stop]
+            self.barrier()
+            if self.process_idx == root_idx:
+                for index in range(self.process_count):
+                    offset = index * send_count
+                    recv[offset + start:offset + stop] = \
+                        self.segment.slot(index, send.dtype)[:stop - start]
+            self.barrier()
+        return None
+
+    def all_gather(self, send_buf, send_count, recv_buf, data_type, group_type):
+        send = self.as_array(send_buf, send_count)
+        recv = self.as_array(recv_buf)
+        own = self.segment.slot(self.process_idx, send.dtype)
+        for start, stop in self.chunks(send_count, send.dtype):
+            own[:stop - start] = send[start:stop]
+            self.barrier()
+            for index in range(self.process_count):
+                offset = index * send_count
+                recv[offset + start:offset + stop] = \
+                    self.segment.slot(index, send.dtype)[:stop - start]
+            self.barrier()
+        return None
+
+    def scatter(self, send_buf, recv_buf, recv_count, data_type, root_idx, group_type):
+        send = self.as_array(send_buf)
+        recv = self.as_array(recv_buf, recv_count)
+        own = self.segment.slot(self.process_idx, recv.dtype)
+        for start, stop in self.chunks(recv_count, recv.dtype):
+            if self.process_idx == root_idx:
+                for index in range(self.process_count):
+                    offset = index * recv_count
+                    self.segment.slot(index, recv.dtype)[:stop - start] = \
+                        send[offset + start:offset + stop]
+            self.barrier()
+            recv[start:stop] = own[:stop - start]
+            self.barrier()
+        return None
+
+
+class ShmPipe(object):
+    """
+    A queue of tensors from one process to another of the same host, with room for
+    depth tensors of at most slot_bytes, so that the producer can run depth tensors
+    ahead of the consumer. Used between the stages of pipeline parallel computations.
+
+    The producer creates the segment and the consumer waits for it to appear, maps it
+    and unlinks its name. The counts of tensors sent and received are on their own
+    cache lines, and each process only stores its own; a slot is written before the
+    count that publishes it. Each process also stores its pid next to its count, so
+    that a process waiting for its peer raises RuntimeError if the peer exited, or if
+    it waited more than timeout seconds.
+
+    Arguments:
+        name: Name of the segment in /dev/shm.
+        slot_bytes: Bytes of every slot.
+        depth: Number of slots.
+        create: True in the producer.
+        timeout: Seconds to wait for the peer before raising, or None to wait as long
+            as the peer runs.
+    """
+
+    def __init__(self, name, slot_bytes, depth, create=False, timeout=None):
+        self.name = name
+        self.depth = depth
+        self.timeout = timeout
+        self.pids = None
+        self.slot_bytes = -(-slot_bytes // LINE_BYTES) * LINE_BYTES
+        size = 2 * LINE_BYTES + self.slot_bytes * depth
+        path = os.path.join('/dev/shm', name)
+        if create:
+            # Created under a temporary name, so the consumer never maps it half made
+            temp_path = path + '.tmp'
+            fd = os.open(temp_path, os.O_RDWR | os.O_CREAT | os.O_EXCL, 0o600)
+            try:
+                os.ftruncate(fd, size)
+                self.map = mmap.mmap(fd, size)
+            finally:
+                os.close(fd)
+        else:
+            self.wait(lambda: os.path.exists(path))
+            fd = os.open(path, os.O_RDWR)
+            try:
+                self.map = mmap.mmap(fd, size)
+            finally:
+                os.close(fd)
+            os.unlink(path)
+        words = np.frombuffer(self.map, dtype=np.int64, count=2 * LINE_BYTES // 8)
+        self.sent = words[0:1]
+        self.received = words[LINE_BYTES // 8:LINE_BYTES // 8 + 1]
+        pids = words[1:LINE_BYTES // 8 + 2:LINE_BYTES // 8]
+        self.peer = 1 if create else 0
+        pids[1 - self.peer] = os.getpid()
+        self.pids = pids
+        if create:
+            os.rename(temp_path, path)
+        self.count = 0
+
+    def wait(self, condition):
+        """
+        Spins until condition() is true. Raises RuntimeError if the peer exited after
+        it mapped the segment, or once the timeout passed.
+        """
+        if condition():
+            return
+        start = time.time()
+
+        def check():
+            pid = 0 if self.pids is None else int(self.pids[self.peer])
+            # The peer may have published what this process waits for before it exited
+            if pid and not process_alive(pid) and not condition():
+                raise RuntimeError("Process {} at the other end of pipe {} exited"
+                                   .format(pid, self.name))
+            if self.timeout is not None and time.time() - start > self.timeout:
+                raise RuntimeError("Waited more than {} seconds for the other end of "
+                                   "pipe {}".format(self.timeout, self.name))
+
+        spin_until(condition, check)
+
+    def slot(self, index, nbytes):
+        return np.frombuffer(self.map, dtype=np.uint8, count=nbytes,
+                             offset=2 * LINE_BYTES + (index % self.depth) * self.slot_bytes)
+
+    def send(self, x):
+        x = np.ascontiguousarray(x)
+        self.wait(lambda: self.count - self.received[0] < self.depth)
+        self.slot(self.count, x.nbytes)[...] = x.reshape(-1).view(np.uint8)
+        self.count += 1
+        self.sent[0] = self.count
+
+    def recv(self, out):
+        self.wait(lambda: self.sent[0] > self.count)
+        out.reshape(-1).view(np.uint8)[...] = self.slot(self.count, out.nbytes)
+        self.count += 1
+        self.received[0] = self.count
+
+    def close(self):
+        self.sent = self.received = self.pids = None
+        try:
+            self.map.close()
+        except BufferError:
+            # Arrays still view the segment; it is unmapped when they are freed
+            pass
+
+
+class MLSL(object):
+    """
+    Stands in for mlsl.MLSL: the processes are those of MPI.COMM_WORLD, which must
+    all run on this host. init() creates the shared segment.
+    """
+
+    def __init__(self):
+        self.comm = None
+        self.segment = None
+        self.buffers = dict()  # address -> array of alloc()
+
+    def init(self):
+        from mpi4py import MPI
+        self.comm = MPI.COMM_WORLD
+        slot_bytes = int(os.getenv('HETR_SHM_SLOT_BYTES', SLOT_BYTES))
+        name = None
+        if self.comm.Get_rank() == 0:
+            name = 'ngraph_hetr_{}'.format(uuid.uuid4().hex)
+            self.segment = ShmSegment(name, self.comm.Get_size(), slot_bytes, create=True)
+        name = self.comm.bcast(name, root=0)
+        if self.segment is None:
+            self.segment = ShmSegment(name, self.comm.Get_size(), slot_bytes)
+        # Every process has the segment mapped; its name is no longer needed
+        self.comm.Barrier()
+        if self.comm.Get_rank() == 0:
+            self.segment.unlink()
+
+    def get_process_count(self):
+        return self.comm.Get_size()
+
+    def get_process_idx(self):
+        return self.comm.Get_rank()
+
+    def create_distribution(self, data_partitions, model_partitions):
+        if data_partitions != self.get_process_count() or model_partitions != 1:
+            raise ValueError("Shared memory collectives only support data parallelism "
+                             "over all processes")
+        return ShmDistribution(self.segment, self.get_process_idx())
+
+    def delete_distribution(self, distribution):
+        pass
+
+    def wait(self, req):
+        pass
+
+    def alloc(self, size, alignment):
+        buf = np.empty(size + alignment, dtype=np.uint8)
+        offset = -buf.ctypes.data % alignment
+        buf = buf[offset:offset + size]
+        self.buffers[buf.ctypes.data] = buf
+        return ctypes.c_void_p(buf.ctypes.data)
+
+    def free(self, address):
+        self.buffers.pop(address, None)
+
+    def finalize(self):
+        if self.segment is not None:
+            self.segment.close()
+            self.segment = None
+
+
+def close():
+    pass
@@ -0,0 +1,222 @@
+/*******************************************************************************
+* Copyright 2018 Intel Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*******************************************************************************/
+
+/*
+ * Threads of kernel runs.
+ *
+ * MKL-DNN runs the primitives of a kernel on the OpenMP team of the thread
+ * that submits them. Every thread that runs kernels (the caller of a
+ * computation, the threads of execution contexts, HeTr workers) therefore has
+ * a team of its own, each as large as the machine by default, and numpy keeps
+ * a BLAS pool next to them.
+ *
+ * configure_thread_runtime() splits num_threads between the callers that run
+ * kernels at the same time: the n-th thread to run a kernel gets team
+ * n % callers of num_threads / callers threads, and with a cpu list the
+ * threads of that team are pinned one per cpu to the team's slice of the
+ * list. OpenMP keeps the team size per thread, so each caller applies a new
+ * configuration to itself before its next kernel run. spin_us is how long the
+ * threads of a team spin after a kernel before they sleep; it is set at run
+ * time where the OpenMP runtime supports kmp_set_blocktime(), otherwise only
+ * through the environment the transformer sets before the runtime is loaded.
+ *
+ * The stats are the time teams sit idle between the kernel runs of their
+ * caller and, with thread counters enabled, the wakeup time of the team: an
+ * empty parallel region before every kernel run measures how long the last
+ * thread of the team takes to join it.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "mkldnn_engine.h"
+#include "mkldnn_util.h"
+
+#define MAX_THREAD_CPUS 1024
+
+/* Intel OpenMP only */
+extern void kmp_set_blocktime(int milliseconds) __attribute__((weak));
+
+static pthread_mutex_t config_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int config_generation = 0;
+static int config_team_size = 0; /* 0: leave the OpenMP default */
+static int config_callers = 1;
+static int config_spin_us = -1;
+static int config_cpus[MAX_THREAD_CPUS];
+static int config_num_cpus = 0;
+static int next_caller = 0;
+static int counters_enabled = 0;
+static long long stats_reset_ns = 0;
+
+static long long thread_stats[THREAD_NUM_STATS];
+
+static __thread int caller_generation = 0;
+static __thread long long caller_run_end = 0;
+
+static long long now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void add_stat(int stat, long long value) {
+  __atomic_add_fetch(&thread_stats[stat], value, __ATOMIC_RELAXED);
+}
+
+static void max_stat(int stat, long long value) {
+  long long old = __atomic_load_n(&thread_stats[stat], __ATOMIC_RELAXED);
+  while (value > old &&
+         !__atomic_compare_exchange_n(&thread_stats[stat], &old, value, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+static int available_threads(void) {
+#ifdef _OPENMP
+  return omp_get_num_procs();
+#else
+  return 1;
+#endif
+}
+
+void configure_thread_runtime(int num_threads, int callers, const int *cpus,
+                              int num_cpus, int spin_us) {
+  pthread_mutex_lock(&config_mutex);
+  if (num_cpus > MAX_THREAD_CPUS) num_cpus = MAX_THREAD_CPUS;
+  if (callers < 1) callers = 1;
+  if (num_threads <= 0)
+    num_threads = num_cpus > 0 ? num_cpus : available_threads();
+  config_team_size = num_threads / callers > 0 ? num_threads / callers : 1;
+  /* apply_config copies a cpu per team thread to a MAX_THREAD_CPUS array */
+  if (config_team_size > MAX_THREAD_CPUS) config_team_size = MAX_THREAD_CPUS;
+  config_callers = callers;
+  config_spin_us = spin_us;
+  config_num_cpus = num_cpus > 0 ? num_cpus : 0;
+  if (config_num_cpus) memcpy(config_cpus, cpus, num_cpus * sizeof(int));
+  next_caller = 0;
+  __atomic_add_fetch(&config_generation, 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&config_mutex);
+}
+
+int query_thread_team_size(void) {
+  return config_team_size > 0 ? config_team_size : available_threads();
+}
+
+/* Pins thread i of the team of the calling thread to cpus[i]. The OpenMP
+ * runtimes keep the threads of a team in their places between regions of
+ * the same size. */
+static void pin_team(const int *cpus, int team_size) {
+#if defined(_OPENMP) && defined(__linux__)
+#pragma omp parallel num_threads(team_size)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[omp_get_thread_num()], &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+#else
+  (void)cpus;
+  (void)team_size;
+#endif
+}
+
+static void apply_config(void) {
+  int cpus[MAX_THREAD_CPUS];
+  int num_cpus = 0, team_size, spin_us, caller_index;
+  pthread_mutex_lock(&config_mutex);
+  caller_generation = __atomic_load_n(&config_generation, __ATOMIC_ACQUIRE);
+  team_size = config_team_size;
+  spin_us = config_spin_us;
+  caller_index = next_caller++ % config_callers;
+  if (config_num_cpus) {
+    /* The slice of the cpu list of this caller's team, wrapping around */
+    num_cpus = team_size;
+    for (int i = 0; i < team_size; i++)
+      cpus[i] = config_cpus[(caller_index * team_size + i) % config_num_cpus];
+  }
+  pthread_mutex_unlock(&config_mutex);
+#ifdef _OPENMP
+  if (team_size > 0) omp_set_num_threads(team_size);
+#endif
+  if (spin_us >= 0 && kmp_set_blocktime)
+    kmp_set_blocktime((spin_us + 999) / 1000);
+  if (num_cpus) pin_team(cpus, num_cpus);
+}
+
+/* Time from the start of an empty parallel region to the last thread joining
+ * it, the latency a kernel run pays to wake its team */
+static long long probe_team_wakeup(void) {
+  long long start = now_ns();
+  long long last = start;
+#ifdef _OPENMP
+#pragma omp parallel
+  {
+    long long joined = now_ns();
+    long long old = __atomic_load_n(&last, __ATOMIC_RELAXED);
+    while (joined > old &&
+           !__atomic_compare_exchange_n(&last, &old, joined, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      ;
+  }
+#endif
+  return last - start;
+}
+
+void thread_runtime_enter(void) {
+  if (caller_generation !=
+      __atomic_load_n(&config_generation, __ATOMIC_ACQUIRE))
+    apply_config();
+  long long reset = __atomic_load_n(&stats_reset_ns, __ATOMIC_RELAXED);
+  if (caller_run_end) {
+    long long now = now_ns();
+    add_stat(THREAD_STAT_IDLE_NS,
+             now - (caller_run_end > reset ? caller_run_end : reset));
+    add_stat(THREAD_STAT_IDLE_GAPS, 1);
+  }
+  if (counters_enabled) {
+    long long wakeup = probe_team_wakeup();
+    add_stat(THREAD_STAT_WAKEUP_NS, wakeup);
+    add_stat(THREAD_STAT_WAKEUPS, 1);
+    max_stat(THREAD_STAT_MAX_WAKEUP_NS, wakeup);
+  }
+}
+
+void thread_runtime_exit(void) {
+  caller_run_end = now_ns();
+  add_stat(THREAD_STAT_KERNEL_RUNS, 1);
+}
+
+void enable_thread_counters(int enable) { counters_enabled = enable; }
+
+void query_thread_stats(long long *out) {
+  for (int i = 0; i < THREAD_NUM_STATS; i++)
+    out[i] = __atomic_load_n(&thread_stats[i], __ATOMIC_RELAXED);
+}
+
+void reset_thread_stats(void) {
+  for (int i = 0; i < THREAD_NUM_STATS; i++)
+    __atomic_store_n(&thread_stats[i], 0, __ATOMIC_RELAXED);
+  /* Idle gaps that started before are counted from now */
+  __atomic_store_n(&stats_reset_ns, now_ns(), __ATOMIC_RELAXED);
+}
@@ -17,17 +17,20 @@
 from __future__ import division
 from __future__ import print_function
 
-from functools import wraps
+from functools import partial, wraps
 from operator import itemgetter
 # These are indirectly used by the generated code
 import numpy as np
 import os
+import copy
+import hashlib
+import types
 
 from ngraph.util.pygen import PyModule, PyGen, indenting
 from ngraph.util.generics import generic_method
 
 from ngraph.op_graph.op_graph import AbsoluteOp, Add, Argmax, Argmin, \
-    ContiguousOp, CosOp, Op, Divide, FloorDivide, DotLowDimension, \
+    AssignableTensorOp, ContiguousOp, CosOp, Op, Divide, FloorDivide, DotLowDimension, \
     Mod, Equal, ExpOp, Greater, GreaterEqual, Less, LessEqual, \
     LogOp, Max, Maximum, Min, Minimum, Multiply, NegativeOp, NotEqual, OneHotOp, \
     ReciprocalOp, Power, AssignOp, SignOp, SinOp, SqrtOp, SquareOp, RngOp, \
@@ -41,14 +44,23 @@ from ngraph.op_graph.ctc import CTCOp
 from ngraph.op_graph.debug import PrintOp
 from ngraph.transformers.cpu.batchnorm import BatchnormOp, BpropBatchnormOp
 from ngraph.transformers.cpu.relu import ReluOp, BpropReluOp
+from ngraph.transformers.cpu.scaled_sum import ScaledSumOp
+from ngraph.transformers.cpu.bucketing import BucketedComputation
+from ngraph.transformers.cpu.execution_context import ExecutionContext
+from ngraph.transformers.cpu.mkl_checkpoint import Blob, Checkpoint, write_checkpoint
+from ngraph.transformers.cpu.inference_export import export_inference
+from ngraph.transformers.cpu.compiled_cache import compile_cache_dir, graph_signature, \
+    engine_signature, MkldnnRecorder, replay_mkldnn_calls, load_artifact, save_artifact, \
+    CachedTensorView, CacheMiss, is_same_view
 from ngraph.transformers.passes.passes import RequiredTensorShaping, \
     CPUTensorShaping, SimplePrune, HeTrTensorShaping
 from ngraph.transformers.passes.cpulayout import CPUTensorLayout
-from ngraph.transformers.passes.cpufusion import CPUFusion
+from ngraph.transformers.passes.cpufusion import CPUFusion, CPUSumFusion
 from ngraph.transformers.passes.mkldnnpasses import MklCreateOpDescriptors, \
-    MklAddLayoutConversions, MklReorderOp
+    MklAddLayoutConversions, MklAssignLayouts, MklReorderOp
 from ngraph.transformers.passes.expass import SSAConversion, IndexElision, \
     CopyElimination, DeadCodeEliminationPass
+from ngraph.transformers.passes.inplace import CPUInPlacePass
 from ngraph.transformers.passes.memlayout import MemLayoutPass
 from ngraph.transformers.passes.memoptimize import MemOptimizePass
 from ngraph.transformers.passes.liveness import LivenessPass
@@ -75,15 +87,49 @@ logger = logging.getLogger(__name__)
 use_mlsl = False
 
 
-def align_ndarray(element_count, alignment, dtype):
+def align_ndarray(element_count, alignment, dtype, pool_allocator=None):
+    """
+    Aligned memory for the pools of a computation, from pool_allocator (see
+    CPUTransformer) if it has some.
+    """
+    if pool_allocator is not None:
+        pool = pool_allocator(element_count, alignment, dtype)
+        if pool is not None:
+            return pool
     if use_mlsl:
         from ngraph.transformers.cpu.hetr import HetrLocals
         return HetrLocals.mlsl_alloc(element_count, alignment, dtype)
     else:
-        x = np.empty(element_count + (alignment - 1), dtype)
-        offset = (x.ctypes.data % alignment) // dtype.itemsize
-        padding = 0 if offset == 0 else (alignment - offset)
-        return x[padding:padding + element_count]
+        return host_align_ndarray(element_count, alignment, dtype)
+
+
+def host_align_ndarray(element_count, alignment, dtype):
+    """
+    Aligned numpy memory, for buffers that are never passed to MLSL.
+    """
+    x = np.empty(element_count + (alignment - 1), dtype)
+    offset = (x.ctypes.data % alignment) // dtype.itemsize
+    padding = 0 if offset == 0 else (alignment - offset)
+    return x[padding:padding + element_count]
+
+
+def state_op_of(tensor_decl):
+    """
+    Returns the variable or constant stored by tensor_decl, or None.
+    """
+    op = tensor_decl.op
+    if op is None or not op.tensor.is_state_op:
+        return None
+    return op.tensor
+
+
+def is_context_shared(state_op, computation_op):
+    """
+    True if the execution contexts of computation_op share the tensor of state_op, a
+    variable or constant that is not an argument of the computation.
+    """
+    return state_op is not None and not state_op.is_placeholder and \
+        state_op not in set(param.tensor for param in computation_op.parameters)
 
 
 class CPUConvEngine(object):
@@ -185,6 +231,393 @@ class CPUDeviceComputation(DeviceComputation):
         self.pool_slices = dict()
         self.conv_params = dict()
         self.conv_slices = dict()
+        # Namespace and parameter/return view names when loaded from the compile cache
+        self.cached = None
+        # Most engine memory allocated on top of what was held when a call started
+        self.workspace_high_water = 0
+
+    @property
+    def mkldnn(self):
+        """
+        The Mkldnn object whose kernel names the generated code of this computation uses.
+        """
+        if self.cached is not None:
+            return self.cached['namespace']['mkldnn']
+        return self.transformer.mkldnn
+
+    def __call__(self, *args, **kwargs):
+        mkldnn = self.transformer.mkldnn
+        if not mkldnn.enabled:
+            return super(CPUDeviceComputation, self).__call__(*args, **kwargs)
+        # A mark of this call, which calls on other threads do not reset
+        mark = mkldnn.begin_memory_mark()
+        try:
+            return super(CPUDeviceComputation, self).__call__(*args, **kwargs)
+        finally:
+            self.workspace_high_water = max(self.workspace_high_water,
+                                            mkldnn.end_memory_mark(mark))
+
+    def kernel_names(self):
+        if self.cached is not None:
+            # The private kernel table of a cached computation holds just its kernels
+            return list(self.mkldnn.kernels)
+        return [exop.op.safe_name for exop in self.computation_decl.exop_block]
+
+    @property
+    def namespace(self):
+        """
+        The globals of the generated code of this computation.
+        """
+        if self.cached is not None:
+            return self.cached['namespace']
+        return self.transformer.globals
+
+    def executor_params(self):
+        params = {'conv_params': self.conv_params,
+                  'pool_params': self.pool_params,
+                  'conv_slices': self.conv_slices,
+                  'pool_slices': self.pool_slices,
+                  'input_nodes': self.input_nodes}
+        if use_mlsl:
+            params.update({'send_nodes': self.send_nodes,
+                           'recv_nodes': self.recv_nodes,
+                           'scatter_send_nodes': self.scatter_send_nodes,
+                           'scatter_recv_nodes': self.scatter_recv_nodes,
+                           'gather_send_nodes': self.gather_send_nodes,
+                           'gather_recv_nodes': self.gather_recv_nodes,
+                           'allreduce_nodes': self.allreduce_nodes,
+                           'broadcast_send_nodes': self.broadcast_send_nodes,
+                           'broadcast_recv_nodes': self.broadcast_recv_nodes})
+        return params
+
+    def pool_name(self, kind):
+        if self.cached is not None:
+            return next((name for name in self.namespace.keys()
+                         if name.endswith('_{}_pool'.format(kind))), None)
+        return '{}_{}_pool'.format(self.computation_op.name, kind)
+
+    def pool(self, kind):
+        return self.namespace.get(self.pool_name(kind), None)
+
+    def memory_stats(self):
+        """
+        Bytes of memory used by this computation: its temporary and persistent graph
+        tensor pools (the temporary pool is the high-water mark of the memory planner),
+        the internal tensors of its MKL-DNN kernels and the most workspace allocated
+        during one call so far. 'high_water' is their sum.
+        """
+        stats = dict()
+        for kind in ('temporary', 'persistent'):
+            pool = self.pool(kind)
+            stats[kind] = 0 if pool is None else pool.nbytes
+        stats['reorder_scratch'] = sum(self.mkldnn.kernel_memory(name)
+                                       for name in self.kernel_names())
+        stats['workspace_high_water'] = self.workspace_high_water
+        stats['high_water'] = sum(stats.values())
+        return stats
+
+    def roofline_report(self, **kwargs):
+        """
+        Roofline rows of the MKL-DNN kernels of this computation, see
+        Mkldnn.roofline_report.
+        """
+        return self.mkldnn.roofline_report(self.kernel_names(), **kwargs)
+
+    def private_tensor_names(self):
+        """
+        Names of the persistent tensors used by this computation that every execution
+        context has its own copy of: arguments and tensors that are not variables or
+        constants.
+        """
+        if self.cached is not None:
+            return self.cached['private_tensors']
+        computation_decl = self.computation_decl
+        tensor_decls = set(computation_decl.get_tensor_decl(op=param.tensor)
+                           for param in self.computation_op.parameters)
+        for exop in computation_decl.exop_block:
+            tensor_decls.update(input_decl.tensor_decl for input_decl in exop.input_decls)
+            tensor_decls.update(output_decl.tensor_decl for output_decl in exop.output_decls)
+        names = set()
+        for tensor_decl in tensor_decls:
+            device_tensor = self.transformer.device_tensors.get(tensor_decl)
+            if device_tensor is None or not tensor_decl.is_persistent or \
+                    is_context_shared(state_op_of(tensor_decl), self.computation_op):
+                continue
+            names.add(device_tensor.name)
+        return sorted(names)
+
+    def parameter_tensors(self):
+        """
+        The arrays the arguments of this computation are copied into, in the order of
+        its parameters.
+        """
+        if self.cached is not None:
+            return [self.namespace[self.cached['parameters'][op]]
+                    for op in self.computation_op.parameters]
+        tensors = []
+        for op in self.computation_op.parameters:
+            tensor_decl = self.computation_decl.get_tensor_decl(op=op.tensor)
+            tensors.append(
+                self.transformer.device_tensor_view(tensor_decl.root_tensor_view_decl).tensor)
+        return tensors
+
+    def shared_kernel_inputs(self):
+        """
+        Bit masks of the inputs of every kernel whose reordered copy execution contexts
+        share: the persistent inputs registered with Mkldnn.share_reorder that are
+        variables or constants. Cached computations do not register them.
+        """
+        masks = dict()
+        if self.cached is not None:
+            return masks
+        for tensor_decl, users in self.mkldnn.shared_reorders.items():
+            if is_context_shared(state_op_of(tensor_decl), self.computation_op):
+                for kernel, index in users:
+                    masks[kernel] = masks.get(kernel, 0) | (1 << index)
+        return masks
+
+    def context(self):
+        """
+        Returns an ExecutionContext that runs this computation with its own temporary
+        tensors, arguments and MKL-DNN kernel copies, so that several threads can call
+        one compiled computation concurrently, each with its own context.
+        """
+        if any((self.send_nodes, self.recv_nodes, self.scatter_send_nodes,
+                self.scatter_recv_nodes, self.gather_send_nodes, self.gather_recv_nodes,
+                self.allreduce_nodes, self.broadcast_send_nodes, self.broadcast_recv_nodes)):
+            raise ValueError("Computations with communication ops can not run in several "
+                             "contexts")
+        self.transformer.initialize()
+        if self.cached is not None:
+            views = self.cached
+        else:
+            views = self.transformer.computation_views(self.computation_decl)
+        kernel_names = self.kernel_names() + list(views['lazy_returns'].values())
+        mkldnn = self.mkldnn.context(kernel_names, self.shared_kernel_inputs())
+
+        namespace = dict(self.namespace)
+        namespace['mkldnn'] = mkldnn
+        pools = self.copy_private_tensors(namespace)
+
+        # The executor class of the context runs the generated code in namespace
+        cls = type(self.executor)
+        call = cls.__dict__['__call__']
+        context_call = types.FunctionType(call.__code__, namespace, call.__name__,
+                                          call.__defaults__, call.__closure__)
+        context_cls = type(cls.__name__, (cls,), {'__call__': context_call})
+        executor = context_cls(**self.executor_params())
+        return ExecutionContext(self, namespace, executor, views, pools)
+
+    def save_mkl_checkpoint(self, path):
+        """
+        Saves the variables and constants of this computation to path, each in the
+        layouts the MKL-DNN kernels of the computation reorder it to, see
+        ngraph.transformers.cpu.mkl_checkpoint. Variables the computation updates, reads
+        as is or returns are saved in their native layout as well.
+
+        Raises:
+            ValueError: If the computation was loaded from the compile cache.
+        """
+        if self.cached is not None:
+            raise ValueError("Computations loaded from the compile cache do not have the "
+                             "layouts of their kernels")
+        self.transformer.initialize()
+        mkldnn = self.mkldnn
+        computation_decl = self.computation_decl
+        packed = dict()     # state op -> {layout: [(kernel name, index, input_decl)]}
+        written = set()
+        native = set()
+        for exop in computation_decl.exop_block:
+            for decl in exop.write_args + list(exop.output_decls):
+                written.add(state_op_of(decl.tensor_decl))
+            for index, input_decl in enumerate(exop.input_decls):
+                state_op = state_op_of(input_decl.tensor_decl)
+                if state_op is None:
+                    continue
+                layout = mkldnn.prepacked_layout(exop.op.safe_name, index)
+                if layout is None:
+                    native.add(state_op)
+                else:
+                    packed.setdefault(state_op, dict()).setdefault(layout, []).append(
+                        (exop.op.safe_name, index, input_decl))
+        if computation_decl.returns is not None:
+            native.update(state_op_of(decl.tensor_decl)
+                          for decl in computation_decl.returns.input_decls)
+
+        native.update(written)
+
+        tensors = dict()
+        for state_op in set(packed) | native:
+            if not is_context_shared(state_op, self.computation_op):
+                continue
+            namespace, name = self.transformer.state_tensors[state_op]
+            array = namespace[name]
+            blobs = []
+            # The kernels reading updated variables keep reordering them on every run
+            if state_op not in written:
+                for layout, users in sorted(packed.get(state_op, dict()).items()):
+                    kernel, index, input_decl = users[0]
+                    src = self.transformer.device_tensor_view(input_decl.tensor_view_decl)
+                    blobs.append(Blob(mkldnn.prepacked_size(kernel, index),
+                                      lambda view, kernel=kernel, index=index, src=src.tensor:
+                                      mkldnn.pack_input(kernel, index, src, view),
+                                      layout, [(k, i) for k, i, _ in users]))
+            if state_op in native or not blobs:
+                blobs.append(Blob(array.nbytes,
+                                  lambda view, array=array:
+                                  np.copyto(view, array.view(np.uint8))))
+            tensors[state_op.name] = (state_op.axes.lengths, array.dtype, blobs)
+        write_checkpoint(path, tensors,
+                         mkldnn.query_memory_desc_size() if mkldnn.enabled else 0)
+
+    def load_mkl_checkpoint(self, path, native=False):
+        """
+        Loads the variables and constants saved with save_mkl_checkpoint. The checkpoint
+        is mapped read-only and the kernels that reorder a variable to the layout of one
+        of its packed blobs read the blob in place from then on. Variables are reordered
+        back to their native layout only when no native copy was saved and a kernel
+        that reads the packed blob can not be bound to it.
+
+        Arguments:
+            path: The checkpoint file.
+            native: Load every variable in its native layout and bind no kernels, e.g.
+                to keep training the variables.
+
+        Returns:
+            dict of the number of kernel inputs bound to packed blobs ('bound_inputs'),
+            the bytes copied ('copied_bytes') and reordered ('reordered_bytes') to native
+            variables, and the names in the checkpoint missing in the transformer
+            ('missing').
+
+        Raises:
+            ValueError: If a variable has another size than in the checkpoint, or can
+                not be converted to its native layout.
+        """
+        self.transformer.initialize()
+        mkldnn = self.mkldnn
+        checkpoint = Checkpoint(path)
+        bind = not native and mkldnn.enabled and \
+            checkpoint.md_size == mkldnn.query_memory_desc_size()
+        states = dict((state_op.name, state)
+                      for state_op, state in self.transformer.state_tensors.items())
+        stats = {'bound_inputs': 0, 'copied_bytes': 0, 'reordered_bytes': 0, 'missing': []}
+        for name, entry in sorted(checkpoint.tensors.items()):
+            if name not in states:
+                stats['missing'].append(name)
+                continue
+            namespace, tensor_name = states[name]
+            array = namespace[tensor_name]
+            nbytes = int(np.prod(entry['shape'])) * np.dtype(entry['dtype']).itemsize
+            if nbytes != array.nbytes:
+                raise ValueError("{} has {} bytes, {} in {}".format(
+                    name, array.nbytes, nbytes, path))
+            native_blob = None
+            unbound = []
+            for blob in entry['blobs']:
+                layout = checkpoint.layout(blob)
+                if layout is None:
+                    native_blob = blob
+                    continue
+                data = checkpoint.blob(blob)
+                for kernel, index in blob['kernels']:
+                    if bind and kernel in mkldnn.kernels and \
+                            mkldnn.bind_input(kernel, index, layout, data):
+                        stats['bound_inputs'] += 1
+                    else:
+                        unbound.append((kernel, index, layout, data))
+            if native_blob is not None:
+                np.copyto(array.view(np.uint8), checkpoint.blob(native_blob))
+                stats['copied_bytes'] += array.nbytes
+            elif unbound:
+                if not any(mkldnn.enabled and kernel in mkldnn.kernels and
+                           mkldnn.unpack_input(kernel, index, layout, data, array)
+                           for kernel, index, layout, data in unbound):
+                    raise ValueError("{} in {} has no native copy and no kernel of this "
+                                     "computation can reorder it".format(name, path))
+                stats['reordered_bytes'] += array.nbytes
+        if stats['missing']:
+            logger.warning("Variables of %s not in the transformer: %s", path,
+                           ', '.join(stats['missing']))
+        self.transformer.mkl_checkpoints.append(checkpoint)
+        mkldnn.reset_contexts()
+        return stats
+
+    def export_inference(self, path):
+        """
+        Writes this computation, with the current values of its variables and
+        constants, to path for the standalone runtime of inference_runtime.h, see
+        ngraph.transformers.cpu.inference_export. The parameters become the inputs
+        and the returns the outputs of the exported model, named like their ops.
+
+        Raises:
+            ValueError: If the transformer was not created with exportable=True, the
+                computation was loaded from the compile cache, has communication or
+                input ops, or has ops the runtime does not run.
+        """
+        if self.cached is not None:
+            raise ValueError("Computations loaded from the compile cache can not be "
+                             "exported, their kernel creation calls are not recorded")
+        if any((self.send_nodes, self.recv_nodes, self.scatter_send_nodes,
+                self.scatter_recv_nodes, self.gather_send_nodes, self.gather_recv_nodes,
+                self.allreduce_nodes, self.broadcast_send_nodes, self.broadcast_recv_nodes,
+                self.input_nodes)):
+            raise ValueError("Computations with communication or input ops can not be "
+                             "exported")
+        self.transformer.initialize()
+        if not self.transformer.exportable:
+            raise ValueError("Only computations of transformers created with "
+                             "exportable=True can be exported")
+        recorder = self.transformer.mkldnn_records.get(self.computation_op)
+        if recorder is None or not recorder.recordable:
+            raise ValueError("The kernel creation calls of {} were not recorded".format(
+                self.computation_op.name))
+        export_inference(self, recorder, path)
+
+    def copy_private_tensors(self, namespace):
+        """
+        Replaces the temporary pool and the private persistent tensors in namespace by
+        new arrays, and every array in namespace viewing their memory by the same view
+        of the new arrays.
+
+        Returns:
+            (array, category) of the new arrays.
+        """
+        alignment = self.transformer.byte_alignment
+        replaced = []
+        pool_name = self.pool_name('temporary')
+        pool = namespace[pool_name]
+        pool_allocator = self.transformer.pool_allocator
+        namespace[pool_name] = align_ndarray(pool.size, alignment, pool.dtype,
+                                             pool_allocator=pool_allocator)
+        replaced.append((pool, namespace[pool_name], 'temporary'))
+        for name in self.private_tensor_names():
+            tensor = namespace[name]
+            namespace[name] = align_ndarray(tensor.size, alignment, tensor.dtype,
+                                            pool_allocator=pool_allocator)
+            namespace[name][()] = tensor
+            replaced.append((tensor, namespace[name], 'persistent'))
+
+        regions = [(old.ctypes.data, old.ctypes.data + old.nbytes, new)
+                   for old, new, _ in replaced if old.nbytes]
+        replaced_ids = set(id(new) for _, new, _ in replaced)
+        for name, value in list(namespace.items()):
+            if not isinstance(value, np.ndarray) or id(value) in replaced_ids \
+                    or value.size == 0:
+                continue
+            address = value.ctypes.data
+            extent = value.itemsize + sum((length - 1) * abs(stride)
+                                          for length, stride in zip(value.shape, value.strides))
+            for start, end, new in regions:
+                if start <= address and address + extent <= end:
+                    namespace[name] = np.ndarray(shape=value.shape, dtype=value.dtype,
+                                                 buffer=new, offset=address - start,
+                                                 strides=value.strides)
+                    break
+
+        pools = [(new, category) for _, new, category in replaced]
+        for new, category in pools:
+            self.mkldnn.track_pool(new, category)
+        return pools
 
 
 class CPUDeviceTensor(DeviceTensor):
@@ -194,6 +627,8 @@ class CPUDeviceTensor(DeviceTensor):
 
     def __init__(self, transformer, device_computation, tensor, **kwargs):
         super(CPUDeviceTensor, self).__init__(transformer, device_computation, tensor, **kwargs)
+        # True when the storage belongs to a computation loaded from the compile cache
+        self.aliased = False
 
     def make_device_tensor_view(self, tensor_view_decl):
         return CPUDeviceTensorView(self, tensor_view_decl)
@@ -220,11 +655,24 @@ class CPUDeviceTensor(DeviceTensor):
         return self.name
 
     def codegen(self):
+        state_op = state_op_of(self.tensor_decl)
+        state = self.transformer.state_tensors.get(state_op)
+        if state is not None and state[0] is not self.transformer.globals:
+            # Already allocated by a computation loaded from the compile cache
+            namespace, name = state
+            self.transformer.globals[self.name] = namespace[name]
+            self.aliased = True
+            self.transformer.record_external_tensor(self)
+            return
+
         start = self.buffer_pool_offset // 4
         end = start + self.size // 4
         pool_name = self.device_computation.computation_op.name
         pool_name += '_persistent_pool' if self.is_persistent else '_temporary_pool'
         dtype = self.element_type.dtype
+        if state_op is not None and state is None:
+            self.transformer.state_tensors[state_op] = (self.transformer.globals, self.name)
+        self.transformer.record_tensor(self, pool_name, start, end, dtype, state_op)
         self.transformer.exop_codegen_tensor.append("\n# tensor size={}, offset={}",
                                                     self.size,
                                                     self.buffer_pool_offset)
@@ -276,6 +724,7 @@ class CPUDeviceTensorView(DeviceTensorView):
         return self.name
 
     def codegen(self):
+        self.transformer.record_tensor_view(self)
         self.transformer.exop_codegen_tensor_view.append("""\n{ref} = np.ndarray(
     shape={shape},
     dtype=np.{dtype},
@@ -289,18 +738,33 @@ class CPUDeviceTensorView(DeviceTensorView):
                                                          offset=self.tensor_description.offset,
                                                          strides=self.tensor_description.strides)
 
+    def host_tensor(self):
+        """
+        The value of the view for the host. A result left in an MKL layout by
+        MklAddLayoutConversions is wrapped so it is converted when first read.
+        """
+        lazy_reorder = self.tensor_view_decl.lazy_mkl_reorder
+        if lazy_reorder is None:
+            return self.tensor
+        return self.transformer.mkldnn.lazy_reorder(lazy_reorder, self.tensor)
+
     def get(self, tensor):
         if tensor is None:
-            return self.tensor
+            return self.host_tensor()
+        if self.tensor_view_decl.lazy_mkl_reorder is not None:
+            self.host_tensor().get(tensor)
+            return
         tensor[:] = self.tensor
 
     def __getitem__(self, key):
-        return self.tensor.__getitem__(key)
+        return self.host_tensor().__getitem__(key)
 
     def __setitem__(self, key, value):
         # Temporary hack to interoperate with neon cpu backend.
         if hasattr(value, '_tensor'):
             value = value._tensor
+        if isinstance(key, tuple) and not key and is_same_view(self.tensor, value):
+            return
         self.tensor.__setitem__(key, value)
 
 
@@ -509,6 +973,13 @@ class CPUCodeGenerator(PyGen):
             else:
                 self.append("{}[...] = {}", dest, source)
 
+    def binary_elementwise(self, op, np_op, out, x, y):
+        if op.safe_name in self.transformer.mkldnn.kernels:
+            self.append("mkldnn.elementwise_binary('{}', {}, {}, {}, out={})",
+                        op.safe_name, np_op, x, y, out)
+        else:
+            self.append("{}({}, {}, out={})", np_op, x, y, out)
+
     @generate_op.on_type(AbsoluteOp)
     def generate_op(self, op, out, x):
         self.append("np.abs({}, out={})", x, out)
@@ -528,28 +999,36 @@ class CPUCodeGenerator(PyGen):
 
     @generate_op.on_type(ConvolutionOp)
     def generate_op(self, op, outputs, inputs, filters, bias=None):
-        self.append("mkldnn.fprop_conv('{}', self.conv_slices['{}'], I={}, F={}, B={}, O={})",
-                    op.safe_name, op.safe_name, inputs, filters, bias, outputs)
+        self.append("mkldnn.fprop_conv('{}', self.conv_slices['{}'], self.conv_params['{}'], "
+                    "I={}, F={}, B={}, O={})",
+                    op.safe_name, op.safe_name, op.safe_name, inputs, filters, bias, outputs)
 
     @generate_op.on_type(bprop_conv)
     def generate_op(self, op, outputs, delta, filters):
-        self.append("mkldnn.bprop_conv('{}', self.conv_slices['{}'], E={}, F={}, gI={})",
-                    op.safe_name, op.fprop.forwarded.safe_name, delta, filters, outputs)
+        self.append("mkldnn.bprop_conv('{}', self.conv_slices['{}'], self.conv_params['{}'], "
+                    "E={}, F={}, gI={})",
+                    op.safe_name, op.fprop.forwarded.safe_name, op.fprop.forwarded.safe_name,
+                    delta, filters, outputs)
 
     @generate_op.on_type(update_conv)
     def generate_op(self, op, outputs, delta, inputs, dbias=None):
-        self.append("mkldnn.update_conv('{}', self.conv_slices['{}'], I={}, E={}, U={}, dB={})",
-                    op.safe_name, op.fprop.forwarded.safe_name, inputs, delta, outputs, dbias)
+        self.append("mkldnn.update_conv('{}', self.conv_slices['{}'], self.conv_params['{}'], "
+                    "I={}, E={}, U={}, dB={})",
+                    op.safe_name, op.fprop.forwarded.safe_name, op.fprop.forwarded.safe_name,
+                    inputs, delta, outputs, dbias)
 
     @generate_op.on_type(DeconvolutionOp)
     def generate_op(self, op, outputs, inputs, filters):
-        self.append("mkldnn.bprop_conv('{}', self.conv_slices['{}'], E={}, F={}, gI={})",
-                    op.safe_name, op.safe_name, inputs, filters, outputs)
+        self.append("mkldnn.bprop_conv('{}', self.conv_slices['{}'], self.conv_params['{}'], "
+                    "E={}, F={}, gI={})",
+                    op.safe_name, op.safe_name, op.safe_name, inputs, filters, outputs)
 
     @generate_op.on_type(DeconvDerivOp)
     def generate_op(self, op, outputs, delta, filters):
-        self.append("mkldnn.fprop_conv('{}', self.conv_slices['{}'], I={}, F={}, B={},  O={})",
-                    op.safe_name, op.fprop.forwarded.safe_name, delta, filters, None, outputs)
+        self.append("mkldnn.fprop_conv('{}', self.conv_slices['{}'], self.conv_params['{}'], "
+                    "I={}, F={}, B={}, O={})",
+                    op.safe_name, op.fprop.forwarded.safe_name, op.fprop.forwarded.safe_name,
+                    delta, filters, None, outputs)
 
     @generate_op.on_type(PoolingOp)
     def generate_op(self, op, outputs, inputs):
@@ -598,7 +1077,7 @@ class CPUCodeGenerator(PyGen):
 
     @generate_op.on_type(Divide)
     def generate_op(self, op, out, x, y):
-        self.append("np.divide({}, {}, out={})", x, y, out)
+        self.binary_elementwise(op, "np.divide", out, x, y)
 
     @generate_op.on_type(FloorDivide)
     def generate_op(self, op, out, x, y):
@@ -635,6 +1114,11 @@ class CPUCodeGenerator(PyGen):
         self.append("mkldnn.bprop_relu('{}', {}, {}, {}, {})",
                     op.safe_name, delta, outputs, inputs, op.fprop.slope)
 
+    @generate_op.on_type(ScaledSumOp)
+    def generate_op(self, op, out, *args):
+        self.append("mkldnn.scaled_sum('{}', [{}], {}, out={})",
+                    op.safe_name, ", ".join(str(arg) for arg in args), op.scales, out)
+
     @generate_op.on_type(Equal)
     def generate_op(self, op, out, x, y):
         self.append("np.equal({}, {}, out={})", x, y, out)
@@ -673,7 +1157,7 @@ class CPUCodeGenerator(PyGen):
 
     @generate_op.on_type(Maximum)
     def generate_op(self, op, out, x, y):
-        self.append("np.maximum({}, {}, out={})", x, y, out)
+        self.binary_elementwise(op, "np.maximum", out, x, y)
 
     @generate_op.on_type(Min)
     def generate_op(self, op, out, x):
@@ -681,7 +1165,7 @@ class CPUCodeGenerator(PyGen):
 
     @generate_op.on_type(Minimum)
     def generate_op(self, op, out, x, y):
-        self.append("np.minimum({}, {}, out={})", x, y, out)
+        self.binary_elementwise(op, "np.minimum", out, x, y)
 
     @generate_op.on_type(MklReorderOp)
     def generate_op(self, op, output, input):
@@ -689,7 +1173,7 @@ class CPUCodeGenerator(PyGen):
 
     @generate_op.on_type(Multiply)
     def generate_op(self, op, out, x, y):
-        self.append("np.multiply({}, {}, out={})", x, y, out)
+        self.binary_elementwise(op, "np.multiply", out, x, y)
 
     @generate_op.on_type(NegativeOp)
     def generate_op(self, op, out, x):
@@ -742,7 +1226,7 @@ class CPUCodeGenerator(PyGen):
 
     @generate_op.on_type(Subtract)
     def generate_op(self, op, out, x, y):
-        self.append("np.subtract({}, {}, out={})", x, y, out)
+        self.binary_elementwise(op, "np.subtract", out, x, y)
 
     @generate_op.on_type(Sum)
     def generate_op(self, op, out, x):
@@ -857,8 +1341,15 @@ class CPUTransformer(ExecutionGraphTransformer):
     default_rtol = 1e-05
     default_atol = 1e-08
 
-    def __init__(self, comm=None, **kwargs):
+    def __init__(self, comm=None, exportable=False, pool_allocator=None, **kwargs):
         super(CPUTransformer, self).__init__(**kwargs)
+        # Keep the MKL-DNN kernel creation calls of every computation for
+        # export_inference
+        self.exportable = exportable
+        # Called like align_ndarray for the memory pools of the computations, returns
+        # None for an aligned host array; a HeTr server passes a
+        # ngraph.transformers.hetr.shm_transport.ShmPoolAllocator
+        self.pool_allocator = pool_allocator
 
         # comm is not None in case of work under HetrTransformer
         if comm is not None:
@@ -879,6 +1370,20 @@ class CPUTransformer(ExecutionGraphTransformer):
 
         self.device_computation = None
         self.conv_engine = CPUConvEngine()
+
+        # Compiled computation cache (see ngraph.transformers.cpu.compiled_cache).
+        # state_tensors maps each variable/constant op to the (namespace, name) of its
+        # storage so cached and freshly compiled computations share state.
+        self.compile_cache_dir = compile_cache_dir()
+        self.compile_cache_engine_signature = None
+        self.cache_record = None
+        self.state_tensors = dict()
+        self.state_views = dict()
+        self.n_cached_computations = 0
+        # Checkpoints whose packed blobs kernels read, see load_mkl_checkpoint
+        self.mkl_checkpoints = []
+        # MkldnnRecorder of the MKL-DNN passes of each computation op, if exportable
+        self.mkldnn_records = dict()
         self.init_code = CPUCodeGenerator(self)
         self.allocate_storage_code = CPUCodeGenerator(self)
         self.allocate_code = CPUCodeGenerator(self)
@@ -917,10 +1422,18 @@ class CPUTransformer(ExecutionGraphTransformer):
         ]
 
         if self.mkldnn.enabled:
+            self.graph_passes += [CPUSumFusion(), DeadCodeEliminationPass()]
+            layout_assignment = None
+            if os.getenv('NGRAPH_MKL_LAYOUT_ASSIGN', '1') != '0':
+                layout_assignment = MklAssignLayouts(mkldnn=self.mkldnn)
+                self.graph_passes += [layout_assignment]
             self.graph_passes += [
-                MklCreateOpDescriptors(mkldnn=self.mkldnn),
+                MklCreateOpDescriptors(mkldnn=self.mkldnn,
+                                       layout_assignment=layout_assignment),
                 DeadCodeEliminationPass(),
-                MklAddLayoutConversions(mkldnn=self.mkldnn),
+                MklAddLayoutConversions(
+                    mkldnn=self.mkldnn,
+                    lazy_returns=os.getenv('NGRAPH_MKL_LAZY_RETURNS', '0') == '1'),
             ]
 
         self.graph_passes += [
@@ -932,8 +1445,10 @@ class CPUTransformer(ExecutionGraphTransformer):
             CopyElimination(),
             IndexElision(),
             LivenessPass(),
-            MemLayoutPass()
         ]
+        if os.getenv('NGRAPH_CPU_INPLACE', '1') != '0':
+            self.graph_passes += [CPUInPlacePass(mkldnn=self.mkldnn)]
+        self.graph_passes += [MemLayoutPass()]
         # from ngraph.transformers.passes.dumpgraphpass import DumpGraphPass
         # self.graph_passes += [DumpGraphPass()]
 
@@ -993,6 +1508,11 @@ self.__profiler_stop__  = list()
 
     def finish_load_computation(self, computation_decl):
         device_computation = computation_decl.device_computation
+        if self.cache_record is not None:
+            try:
+                self.cache_record.update(self.computation_view_names(computation_decl))
+            except CacheMiss:
+                self.cache_record['recordable'] = False
         byte_alignment = computation_decl.execution_graph.execution_state \
             .transformer.byte_alignment
         self.exop_codegen_pools.append(
@@ -1005,11 +1525,18 @@ self.__profiler_stop__  = list()
             computation_decl.computation_op.name, computation_decl.persistent_max_allocated,
             byte_alignment,
             'float32')
+        for kind in ('temporary', 'persistent'):
+            self.exop_codegen_pools.append("mkldnn.track_pool({}_{}_pool, '{}')",
+                                           computation_decl.computation_op.name, kind, kind)
+
+        pools_code = self.exop_codegen_pools.take_code()
+        tensor_view_code = self.exop_codegen_tensor_view.take_code()
+        class_code = self.exop_codegen.take_code()
 
         code = '#---------------------------------------------\n'
         code += '# memory pool\n'
         code += '#---------------------------------------------\n'
-        code += self.exop_codegen_pools.take_code()
+        code += pools_code
         code += '\n\n#---------------------------------------------\n'
         code += '# tensor\n'
         code += '#---------------------------------------------\n'
@@ -1017,30 +1544,20 @@ self.__profiler_stop__  = list()
         code += '\n\n#---------------------------------------------\n'
         code += '# tensor view\n'
         code += '#---------------------------------------------\n'
-        code += self.exop_codegen_tensor_view.take_code()
+        code += tensor_view_code
         code += '\n\n#---------------------------------------------\n'
         code += '# code\n'
         code += '#---------------------------------------------\n'
-        code += self.exop_codegen.take_code()
+        code += class_code
 
         self.globals.compile(code)
         cls = self.globals[computation_decl.computation_op.name]
-        params = {'conv_params': device_computation.conv_params,
-                  'pool_params': device_computation.pool_params,
-                  'conv_slices': device_computation.conv_slices,
-                  'pool_slices': device_computation.pool_slices,
-                  'input_nodes': device_computation.input_nodes}
-        if use_mlsl:
-            params.update({'send_nodes': device_computation.send_nodes,
-                           'recv_nodes': device_computation.recv_nodes,
-                           'scatter_send_nodes': device_computation.scatter_send_nodes,
-                           'scatter_recv_nodes': device_computation.scatter_recv_nodes,
-                           'gather_send_nodes': device_computation.gather_send_nodes,
-                           'gather_recv_nodes': device_computation.gather_recv_nodes,
-                           'allreduce_nodes': device_computation.allreduce_nodes,
-                           'broadcast_send_nodes': device_computation.broadcast_send_nodes,
-                           'broadcast_recv_nodes': device_computation.broadcast_recv_nodes})
+        params = device_computation.executor_params()
         executor = cls(**params)
+        self.mkldnn.warmup_kernels()
+        if self.cache_record is not None:
+            self.save_compiled_computation(computation_decl, pools_code, tensor_view_code,
+                                           class_code, params)
         return executor
 
     def make_device_tensor(self, computation, tensor_decl):
@@ -1056,6 +1573,15 @@ self.__profiler_stop__  = list()
         return CPUDeviceTensor(self, computation, tensor_decl)
 
     def initialize_module(self, module):
+        self.import_module_dependencies(module)
+
+        mkldnn_path = os.path.join(os.path.dirname(__file__), "..", "..")
+        mkldnn_engine_path = os.path.join(mkldnn_path, 'mkldnn_engine.so')
+        module.execute("mkldnn = Mkldnn(r'{}')".format(mkldnn_engine_path))
+        module.execute("mkldnn.open()")
+        self.mkldnn = module['mkldnn']
+
+    def import_module_dependencies(self, module):
         module.execute("""from __future__ import print_function
 from builtins import print
 import os
@@ -1076,12 +1602,9 @@ from ngraph.transformers.cputransform import align_ndarray
             module.execute("""
 from ngraph.transformers.cpu.hetr import HetrLocals
             """)
-
-        mkldnn_path = os.path.join(os.path.dirname(__file__), "..", "..")
-        mkldnn_engine_path = os.path.join(mkldnn_path, 'mkldnn_engine.so')
-        module.execute("mkldnn = Mkldnn(r'{}')".format(mkldnn_engine_path))
-        module.execute("mkldnn.open()")
-        self.mkldnn = module['mkldnn']
+        if self.pool_allocator is not None:
+            module['align_ndarray'] = partial(align_ndarray,
+                                              pool_allocator=self.pool_allocator)
 
     def transform_allocate_ops(self, all_ops):
         def tensor_description_value(x):
@@ -1122,6 +1645,10 @@ from ngraph.transformers.cpu.hetr import HetrLocals
 
             except TypeError:
                 pass
+        # After the kernels reading them are deleted
+        for checkpoint in self.mkl_checkpoints:
+            checkpoint.close()
+        self.mkl_checkpoints = []
         self.code = None
 
     def consume(self, buf_index, hostlist, devlist):
@@ -1138,6 +1665,336 @@ from ngraph.transformers.cpu.hetr import HetrLocals
     def make_computation(self, computation):
         return CPUDeviceComputation(self, computation)
 
+    def bucketed_computation(self, build, buckets, pad_value=0):
+        """
+        Returns a computation for inputs whose lengths along some axes vary between
+        calls, compiled lazily per bucket of lengths; see BucketedComputation.
+
+        Arguments:
+            build: build(**lengths) returns (results, *parameters) for the given length
+                of every dynamic axis.
+            buckets: Dict of dynamic axis name to the lengths to compile for, e.g.
+                {'N': [1, 8, 32, 128]}.
+            pad_value: Value the arguments are padded with up to the bucket lengths.
+        """
+        return BucketedComputation(self, build, buckets, pad_value=pad_value)
+
+    def add_computation(self, computation_op):
+        if computation_op in self.device_computations or self.compile_cache_dir is None \
+                or use_mlsl or is_tracing_enabled():
+            return super(CPUTransformer, self).add_computation(computation_op)
+
+        if self.compile_cache_engine_signature is None:
+            self.compile_cache_engine_signature = engine_signature(self.mkldnn)
+        try:
+            signature, ops, index = graph_signature(computation_op)
+        except CacheMiss as e:
+            logger.info("Computation %s can not be cached: %s", computation_op.name, e)
+            return super(CPUTransformer, self).add_computation(computation_op)
+        key = hashlib.sha1((signature + self.compile_cache_engine_signature).encode()).hexdigest()
+
+        artifact = load_artifact(self.compile_cache_dir, key)
+        if artifact is not None:
+            try:
+                device_computation = self.load_cached_computation(computation_op, artifact, ops)
+                self.device_computations[computation_op] = device_computation
+                return device_computation
+            except CacheMiss as e:
+                logger.info("Recompiling cached computation %s: %s", key, e)
+
+        self.cache_record = {'key': key,
+                             'index': index,
+                             'recordable': True,
+                             'recorder': None,
+                             'tensors': [],
+                             'defined': set(),
+                             'external_tensors': dict(),
+                             'views': set(),
+                             'external_views': dict(),
+                             'state_views': dict(),
+                             'initializations': []}
+        try:
+            return super(CPUTransformer, self).add_computation(computation_op)
+        finally:
+            self.cache_record = None
+
+    def run_registered_graph_passes(self, computation_decl, **kwargs):
+        # The kernel creation calls are only recorded for the compile cache and
+        # export_inference
+        if self.cache_record is None and not self.exportable:
+            return super(CPUTransformer, self).run_registered_graph_passes(
+                computation_decl=computation_decl, **kwargs)
+        with MkldnnRecorder(self.mkldnn) as recorder:
+            super(CPUTransformer, self).run_registered_graph_passes(
+                computation_decl=computation_decl, **kwargs)
+        if self.exportable:
+            self.mkldnn_records[computation_decl.computation_op] = recorder
+        if self.cache_record is not None:
+            self.cache_record['recorder'] = recorder
+
+    def record_tensor(self, device_tensor, pool_name, start, end, dtype, state_op):
+        record = self.cache_record
+        if record is None:
+            return
+        state_index = record['index'].get(state_op)
+        if state_op is not None and state_index is None and not state_op.is_constant:
+            # Variables outside the graph can not be matched up on a warm start
+            record['recordable'] = False
+        record['tensors'].append((device_tensor.name, pool_name, start, end, str(dtype),
+                                  state_index))
+        record['defined'].add(device_tensor.name)
+
+    def record_external_tensor(self, device_tensor):
+        record = self.cache_record
+        if record is None or device_tensor.name in record['external_tensors']:
+            return
+        state_index = record['index'].get(state_op_of(device_tensor.tensor_decl))
+        if state_index is None:
+            record['recordable'] = False
+        record['external_tensors'][device_tensor.name] = state_index
+
+    def record_tensor_view(self, device_tensor_view):
+        record = self.cache_record
+        if record is None:
+            return
+        record['views'].add(device_tensor_view.name)
+        device_tensor = device_tensor_view.device_tensor
+        tensor_decl = device_tensor.tensor_decl
+        state_index = record['index'].get(state_op_of(tensor_decl))
+        if state_index is not None and device_tensor.name in record['defined'] \
+                and device_tensor_view.tensor_view_decl is tensor_decl.root_tensor_view_decl:
+            record['state_views'][state_index] = device_tensor_view.name
+
+    def device_tensor_view(self, tensor_view_decl):
+        device_tensor_view = super(CPUTransformer, self).device_tensor_view(tensor_view_decl)
+        record = self.cache_record
+        if record is not None and device_tensor_view is not None \
+                and device_tensor_view.name not in record['views']:
+            # Generated by an earlier computation, rebuilt on a warm start
+            device_tensor = device_tensor_view.device_tensor
+            if device_tensor.name not in record['defined']:
+                self.record_external_tensor(device_tensor)
+            description = device_tensor_view.tensor_description
+            record['external_views'][device_tensor_view.name] = (
+                device_tensor_view.name, device_tensor.name, description.shape,
+                str(np.dtype(description.dtype)), description.offset, description.strides)
+            record['views'].add(device_tensor_view.name)
+        return device_tensor_view
+
+    def add_device_tensor_initialization(self, device_tensor_view, host_tensor):
+        device_tensor = device_tensor_view.device_tensor
+        if device_tensor.aliased:
+            # Initialized by the cached computation that owns the storage
+            return
+        super(CPUTransformer, self).add_device_tensor_initialization(device_tensor_view,
+                                                                     host_tensor)
+        record = self.cache_record
+        if record is not None:
+            state_index = record['index'].get(state_op_of(device_tensor.tensor_decl))
+            record['initializations'].append(
+                (device_tensor.name, device_tensor_view.name, state_index,
+                 host_tensor if state_index is None else None))
+
+    def computation_views(self, computation_decl):
+        """
+        Names of the tensor views used for the parameters and returns of a computation,
+        and the reorder kernels of returns left in an MKL layout, keyed by op.
+        """
+        computation_op = computation_decl.computation_op
+        parameters = dict()
+        for param in computation_op.parameters:
+            tensor_decl = computation_decl.get_tensor_decl(op=param.tensor)
+            view = self.device_tensor_view(tensor_decl.root_tensor_view_decl)
+            parameters[param] = view.name
+
+        returns = computation_op.returns
+        if returns is None:
+            returns = []
+        elif isinstance(returns, Op):
+            returns = [returns]
+        return_views = dict()
+        lazy_returns = dict()
+        for op in returns:
+            if not op.is_tensor_op or 'skip_returns' in op.metadata:
+                continue
+            if isinstance(op, AssignableTensorOp):
+                tensor_decl = computation_decl.get_tensor_decl(op=op)
+                view = self.device_tensor_view(tensor_decl.root_tensor_view_decl)
+            else:
+                view = self.device_tensor_view(
+                    computation_decl.op_returns[op.tensor].tensor_view_decl)
+            return_views[op] = view.name
+            if view.tensor_view_decl.lazy_mkl_reorder is not None:
+                lazy_returns[op] = view.tensor_view_decl.lazy_mkl_reorder
+        return {'parameters': parameters, 'returns': return_views, 'lazy_returns': lazy_returns}
+
+    def computation_view_names(self, computation_decl):
+        """
+        computation_views keyed by the index of the op in the cache record.
+        """
+        index = self.cache_record['index']
+        try:
+            views = self.computation_views(computation_decl)
+            return dict((key, dict((index[op], name) for op, name in names.items()))
+                        for key, names in views.items())
+        except (KeyError, AttributeError):
+            raise CacheMiss("Computation parameters or returns are not part of the graph")
+
+    def save_compiled_computation(self, computation_decl, pools_code, tensor_view_code,
+                                  class_code, params):
+        record = self.cache_record
+        recorder = record['recorder']
+        name = computation_decl.computation_op.name
+        if not record['recordable'] or recorder is None or not recorder.recordable:
+            logger.info("Computation %s can not be cached", name)
+            return
+        try:
+            input_nodes = [record['index'][op] for op in params['input_nodes']]
+        except KeyError:
+            logger.info("Computation %s can not be cached", name)
+            return
+        params = dict(params)
+        del params['input_nodes']
+        state_tensors = dict((state_index, tensor_name)
+                             for tensor_name, _, _, _, _, state_index in record['tensors']
+                             if state_index is not None)
+        artifact = {'class_name': name,
+                    'pools': pools_code,
+                    'tensors': record['tensors'],
+                    'external_tensors': record['external_tensors'],
+                    'external_views': list(record['external_views'].values()),
+                    'tensor_views': tensor_view_code,
+                    'code': class_code,
+                    'params': params,
+                    'input_nodes': input_nodes,
+                    'mkldnn_calls': recorder.calls,
+                    'kernels': recorder.kernels,
+                    'native_layouts': recorder.native_layouts,
+                    'state_tensors': state_tensors,
+                    'state_views': record['state_views'],
+                    'initializations': record['initializations'],
+                    'parameters': record['parameters'],
+                    'returns': record['returns'],
+                    'lazy_returns': record['lazy_returns']}
+        save_artifact(self.compile_cache_dir, record['key'], artifact)
+
+    def load_cached_computation(self, computation_op, artifact, ops):
+        """
+        Loads a computation from a compile cache artifact.
+
+        Arguments:
+            computation_op: The computation op the artifact was found for.
+            artifact: The artifact.
+            ops: The ops of computation_op in cache signature order.
+
+        Returns:
+            A CPUDeviceComputation.
+        """
+        for state_index in artifact['external_tensors'].values():
+            if ops[state_index] not in self.state_tensors:
+                raise CacheMiss("Shared tensor {} has not been allocated"
+                                .format(ops[state_index].name))
+
+        # Kernels get a private name table so they can not clash with kernels of
+        # computations compiled in this process; the engine still owns them for close().
+        results = replay_mkldnn_calls(self.mkldnn, artifact['mkldnn_calls'])
+        mkldnn = copy.copy(self.mkldnn)
+        mkldnn.kernels = dict((name, results[call])
+                              for name, call in artifact['kernels'].items())
+        mkldnn.native_layouts = [results[call] for call in artifact['native_layouts']]
+        prefix = 'cached{}'.format(self.n_cached_computations)
+        self.n_cached_computations += 1
+        for name, kernel in mkldnn.kernels.items():
+            self.mkldnn.kernels['{}/{}'.format(prefix, name)] = kernel
+        self.mkldnn.native_layouts += mkldnn.native_layouts
+
+        namespace = PyModule(prefix="op")
+        self.import_module_dependencies(namespace)
+        namespace['mkldnn'] = mkldnn
+        namespace.execute(artifact['pools'])
+
+        aliased = set()
+        for tensor_name, state_index in artifact['external_tensors'].items():
+            state_namespace, state_name = self.state_tensors[ops[state_index]]
+            namespace[tensor_name] = state_namespace[state_name]
+            aliased.add(tensor_name)
+        for tensor_name, pool_name, start, end, dtype, state_index in artifact['tensors']:
+            state_op = None if state_index is None else ops[state_index]
+            state = self.state_tensors.get(state_op)
+            if state is not None:
+                namespace[tensor_name] = state[0][state[1]]
+                aliased.add(tensor_name)
+                continue
+            namespace[tensor_name] = namespace[pool_name][start:end].view(dtype)
+            if state_op is not None:
+                self.state_tensors[state_op] = (namespace, tensor_name)
+        for view_name, tensor_name, shape, dtype, offset, strides in artifact['external_views']:
+            namespace[view_name] = np.ndarray(shape=shape, dtype=np.dtype(dtype),
+                                              buffer=namespace[tensor_name],
+                                              offset=offset, strides=strides)
+        namespace.compile(artifact['tensor_views'] + '\n\n' + artifact['code'])
+
+        for state_index, view_name in artifact['state_views'].items():
+            if ops[state_index] not in self.state_views:
+                self.state_views[ops[state_index]] = (namespace, view_name)
+        for tensor_name, view_name, state_index, value in artifact['initializations']:
+            if tensor_name in aliased:
+                continue
+            if state_index is not None:
+                value = ops[state_index].initial_value
+            namespace[view_name][()] = value
+
+        # Persistent tensors that execution contexts copy, see private_tensor_names
+        private_tensors = set()
+        for tensor_name, pool_name, _, _, _, state_index in artifact['tensors']:
+            state_op = None if state_index is None else ops[state_index]
+            if pool_name.endswith('_persistent_pool') and \
+                    not is_context_shared(state_op, computation_op):
+                private_tensors.add(tensor_name)
+        for tensor_name, state_index in artifact['external_tensors'].items():
+            if not is_context_shared(ops[state_index], computation_op):
+                private_tensors.add(tensor_name)
+
+        params = dict(artifact['params'])
+        params['input_nodes'] = [ops[i] for i in artifact['input_nodes']]
+        device_computation = self.make_computation(computation_op)
+        device_computation.input_nodes = params['input_nodes']
+        device_computation.conv_params = params['conv_params']
+        device_computation.pool_params = params['pool_params']
+        device_computation.conv_slices = params['conv_slices']
+        device_computation.pool_slices = params['pool_slices']
+        device_computation.cached = {
+            'namespace': namespace,
+            'parameters': dict((ops[i], name) for i, name in artifact['parameters'].items()),
+            'returns': dict((ops[i], name) for i, name in artifact['returns'].items()),
+            'lazy_returns': dict((ops[i], name)
+                                 for i, name in artifact['lazy_returns'].items()),
+            'private_tensors': sorted(private_tensors)}
+        device_computation.executor = namespace[artifact['class_name']](**params)
+        mkldnn.warmup_kernels()
+        return device_computation
+
+    def get_op_tensor_view(self, op):
+        state = self.state_views.get(op.tensor)
+        if state is not None:
+            return CachedTensorView(*state)
+        return super(CPUTransformer, self).get_op_tensor_view(op)
+
+    def host_to_device(self, device_computation, parameters, args):
+        cached = device_computation.cached
+        if cached is None:
+            return super(CPUTransformer, self).host_to_device(device_computation,
+                                                              parameters, args)
+        for op, arg in zip(parameters, args):
+            CachedTensorView(cached['namespace'], cached['parameters'][op])[()] = arg
+
+    def device_to_host(self, device_computation, op, tensor=None):
+        cached = device_computation.cached
+        if cached is None:
+            return super(CPUTransformer, self).device_to_host(device_computation, op, tensor)
+        return CachedTensorView(cached['namespace'], cached['returns'][op],
+                                cached['lazy_returns'].get(op)).get(tensor)
+
 
 set_transformer_factory(
     make_transformer_factory(CPUTransformer.transformer_name))
@@ -368,6 +368,12 @@ class ExOp(ExecutionGraphElt):
         tensor_view: View of the primary output.
         ref_ops: All computation graph ops covered by this op
         op_map: A map from ops to ref ops, sha
+        inplace_inputs: Maps output positions to the positions of the inputs whose
+            buffer the output may reuse, in order of preference; the first input
+            that is dead after this exop is used.
+        packed_inputs: Tuples of input positions whose tensors the kernel reads as
+            the consecutive rows of one array, laid out back to back if possible.
+        packed_outputs: Tuples of output positions, like packed_inputs.
 
     """
 
@@ -393,6 +399,9 @@ class ExOp(ExecutionGraphElt):
         self.liveness_live_list = []
         self.liveness_free_list = []
         self.liveness_new_list = []
+        self.inplace_inputs = dict()
+        self.packed_inputs = []
+        self.packed_outputs = []
         if self.op is not None:
             self.computation_decl.ops[self.op] = self
             self.add_ref_op(self.op)
@@ -1149,6 +1158,8 @@ class TensorViewDecl(ExecutionGraphElt):
         self.readers = OrderedSet()
         self.writers = OrderedSet()
         self.mkl_layout = None
+        # Name of the kernel converting a returned MKL layout view on host access
+        self.lazy_mkl_reorder = None
         self.value = None
 
     @property
@@ -36,14 +36,23 @@ class DeviceComputation(BaseDeviceComputation):
     """
     def __init__(self, transformer, computation_op, **kwargs):
         super(DeviceComputation, self).__init__(transformer, computation_op, **kwargs)
+        # With tracing enabled, called after every execution with a list of
+        # (exop, start, stop) times in seconds instead of writing a trace file
+        self.profile_listener = None
 
     def generate_profile(self, profiler_start, profiler_stop):
+        timings = list(zip(self.computation_decl.exop_block, profiler_start, profiler_stop))
+        # The executor appends to the lists on every call
+        del profiler_start[:]
+        del profiler_stop[:]
+        if self.profile_listener is not None:
+            self.profile_listener(timings)
+            return
+
         tracker = TraceEventTracker(self.computation_op.name)
-        start = iter(profiler_start)
-        stop = iter(profiler_stop)
-        for exop in self.computation_decl.exop_block:
-            start_time = next(start) * 1e6
-            duration = (next(stop) * 1e6) - start_time
+        for exop, start, stop in timings:
+            start_time = start * 1e6
+            duration = (stop * 1e6) - start_time
             args = {}
             count = 0
             for input_decl in exop.input_decls:
@@ -20,7 +20,7 @@ DESCRIPTOR = _descriptor.FileDescriptor(
   name='ngraph/transformers/hetr/hetr.proto',
   package='',
   syntax='proto3',
-  serialized_pb=_b('\n#ngraph/transformers/hetr/hetr.proto\x1a\x1fngraph/op_graph/serde/ops.proto\"F\n\x05Value\x12\x19\n\x06scalar\x18\x01 \x01(\x0b\x32\x07.ScalarH\x00\x12\x19\n\x06tensor\x18\x02 \x01(\x0b\x32\x07.TensorH\x00\x42\x07\n\x05value\"3\n\x17\x42uildTransformerRequest\x12\x18\n\x10transformer_type\x18\x01 \x01(\t\"8\n\x15\x42uildTransformerReply\x12\x0e\n\x06status\x18\x01 \x01(\x08\x12\x0f\n\x07message\x18\x02 \x01(\t\"\x19\n\x17\x43loseTransformerRequest\"8\n\x15\x43loseTransformerReply\x12\x0e\n\x06status\x18\x01 \x01(\x08\x12\x0f\n\x07message\x18\x02 \x01(\t\"m\n\x12\x43omputationRequest\x12\x10\n\x03ops\x18\x01 \x03(\x0b\x32\x03.Op\x12\x14\n\x05\x65\x64ges\x18\x02 \x03(\x0b\x32\x05.Edge\x12\x14\n\x07returns\x18\x03 \x03(\x0b\x32\x03.Op\x12\x19\n\x0cplaceholders\x18\x04 \x03(\x0b\x32\x03.Op\"4\n\x10\x43omputationReply\x12\x0f\n\x07\x63omp_id\x18\x01 \x01(\x05\x12\x0f\n\x07message\x18\x02 \x01(\t\";\n\x10\x46\x65\x65\x64InputRequest\x12\x0f\n\x07\x63omp_id\x18\x01 \x01(\x05\x12\x16\n\x06values\x18\x02 \x03(\x0b\x32\x06.Value\"1\n\x0e\x46\x65\x65\x64InputReply\x12\x0e\n\x06status\x18\x01 \x01(\x08\x12\x0f\n\x07message\x18\x02 \x01(\t\"$\n\x11GetResultsRequest\x12\x0f\n\x07\x63omp_id\x18\x01 \x01(\x05\"K\n\x0fGetResultsReply\x12\x0e\n\x06status\x18\x01 \x01(\x08\x12\x0f\n\x07message\x18\x02 \x01(\t\x12\x17\n\x07results\x18\x03 \x03(\x0b\x32\x06.Value\"\x0e\n\x0c\x43loseRequest\"\x1d\n\nCloseReply\x12\x0f\n\x07message\x18\x01 \x01(\t2\xe1\x02\n\x04Hetr\x12\x46\n\x10\x42uildTransformer\x12\x18.BuildTransformerRequest\x1a\x16.BuildTransformerReply\"\x00\x12\x46\n\x10\x43loseTransformer\x12\x18.CloseTransformerRequest\x1a\x16.CloseTransformerReply\"\x00\x12\x39\n\x0b\x43omputation\x12\x13.ComputationRequest\x1a\x11.ComputationReply\"\x00(\x01\x12\x31\n\tFeedInput\x12\x11.FeedInputRequest\x1a\x0f.FeedInputReply\"\x00\x12\x34\n\nGetResults\x12\x12.GetResultsRequest\x1a\x10.GetResultsReply\"\x00\x12%\n\x05\x43lose\x12\r.CloseRequest\x1a\x0b.CloseReply\"\x00\x62\x06proto3')
+  serialized_pb=_b('\n#ngraph/transformers/hetr/hetr.proto\x1a\x1fngraph/op_graph/serde/ops.proto\"T\n\tShmTensor\x12\x0c\n\x04name\x18\x01 \x01(\t\x12\x0e\n\x06offset\x18\x02 \x01(\x04\x12\x19\n\x04info\x18\x03 \x01(\x0b\x32\x0b.TensorInfo\x12\x0e\n\x06pinned\x18\x04 \x01(\x08\"h\n\x05Value\x12\x19\n\x06scalar\x18\x01 \x01(\x0b\x32\x07.ScalarH\x00\x12\x19\n\x06tensor\x18\x02 \x01(\x0b\x32\x07.TensorH\x00\x12 \n\nshm_tensor\x18\x03 \x01(\x0b\x32\n.ShmTensorH\x00\x42\x07\n\x05value\"3\n\x17\x42uildTransformerRequest\x12\x18\n\x10transformer_type\x18\x01 \x01(\t\"8\n\x15\x42uildTransformerReply\x12\x0e\n\x06status\x18\x01 \x01(\x08\x12\x0f\n\x07message\x18\x02 \x01(\t\"\x19\n\x17\x43loseTransformerRequest\"8\n\x15\x43loseTransformerReply\x12\x0e\n\x06status\x18\x01 \x01(\x08\x12\x0f\n\x07message\x18\x02 \x01(\t\"m\n\x12\x43omputationRequest\x12\x10\n\x03ops\x18\x01 \x03(\x0b\x32\x03.Op\x12\x14\n\x05\x65\x64ges\x18\x02 \x03(\x0b\x32\x05.Edge\x12\x14\n\x07returns\x18\x03 \x03(\x0b\x32\x03.Op\x12\x19\n\x0cplaceholders\x18\x04 \x03(\x0b\x32\x03.Op\"4\n\x10\x43omputationReply\x12\x0f\n\x07\x63omp_id\x18\x01 \x01(\x05\x12\x0f\n\x07message\x18\x02 \x01(\t\"g\n\x10\x46\x65\x65\x64InputRequest\x12\x0f\n\x07\x63omp_id\x18\x01 \x01(\x05\x12\x16\n\x06values\x18\x02 \x03(\x0b\x32\x06.Value\x12\x13\n\x0bshm_results\x18\x03 \x01(\x08\x12\x15\n\rmicro_batches\x18\x04 \x01(\x05\"M\n\x0e\x46\x65\x65\x64InputReply\x12\x0e\n\x06status\x18\x01 \x01(\x08\x12\x0f\n\x07message\x18\x02 \x01(\t\x12\x1a\n\x06inputs\x18\x03 \x03(\x0b\x32\n.ShmTensor\"$\n\x11GetResultsRequest\x12\x0f\n\x07\x63omp_id\x18\x01 \x01(\x05\"K\n\x0fGetResultsReply\x12\x0e\n\x06status\x18\x01 \x01(\x08\x12\x0f\n\x07message\x18\x02 \x01(\t\x12\x17\n\x07results\x18\x03 \x03(\x0b\x32\x06.Value\"\x0e\n\x0c\x43loseRequest\"\x1d\n\nCloseReply\x12\x0f\n\x07message\x18\x01 \x01(\t2\xe1\x02\n\x04Hetr\x12\x46\n\x10\x42uildTransformer\x12\x18.BuildTransformerRequest\x1a\x16.BuildTransformerReply\"\x00\x12\x46\n\x10\x43loseTransformer\x12\x18.CloseTransformerRequest\x1a\x16.CloseTransformerReply\"\x00\x12\x39\n\x0b\x43omputation\x12\x13.ComputationRequest\x1a\x11.ComputationReply\"\x00(\x01\x12\x31\n\tFeedInput\x12\x11.FeedInputRequest\x1a\x0f.FeedInputReply\"\x00\x12\x34\n\nGetResults\x12\x12.GetResultsRequest\x1a\x10.GetResultsReply\"\x00\x12%\n\x05\x43lose\x12\r.CloseRequest\x1a\x0b.CloseReply\"\x00\x62\x06proto3')
   ,
   dependencies=[ngraph_dot_op__graph_dot_serde_dot_ops__pb2.DESCRIPTOR,])
 _sym_db.RegisterFileDescriptor(DESCRIPTOR)
@@ -28,6 +28,58 @@ _sym_db.RegisterFileDescriptor(DESCRIPTOR)
 
 
 
+_SHMTENSOR = _descriptor.Descriptor(
+  name='ShmTensor',
+  full_name='ShmTensor',
+  filename=None,
+  file=DESCRIPTOR,
+  containing_type=None,
+  fields=[
+    _descriptor.FieldDescriptor(
+      name='name', full_name='ShmTensor.name', index=0,
+      number=1, type=9, cpp_type=9, label=1,
+      has_default_value=False, default_value=_b("").decode('utf-8'),
+      message_type=None, enum_type=None, containing_type=None,
+      is_extension=False, extension_scope=None,
+      options=None),
+    _descriptor.FieldDescriptor(
+      name='offset', full_name='ShmTensor.offset', index=1,
+      number=2, type=4, cpp_type=4, label=1,
+      has_default_value=False, default_value=0,
+      message_type=None, enum_type=None, containing_type=None,
+      is_extension=False, extension_scope=None,
+      options=None),
+    _descriptor.FieldDescriptor(
+      name='info', full_name='ShmTensor.info', index=2,
+      number=3, type=11, cpp_type=10, label=1,
+      has_default_value=False, default_value=None,
+      message_type=None, enum_type=None, containing_type=None,
+      is_extension=False, extension_scope=None,
+      options=None),
+    _descriptor.FieldDescriptor(
+      name='pinned', full_name='ShmTensor.pinned', index=3,
+      number=4, type=8, cpp_type=7, label=1,
+      has_default_value=False, default_value=False,
+      message_type=None, enum_type=None, containing_type=None,
+      is_extension=False, extension_scope=None,
+      options=None),
+  ],
+  extensions=[
+  ],
+  nested_types=[],
+  enum_types=[
+  ],
+  options=None,
+  is_extendable=False,
+  syntax='proto3',
+  extension_ranges=[],
+  oneofs=[
+  ],
+  serialized_start=72,
+  serialized_end=156,
+)
+
+
 _VALUE = _descriptor.Descriptor(
   name='Value',
   full_name='Value',
@@ -49,6 +101,13 @@ _VALUE = _descriptor.Descriptor(
       message_type=None, enum_type=None, containing_type=None,
       is_extension=False, extension_scope=None,
       options=None),
+    _descriptor.FieldDescriptor(
+      name='shm_tensor', full_name='Value.shm_tensor', index=2,
+      number=3, type=11, cpp_type=10, label=1,
+      has_default_value=False, default_value=None,
+      message_type=None, enum_type=None, containing_type=None,
+      is_extension=False, extension_scope=None,
+      options=None),
   ],
   extensions=[
   ],
@@ -64,8 +123,8 @@ _VALUE = _descriptor.Descriptor(
       name='value', full_name='Value.value',
       index=0, containing_type=None, fields=[]),
   ],
-  serialized_start=72,
-  serialized_end=142,
+  serialized_start=158,
+  serialized_end=262,
 )
 
 
@@ -95,8 +154,8 @@ _BUILDTRANSFORMERREQUEST = _descriptor.Descriptor(
   extension_ranges=[],
   oneofs=[
   ],
-  serialized_start=144,
-  serialized_end=195,
+  serialized_start=264,
+  serialized_end=315,
 )
 
 
@@ -133,8 +192,8 @@ _BUILDTRANSFORMERREPLY = _descriptor.Descriptor(
   extension_ranges=[],
   oneofs=[
   ],
-  serialized_start=197,
-  serialized_end=253,
+  serialized_start=317,
+  serialized_end=373,
 )
 
 
@@ -157,8 +216,8 @@ _CLOSETRANSFORMERREQUEST = _descriptor.Descriptor(
   extension_ranges=[],
   oneofs=[
   ],
-  serialized_start=255,
-  serialized_end=280,
+  serialized_start=375,
+  serialized_end=400,
 )
 
 
@@ -195,8 +254,8 @@ _CLOSETRANSFORMERREPLY = _descriptor.Descriptor(
   extension_ranges=[],
   oneofs=[
   ],
-  serialized_start=282,
-  serialized_end=338,
+  serialized_start=402,
+  serialized_end=458,
 )
 
 
@@ -247,8 +306,8 @@ _COMPUTATIONREQUEST = _descriptor.Descriptor(
   extension_ranges=[],
   oneofs=[
   ],
-  serialized_start=340,
-  serialized_end=449,
+  serialized_start=460,
+  serialized_end=569,
 )
 
 
@@ -285,8 +344,8 @@ _COMPUTATIONREPLY = _descriptor.Descriptor(
   extension_ranges=[],
   oneofs=[
   ],
-  serialized_start=451,
-  serialized_end=503,
+  serialized_start=571,
+  serialized_end=623,
 )
 
 
@@ -311,6 +370,20 @@ _FEEDINPUTREQUEST = _descriptor.Descriptor(
       message_type=None, enum_type=None, containing_type=None,
       is_extension=False, extension_scope=None,
       options=None),
+    _descriptor.FieldDescriptor(
+      name='shm_results', full_name='FeedInputRequest.shm_results', index=2,
+      number=3, type=8, cpp_type=7, label=1,
+      has_default_value=False, default_value=False,
+      message_type=None, enum_type=None, containing_type=None,
+      is_extension=False, extension_scope=None,
+      options=None),
+    _descriptor.FieldDescriptor(
+      name='micro_batches', full_name='FeedInputRequest.micro_batches', index=3,
+      number=4, type=5, cpp_type=1, label=1,
+      has_default_value=False, default_value=0,
+      message_type=None, enum_type=None, containing_type=None,
+      is_extension=False, extension_scope=None,
+      options=None),
   ],
   extensions=[
   ],
@@ -323,8 +396,8 @@ _FEEDINPUTREQUEST = _descriptor.Descriptor(
   extension_ranges=[],
   oneofs=[
   ],
-  serialized_start=505,
-  serialized_end=564,
+  serialized_start=625,
+  serialized_end=728,
 )
 
 
@@ -349,6 +422,13 @@ _FEEDINPUTREPLY = _descriptor.Descriptor(
       message_type=None, enum_type=None, containing_type=None,
       is_extension=False, extension_scope=None,
       options=None),
+    _descriptor.FieldDescriptor(
+      name='inputs', full_name='FeedInputReply.inputs', index=2,
+      number=3, type=11, cpp_type=10, label=3,
+      has_default_value=False, default_value=[],
+      message_type=None, enum_type=None, containing_type=None,
+      is_extension=False, extension_scope=None,
+      options=None),
   ],
   extensions=[
   ],
@@ -361,8 +441,8 @@ _FEEDINPUTREPLY = _descriptor.Descriptor(
   extension_ranges=[],
   oneofs=[
   ],
-  serialized_start=566,
-  serialized_end=615,
+  serialized_start=730,
+  serialized_end=807,
 )
 
 
@@ -392,8 +472,8 @@ _GETRESULTSREQUEST = _descriptor.Descriptor(
   extension_ranges=[],
   oneofs=[
   ],
-  serialized_start=617,
-  serialized_end=653,
+  serialized_start=809,
+  serialized_end=845,
 )
 
 
@@ -437,8 +517,8 @@ _GETRESULTSREPLY = _descriptor.Descriptor(
   extension_ranges=[],
   oneofs=[
   ],
-  serialized_start=655,
-  serialized_end=730,
+  serialized_start=847,
+  serialized_end=922,
 )
 
 
@@ -461,8 +541,8 @@ _CLOSEREQUEST = _descriptor.Descriptor(
   extension_ranges=[],
   oneofs=[
   ],
-  serialized_start=732,
-  serialized_end=746,
+  serialized_start=924,
+  serialized_end=938,
 )
 
 
@@ -492,24 +572,31 @@ _CLOSEREPLY = _descriptor.Descriptor(
   extension_ranges=[],
   oneofs=[
   ],
-  serialized_start=748,
-  serialized_end=777,
+  serialized_start=940,
+  serialized_end=969,
 )
 
+_SHMTENSOR.fields_by_name['info'].message_type = ngraph_dot_op__graph_dot_serde_dot_ops__pb2._TENSORINFO
 _VALUE.fields_by_name['scalar'].message_type = ngraph_dot_op__graph_dot_serde_dot_ops__pb2._SCALAR
 _VALUE.fields_by_name['tensor'].message_type = ngraph_dot_op__graph_dot_serde_dot_ops__pb2._TENSOR
+_VALUE.fields_by_name['shm_tensor'].message_type = _SHMTENSOR
 _VALUE.oneofs_by_name['value'].fields.append(
   _VALUE.fields_by_name['scalar'])
 _VALUE.fields_by_name['scalar'].containing_oneof = _VALUE.oneofs_by_name['value']
 _VALUE.oneofs_by_name['value'].fields.append(
   _VALUE.fields_by_name['tensor'])
 _VALUE.fields_by_name['tensor'].containing_oneof = _VALUE.oneofs_by_name['value']
+_VALUE.oneofs_by_name['value'].fields.append(
+  _VALUE.fields_by_name['shm_tensor'])
+_VALUE.fields_by_name['shm_tensor'].containing_oneof = _VALUE.oneofs_by_name['value']
 _COMPUTATIONREQUEST.fields_by_name['ops'].message_type = ngraph_dot_op__graph_dot_serde_dot_ops__pb2._OP
 _COMPUTATIONREQUEST.fields_by_name['edges'].message_type = ngraph_dot_op__graph_dot_serde_dot_ops__pb2._EDGE
 _COMPUTATIONREQUEST.fields_by_name['returns'].message_type = ngraph_dot_op__graph_dot_serde_dot_ops__pb2._OP
 _COMPUTATIONREQUEST.fields_by_name['placeholders'].message_type = ngraph_dot_op__graph_dot_serde_dot_ops__pb2._OP
 _FEEDINPUTREQUEST.fields_by_name['values'].message_type = _VALUE
+_FEEDINPUTREPLY.fields_by_name['inputs'].message_type = _SHMTENSOR
 _GETRESULTSREPLY.fields_by_name['results'].message_type = _VALUE
+DESCRIPTOR.message_types_by_name['ShmTensor'] = _SHMTENSOR
 DESCRIPTOR.message_types_by_name['Value'] = _VALUE
 DESCRIPTOR.message_types_by_name['BuildTransformerRequest'] = _BUILDTRANSFORMERREQUEST
 DESCRIPTOR.message_types_by_name['BuildTransformerReply'] = _BUILDTRANSFORMERREPLY
@@ -524,6 +611,13 @@ DESCRIPTOR.message_types_by_name['GetResultsReply'] = _GETRESULTSREPLY
 DESCRIPTOR.message_types_by_name['CloseRequest'] = _CLOSEREQUEST
 DESCRIPTOR.message_types_by_name['CloseReply'] = _CLOSEREPLY
 
+ShmTensor = _reflection.GeneratedProtocolMessageType('ShmTensor', (_message.Message,), dict(
+  DESCRIPTOR = _SHMTENSOR,
+  __module__ = 'ngraph.transformers.hetr.hetr_pb2'
+  # @@protoc_insertion_point(class_scope:ShmTensor)
+  ))
+_sym_db.RegisterMessage(ShmTensor)
+
 Value = _reflection.GeneratedProtocolMessageType('Value', (_message.Message,), dict(
   DESCRIPTOR = _VALUE,
   __module__ = 'ngraph.transformers.hetr.hetr_pb2'
@@ -2,6 +2,7 @@ from concurrent import futures
 import argparse
 import time
 import socket
+import threading
 import grpc
 import hetr_pb2
 import hetr_pb2_grpc
@@ -10,8 +11,12 @@ import numpy as np
 from mpi4py import MPI
 from ngraph.op_graph.op_graph import Op
 from ngraph.op_graph.serde.serde import protobuf_to_op, pb_to_tensor, tensor_to_protobuf,\
-    _deserialize_graph_ops_edges, assign_scalar, protobuf_scalar_to_python, is_scalar_type
+    _deserialize_graph_ops_edges, assign_scalar, protobuf_scalar_to_python, is_scalar_type, \
+    pb_to_dtype
 from ngraph.transformers.hetrtransform import build_transformer
+from ngraph.transformers.cpu.cpuengine import parse_cpulist
+from ngraph.transformers.hetr.shm_transport import ShmPoolAllocator, ShmTensorReader, \
+    ShmTensorWriter, assign_shm_tensor, pb_to_shm_tensor
 import logging
 import os
 import fcntl
@@ -20,7 +25,7 @@ from ngraph.op_graph.comm_nodes import GatherRecvOp, ScatterRecvOp
 try:
     # The first "import mlsl" will create internal mlsl object and will init MLSL library.
     # That object will be destroyed explicitly over HetrLocals.close_module()->mlsl.close().
-    import mlsl  # noqa: F401
+    # With HETR_COLLECTIVES=shm, HetrLocals uses shared memory collectives instead.
     from ngraph.transformers.cpu.hetr import HetrLocals
     use_mlsl = True
 except ImportError:
@@ -28,6 +33,9 @@ except ImportError:
 
 
 _ONE_DAY_IN_SECONDS = 60 * 60 * 24
+# Requests are served concurrently, so that the results of one computation can be
+# fetched while the next executes; executions themselves are serialized
+_SERVER_WORKERS = 4
 LINE_TOKEN = 'token'
 logger = logging.getLogger(__name__)
 
@@ -41,6 +49,18 @@ class HetrServer(hetr_pb2_grpc.HetrServicer):
         self.comm = comm
         self.server = server
         self.transformer_type = None
+        # Serializes the use of the transformer by concurrent requests
+        self.lock = threading.Lock()
+        # Shared memory of the inputs and results of each computation
+        self.shm_readers = dict()
+        self.shm_writers = dict()
+        self.shm_results = dict()
+        self.shm_inputs = dict()
+        # Allocates the memory pools of the CPU transformer in shared memory
+        self.pool_allocator = None
+        # Positions of the micro-batch axis in the inputs and results of each
+        # computation, and the reductions of the results without it
+        self.pipeline_positions = dict()
 
     def new_comp_id(self):
         c_id = self.comp_id_ctr
@@ -55,7 +75,13 @@ class HetrServer(hetr_pb2_grpc.HetrServicer):
             return hetr_pb2.BuildTransformerReply(status=False, message=message)
 
         try:
-            self.transformer = build_transformer(name=request.transformer_type, comm=self.comm)
+            with self.lock:
+                kwargs = dict()
+                if self.transformer_type == 'cpu' and use_shared_pools():
+                    self.pool_allocator = ShmPoolAllocator()
+                    kwargs['pool_allocator'] = self.pool_allocator
+                self.transformer = build_transformer(name=request.transformer_type,
+                                                     comm=self.comm, **kwargs)
             return hetr_pb2.BuildTransformerReply(status=True)
         except Exception:
             return hetr_pb2.BuildTransformerReply(status=False, message=traceback.format_exc())
@@ -109,9 +135,14 @@ class HetrServer(hetr_pb2_grpc.HetrServicer):
                     if op.uuid == p.uuid:
                         reconstructed_placeholders.append(op)
 
-            computation = self.transformer.computation(reconstructed_returns,
-                                                       *reconstructed_placeholders)
+            with self.lock:
+                computation = self.transformer.computation(reconstructed_returns,
+                                                           *reconstructed_placeholders)
             self.computations[comp_id] = computation
+            self.pipeline_positions[comp_id] = (
+                [pipeline_axis_position(p) for p in reconstructed_placeholders],
+                [pipeline_axis_position(r) for r in reconstructed_returns],
+                [r.metadata.get('micro_batch_reduce') for r in reconstructed_returns])
             return hetr_pb2.ComputationReply(comp_id=comp_id)
         except Exception:
             return hetr_pb2.ComputationReply(comp_id=-1, message=traceback.format_exc())
@@ -127,27 +158,47 @@ class HetrServer(hetr_pb2_grpc.HetrServicer):
             for v in request.values:
                 if v.HasField('scalar'):
                     values.append(protobuf_scalar_to_python(v.scalar))
+                elif v.HasField('shm_tensor'):
+                    values.append(self.view_shm_tensor(request.comp_id, v.shm_tensor))
                 else:
                     values.append(pb_to_tensor(v.tensor))
             computation = self.computations[request.comp_id]
-            if self.transformer.transformer_name == "gpu":
-                import pycuda.driver as drv
-                if self.transformer.runtime and \
-                   not self.transformer.runtime.ctx == drv.Context.get_current():
-                    self.transformer.runtime.ctx.push()
-                # TODO figure out doc for rpdb to pass in port
-                # give unique port per device (4444 + device_id)
-                outputs = computation(*values)
-                self.transformer.runtime.ctx.pop()
-            else:
-                outputs = computation(*values)
+            with self.lock:
+                if self.transformer.transformer_name == "gpu":
+                    import pycuda.driver as drv
+                    if self.transformer.runtime and \
+                       not self.transformer.runtime.ctx == drv.Context.get_current():
+                        self.transformer.runtime.ctx.push()
+                    # TODO figure out doc for rpdb to pass in port
+                    # give unique port per device (4444 + device_id)
+                    outputs = self.execute(request, computation, values)
+                    self.transformer.runtime.ctx.pop()
+                else:
+                    outputs = self.execute(request, computation, values)
+                reply = hetr_pb2.FeedInputReply(status=True)
+                if request.shm_results:
+                    # Written out before the next execution can reuse the result buffers
+                    self.shm_results[request.comp_id] = self.write_shm_results(
+                        request.comp_id, outputs)
+                    for name, offset, tensor in self.shm_input_slots(request.comp_id,
+                                                                     values):
+                        assign_shm_tensor(reply.inputs.add(), name, offset, tensor,
+                                          pinned=True)
+                else:
+                    self.shm_results.pop(request.comp_id, None)
 
             self.results[request.comp_id] = outputs
 
-            return hetr_pb2.FeedInputReply(status=True)
+            return reply
         except Exception:
             return hetr_pb2.FeedInputReply(status=False, message=traceback.format_exc())
 
+    def execute(self, request, computation, values):
+        if request.micro_batches > 1:
+            return run_micro_batches(computation, values, request.micro_batches,
+                                     *self.pipeline_positions[request.comp_id])
+        return computation(*values)
+
     def GetResults(self, request, context):
         logger.debug("server: get_results")
         if request.comp_id not in self.results:
@@ -156,10 +207,16 @@ class HetrServer(hetr_pb2_grpc.HetrServicer):
 
         try:
             pb_results = []
+            shm_results = self.shm_results.get(request.comp_id)
+            if shm_results is not None:
+                shm_results = iter(shm_results)
             for r in self.results[request.comp_id]:
                 pb_val = hetr_pb2.Value()
                 if is_scalar_type(r):
                     assign_scalar(pb_val.scalar, r)
+                elif shm_results is not None:
+                    name, offset, pinned = next(shm_results)
+                    assign_shm_tensor(pb_val.shm_tensor, name, offset, np.asarray(r), pinned)
                 else:
                     pb_val.tensor.CopyFrom(tensor_to_protobuf(r))
                 pb_results.append(pb_val)
@@ -167,19 +224,172 @@ class HetrServer(hetr_pb2_grpc.HetrServicer):
         except Exception:
             return hetr_pb2.GetResultsReply(status=False, message=traceback.format_exc())
 
+    def view_shm_tensor(self, comp_id, message):
+        """
+        The tensor of ShmTensor message, viewed in place: in a memory pool of this
+        server, at the address the computation uses, or in a segment of the client.
+        """
+        if message.pinned and self.pool_allocator is not None:
+            tensor = self.pool_allocator.view(message.name, message.offset,
+                                              tuple(message.info.shape),
+                                              pb_to_dtype(message.info.dtype))
+            if tensor is not None:
+                return tensor
+        reader = self.shm_readers.setdefault(comp_id, ShmTensorReader())
+        return pb_to_shm_tensor(reader, message)
+
+    def write_shm_results(self, comp_id, outputs):
+        """
+        Returns (segment name, offset, pinned) of each tensor output of computation
+        comp_id. Outputs in the memory pools are returned in place, the others are
+        copied into the shared memory segment of the computation.
+        """
+        tensors = [r for r in outputs if not is_scalar_type(r)]
+        locations = [None if self.pool_allocator is None else self.pool_allocator.locate(r)
+                     for r in tensors]
+        writer = self.shm_writers.setdefault(comp_id, ShmTensorWriter())
+        offsets = iter(writer.write([np.asarray(r) for r, location in zip(tensors, locations)
+                                     if location is None]))
+        return [(writer.name, next(offsets), False) if location is None else
+                location + (True,) for location in locations]
+
+    def shm_input_slots(self, comp_id, values):
+        """
+        Returns (segment name, offset, tensor) of the tensors of computation comp_id
+        its tensor arguments are copied into, where the client can write the
+        arguments of the next call in place. Empty unless all of them are in the
+        memory pools and have the shapes of values.
+        """
+        slots = self.shm_inputs.get(comp_id)
+        if slots is None:
+            slots = []
+            computation = self.computations[comp_id]
+            if self.pool_allocator is not None and hasattr(computation, 'parameter_tensors'):
+                for value, tensor in zip(values, computation.parameter_tensors()):
+                    if is_scalar_type(value):
+                        continue
+                    location = self.pool_allocator.locate(tensor)
+                    if location is None:
+                        slots = []
+                        break
+                    slots.append(location + (tensor,))
+            self.shm_inputs[comp_id] = slots
+        tensors = [v for v in values if not is_scalar_type(v)]
+        if len(slots) != len(tensors) or \
+                any(np.shape(v) != tensor.shape for v, (_, _, tensor) in zip(tensors, slots)):
+            return []
+        return slots
+
+    def close_shm(self):
+        for shm in list(self.shm_readers.values()) + list(self.shm_writers.values()):
+            shm.close()
+        self.shm_readers.clear()
+        self.shm_writers.clear()
+        self.shm_results.clear()
+        self.shm_inputs.clear()
+
+    def close_pools(self):
+        # After the transformer that allocated them is closed
+        if self.pool_allocator is not None:
+            self.pool_allocator.close()
+            self.pool_allocator = None
+
     def CloseTransformer(self, request, context):
         logger.debug("server: close transformer")
-        self.transformer.close()
+        with self.lock:
+            self.transformer.close()
+            self.close_shm()
+            self.close_pools()
         return hetr_pb2.CloseTransformerReply(status=True)
 
     def Close(self, request, context):
         logger.debug("server: close, self.transformer_type %s", self.transformer_type)
+        # Not while a request still uses the shared memory
+        with self.lock:
+            self.close_shm()
+            self.close_pools()
         if use_mlsl:
             HetrLocals.close_mlsl()
         self.server.stop(0)
         return hetr_pb2.CloseReply()
 
 
+def use_shared_pools():
+    """
+    True to allocate the memory pools of the CPU transformer in shared memory, for
+    clients on this host to pass arguments and results in place: HETR_SHM_TRANSPORT
+    is not 0 and the pools are not MLSL buffers.
+    """
+    if os.getenv('HETR_SHM_TRANSPORT', '1') == '0':
+        return False
+    return not use_mlsl or os.getenv('HETR_COLLECTIVES', 'mlsl') == 'shm'
+
+
+def pipeline_axis_position(op):
+    """
+    The position of the micro-batch axis PipelinePass marked op with, or None.
+    """
+    name = op.metadata.get('pipeline_axis')
+    if name is None or getattr(op, 'axes', None) is None:
+        return None
+    names = [a.name for a in op.axes]
+    return names.index(name) if name in names else None
+
+
+def run_micro_batches(computation, values, micro_batches, in_positions, out_positions,
+                      out_reductions):
+    """
+    Runs computation once per micro-batch of values, split along the micro-batch
+    axis of each input. Results with the axis are concatenated along it, and the
+    others (losses, metrics) summed or averaged over the micro-batches, as their
+    reduction in out_reductions, 'sum' or 'mean', says.
+    """
+    splits = [np.split(np.asarray(v), micro_batches, axis=pos) if pos is not None else None
+              for v, pos in zip(values, in_positions)]
+    micro_outputs = []
+    for m in range(micro_batches):
+        micro_values = [v if split is None else split[m] for v, split in zip(values, splits)]
+        outputs = computation(*micro_values)
+        # Copied, since the next execution reuses the result buffers
+        micro_outputs.append([None if r is None else np.array(r, copy=True) for r in outputs])
+
+    results = []
+    for i, pos in enumerate(out_positions):
+        micro_results = [outputs[i] for outputs in micro_outputs]
+        if micro_results[0] is None:
+            results.append(None)
+        elif pos is not None:
+            results.append(np.concatenate(micro_results, axis=pos))
+        elif out_reductions[i] == 'sum':
+            results.append(np.sum(micro_results, axis=0).astype(micro_results[0].dtype))
+        elif out_reductions[i] == 'mean':
+            results.append(np.mean(micro_results, axis=0).astype(micro_results[0].dtype))
+        else:
+            raise ValueError("result {} has no micro-batch axis and no micro_batch_reduce "
+                             "of 'sum' or 'mean'".format(i))
+    return tuple(results)
+
+
+def pin_to_cpuset(rank):
+    """
+    Pins the server of rank to the rank-th of the ':'-separated cpulists of
+    HETR_CPUSETS, typically the cpus of a NUMA node per pipeline stage. The
+    server pages its buffers in itself, so that they are first touched on the
+    node it runs on.
+    """
+    cpusets = os.getenv('HETR_CPUSETS')
+    if not cpusets:
+        return
+    cpusets = cpusets.split(':')
+    cpus = parse_cpulist(cpusets[rank % len(cpusets)])
+    if hasattr(os, 'sched_setaffinity'):
+        os.sched_setaffinity(0, cpus)
+    os.environ.setdefault('OMP_NUM_THREADS', str(len(cpus)))
+    # The engine's thread runtime pins the kernel threads to the same cpus
+    os.environ.setdefault('NGRAPH_MKL_CPUS', cpusets[rank % len(cpusets)])
+    logger.debug("pin_to_cpuset: rank %d, cpus %s", rank, cpus)
+
+
 def is_port_open(port):
     s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
     s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
@@ -216,9 +426,10 @@ def serve():
     parser.add_argument("-r", "--rng_seed", nargs='+')
     args = parser.parse_args()
     comm = MPI.COMM_WORLD
+    pin_to_cpuset(comm.Get_rank())
 
     options = [('grpc.max_send_message_length', -1), ('grpc.max_receive_message_length', -1)]
-    server = grpc.server(futures.ThreadPoolExecutor(max_workers=1), options=options)
+    server = grpc.server(futures.ThreadPoolExecutor(max_workers=_SERVER_WORKERS), options=options)
     hetr_pb2_grpc.add_HetrServicer_to_server(HetrServer(comm, server), server)
     logger.debug("server: rank %d, tmpfile %s, ports %s",
                  comm.Get_rank(), args.tmpfile[0], args.ports if args.ports is not None else "")
@@ -1,8 +1,11 @@
 import grpc
+import numpy as np
 from six import iteritems
 
 from . import hetr_pb2
 from . import hetr_pb2_grpc
+from .shm_transport import ShmTensorReader, ShmTensorWriter, assign_shm_tensor, \
+    pb_to_shm_tensor, shm_transport_enabled
 from ngraph.op_graph.serde.serde import op_to_protobuf, tensor_to_protobuf,\
     pb_to_tensor, is_scalar_type, assign_scalar, protobuf_scalar_to_python
 import logging
@@ -18,25 +21,43 @@ def is_channel_ready(channel):
 
 
 class RPCComputationClient(object):
-    def __init__(self, comp_id, stub):
+    def __init__(self, comp_id, stub, use_shm=False):
         self.comp_id = comp_id
         self.RPC = stub
         self.feed_input_response_future = None
+        # Micro-batches of the inputs the server runs the computation on
+        self.micro_batches = 1
+        # Tensors go through shared memory when the server is on this host
+        self.use_shm = use_shm
+        self.shm_writer = ShmTensorWriter()
+        self.shm_reader = ShmTensorReader()
+        # Where the server takes the tensor inputs of the next call, from its last reply
+        self.shm_inputs = []
 
     def feed_input(self, values):
         logger.debug("client: feed input")
+        if self.use_shm:
+            if self.feed_input_response_future is not None:
+                # The server may still read the inputs of the previous request
+                self.feed_input_response_future.result()
+            tensors = [np.asarray(v) for v in values if not is_scalar_type(v)]
+            shm_tensors = iter(self.write_shm_inputs(tensors))
         pb_values = []
         for v in values:
             pb_val = hetr_pb2.Value()
             if is_scalar_type(v):
                 assign_scalar(pb_val.scalar, v)
+            elif self.use_shm:
+                pb_val.shm_tensor.CopyFrom(next(shm_tensors))
             else:
                 pb_val.tensor.CopyFrom(tensor_to_protobuf(v))
             pb_values.append(pb_val)
         self.feed_input_response_future = self.RPC.FeedInput.future(
             hetr_pb2.FeedInputRequest(
                 comp_id=self.comp_id,
-                values=pb_values),
+                values=pb_values,
+                shm_results=self.use_shm,
+                micro_batches=self.micro_batches),
             _TIMEOUT_SECONDS)
 
     def get_results(self):
@@ -47,6 +68,7 @@ class RPCComputationClient(object):
         self.feed_input_response_future = None
         if not response.status:
             raise RuntimeError("RPC feed_input request failed: {}".format(response.message))
+        self.shm_inputs = list(response.inputs)
         response = self.RPC.GetResults(
             hetr_pb2.GetResultsRequest(comp_id=self.comp_id),
             _TIMEOUT_SECONDS)
@@ -56,12 +78,39 @@ class RPCComputationClient(object):
         for r in response.results:
             if r.HasField('scalar'):
                 return_list.append(protobuf_scalar_to_python(r.scalar))
+            elif r.HasField('shm_tensor'):
+                # Copied out, since the server reuses its memory for the next results
+                value = pb_to_shm_tensor(self.shm_reader, r.shm_tensor).copy()
+                return_list.append(value if value.ndim > 0 else value[()])
             else:
                 return_list.append(pb_to_tensor(r.tensor))
         return_dict = {op: return_list[mypos]
                        for (op, mypos) in iteritems(self.returns)}
         return return_dict
 
+    def write_shm_inputs(self, tensors):
+        """
+        Writes tensors where the server takes them and returns their ShmTensor
+        descriptors: in place of the arguments in the memory pools of the server when
+        it said where and the shapes match, else into the segment of this client.
+        """
+        slots = self.shm_inputs
+        if len(slots) == len(tensors) and \
+                all(tuple(slot.info.shape) == t.shape for slot, t in zip(slots, tensors)):
+            for slot, tensor in zip(slots, tensors):
+                pb_to_shm_tensor(self.shm_reader, slot)[()] = tensor
+            return slots
+        descriptors = []
+        for tensor, offset in zip(tensors, self.shm_writer.write(tensors)):
+            descriptor = hetr_pb2.ShmTensor()
+            assign_shm_tensor(descriptor, self.shm_writer.name, offset, tensor)
+            descriptors.append(descriptor)
+        return descriptors
+
+    def close(self):
+        self.shm_writer.close()
+        self.shm_reader.close()
+
 
 class RPCTransformerClient(object):
 
@@ -74,6 +123,7 @@ class RPCTransformerClient(object):
         self.computation_builds = dict()
         self.comp_id_ctr = 0
         self.is_trans_built = False
+        self.use_shm = False
         self.computation_response_future = None
         self.close_transformer_response_future = None
 
@@ -94,6 +144,7 @@ class RPCTransformerClient(object):
         if not is_channel_ready(channel):
             raise RuntimeError("gRPC channel is not ready...")
         self.RPC = hetr_pb2_grpc.HetrStub(channel)
+        self.use_shm = shm_transport_enabled(self.server_address)
 
         if self.close_transformer_response_future is not None:
             response = self.close_transformer_response_future.result()
@@ -150,7 +201,9 @@ class RPCTransformerClient(object):
         response = self.computation_response_future.result()
         self.computation_response_future = None
         if response.comp_id >= 0:
-            rpcComputationClient = RPCComputationClient(response.comp_id, self.RPC)
+            rpcComputationClient = RPCComputationClient(response.comp_id, self.RPC,
+                                                        self.use_shm)
+            self.computations[response.comp_id] = rpcComputationClient
             return rpcComputationClient
         else:
             raise RuntimeError("RPC computation request failed: {}".format(response.message))
@@ -171,6 +224,9 @@ class RPCTransformerClient(object):
                                    .format(response.message))
             self.is_trans_built = False
             self.close_transformer_response_future = None
+        for computation in self.computations.values():
+            computation.close()
+        self.computations.clear()
         try:
             self.RPC.Close.future(
                 hetr_pb2.CloseRequest(),
@@ -0,0 +1,288 @@
+# ******************************************************************************
+# Copyright 2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+"""
+Shared memory transport of tensors between the HeTr client and its servers on
+the same host.
+
+The process that produces tensors (the client for inputs, a server for results)
+writes them into a segment in /dev/shm it owns and sends only their descriptors,
+(segment name, offset, shape, dtype), over gRPC. The process that consumes them
+maps the segment once and views the tensors in place.
+
+The consumer unlinks the name of a segment once it has mapped it, and the
+producer when it replaces or closes it, so no segment outlives the processes
+using it.
+
+A server running a CPU transformer allocates the memory pools of its
+computations in pinned segments as well, see ShmPoolAllocator. The arguments
+and results of a computation are then tensors of its pools: the server tells the
+client where the arguments of the next call go, the client writes them there,
+and the server runs the computation on them and returns its results without
+copying either. Pinned segments stay mapped by both processes until they close,
+and the server unlinks them.
+"""
+import mmap
+import os
+import socket
+import uuid
+
+import numpy as np
+
+from ngraph.op_graph.serde.serde import dtype_to_protobuf, pb_to_dtype
+
+# Tensors start on cache lines
+ALIGN_BYTES = 64
+MIN_SEGMENT_BYTES = 1 << 20
+
+
+def shm_transport_enabled(address):
+    """
+    True to exchange tensors with the server at address through shared memory:
+    HETR_SHM_TRANSPORT is not 0 and the server is on this host.
+    """
+    if os.getenv('HETR_SHM_TRANSPORT', '1') == '0':
+        return False
+    host = address.rsplit(':', 1)[0].strip('[]')
+    return host in ('localhost', '127.0.0.1', '::1', '',
+                    socket.gethostname(), socket.getfqdn())
+
+
+def shm_path(name):
+    return os.path.join('/dev/shm', name)
+
+
+def unlink_segment(name):
+    try:
+        os.unlink(shm_path(name))
+    except OSError:
+        pass
+
+
+def map_segment(name, size=None):
+    """
+    Maps segment name, creating it with size bytes if size is given.
+    """
+    flags = os.O_RDWR | (os.O_CREAT | os.O_EXCL if size is not None else 0)
+    fd = os.open(shm_path(name), flags, 0o600)
+    try:
+        if size is not None:
+            try:
+                # Raises here rather than SIGBUS on first touch when /dev/shm is full
+                os.posix_fallocate(fd, 0, size)
+            except OSError:
+                os.unlink(shm_path(name))
+                raise
+        else:
+            size = os.fstat(fd).st_size
+        return mmap.mmap(fd, size)
+    finally:
+        os.close(fd)
+
+
+def assign_shm_tensor(message, name, offset, tensor, pinned=False):
+    """
+    Fills ShmTensor message with the descriptor of tensor at offset in segment name,
+    pinned if the segment is a memory pool of the producer.
+    """
+    message.name = name
+    message.offset = offset
+    message.info.dtype = dtype_to_protobuf(tensor.dtype)
+    message.info.shape.extend(tensor.shape)
+    message.pinned = pinned
+
+
+def pb_to_shm_tensor(reader, message):
+    """
+    The tensor ShmTensor message describes, viewed in place through reader.
+    """
+    return reader.view(message.name, message.offset, tuple(message.info.shape),
+                       pb_to_dtype(message.info.dtype), message.pinned)
+
+
+def view_tensor(segment_map, offset, shape, dtype):
+    dtype = np.dtype(dtype)
+    count = int(np.prod(shape))
+    if count == 0:
+        return np.empty(shape, dtype=dtype)
+    return np.frombuffer(segment_map, dtype=dtype, count=count, offset=offset).reshape(shape)
+
+
+def close_map(segment_map):
+    try:
+        segment_map.close()
+    except BufferError:
+        # Arrays still view the segment; it is unmapped when they are freed
+        pass
+
+
+class ShmTensorWriter(object):
+    """
+    The segment a producer writes its tensors into. The segment is reused for
+    every write, and replaced by a larger one when the tensors do not fit.
+
+    The tensors of a write stay valid until the next write, so the producer must
+    not write again before the consumer is done with them.
+    """
+
+    def __init__(self):
+        self.name = None
+        self.map = None
+        self.size = 0
+
+    def layout(self, shapes_dtypes):
+        """
+        Offsets of tensors of the given (shape, dtype), and the bytes they take.
+        """
+        offsets = []
+        end = 0
+        for shape, dtype in shapes_dtypes:
+            offsets.append(end)
+            nbytes = int(np.prod(shape)) * np.dtype(dtype).itemsize
+            end += -(-nbytes // ALIGN_BYTES) * ALIGN_BYTES
+        return offsets, end
+
+    def reserve(self, nbytes):
+        if nbytes <= self.size:
+            return
+        size = max(nbytes, 2 * self.size, MIN_SEGMENT_BYTES)
+        self.close()
+        self.name = 'ngraph_hetr_{}'.format(uuid.uuid4().hex)
+        self.map = map_segment(self.name, size)
+        self.size = size
+
+    def allocate(self, shapes_dtypes):
+        """
+        Returns a list of (offset, array) for tensors of the given (shape, dtype),
+        the arrays viewing the segment.
+        """
+        offsets, nbytes = self.layout(shapes_dtypes)
+        self.reserve(nbytes)
+        return [(offset, view_tensor(self.map, offset, shape, dtype))
+                for offset, (shape, dtype) in zip(offsets, shapes_dtypes)]
+
+    def write(self, tensors):
+        """
+        Copies tensors into the segment and returns their offsets.
+        """
+        tensors = [np.asarray(t) for t in tensors]
+        slots = self.allocate([(t.shape, t.dtype) for t in tensors])
+        for tensor, (_, array) in zip(tensors, slots):
+            np.copyto(array, tensor)
+        return [offset for offset, _ in slots]
+
+    def close(self):
+        if self.map is not None:
+            unlink_segment(self.name)
+            close_map(self.map)
+        self.name = None
+        self.map = None
+        self.size = 0
+
+
+class ShmTensorReader(object):
+    """
+    Views the tensors of the segment of one producer, and of its pinned segments.
+    """
+
+    def __init__(self):
+        self.name = None
+        self.map = None
+        self.pinned = dict()
+
+    def view(self, name, offset, shape, dtype, pinned=False):
+        """
+        The tensor of the given shape and dtype at offset in segment name, viewed in
+        place. A new segment name means the producer has replaced its segment.
+        Pinned segments are mapped once and left for the producer to unlink.
+        """
+        if pinned:
+            segment_map = self.pinned.get(name)
+            if segment_map is None:
+                segment_map = self.pinned[name] = map_segment(name)
+            return view_tensor(segment_map, offset, shape, dtype)
+        if name != self.name:
+            self.close()
+            self.map = map_segment(name)
+            self.name = name
+            unlink_segment(name)
+        return view_tensor(self.map, offset, shape, dtype)
+
+    def close(self):
+        if self.map is not None:
+            close_map(self.map)
+        for segment_map in self.pinned.values():
+            close_map(segment_map)
+        self.name = None
+        self.map = None
+        self.pinned = dict()
+
+
+class ShmPoolAllocator(object):
+    """
+    Allocates memory pools in pinned segments, as the pool_allocator of a
+    CPUTransformer. Each pool gets its own segment, so the tensors of a pool are
+    at fixed offsets of its segment for as long as the allocator is open.
+
+    Returns None, for a private allocation, for empty pools and pools that do not
+    fit in /dev/shm.
+    """
+
+    def __init__(self):
+        self.segments = []  # (name, map, address, bytes)
+
+    def __call__(self, element_count, alignment, dtype):
+        dtype = np.dtype(dtype)
+        nbytes = element_count * dtype.itemsize
+        if nbytes == 0 or mmap.PAGESIZE % alignment != 0:
+            return None
+        name = 'ngraph_hetr_pool_{}'.format(uuid.uuid4().hex)
+        try:
+            segment_map = map_segment(name, nbytes)
+        except OSError:
+            return None
+        pool = view_tensor(segment_map, 0, (element_count,), dtype)
+        self.segments.append((name, segment_map, pool.ctypes.data, nbytes))
+        return pool
+
+    def locate(self, tensor):
+        """
+        (segment name, offset) of tensor if it is a contiguous tensor of a pool,
+        else None.
+        """
+        if not isinstance(tensor, np.ndarray) or tensor.size == 0 or \
+                not tensor.flags.c_contiguous:
+            return None
+        address = tensor.ctypes.data
+        for name, _, start, nbytes in self.segments:
+            if start <= address and address + tensor.nbytes <= start + nbytes:
+                return name, address - start
+        return None
+
+    def view(self, name, offset, shape, dtype):
+        """
+        The tensor at offset in pool segment name, at the address the pool uses, or
+        None if name is not a segment of this allocator.
+        """
+        for segment_name, segment_map, _, _ in self.segments:
+            if segment_name == name:
+                return view_tensor(segment_map, offset, shape, dtype)
+        return None
+
+    def close(self):
+        for name, segment_map, _, _ in self.segments:
+            unlink_segment(name)
+            close_map(segment_map)
+        self.segments = []
@@ -27,6 +27,7 @@ from ngraph.transformers.hetr.mpilauncher import MPILauncher
 from ngraph.transformers.passes.hetrpasses import CommunicationPass
 from ngraph.transformers.passes.hetrpasses import DeviceAssignPass
 from ngraph.transformers.passes.hetrpasses import AxesUpdatePass
+from ngraph.transformers.passes.hetrpasses import PipelinePass
 from ngraph.op_graph.serde.serde import op_to_protobuf, add_edges
 import logging
 
@@ -35,14 +36,14 @@ _OPS_PER_MSG = 10
 logger = logging.getLogger(__name__)
 
 
-def build_transformer(name, comm=None):
+def build_transformer(name, comm=None, **kwargs):
     """
 
     :param results: the graph nodes that we care about, for the computation
     :return: the dictionary of transformers, with names matching the graph node hints
     """
     if 'cpu' in name:
-        transformer = make_transformer_factory('cpu', comm=comm)()
+        transformer = make_transformer_factory('cpu', comm=comm, **kwargs)()
     elif 'gpu' in name:
         try:
             from ngraph.transformers.gputransform import GPUTransformer  # noqa
@@ -154,6 +155,7 @@ class HetrComputation(Computation):
             comp = trans.get_computation()
             comp.param_idx = [g_pos for g_pos, p in enumerate(self.computation_op.parameters)
                               if is_my_op(p, t_name)]
+            comp.micro_batches = self.transformer.micro_batches
 
             # when there is a ResultOp, hack around it
             comp.returns = dict()
@@ -204,10 +206,12 @@ class HetrTransformer(ComputationGraphTransformer):
     default_rtol = 1e-05
     default_atol = 1e-08
 
-    def __init__(self, device='cpu', **kwargs):
+    def __init__(self, device='cpu', micro_batches=1, **kwargs):
         super(HetrTransformer, self).__init__(**kwargs)
 
         self.default_device = device
+        # Micro-batches each call of a pipeline parallel computation is split into
+        self.micro_batches = micro_batches
         self.my_pid = os.getpid()
         self.is_closed = False
         self.child_transformers = dict()
@@ -217,6 +221,8 @@ class HetrTransformer(ComputationGraphTransformer):
                                               default_device_id=0),
                              CommunicationPass(self.send_nodes),
                              AxesUpdatePass()]
+        if micro_batches > 1:
+            self.graph_passes.append(PipelinePass(micro_batches))
         self.mpilauncher = MPILauncher()
 
     def close(self):
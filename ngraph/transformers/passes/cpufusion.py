@@ -1,7 +1,9 @@
 import warnings
 
+import numpy as np
+
 import ngraph as ng
-from ngraph.op_graph.op_graph import Add, Multiply, Greater, Less
+from ngraph.op_graph.op_graph import Op, Add, Multiply, Greater, Less
 from ngraph.op_graph.op_graph import Maximum, Minimum, NegativeOp, Sum
 from ngraph.op_graph.op_graph import ReciprocalOp, Subtract, SqrtOp
 from ngraph.op_graph.op_graph import PatternLabelOp, PatternSkipOp
@@ -11,7 +13,9 @@ from ngraph.op_graph.op_graph import DotOp, MapRolesOp, TensorSliceOp, TensorVal
 from ngraph.op_graph.convolution import ConvolutionOp, update_conv
 from ngraph.transformers.cpu.batchnorm import BatchnormOp, BpropBatchnormOp
 from ngraph.transformers.cpu.relu import ReluOp, BpropReluOp
-from ngraph.transformers.passes.passes import GraphRewritePass
+from ngraph.transformers.cpu.scaled_sum import ScaledSumOp
+from ngraph.transformers.passes.passes import GraphRewritePass, PeepholeGraphPass
+from ngraph.util.generics import generic_method
 
 
 class CPUFusion(GraphRewritePass):
@@ -525,3 +529,151 @@ class CPUFusion(GraphRewritePass):
         # Register Inner + Bias  pattern
         pattern_inner_bias = self.construct_innerproduct_and_bias_pattern()
         self.register_pattern(pattern_inner_bias, self.fuse_innerproduct_and_bias_callback)
+
+
+class CPUSumFusion(PeepholeGraphPass):
+    """
+    Collapses trees of Add, Subtract, NegativeOp and multiplications by scalar
+    constants into a single ScaledSumOp, e.g. a + b + c, a - b and
+    alpha * a + beta * b, so the whole expression is one pass over memory instead
+    of one pass and one temporary per op.
+
+    Only float32 intermediate results with a single reader are absorbed, and every
+    term must be a full (not broadcast) tensor with the axes of the result. Runs on
+    the execution graph after tensor shaping.
+    """
+    # Largest number of inputs of an MKL-DNN sum kernel
+    max_terms = 8
+
+    @generic_method(dispatch_base_type=Op)
+    def visit(self, op, *args):
+        pass
+
+    @visit.on_type(Add)
+    def visit(self, op, x, y):
+        self.fuse(op)
+
+    @visit.on_type(Subtract)
+    def visit(self, op, x, y):
+        self.fuse(op)
+
+    @visit.on_type(ScaledSumOp)
+    def visit(self, op, *args):
+        self.fuse(op)
+
+    def get_exop(self, op):
+        return self.op_accessor.computation_decl.get_exop(op)
+
+    def is_full_tensor(self, op, axes):
+        exop = self.get_exop(op)
+        if len(exop.output_decls) != 1 or op.axes != axes:
+            return False
+        td = exop.output_decls[0].tensor_description
+        return all(stride != 0 or length == 1
+                   for stride, length in zip(td.strides, td.axes.lengths))
+
+    def is_absorbable(self, op, axes):
+        """
+        True if op only feeds one op and can be folded into it.
+        """
+        if not self.is_full_tensor(op, axes) or op.dtype != np.float32:
+            return False
+        exop = self.get_exop(op)
+        return (len(exop.output_decls[0].user_input_decls) == 1 and
+                exop not in self.op_accessor.exop_block.root_set)
+
+    def scalar_constant(self, op):
+        """
+        The value of op if it is a broadcast scalar constant, otherwise None.
+        """
+        while isinstance(op, (BroadcastOp, ContiguousOp, ExpandDims)):
+            op = self.op_arg(op, 0)
+        if op.is_scalar and op.is_constant:
+            return float(op.const)
+        return None
+
+    def scaled_args(self, op, scale):
+        """
+        The (arg, scale) pairs op computes the sum of, or None if op is not a sum.
+        """
+        if isinstance(op, Add):
+            return [(self.op_arg(op, 0), scale), (self.op_arg(op, 1), scale)]
+        if isinstance(op, Subtract):
+            return [(self.op_arg(op, 0), scale), (self.op_arg(op, 1), -scale)]
+        if isinstance(op, ScaledSumOp):
+            return [(arg, scale * arg_scale)
+                    for arg, arg_scale in zip(self.op_args(op), op.scales)]
+        if isinstance(op, NegativeOp):
+            return [(self.op_arg(op, 0), -scale)]
+        if isinstance(op, Multiply):
+            for index in (0, 1):
+                factor = self.scalar_constant(self.op_arg(op, index))
+                if factor is not None:
+                    return [(self.op_arg(op, 1 - index), scale * factor)]
+        return None
+
+    def add_terms(self, op, scale, axes, terms, expanded):
+        """
+        Appends the terms of op, expanded through absorbable sums, to terms and the
+        ops folded into op to expanded.
+
+        Returns:
+            False if some term is not a full tensor with the given axes.
+        """
+        for arg, arg_scale in self.scaled_args(op, scale):
+            if self.is_absorbable(arg, axes) and self.scaled_args(arg, 1.0) is not None:
+                nested = []
+                nested_expanded = []
+                if self.add_terms(arg, arg_scale, axes, nested, nested_expanded) and \
+                        len(terms) + len(nested) <= self.max_terms:
+                    terms.extend(nested)
+                    expanded.append(arg)
+                    expanded.extend(nested_expanded)
+                    continue
+            if not self.is_full_tensor(arg, axes):
+                return False
+            terms.append((arg, arg_scale))
+        return True
+
+    def sum_terms(self, op):
+        """
+        The (arg, scale) terms of the fused sum rooted at op and the ops folded
+        into it, or None if it cannot be fused.
+        """
+        if op.dtype != np.float32:
+            return None
+        terms = []
+        expanded = []
+        if not self.add_terms(op, 1.0, op.axes, terms, expanded) or \
+                len(terms) > self.max_terms:
+            return None
+        return terms, expanded
+
+    def is_absorbed(self, op):
+        """
+        True if op is folded into the sum rooted at one of its downstream ops.
+        """
+        user = op
+        while self.is_absorbable(user, op.axes):
+            user = self.get_exop(user).output_decls[0].user_input_decls[0].exop.op
+            if isinstance(user, (Add, Subtract, ScaledSumOp)):
+                fused = self.sum_terms(user)
+                return fused is not None and any(folded is op for folded in fused[1])
+            if self.scaled_args(user, 1.0) is None:
+                break
+        return False
+
+    def fuse(self, op):
+        if self.is_absorbed(op):
+            return
+        fused = self.sum_terms(op)
+        if fused is None:
+            return
+        terms = fused[0]
+        if isinstance(op, ScaledSumOp):
+            if [arg for arg, _ in terms] == list(self.op_args(op)):
+                return
+        elif len(terms) <= 2 and all(scale == 1.0 for _, scale in terms):
+            return
+        args, scales = zip(*terms)
+        self.replace_op(op, ScaledSumOp(args, scales, dtype=op.dtype))
@@ -19,7 +19,8 @@ from orderedset import OrderedSet
 
 from ngraph.factory.comm_node_factory import get_comm_pattern, CommNodePair
 from ngraph.op_graph.op_graph import Op, TensorValueOp
-from ngraph.op_graph.comm_nodes import RecvOp
+from ngraph.op_graph.comm_nodes import RecvOp, SendOp, CPUMlslSendOp, CPUMlslRecvOp, \
+    set_parallel_axes
 from ngraph.transformers.passes.passes import GraphBuildingPass
 from ngraph.op_graph.axes import make_axis
 from ngraph.transformers.hetr.hetr_utils import update_parallel_axis
@@ -121,3 +122,92 @@ class AxesUpdatePass(GraphBuildingPass):
                         docstring='HeTr parallel axis')
                 gather_send_op = op.send_node()
                 update_parallel_axis(gather_send_op, self.parallel_axis)
+
+
+class PipelinePass(GraphBuildingPass):
+    """
+    Description:
+        PipelinePass splits the batch of a pipeline parallel computation into
+        micro_batches micro-batches. Stages are the devices ops are placed on, and
+        the batch axis is the one given by the ops marked with
+        ng.metadata(pipeline=axis). The axis is shrunk to the micro-batch, which
+        each stage then runs micro_batches times per call, passing its outputs
+        to the next stage through the sends marked as pipeline boundaries.
+
+        Stages must form a chain (or a DAG) of forward computations: a stage
+        which receives from a later one could not run ahead of it.
+
+        Results without the batch axis are reduced over the micro-batches as
+        marked with ng.metadata(micro_batch_reduce='sum') or 'mean'.
+    """
+
+    def __init__(self, micro_batches, **kwargs):
+        super(PipelinePass, self).__init__(**kwargs)
+        self.micro_batches = micro_batches
+        self.pipeline_axis = None
+
+    def do_pass(self, ops, **kwargs):
+
+        ops = OrderedSet(op.forwarded for op in ops)
+        all_ops = Op.ordered_ops(ops)
+
+        axes = set(op.metadata['pipeline'] for op in all_ops if 'pipeline' in op.metadata)
+        if not axes:
+            return
+        if len(axes) > 1:
+            raise ValueError('ops are marked with different pipeline axes {}'.format(axes))
+        a = axes.pop()
+        if a.length % self.micro_batches != 0:
+            raise ValueError('{} can not be equally divided into {} micro-batches'
+                             .format(a, self.micro_batches))
+
+        sends = [op for op in all_ops if isinstance(op, CPUMlslSendOp)]
+        stages = dict()
+        for op in sends:
+            stages.setdefault(str(op.metadata['device_id']), set()).add(op.metadata['peer_id'])
+        self.check_acyclic(stages)
+
+        if self.pipeline_axis is None:
+            self.pipeline_axis = make_axis(name=a.name,
+                                           length=a.length // self.micro_batches,
+                                           docstring='HeTr pipeline micro-batch axis')
+        for op in ops:
+            update_parallel_axis(op, self.pipeline_axis)
+
+        for op in all_ops:
+            if isinstance(op, (CPUMlslSendOp, CPUMlslRecvOp)):
+                op.metadata['pipeline_boundary'] = True
+                if self.pipeline_axis in op.native_axes:
+                    op.native_axes = set_parallel_axes(op.native_axes, self.pipeline_axis)
+            if getattr(op, 'axes', None) is not None and self.pipeline_axis in op.axes:
+                # Inputs and results are split and joined along it by the servers
+                op.metadata['pipeline_axis'] = self.pipeline_axis.name
+
+        for op in ops:
+            if isinstance(op, SendOp) or getattr(op, 'axes', None) is None or \
+                    op.tensor.is_placeholder or 'pipeline_axis' in op.metadata:
+                continue
+            result = op.metadata.get('replaces_op', op)
+            if result.metadata.get('micro_batch_reduce') not in ('sum', 'mean'):
+                raise ValueError("result {} does not have the pipeline axis {}, mark it with "
+                                 "ng.metadata(micro_batch_reduce='sum' or 'mean') to choose how "
+                                 "it is reduced over micro-batches".format(result.name, a.name))
+
+    @staticmethod
+    def check_acyclic(stages):
+        visiting, done = set(), set()
+
+        def visit(stage):
+            if stage in done:
+                return
+            if stage in visiting:
+                raise ValueError('pipeline stages {} form a cycle, only forward '
+                                 'computations can be pipelined'.format(sorted(visiting)))
+            visiting.add(stage)
+            for peer in stages.get(stage, ()):
+                visit(str(peer))
+            visiting.remove(stage)
+            done.add(stage)
+
+        for stage in list(stages):
+            visit(stage)
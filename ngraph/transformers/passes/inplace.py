@@ -0,0 +1,111 @@
+# ******************************************************************************
+# Copyright 2017-2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+from ngraph.op_graph.op_graph import Add
+from ngraph.transformers.cpu.batchnorm import BatchnormOp
+from ngraph.transformers.cpu.relu import ReluOp, BpropReluOp
+from ngraph.transformers.cpu.scaled_sum import ScaledSumOp
+from ngraph.transformers.exop import ExOpBlock
+from ngraph.transformers.passes.passes import GraphPass
+
+
+class InPlacePass(GraphPass):
+    """
+    Fills exop.inplace_inputs for exops whose kernels can write an output over
+    one of their inputs. MemLayoutPass gives such an output the buffer of the
+    input when the input is dead after the exop.
+
+    Subclasses name the candidate (output, input) pairs; this pass only keeps
+    pairs where both sides are temporary tensors viewed identically, so that
+    every element is read and written at the same address.
+    """
+
+    def do_pass(self, computation_decl, **kwargs):
+        assert isinstance(computation_decl.exop_block, ExOpBlock)
+        for exop in computation_decl.exop_block:
+            exop.inplace_inputs = dict()
+            for output_pos, input_pos in self.inplace_candidates(exop):
+                if self.can_alias(exop, output_pos, input_pos):
+                    exop.inplace_inputs[output_pos] = \
+                        exop.inplace_inputs.get(output_pos, ()) + (input_pos,)
+
+    def inplace_candidates(self, exop):
+        """
+        Returns:
+            (output position, input position) pairs that the kernel of exop can
+            run in place for.
+        """
+        return ()
+
+    @staticmethod
+    def is_temporary(tensor_decl):
+        return not (tensor_decl.is_persistent or tensor_decl.is_constant or
+                    tensor_decl.is_compile_only)
+
+    def can_alias(self, exop, output_pos, input_pos):
+        output_decl = exop.output_decls[output_pos]
+        input_decl = exop.input_decls[input_pos]
+        out_tensor = output_decl.tensor_decl
+        in_tensor = input_decl.tensor_decl
+        if in_tensor is out_tensor or in_tensor.size != out_tensor.size:
+            return False
+        if not self.is_temporary(in_tensor) or not self.is_temporary(out_tensor):
+            return False
+        # Another view of the same input would be read after it is overwritten
+        if any(other is not input_decl and other.tensor_decl is in_tensor
+               for other in exop.input_decls):
+            return False
+        in_td = input_decl.tensor_view_decl.tensor_description
+        out_td = output_decl.tensor_view_decl.tensor_description
+        return (in_td.dtype == out_td.dtype and in_td.shape == out_td.shape and
+                in_td.strides == out_td.strides and in_td.offset == out_td.offset)
+
+
+class CPUInPlacePass(InPlacePass):
+    """
+    In-place candidates of the CPU transformer: relu fprop and bprop, add, scaled
+    sum and batchnorm fprop. The numpy fallbacks of these ops are all safe in
+    place; an MKL-DNN kernel is only used in place if its input and output
+    memory layouts allow it.
+    """
+
+    def __init__(self, mkldnn, **kwargs):
+        super(CPUInPlacePass, self).__init__(**kwargs)
+        self.mkldnn = mkldnn
+
+    def kernel_inputs(self, exop):
+        """
+        (output position, input position, kernel input index) triples.
+        """
+        op = exop.op
+        if isinstance(op, ReluOp):
+            return [(0, 0, 0)]
+        if isinstance(op, BpropReluOp):
+            # The bprop kernel takes the fprop input first and delta second
+            return [(0, 0, 1)]
+        if isinstance(op, (Add, ScaledSumOp)):
+            return [(0, index, index) for index in range(len(exop.input_decls))]
+        if isinstance(op, BatchnormOp):
+            return [(0, 0, 0)]
+        return []
+
+    def inplace_candidates(self, exop):
+        kernel = None
+        if self.mkldnn.enabled:
+            kernel = self.mkldnn.kernels.get(exop.op.safe_name)
+        for output_pos, input_pos, kernel_index in self.kernel_inputs(exop):
+            if kernel is None or \
+                    self.mkldnn.inplace_compatible(kernel, kernel_index, output_pos):
+                yield output_pos, input_pos
@@ -43,6 +43,11 @@ class MemLayoutPass(GraphPass):
 
         # Layout persistent memory
         pmm = MemoryManager(self.byte_alignment)
+        for exop in self.exop_block:
+            for group in self.packed_groups(exop):
+                if all(tensor.is_persistent and tensor.buffer_pool_offset is None
+                       for tensor in group):
+                    self.allocate_packed(pmm, group)
         for exop in self.exop_block:
             for input_decl in exop.input_decls:
                 if input_decl.source_output_decl.tensor_decl.is_persistent and \
@@ -59,12 +64,72 @@ class MemLayoutPass(GraphPass):
 
         # self.test_memory_overlap()
 
+    @staticmethod
+    def inplace_donor(node, tensor, donated):
+        """
+        The input tensor whose buffer tensor can reuse, or None.
+
+        node.inplace_inputs lists the inputs each output may be written over; the
+        buffer of the first one that is freed by node, and not already given to
+        another output, is reused.
+        """
+        for output_pos, input_positions in six.iteritems(node.inplace_inputs):
+            if node.output_decls[output_pos].tensor_decl is not tensor:
+                continue
+            for input_pos in input_positions:
+                donor = node.input_decls[input_pos].tensor_decl
+                if donor in node.liveness_free_list and donor not in donated and \
+                        donor.buffer_pool_offset is not None and donor.size >= tensor.size:
+                    return donor
+        return None
+
+    @staticmethod
+    def packed_groups(exop):
+        """
+        The groups of tensors that exop reads or writes as the rows of one array,
+        see ExOp.packed_inputs, skipping groups with a tensor used twice.
+        """
+        groups = [tuple(exop.input_decls[pos].tensor_decl for pos in positions)
+                  for positions in exop.packed_inputs]
+        groups += [tuple(exop.output_decls[pos].tensor_decl for pos in positions)
+                   for positions in exop.packed_outputs]
+        return [group for group in groups if len(set(group)) == len(group)]
+
+    @staticmethod
+    def allocate_packed(mm, group):
+        """
+        Allocates one block for the tensors of group, placed back to back in order.
+        """
+        offset = mm.allocate(sum(tensor.size for tensor in group))
+        for tensor in group:
+            tensor.buffer_pool_offset = offset
+            offset += tensor.size
+
     def layout_memory_best_fit(self):
         mm = MemoryManager(self.byte_alignment)
+        donated = set()
+        # Tensor of a packed block -> (first tensor, tensors of the block still live)
+        packed = dict()
         for i, node in enumerate(self.exop_block):
+            for group in self.packed_groups(node):
+                if all(tensor in node.liveness_new_list and
+                       tensor.buffer_pool_offset is None and
+                       self.inplace_donor(node, tensor, donated) is None
+                       for tensor in group):
+                    self.allocate_packed(mm, group)
+                    block = (group[0], list(group))
+                    for tensor in group:
+                        packed[tensor] = block
             for new in node.liveness_new_list:
+                if new in packed:
+                    continue
                 if new.buffer_pool_offset is not None:
                     raise RuntimeError('Error: {} - {} Already allocated'.format(i, new))
+                donor = self.inplace_donor(node, new, donated)
+                if donor is not None:
+                    # The output takes over the input's buffer, which is freed with it
+                    new.buffer_pool_offset = donor.buffer_pool_offset
+                    donated.add(donor)
                 else:
                     new.buffer_pool_offset = mm.allocate(new.size)
 
@@ -73,7 +138,13 @@ class MemLayoutPass(GraphPass):
                     raise RuntimeError('Error: {} - {} Already free'.format(
                         i,
                         free.tensor_description_base.name))
-                else:
+                elif free in packed:
+                    # The block is freed with the last of its tensors
+                    first, live = packed.pop(free)
+                    live.remove(free)
+                    if not live:
+                        mm.free(first.buffer_pool_offset)
+                elif free not in donated:
                     mm.free(free.buffer_pool_offset)
         return mm.max_allocated()
 
@@ -17,18 +17,24 @@ from __future__ import division
 
 from ngraph.op_graph.convolution import ConvolutionOp, bprop_conv, update_conv
 from ngraph.op_graph.op_graph import Op, MapRolesOp, TensorOp, TensorSliceOp, ExpandDims, \
-    Flatten, Unflatten, ReorderAxes, DotLowDimension, Add, ContiguousOp, ReturnOp
+    Flatten, Unflatten, ReorderAxes, DotLowDimension, Add, ContiguousOp, ReturnOp, \
+    BinaryElementWiseOp, Subtract, Multiply, Divide, Maximum, Minimum
 from ngraph.op_graph.pooling import PoolingOp, BpropPoolOp
 from ngraph.transformers.cpu.batchnorm import BatchnormOp, BpropBatchnormOp
 from ngraph.op_graph.axes import Axes
 from ngraph.transformers.cpu.relu import ReluOp, BpropReluOp
-from ngraph.transformers.passes.passes import PeepholeGraphPass
+from ngraph.transformers.cpu.scaled_sum import ScaledSumOp
+from ngraph.transformers.passes.passes import GraphPass, PeepholeGraphPass
 from ngraph.util.generics import generic_method
 
 import ctypes as ct
+import itertools
+import logging
 import numpy as np
 from operator import itemgetter
 
+logger = logging.getLogger(__name__)
+
 
 class MklReorderOp(TensorOp):
     '''
@@ -150,6 +156,289 @@ def get_arg_output_idx(exop, arg_exop):
     return 0
 
 
+class MklLayoutCostModel(object):
+    """
+    Per-step cost of running ops in MKL-DNN blocked or native layouts, in bytes moved
+    through memory. The ops are all bandwidth bound, so bytes stand in for time.
+
+    A reorder reads its tensor and writes it once: 2 bytes per tensor byte, ignoring
+    that one side is accessed with a stride. An MKL-DNN elementwise kernel reads
+    every input and writes its output once. The numpy fallbacks in Mkldnn run
+    several numpy calls per op, each of which reads its operands and writes its
+    result in full; numpy_eltwise_bytes counts those, one statement at a time.
+    """
+    reorder_cost_per_byte = 2.0
+    mkl_eltwise_cost_per_byte = 1.0
+
+    def reorder_cost(self, nbytes):
+        return self.reorder_cost_per_byte * nbytes
+
+    @staticmethod
+    def numpy_eltwise_bytes(op, nbytes, num_inputs):
+        """
+        Bytes moved by the numpy fallback of op for float32 tensors of nbytes, where
+        boolean masks are a quarter of that.
+        """
+        if isinstance(op, ReluOp):
+            # Mkldnn.fprop_relu: maximum(x, 0) 2, minimum(0, x) 2, slope * min 2,
+            # add(max, slope * min, out) 3
+            return 9 * nbytes
+        if isinstance(op, BpropReluOp):
+            # Mkldnn.bprop_relu: greater(x, 0) 1.25, delta * mask 2.25, delta * slope 2,
+            # less(x, 0) 1.25, (delta * slope) * mask 2.25, add(..., out) 3
+            return 12 * nbytes
+        if isinstance(op, ScaledSumOp):
+            # Mkldnn.scaled_sum: acc = x0 * s0 2, then acc += x 3 or acc += s * x 5 per
+            # further input, out[...] = acc 2
+            further = sum(3 if abs(scale) == 1.0 else 5 for scale in op.scales[1:])
+            return (4 + further) * nbytes
+        # One numpy call with out=, as the MKL-DNN kernel
+        return (num_inputs + 1) * nbytes
+
+    def eltwise_cost(self, op, nbytes, num_inputs, blocked):
+        if blocked:
+            return self.mkl_eltwise_cost_per_byte * (num_inputs + 1) * nbytes
+        return self.numpy_eltwise_bytes(op, nbytes, num_inputs)
+
+
+class MklAssignLayouts(GraphPass):
+    """
+    Chooses, for the whole graph, which MKL-DNN elementwise ops keep their output
+    in the blocked layout of their input and which run on native layout tensors.
+    Relu ops follow their first input; binary ops follow whichever input is blocked
+    and read the other one in place.
+
+    MklCreateOpDescriptors decides greedily: an elementwise op with a blocked
+    input always produces a blocked output, and MklAddLayoutConversions later
+    reorders it for every non-MKL consumer. With a native second operand, or a
+    blocked result that only feeds numpy ops, that places a reorder on both sides
+    of the op. This pass labels every tensor blocked or native, prices each label
+    with MklLayoutCostModel (reorders plus elementwise compute) and picks the
+    labels of the elementwise ops that minimize the total.
+
+    Ops whose label can influence each other are grouped; each group is solved
+    exactly when small and by local search from the greedy labels otherwise.
+    MklCreateOpDescriptors then leaves the ops labeled native to the numpy code.
+
+    Every computation appends a report to mkldnn.layout_reports with the reorder
+    bytes per step of the greedy and the assigned labels; MklAddLayoutConversions
+    adds the bytes of the reorder ops it actually inserted.
+    """
+    max_exhaustive_group = 10
+
+    def __init__(self, mkldnn, cost_model=None, **kwargs):
+        super(MklAssignLayouts, self).__init__(**kwargs)
+        assert mkldnn.enabled
+        self.mkldnn = mkldnn
+        self.cost_model = cost_model or MklLayoutCostModel()
+        self.native_ops = set()
+
+    def is_native(self, op):
+        return op.safe_name in self.native_ops
+
+    # Ops MklCreateOpDescriptors creates kernels for with a blocked output
+    blocked_producers = (ConvolutionOp, bprop_conv, PoolingOp, BpropPoolOp,
+                         BatchnormOp, BpropBatchnormOp)
+    # Ops whose kernels convert native inputs to their preferred blocked layout
+    blocked_consumers = blocked_producers + (update_conv,)
+    # Ops whose kernels work in whatever layout their first input is in
+    eltwise_ops = (ReluOp, BpropReluOp)
+    # Ops whose kernels work in the layout of any input and read the others as they are
+    binary_eltwise_ops = (Add, Subtract, Multiply, Divide, Maximum, Minimum, ScaledSumOp)
+    # Ops that forward the MKL layout of their argument
+    pass_through_ops = (MapRolesOp, ReorderAxes, ContiguousOp, Flatten, Unflatten,
+                        TensorSliceOp, ExpandDims)
+
+    @staticmethod
+    def output_bytes(output_decl):
+        td = output_decl.tensor_description
+        return int(np.prod(td.axes.lengths)) * td.dtype.itemsize
+
+    def is_float32(self, exop):
+        return exop.op.dtype.type == np.float32
+
+    def is_pass_through(self, exop):
+        return isinstance(exop.op, self.pass_through_ops) and len(exop.input_decls) == 1
+
+    def source(self, input_decl):
+        """
+        The output that produced the value read by input_decl, skipping pass-through ops.
+        """
+        output_decl = input_decl.source_output_decl
+        while self.is_pass_through(output_decl.exop):
+            output_decl = output_decl.exop.input_decls[0].source_output_decl
+        return output_decl
+
+    def users(self, output_decl):
+        """
+        The input decls reading output_decl, looking through pass-through ops.
+        """
+        users = []
+        for input_decl in output_decl.user_input_decls:
+            if self.is_pass_through(input_decl.exop):
+                for pass_output_decl in input_decl.exop.output_decls:
+                    users.extend(self.users(pass_output_decl))
+            else:
+                users.append(input_decl)
+        return users
+
+    def do_pass(self, computation_decl, **kwargs):
+        self.native_ops = set()
+        exops = [exop for exop in computation_decl.exop_block
+                 if not self.is_pass_through(exop)]
+        position = {exop: i for i, exop in enumerate(exops)}
+        self.eltwise = [exop for exop in exops
+                        if isinstance(exop.op, self.eltwise_ops + self.binary_eltwise_ops) and
+                        self.is_float32(exop)]
+
+        # Greedy labels: as MklCreateOpDescriptors would assign them
+        greedy = dict()
+        for exop in self.eltwise:
+            greedy[exop] = self.input_is_blocked(exop, greedy)
+
+        # Group elementwise ops connected through producer/consumer edges
+        group_of = {exop: exop for exop in self.eltwise}
+
+        def find(exop):
+            while group_of[exop] is not exop:
+                group_of[exop] = group_of[group_of[exop]]
+                exop = group_of[exop]
+            return exop
+
+        for exop in self.eltwise:
+            for input_decl in exop.input_decls:
+                src = self.source(input_decl).exop
+                if src in group_of:
+                    group_of[find(src)] = find(exop)
+        groups = dict()
+        for exop in self.eltwise:
+            groups.setdefault(find(exop), []).append(exop)
+
+        assigned = dict(greedy)
+        for members in groups.values():
+            members.sort(key=lambda exop: position[exop])
+            self.solve_group(members, assigned)
+
+        for exop in self.eltwise:
+            if greedy[exop] and not assigned[exop]:
+                self.native_ops.add(exop.op.safe_name)
+
+        greedy_bytes = self.reorder_bytes(exops, greedy)
+        assigned_bytes = self.reorder_bytes(exops, assigned)
+        report = dict(computation=computation_decl.computation_op.name,
+                      greedy_reorder_bytes=greedy_bytes,
+                      assigned_reorder_bytes=assigned_bytes,
+                      native_ops=sorted(self.native_ops))
+        self.mkldnn.layout_reports.append(report)
+        logger.debug("MKL layout assignment for %s: %d native elementwise ops, "
+                     "reorder bytes per step %d -> %d", report['computation'],
+                     len(self.native_ops), greedy_bytes, assigned_bytes)
+
+    def is_blocked(self, output_decl, labels):
+        exop = output_decl.exop
+        if exop in labels:
+            return labels[exop]
+        return (isinstance(exop.op, self.blocked_producers) and
+                output_decl.pos == 0 and self.is_float32(exop))
+
+    def input_is_blocked(self, exop, labels):
+        if isinstance(exop.op, self.binary_eltwise_ops):
+            return any(self.is_blocked(self.source(input_decl), labels)
+                       for input_decl in exop.input_decls)
+        return self.is_blocked(self.source(exop.input_decls[0]), labels)
+
+    def wants_blocked(self, input_decl, labels):
+        """
+        Returns True, False or None (either layout) for the layout the reader of
+        input_decl wants its value in.
+        """
+        exop = input_decl.exop
+        if exop in labels:
+            if labels[exop] and isinstance(exop.op, self.binary_eltwise_ops):
+                # The binary kernel reads the other operand in place
+                return None
+            return labels[exop]
+        if isinstance(exop.op, self.blocked_consumers) and self.is_float32(exop):
+            return True
+        if isinstance(exop.op, DotLowDimension):
+            return None
+        return False
+
+    def producer_cost(self, output_decl, labels, reorder_bytes=False):
+        """
+        Reorders caused by the value of output_decl. A blocked value gets one shared
+        reorder to native if any reader needs native; a native value is converted
+        by every reader kernel that wants it blocked.
+        """
+        blocked = self.is_blocked(output_decl, labels)
+        readers = [self.wants_blocked(input_decl, labels)
+                   for input_decl in self.users(output_decl)]
+        if blocked:
+            num_reorders = 1 if any(wants is False for wants in readers) else 0
+        else:
+            num_reorders = sum(1 for wants in readers if wants is True)
+        nbytes = num_reorders * self.output_bytes(output_decl)
+        return nbytes if reorder_bytes else self.cost_model.reorder_cost(nbytes)
+
+    def fixup_labels(self, members, labels):
+        # An elementwise op can only be blocked if its first input is
+        for exop in members:
+            if labels[exop] and not self.input_is_blocked(exop, labels):
+                labels[exop] = False
+
+    def group_cost(self, members, labels):
+        outputs = set()
+        cost = 0.0
+        for exop in members:
+            outputs.add(exop.output_decls[0])
+            for input_decl in exop.input_decls:
+                outputs.add(self.source(input_decl))
+            cost += self.cost_model.eltwise_cost(
+                exop.op, self.output_bytes(exop.output_decls[0]),
+                len(exop.input_decls), labels[exop])
+        return cost + sum(self.producer_cost(output_decl, labels) for output_decl in outputs)
+
+    def solve_group(self, members, labels):
+        # Only ops that could be blocked under some labeling are free
+        free = [exop for exop in members if labels[exop]]
+        if not free:
+            return
+        best = dict((exop, labels[exop]) for exop in members)
+        best_cost = self.group_cost(members, labels)
+
+        def evaluate(choice):
+            trial = dict(labels)
+            trial.update(zip(free, choice))
+            self.fixup_labels(members, trial)
+            return self.group_cost(members, trial), trial
+
+        if len(free) <= self.max_exhaustive_group:
+            for choice in itertools.product((True, False), repeat=len(free)):
+                cost, trial = evaluate(choice)
+                if cost < best_cost:
+                    best_cost = cost
+                    best = dict((exop, trial[exop]) for exop in members)
+        else:
+            choice = [True] * len(free)
+            improved = True
+            while improved:
+                improved = False
+                for i in range(len(free)):
+                    choice[i] = not choice[i]
+                    cost, trial = evaluate(choice)
+                    if cost < best_cost:
+                        best_cost = cost
+                        best = dict((exop, trial[exop]) for exop in members)
+                        improved = True
+                    else:
+                        choice[i] = not choice[i]
+        labels.update(best)
+
+    def reorder_bytes(self, exops, labels):
+        return sum(self.producer_cost(output_decl, labels, reorder_bytes=True)
+                   for exop in exops for output_decl in exop.output_decls)
+
+
 class MklCreateOpDescriptors(PeepholeGraphPass):
     """
     Creates MKL-DNN op kernels for ops in the graph that have an MKL-DNN implementation.
@@ -167,10 +456,14 @@ class MklCreateOpDescriptors(PeepholeGraphPass):
 
     """
 
-    def __init__(self, mkldnn, **kwargs):
+    def __init__(self, mkldnn, layout_assignment=None, **kwargs):
         super(MklCreateOpDescriptors, self).__init__(**kwargs)
         assert mkldnn.enabled
         self.mkldnn = mkldnn
+        self.layout_assignment = layout_assignment
+
+    def is_assigned_native(self, op):
+        return self.layout_assignment is not None and self.layout_assignment.is_native(op)
 
     def begin_pass(self, op_accessor, **kwargs):
         """
@@ -196,6 +489,16 @@ class MklCreateOpDescriptors(PeepholeGraphPass):
     def get_exop(self, op):
         return self.op_accessor.computation_decl.get_exop(op)
 
+    def share_persistent_reorders(self, op):
+        """
+        Lets the kernel of op share the MKL-DNN copies of its persistent inputs (weights)
+        with the kernels of other computations that reorder them the same way.
+        """
+        kernel = self.mkldnn.kernels[op.safe_name]
+        for index, input_decl in enumerate(self.get_exop(op).input_decls):
+            if input_decl.tensor_decl.is_persistent:
+                self.mkldnn.share_reorder(input_decl.tensor_decl, kernel, index)
+
     def set_mkl_layout(self, op, mkl_axes, index=0):
         exop = self.get_exop(op)
         mkl_layout = self.mkldnn.output_layout(self.mkldnn.kernels[op.safe_name], index)
@@ -334,6 +637,8 @@ class MklCreateOpDescriptors(PeepholeGraphPass):
         # MKLDNN kernel computes batch mean and variance as well
         self.replace_exop(op, mean)
         self.replace_exop(op, variance)
+        # gamma and beta are the rows of the kernel's scale-shift weights
+        self.get_exop(op).packed_inputs.append((1, 2))
 
     @visit.on_type(BpropBatchnormOp)
     def visit(
@@ -404,6 +709,10 @@ class MklCreateOpDescriptors(PeepholeGraphPass):
         # MKLDNN kernel computes dgamma and dbeta as well
         self.replace_exop(op, dgamma)
         self.replace_exop(op, dbeta)
+        # Scale-shift weights and their gradient, as in fprop
+        exop = self.get_exop(op)
+        exop.packed_inputs.append((4, 5))
+        exop.packed_outputs.append((1, 2))
 
     @visit.on_type(ConvolutionOp)
     def visit(self, op, input, filter, bias=None):
@@ -458,6 +767,7 @@ class MklCreateOpDescriptors(PeepholeGraphPass):
                 op.safe_name])
 
         self.set_mkl_layout(op, out_axes)
+        self.share_persistent_reorders(op)
         dbg_print_kernel(self.mkldnn, op, op_id)
 
     @visit.on_type(bprop_conv)
@@ -508,6 +818,7 @@ class MklCreateOpDescriptors(PeepholeGraphPass):
                 op.safe_name])
 
         self.set_mkl_layout(op, out_axes)
+        self.share_persistent_reorders(op)
         dbg_print_kernel(self.mkldnn, op, op_id)
 
     @visit.on_type(update_conv)
@@ -573,6 +884,8 @@ class MklCreateOpDescriptors(PeepholeGraphPass):
     def visit(self, op, input):
         if (op.dtype.type != np.float32):
             return
+        if self.is_assigned_native(op):
+            return
         data_type = self.mkldnn.datatype[op.dtype.type]
         arg_idx = get_arg_output_idx(self.get_exop(op), self.get_exop(input))
         mkl_layout = self.get_exop(input).output_decls[
@@ -605,6 +918,8 @@ class MklCreateOpDescriptors(PeepholeGraphPass):
     def visit(self, op, delta, fprop_src):
         if (op.dtype.type != np.float32):
             return
+        if self.is_assigned_native(op):
+            return
 
         data_type = self.mkldnn.datatype[op.dtype.type]
 
@@ -776,27 +1091,13 @@ class MklCreateOpDescriptors(PeepholeGraphPass):
 
         out_axes = get_axes_mkl_order(op.axes, [1, 0])
         self.set_mkl_layout(op, out_axes)
+        self.share_persistent_reorders(op)
         dbg_print_kernel(self.mkldnn, op, op_id)
 
-    @visit.on_type(Add)
-    def visit(self, op, x, y):
-        # Disable for now since we are seeing perf slowdowns
-        # return
-
-        # Sanity check for tensor shapes
-        if (op.dtype.type != np.float32):
-            return
-        # if len(x.shape) != 5 or len(y.shape) != 5:
-        #    return
-
-        arg_idx = get_arg_output_idx(self.get_exop(op), self.get_exop(x))
-        if self.get_exop(x).output_decls[
-                arg_idx].tensor_view_decl.mkl_layout is None:
-            return
-
-        (_, input_axes) = self.get_exop(x).output_decls[
-            arg_idx].tensor_view_decl.mkl_layout
-        mkl_order = get_order_from_axes(op.axes, input_axes)
+    def create_sum_kernel(self, op, x, y, mkl_order):
+        """
+        Adds with the MKL-DNN sum primitive, reordering y to the layout of x if needed.
+        """
         data_type = self.mkldnn.datatype[op.dtype.type]
         (x_shape, x_layout) = self.get_arg_shape_and_layout(op, x, mkl_order)
         (y_shape, y_layout) = self.get_arg_shape_and_layout(op, y, mkl_order)
@@ -817,6 +1118,138 @@ class MklCreateOpDescriptors(PeepholeGraphPass):
         self.set_mkl_layout(op, out_axes)
         dbg_print_kernel(self.mkldnn, op, op_id)
 
+    def is_broadcast_arg(self, op, index):
+        td = self.get_exop(op).input_decls[index].tensor_description
+        return any(stride == 0 and length != 1
+                   for stride, length in zip(td.strides, td.axes.lengths))
+
+    def get_binary_operand(self, op, index, arg, mkl_order):
+        """
+        Sizes, element strides and MKL layout of a binary elementwise operand in
+        mkl_order. Broadcast dimensions have size 1; strides are only needed
+        without a layout.
+        """
+        if self.get_arg_mkl_layout(op, arg) is not None:
+            (shape, layout) = self.get_arg_shape_and_layout(op, arg, mkl_order)
+            return shape, None, layout
+        td = self.get_exop(op).input_decls[index].tensor_description
+        lengths = td.axes.lengths
+        strides = [td.strides[i] // td.dtype.itemsize for i in mkl_order]
+        sizes = [lengths[i] if stride != 0 else 1
+                 for i, stride in zip(mkl_order, strides)]
+        return sizes, strides, None
+
+    def create_binary_eltwise_kernel(self, op, x, y):
+        """
+        Creates a broadcasting binary elementwise kernel when an operand with the
+        output shape is in an MKL layout. The output is produced in that layout so
+        the op does not need a reorder.
+
+        Returns:
+            True if the kernel was created.
+        """
+        full_layout = None
+        for index, arg in enumerate((x, y)):
+            mkl_layout = self.get_arg_mkl_layout(op, arg)
+            if mkl_layout is not None and len(mkl_layout[1]) == len(op.axes) and \
+                    not self.is_broadcast_arg(op, index):
+                full_layout = mkl_layout
+                break
+        if full_layout is None:
+            return False
+        (_, mkl_axes) = full_layout
+        mkl_order = get_order_from_axes(op.axes, mkl_axes)
+        operands = [self.get_binary_operand(op, index, arg, mkl_order)
+                    for index, arg in enumerate((x, y))]
+        dst_sizes = get_size_mkl_order(op.axes, mkl_order)
+
+        op_id = len(self.mkldnn.kernels)
+        kernel = self.mkldnn.create_empty_kernel(op_id)
+        args = [self.mkldnn.mkldnn_engine, len(dst_sizes), get_ctypes_arg(dst_sizes)]
+        for sizes, strides, layout in operands:
+            args += [get_ctypes_arg(sizes), get_ctypes_arg(strides), layout]
+        args += [self.binary_eltwise_algs[type(op)],
+                 self.mkldnn.datatype[op.dtype.type], kernel]
+        if not self.mkldnn.binary_eltwise_kernel(*args):
+            self.mkldnn.delete_opkernel(kernel)
+            return False
+        self.mkldnn.kernels[op.safe_name] = kernel
+        self.set_mkl_layout(op, get_axes_mkl_order(op.axes, mkl_order))
+        dbg_print_kernel(self.mkldnn, op, op_id)
+        return True
+
+    # Operation codes of create_mkldnn_binary_eltwise_kernel
+    binary_eltwise_algs = {Add: 0, Subtract: 1, Multiply: 2, Divide: 3, Maximum: 4, Minimum: 5}
+
+    @visit.on_type(Add)
+    def visit(self, op, x, y):
+        # Sanity check for tensor shapes
+        if (op.dtype.type != np.float32):
+            return
+        if self.is_assigned_native(op):
+            return
+
+        x_layout = self.get_arg_mkl_layout(op, x)
+        y_layout = self.get_arg_mkl_layout(op, y)
+        if x_layout is not None and y_layout is not None:
+            # Operands already in the same layout use the MKL-DNN sum primitive
+            mkl_order = get_order_from_axes(op.axes, x_layout[1])
+            (x_shape, x_md) = self.get_arg_shape_and_layout(op, x, mkl_order)
+            (y_shape, y_md) = self.get_arg_shape_and_layout(op, y, mkl_order)
+            if x_shape == y_shape and self.mkldnn.cmp_layouts(x_md, y_md):
+                self.create_sum_kernel(op, x, y, mkl_order)
+                return
+
+        if self.create_binary_eltwise_kernel(op, x, y):
+            return
+
+        if x_layout is not None and not self.is_broadcast_arg(op, 1):
+            self.create_sum_kernel(op, x, y, get_order_from_axes(op.axes, x_layout[1]))
+
+    @visit.on_type(BinaryElementWiseOp)
+    def visit(self, op, x, y):
+        if type(op) not in self.binary_eltwise_algs or op.dtype.type != np.float32:
+            return
+        if self.is_assigned_native(op):
+            return
+        self.create_binary_eltwise_kernel(op, x, y)
+
+    @visit.on_type(ScaledSumOp)
+    def visit(self, op, *args):
+        if op.dtype.type != np.float32 or self.is_assigned_native(op):
+            return
+        if any(self.is_broadcast_arg(op, index) for index in range(len(args))):
+            return
+        # Sum in the layout of the first MKL layout input; others are reordered to it
+        mkl_layouts = [self.get_arg_mkl_layout(op, arg) for arg in args]
+        primary = next((index for index, mkl_layout in enumerate(mkl_layouts)
+                        if mkl_layout is not None), None)
+        if primary is not None:
+            mkl_order = get_order_from_axes(op.axes, mkl_layouts[primary][1])
+        else:
+            mkl_order = list(range(len(op.axes)))
+        operands = [self.get_arg_shape_and_layout(op, arg, mkl_order) for arg in args]
+        if primary is None:
+            # All native: the output must have the same strides as the inputs
+            (out_layout, _) = get_native_layout(
+                self.mkldnn, self.get_exop(op).output_decls[0].tensor_description, mkl_order)
+            if not all(self.mkldnn.cmp_layouts(layout, out_layout) for _, layout in operands):
+                return
+            primary = 0
+        sizes = get_size_mkl_order(op.axes, mkl_order)
+
+        op_id = len(self.mkldnn.kernels)
+        self.mkldnn.kernels[op.safe_name] = self.mkldnn.create_empty_kernel(op_id)
+        self.mkldnn.sum_kernel(
+            self.mkldnn.mkldnn_engine,
+            len(sizes), get_ctypes_arg(sizes),
+            len(args), (ct.c_void_p * len(args))(*[layout for _, layout in operands]),
+            (ct.c_float * len(args))(*op.scales), primary,
+            self.mkldnn.datatype[op.dtype.type], self.mkldnn.kernels[op.safe_name])
+        if mkl_layouts[primary] is not None:
+            self.set_mkl_layout(op, get_axes_mkl_order(op.axes, mkl_order))
+        dbg_print_kernel(self.mkldnn, op, op_id)
+
     @visit.on_type(ContiguousOp)
     def visit(self, op, arg):
         mkl_layout = self.get_arg_mkl_layout(op, arg)
@@ -911,11 +1344,17 @@ class MklAddLayoutConversions(PeepholeGraphPass):
     """
     Adds layout conversion nodes when an MKLDNN tensor is utilized by a
     non-MKL op
+
+    Returned values in an MKL layout are converted by a reorder before the
+    computation returns, unless lazy_returns is set or the returned op has
+    metadata['mkl_lazy_return']. Those are returned in their MKL layout and
+    converted by the same reorder kernel the first time the host reads them.
     """
 
-    def __init__(self, mkldnn, **kwargs):
+    def __init__(self, mkldnn, lazy_returns=False, **kwargs):
         super(MklAddLayoutConversions, self).__init__(**kwargs)
         self.mkldnn = mkldnn
+        self.lazy_returns = lazy_returns
         self.reorder_ops = dict()   # Maps op.safe_name to reorder op
 
     def init_mkldnn_reorder(self, op):
@@ -958,6 +1397,26 @@ class MklAddLayoutConversions(PeepholeGraphPass):
     def get_exop(self, op):
         return self.op_accessor.computation_decl.get_exop(op)
 
+    def begin_pass(self, **kwargs):
+        super(MklAddLayoutConversions, self).begin_pass(**kwargs)
+        self.reorder_ops_before = set(self.reorder_ops)
+
+    def end_pass(self, **kwargs):
+        super(MklAddLayoutConversions, self).end_pass(**kwargs)
+        if not self.mkldnn.layout_reports or \
+                'inserted_reorder_bytes' in self.mkldnn.layout_reports[-1]:
+            return
+        # Complete the report of MklAssignLayouts with the reorders actually inserted
+        report = self.mkldnn.layout_reports[-1]
+        report['inserted_reorder_bytes'] = sum(
+            int(np.prod(op.axes.lengths)) * op.dtype.itemsize
+            for name, op in self.reorder_ops.items() if name not in self.reorder_ops_before)
+        logger.log(logging.INFO if self.mkldnn.layout_report_enabled else logging.DEBUG,
+                   "MKL layouts %(computation)s: reorder bytes per step greedy "
+                   "%(greedy_reorder_bytes)d, assigned %(assigned_reorder_bytes)d, "
+                   "inserted reorder ops %(inserted_reorder_bytes)d, "
+                   "native elementwise ops %(native_ops)s", report)
+
     def get_arg_mkl_layout(self, op, arg):
         arg_idx = get_arg_output_idx(self.get_exop(op), self.get_exop(arg))
         return self.get_exop(arg).output_decls[
@@ -1020,6 +1479,14 @@ class MklAddLayoutConversions(PeepholeGraphPass):
     def visit(self, op, arg):
         pass
 
+    def is_lazy_return(self, input_decl):
+        if self.lazy_returns:
+            return True
+        op_returns = self.op_accessor.computation_decl.op_returns
+        return any(decl is input_decl and isinstance(returned, Op) and
+                   returned.metadata.get('mkl_lazy_return', False)
+                   for returned, decl in op_returns.items())
+
     @visit.on_type(ReturnOp)
     def visit(self, op, *returns):
         # This version only runs with the exec-graph transformer
@@ -1030,6 +1497,11 @@ class MklAddLayoutConversions(PeepholeGraphPass):
                 input_op = input_decl.source_output_decl.exop.op
                 input_exop = input_decl.source_output_decl.exop
                 reorder_op = self.get_reorder_op(input_op)
+                if self.is_lazy_return(input_decl):
+                    # The reorder kernel runs on host access instead of every step
+                    input_decl.tensor_view_decl.mkl_layout = mkl_layout
+                    input_decl.tensor_view_decl.lazy_mkl_reorder = reorder_op.safe_name
+                    continue
                 self.op_accessor.computation_decl.exop_block.add_ops(
                     [reorder_op], input_exop)
                 reorder_exop = self.get_exop(reorder_op)
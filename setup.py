@@ -66,20 +66,30 @@ ext_modules = []
 if "MKLDNN_ROOT" in os.environ:
     MKLDNNROOT=os.environ['MKLDNN_ROOT']
     if sys.platform == 'darwin':
+        extra_compile_args = ["-std=gnu99"]
         extra_link_args = ["-Wl,-rpath,%s/lib"%(MKLDNNROOT)]
     else:
-        extra_link_args = ["-shared", "-Wl,-rpath,%s/lib"%(MKLDNNROOT)]
+        extra_compile_args = ["-std=gnu99", "-fopenmp", "-pthread"]
+        extra_link_args = ["-shared", "-fopenmp", "-pthread", "-Wl,-rpath,%s/lib"%(MKLDNNROOT)]
     ext_modules.append(Extension('mkldnn_engine',
                         include_dirs = ['%s/include'%(MKLDNNROOT)],
-			extra_compile_args = ["-std=gnu99"],
+			extra_compile_args = extra_compile_args,
                         extra_link_args = extra_link_args,
                         library_dirs = ['%s/lib'%(MKLDNNROOT)],
                         libraries = ['mkldnn'],
-                        sources = ['ngraph/transformers/cpu/convolution.c', \
+                        sources = ['ngraph/transformers/cpu/binary_eltwise.c', \
+                                   'ngraph/transformers/cpu/conv_autotune.c', \
+                                   'ngraph/transformers/cpu/convolution.c', \
                                    'ngraph/transformers/cpu/elementwise.c', \
+                                   'ngraph/transformers/cpu/gemm_convolution.c', \
                                    'ngraph/transformers/cpu/innerproduct.c', \
+                                   'ngraph/transformers/cpu/kernel_build.c', \
+                                   'ngraph/transformers/cpu/memory_stats.c', \
                                    'ngraph/transformers/cpu/mkldnn_engine.c',\
+                                   'ngraph/transformers/cpu/perf_counters.c', \
+                                   'ngraph/transformers/cpu/prepacked_inputs.c', \
                                    'ngraph/transformers/cpu/relu.c', \
+                                   'ngraph/transformers/cpu/thread_runtime.c', \
                                    'ngraph/transformers/cpu/pooling.c', \
                                    'ngraph/transformers/cpu/batchnorm.c']))
 
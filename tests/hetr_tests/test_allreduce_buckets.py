@@ -0,0 +1,81 @@
+# ******************************************************************************
+# Copyright 2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+import numpy as np
+
+import ngraph as ng
+from ngraph.op_graph.comm_nodes import CPUMlslAllReduceStartOp, CPUMlslAllReduceWaitOp
+from ngraph.transformers.cpu.allreduce_buckets import plan_allreduce_buckets
+
+
+def allreduce(length, func='sum', dtype=np.float32):
+    """
+    The start and wait ops of an allreduce of a gradient of length elements.
+    """
+    grad = ng.placeholder([ng.make_axis(length=length)], dtype=dtype)
+    grad.metadata.update(device='cpu', device_id='0', transformer='cpu0',
+                         host_transformer=None)
+    start = CPUMlslAllReduceStartOp(grad, func)
+    return start, CPUMlslAllReduceWaitOp(grad, start, func)
+
+
+def test_buckets_close_at_size():
+    ops = [allreduce(length) for length in (100, 100, 100, 50)]
+    starts = [start for start, _ in ops]
+    # 800 byte buckets; every wait runs after all starts
+    buckets = plan_allreduce_buckets(starts + [wait for _, wait in ops], 800)
+
+    assert set(buckets) == set(starts)
+    assert buckets[starts[0]] is buckets[starts[1]]
+    assert buckets[starts[2]] is buckets[starts[3]]
+    assert buckets[starts[0]] is not buckets[starts[2]]
+    first, second = buckets[starts[0]], buckets[starts[2]]
+    assert first.members == starts[:2] and first.nbytes == 800
+    assert first.offsets == {starts[0]: 0, starts[1]: 100}
+    assert second.members == starts[2:] and second.size == 150
+
+
+def test_bucket_closes_on_wait():
+    (start_a, wait_a), (start_b, wait_b), (start_c, wait_c) = \
+        [allreduce(10) for _ in range(3)]
+    # a's result is needed before c starts, so the bucket of a and b is closed
+    buckets = plan_allreduce_buckets([start_a, start_b, wait_a, start_c, wait_b, wait_c],
+                                     1 << 20)
+
+    assert buckets[start_a] is buckets[start_b]
+    assert buckets[start_a].members == [start_a, start_b]
+    assert buckets[start_c].members == [start_c]
+
+
+def test_wait_of_other_bucket_keeps_bucket_open():
+    (start_a, wait_a), (start_b, wait_b), (start_c, wait_c) = \
+        [allreduce(length) for length in (200, 100, 100)]
+    # a fills its own bucket; its wait does not close the bucket b is in
+    buckets = plan_allreduce_buckets([start_a, start_b, wait_a, start_c, wait_b, wait_c], 800)
+
+    assert buckets[start_a].members == [start_a]
+    assert buckets[start_b].members == [start_b, start_c]
+
+
+def test_unbucketed_allreduces():
+    (start_a, wait_a), (start_b, wait_b), (start_c, wait_c), (start_d, wait_d) = \
+        [allreduce(10), allreduce(10, dtype=np.float64), allreduce(10), allreduce(10)]
+    buckets = plan_allreduce_buckets([start_a, start_b, start_c, start_d,
+                                      wait_a, wait_b, wait_c, wait_d],
+                                     1 << 20, excluded=lambda op: op is start_c)
+
+    # float64 and excluded (e.g. compressed) gradients are allreduced on their own
+    assert set(buckets) == {start_a, start_d}
+    assert buckets[start_a].members == [start_a, start_d]
@@ -0,0 +1,86 @@
+# ******************************************************************************
+# Copyright 2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+import numpy as np
+import pytest
+
+from ngraph.transformers.cpu.grad_compression import Fp16Compressor, TopKCompressor, \
+    compression_spec, make_compressor, parse_spec
+
+PROCESSES = 3
+
+
+def exchange(compressors, grads):
+    """
+    Sums grads over the processes as the allgather and the wait of HetrLocals do.
+    """
+    payloads = np.stack([c.compress(g).copy() for c, g in zip(compressors, grads)])
+    out = np.empty_like(grads[0])
+    compressors[0].accumulate(payloads, out)
+    return out
+
+
+def test_fp16():
+    grads = [np.random.uniform(-1, 1, (7, 13)).astype(np.float32) for _ in range(PROCESSES)]
+    compressors = [Fp16Compressor(grads[0].size) for _ in range(PROCESSES)]
+    assert compressors[0].payload_bytes == grads[0].nbytes // 2
+    np.testing.assert_allclose(exchange(compressors, grads), sum(grads), atol=3e-3)
+
+
+def test_topk_sends_largest():
+    grad = np.zeros(100, dtype=np.float32)
+    grad[[3, 50, 97]] = [5, -7, 6]
+    grad[10] = 0.5
+    compressor = TopKCompressor(grad.size, ratio=0.03)
+    assert compressor.k == 3 and compressor.payload_bytes == 24
+    out = exchange([compressor], [grad])
+    expected = grad.copy()
+    expected[10] = 0
+    np.testing.assert_array_equal(out, expected)
+    np.testing.assert_array_equal(compressor.residual[10], 0.5)
+
+
+def test_topk_error_feedback():
+    # With error feedback every element is eventually sent: the sum of what was sent
+    # plus the residuals equals the sum of the gradients
+    size, steps = 50, 20
+    compressors = [TopKCompressor(size, ratio=0.1) for _ in range(PROCESSES)]
+    sent = np.zeros(size, dtype=np.float32)
+    total = np.zeros(size, dtype=np.float32)
+    for _ in range(steps):
+        grads = [np.random.uniform(-1, 1, size).astype(np.float32) for _ in range(PROCESSES)]
+        sent += exchange(compressors, grads)
+        total += sum(grads)
+    residuals = sum(c.residual for c in compressors)
+    np.testing.assert_allclose(sent + residuals, total, rtol=1e-4, atol=1e-4)
+
+
+def test_specs(monkeypatch):
+    assert parse_spec('none') == (None, None)
+    assert parse_spec('fp16') == ('fp16', None)
+    assert parse_spec('topk:0.1') == ('topk', 0.1)
+    with pytest.raises(ValueError):
+        parse_spec('topk:2')
+    with pytest.raises(ValueError):
+        parse_spec('int8')
+
+    monkeypatch.setenv('HETR_GRAD_COMPRESSION', 'fp16')
+    monkeypatch.setenv('HETR_GRAD_COMPRESSION_MIN_ELEMENTS', '100')
+    assert compression_spec({}, 1000) == 'fp16'
+    assert compression_spec({}, 10) is None
+    assert compression_spec({'grad_compression': 'topk'}, 10) == 'topk'
+    assert compression_spec({'grad_compression': 'none'}, 1000) == 'none'
+    assert make_compressor('none', 1000) is None
+    assert isinstance(make_compressor('topk:0.5', 1000), TopKCompressor)
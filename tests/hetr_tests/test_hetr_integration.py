@@ -91,6 +91,64 @@ def test_distributed_plus_one(hetr_device, config):
         np.testing.assert_array_equal(res, np_x + 1)
 
 
+def pipeline_model(micro_batch_reduce='sum'):
+    # A two stage model, with the batch axis marked for pipeline parallel micro-batches
+    ax_N = ng.make_axis(length=8, name='N')
+    ax_F = ng.make_axis(length=12, name='F')
+    ax_H = ng.make_axis(length=6, name='H')
+    x = ng.placeholder([ax_F, ax_N])
+    w1 = ng.variable([ax_H, ax_F], initial_value=np.linspace(-1, 1, 72).reshape(6, 12))
+    w2 = ng.variable([ax_F, ax_H], initial_value=np.linspace(1, -1, 72).reshape(12, 6))
+    with ng.metadata(device_id='0', pipeline=ax_N):
+        h = ng.tanh(ng.dot(w1, x))
+    with ng.metadata(device_id='1', pipeline=ax_N):
+        y = ng.dot(w2, h)
+        with ng.metadata(micro_batch_reduce=micro_batch_reduce):
+            total = ng.sum(y, out_axes=())
+    return x, y, total
+
+
+@pytest.mark.multi_device
+def test_pipeline_micro_batches(hetr_device):
+    if hetr_device == 'gpu':
+        pytest.skip('pipeline parallel micro-batches run on cpu servers')
+    np_x = np.random.uniform(-1, 1, (12, 8))
+    results = []
+    for micro_batches in (1, 2):
+        # PipelinePass shrinks the batch axis of the graph it is run on
+        x, y, total = pipeline_model()
+        with closing(ngt.make_transformer_factory('hetr', device=hetr_device,
+                                                  micro_batches=micro_batches)()) as t:
+            computation = t.computation([y, total], x)
+            results.append(computation(np_x))
+    np.testing.assert_allclose(results[1][0], results[0][0], rtol=1e-5)
+    np.testing.assert_allclose(results[1][1], results[0][1], rtol=1e-5)
+
+    # Results without the batch axis need a reduction over micro-batches
+    x, y, total = pipeline_model(micro_batch_reduce=None)
+    with closing(ngt.make_transformer_factory('hetr', device=hetr_device,
+                                              micro_batches=2)()) as t:
+        with pytest.raises(ValueError):
+            t.computation([y, total], x)
+
+
+@pytest.mark.parametrize('shm_transport', ['0', '1'])
+def test_repeated_calls(hetr_device, monkeypatch, shm_transport):
+    # With the shared memory transport, calls after the first write the input into
+    # the memory pool of the server and read the result from it in place
+    monkeypatch.setenv('HETR_SHM_TRANSPORT', shm_transport)
+    with ng.metadata(device=hetr_device):
+        x = ng.placeholder([ax_A, ax_B])
+        with ng.metadata(device_id='0'):
+            y = ng.tanh(x) * 2 + 1
+
+    with closing(ngt.make_transformer_factory('hetr', device=hetr_device)()) as transformer:
+        computation = transformer.computation(y, x)
+        for _ in range(3):
+            np_x = np.random.uniform(-1, 1, (ax_A.length, ax_B.length))
+            np.testing.assert_allclose(computation(np_x), np.tanh(np_x) * 2 + 1, rtol=1e-5)
+
+
 @pytest.mark.multi_device
 @pytest.mark.parametrize('config', [
     {
@@ -18,7 +18,7 @@ from ngraph.testing import ExecutorFactory
 from orderedset import OrderedSet
 import ngraph as ng
 from ngraph.transformers.passes.hetrpasses import DeviceAssignPass, \
-    CommunicationPass
+    CommunicationPass, PipelinePass
 
 
 pytestmark = pytest.mark.hetr_only
@@ -173,3 +173,40 @@ def test_hetr_graph_passes():
     check_device_assign_pass("cpu", "0", graph_op_metadata, graph_ops)
     check_communication_pass(ops_to_transform=graph_ops,
                              expected_recv_nodes=[x_plus_y])
+
+
+def test_pipeline_check_acyclic():
+    # Stage -> the stages it sends to
+    PipelinePass.check_acyclic({'0': {1}, '1': {2}, '2': set()})
+    PipelinePass.check_acyclic({'0': {1, 2}, '1': {2}})
+    with pytest.raises(ValueError):
+        PipelinePass.check_acyclic({'0': {1}, '1': {2}, '2': {0}})
+
+
+@pytest.mark.parametrize('micro_batch_reduce', [None, 'sum', 'mean'])
+def test_pipeline_pass(micro_batch_reduce):
+    ax_N = ng.make_axis(length=8, name='N')
+    ax_F = ng.make_axis(length=4, name='F')
+    x = ng.placeholder([ax_F, ax_N])
+    with ng.metadata(pipeline=ax_N):
+        y = ng.tanh(x) * 2
+    with ng.metadata(micro_batch_reduce=micro_batch_reduce):
+        total = ng.sum(y, out_axes=())
+
+    pipeline_pass = PipelinePass(micro_batches=4)
+    if micro_batch_reduce is None:
+        # A result without the batch axis must say how micro-batches are reduced
+        with pytest.raises(ValueError):
+            pipeline_pass.do_pass(ops=OrderedSet([y, total, x]))
+        return
+    pipeline_pass.do_pass(ops=OrderedSet([y, total, x]))
+
+    # The batch axis is shrunk to the micro-batch in the ops and the placeholder
+    assert pipeline_pass.pipeline_axis.length == 2
+    for op in (x, y):
+        assert op.axes.lengths == (4, 2)
+        assert op.metadata['pipeline_axis'] == 'N'
+    assert 'pipeline_axis' not in total.metadata
+
+    with pytest.raises(ValueError):
+        PipelinePass(micro_batches=3).do_pass(ops=OrderedSet([y, x]))
@@ -0,0 +1,75 @@
+# ******************************************************************************
+# Copyright 2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+import time
+
+import numpy as np
+import pytest
+
+from ngraph.transformers.cpu.input_prefetch import InputPrefetcher
+
+BATCHES = 6
+
+
+def loader(delay=0.0):
+    # Reuses its arrays like aeon does, so batches must be copied out
+    image = np.empty((4, 3), dtype=np.float32)
+    label = np.empty(4, dtype=np.int32)
+    for step in range(BATCHES):
+        time.sleep(delay)
+        image.fill(step)
+        label.fill(-step)
+        yield {'image': image, 'label': label}
+
+
+@pytest.mark.parametrize('depth', [0, 1, 3])
+def test_prefetch_batches(depth):
+    allocations = []
+
+    def alloc(element_count, dtype):
+        allocations.append(element_count)
+        return np.empty(element_count, dtype)
+
+    stats = dict()
+    prefetcher = InputPrefetcher(loader(), depth=depth, alloc=alloc, stats=stats)
+    try:
+        for step in range(BATCHES):
+            batch = prefetcher.next_batch()
+            np.testing.assert_array_equal(batch['image'], np.full((4, 3), step))
+            np.testing.assert_array_equal(batch['label'], np.full(4, -step))
+        with pytest.raises(StopIteration):
+            prefetcher.next_batch()
+    finally:
+        prefetcher.close()
+    # Slots are reused: one in use plus depth loaded ahead, two buffers each
+    assert len(allocations) <= 2 * (depth + 1)
+    assert stats['batches'] == BATCHES
+
+
+def test_prefetch_stalls():
+    stats = dict()
+    prefetcher = InputPrefetcher(loader(delay=0.05), depth=2, stats=stats)
+    try:
+        # A step longer than the load time hides the loader
+        time.sleep(0.3)
+        prefetcher.next_batch()
+        prefetcher.next_batch()
+        assert stats['stalls'] == 0
+        # Steps faster than the loader wait for it
+        for _ in range(BATCHES - 2):
+            prefetcher.next_batch()
+        assert stats['stalls'] > 0 and stats['stall_seconds'] > 0
+    finally:
+        prefetcher.close()
@@ -0,0 +1,167 @@
+# ******************************************************************************
+# Copyright 2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+import multiprocessing
+import os
+import uuid
+
+import numpy as np
+import pytest
+
+from ngraph.transformers.cpu.shm_collectives import ShmSegment, ShmDistribution, ShmPipe, \
+    DataType, ReductionType, GroupType
+
+# Small slots so that the tensors below take several chunks
+SLOT_BYTES = 256
+COUNT = 203
+
+
+def inputs(process_idx, count=COUNT):
+    return np.arange(count, dtype=np.float32) * (process_idx + 1)
+
+
+def run_collective(name, process_idx, process_count, collective, results):
+    segment = ShmSegment(name, process_count, SLOT_BYTES)
+    distribution = ShmDistribution(segment, process_idx)
+    x = inputs(process_idx)
+    if collective == 'allreduce':
+        out = np.empty_like(x)
+        distribution.all_reduce(x, out, x.size, DataType.FLOAT, ReductionType.SUM,
+                                GroupType.DATA)
+    elif collective == 'allreduce_inplace':
+        out = x
+        distribution.all_reduce(x, x, x.size, DataType.FLOAT, ReductionType.SUM,
+                                GroupType.DATA)
+    elif collective == 'reduce':
+        out = np.zeros_like(x)
+        distribution.reduce(x, out, x.size, DataType.FLOAT, ReductionType.MAX, 0,
+                            GroupType.DATA)
+    elif collective == 'bcast':
+        out = x
+        distribution.bcast(x, x.size, DataType.FLOAT, 1, GroupType.DATA)
+    elif collective == 'all_gather':
+        send = x.view(np.uint8)
+        out = np.zeros(send.size * process_count, dtype=np.uint8)
+        distribution.all_gather(send, send.size, out, DataType.BYTE, GroupType.DATA)
+        out = out.view(np.float32)
+    elif collective == 'gather':
+        out = np.zeros(x.size * process_count, dtype=np.float32)
+        distribution.gather(x, x.size, out, DataType.FLOAT, 0, GroupType.DATA)
+    elif collective == 'scatter':
+        send = inputs(0, COUNT * process_count) if process_idx == 0 else None
+        out = np.zeros(COUNT, dtype=np.float32)
+        distribution.scatter(send, out, COUNT, DataType.FLOAT, 0, GroupType.DATA)
+    results.put((process_idx, out.tolist()))
+
+
+@pytest.mark.parametrize('process_count', [2, 3])
+@pytest.mark.parametrize('collective', ['allreduce', 'allreduce_inplace', 'reduce', 'bcast',
+                                        'all_gather', 'gather', 'scatter'])
+def test_shm_collectives(collective, process_count):
+    name = 'ngraph_test_{}'.format(uuid.uuid4().hex)
+    segment = ShmSegment(name, process_count, SLOT_BYTES, create=True)
+    results = multiprocessing.Queue()
+    try:
+        processes = [multiprocessing.Process(target=run_collective,
+                                             args=(name, idx, process_count, collective,
+                                                   results))
+                     for idx in range(process_count)]
+        for process in processes:
+            process.start()
+        outputs = dict(results.get(timeout=60) for _ in processes)
+        for process in processes:
+            process.join()
+    finally:
+        segment.unlink()
+        segment.close()
+
+    for idx in range(process_count):
+        out = np.array(outputs[idx], dtype=np.float32)
+        if collective.startswith('allreduce'):
+            expected = sum(inputs(i) for i in range(process_count))
+        elif collective == 'reduce':
+            expected = inputs(process_count - 1) if idx == 0 else np.zeros(COUNT)
+        elif collective == 'bcast':
+            expected = inputs(1)
+        elif collective == 'all_gather':
+            expected = np.concatenate([inputs(i) for i in range(process_count)])
+        elif collective == 'gather':
+            expected = np.concatenate([inputs(i) for i in range(process_count)]) \
+                if idx == 0 else np.zeros(COUNT * process_count)
+        else:
+            expected = inputs(0, COUNT * process_count)[idx * COUNT:(idx + 1) * COUNT]
+        np.testing.assert_allclose(out, expected)
+
+
+def run_pipe(name, create, steps, results):
+    pipe = ShmPipe(name, COUNT * 4, depth=2, create=create)
+    out = np.zeros(COUNT, dtype=np.float32)
+    received = []
+    for step in range(steps):
+        if create:
+            pipe.send(inputs(step))
+        else:
+            pipe.recv(out)
+            received.append(out.tolist())
+    pipe.close()
+    results.put(received)
+
+
+def test_shm_pipe():
+    # More tensors than slots, so the producer waits for the consumer
+    name = 'ngraph_test_{}'.format(uuid.uuid4().hex)
+    steps = 7
+    results = multiprocessing.Queue()
+    consumer = multiprocessing.Process(target=run_pipe, args=(name, False, steps, results))
+    consumer.start()
+    run_pipe(name, True, steps, multiprocessing.Queue())
+    received = results.get(timeout=60)
+    consumer.join()
+    for step in range(steps):
+        np.testing.assert_allclose(received[step], inputs(step))
+
+
+def send_and_exit(name, steps):
+    pipe = ShmPipe(name, COUNT * 4, depth=2, create=True)
+    for step in range(steps):
+        pipe.send(inputs(step))
+
+
+def test_shm_pipe_dead_producer():
+    # The consumer receives what was sent before the producer exited, then raises
+    name = 'ngraph_test_{}'.format(uuid.uuid4().hex)
+    producer = multiprocessing.Process(target=send_and_exit, args=(name, 1))
+    producer.start()
+    pipe = ShmPipe(name, COUNT * 4, depth=2)
+    out = np.zeros(COUNT, dtype=np.float32)
+    pipe.recv(out)
+    np.testing.assert_allclose(out, inputs(0))
+    with pytest.raises(RuntimeError, match='exited'):
+        pipe.recv(out)
+    producer.join()
+    pipe.close()
+
+
+def test_shm_pipe_timeout():
+    name = 'ngraph_test_{}'.format(uuid.uuid4().hex)
+    pipe = ShmPipe(name, COUNT * 4, depth=1, create=True, timeout=0.1)
+    try:
+        # Nobody receives, so the second tensor has no free slot
+        pipe.send(inputs(0))
+        with pytest.raises(RuntimeError, match='seconds'):
+            pipe.send(inputs(1))
+    finally:
+        os.unlink(os.path.join('/dev/shm', name))
+        pipe.close()
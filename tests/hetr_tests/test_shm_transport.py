@@ -0,0 +1,149 @@
+# ******************************************************************************
+# Copyright 2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+import multiprocessing
+import os
+from contextlib import closing
+
+import numpy as np
+
+import ngraph as ng
+import ngraph.transformers as ngt
+from ngraph.transformers.cpu.compiled_cache import is_same_view
+from ngraph.transformers.hetr.shm_transport import ShmPoolAllocator, ShmTensorReader, \
+    ShmTensorWriter, MIN_SEGMENT_BYTES, shm_path, shm_transport_enabled
+
+
+def tensors(scale):
+    return [np.arange(12, dtype=np.float32).reshape(3, 4) * scale,
+            np.array(scale, dtype=np.int32),
+            np.zeros((0, 5), dtype=np.float32),
+            np.ones(7, dtype=np.float64) * scale]
+
+
+def consume(requests, replies):
+    # Plays the server: views the inputs in place and returns their sums
+    reader = ShmTensorReader()
+    for descriptors in iter(requests.get, None):
+        views = [reader.view(*d) for d in descriptors]
+        replies.put([float(v.sum()) for v in views])
+    reader.close()
+
+
+def test_shm_transport():
+    writer = ShmTensorWriter()
+    requests, replies = multiprocessing.Queue(), multiprocessing.Queue()
+    consumer = multiprocessing.Process(target=consume, args=(requests, replies))
+    consumer.start()
+    try:
+        names = []
+        for scale in (1, 2, 3):
+            values = tensors(scale)
+            offsets = writer.write(values)
+            assert all(offset % 64 == 0 for offset in offsets)
+            requests.put([(writer.name, offset, v.shape, v.dtype)
+                          for offset, v in zip(offsets, values)])
+            assert replies.get(timeout=60) == [float(v.sum()) for v in values]
+            names.append(writer.name)
+        # The segment is reused, and unlinked once the consumer mapped it
+        assert len(set(names)) == 1
+        assert not os.path.exists(shm_path(writer.name))
+
+        # Tensors that do not fit replace the segment
+        large = [np.ones(MIN_SEGMENT_BYTES // 4 + 1, dtype=np.float32)]
+        offsets = writer.write(large)
+        assert writer.name != names[0] and writer.size > MIN_SEGMENT_BYTES
+        requests.put([(writer.name, offsets[0], large[0].shape, large[0].dtype)])
+        assert replies.get(timeout=60) == [float(large[0].sum())]
+    finally:
+        requests.put(None)
+        consumer.join()
+        name = writer.name
+        writer.close()
+    assert not os.path.exists(shm_path(name))
+
+
+def test_shm_transport_enabled(monkeypatch):
+    assert shm_transport_enabled('localhost:50051')
+    assert not shm_transport_enabled('remote-host.example:50051')
+    monkeypatch.setenv('HETR_SHM_TRANSPORT', '0')
+    assert not shm_transport_enabled('localhost:50051')
+
+
+def test_shm_pool_allocator():
+    allocator = ShmPoolAllocator()
+    reader = ShmTensorReader()
+    pool = allocator(256, 64, np.dtype(np.float32))
+    assert allocator(0, 64, np.dtype(np.float32)) is None
+    name = allocator.segments[0][0]
+    try:
+        tensor = pool[64:76].view(np.float32).reshape(3, 4)
+        assert allocator.locate(tensor) == (name, 256)
+        assert allocator.locate(tensor[:, :2]) is None
+        assert allocator.locate(np.zeros((3, 4), dtype=np.float32)) is None
+
+        # Another mapping writes the tensor, pinned segments are not unlinked by readers
+        view = reader.view(name, 256, (3, 4), np.float32, pinned=True)
+        view[()] = np.arange(12).reshape(3, 4)
+        assert os.path.exists(shm_path(name))
+        np.testing.assert_array_equal(tensor, np.arange(12).reshape(3, 4))
+        assert not is_same_view(tensor, view)
+        assert is_same_view(tensor, allocator.view(name, 256, (3, 4), np.float32))
+        assert allocator.view('ngraph_hetr_unknown', 0, (3, 4), np.float32) is None
+    finally:
+        reader.close()
+        allocator.close()
+    assert not os.path.exists(shm_path(name))
+
+
+def test_shared_pool_computation():
+    # The memory pools of a HeTr server on the host of its client, which writes the
+    # arguments and reads the results in place
+    allocator = ShmPoolAllocator()
+    reader = ShmTensorReader()
+    ax_a, ax_b = ng.make_axis(length=4), ng.make_axis(length=8)
+    x = ng.placeholder([ax_a, ax_b])
+    w = ng.variable([ax_a, ax_b], initial_value=0.5)
+    y = ng.tanh(x) * w + 1
+    np_x = np.random.uniform(-1, 1, (4, 8)).astype(np.float32)
+    try:
+        factory = ngt.make_transformer_factory('cpu', pool_allocator=allocator)
+        with closing(factory()) as transformer:
+            computation = transformer.computation(y, x)
+            expected = np.tanh(np_x) * 0.5 + 1
+            np.testing.assert_allclose(computation(np_x), expected, rtol=1e-6)
+
+            param, = computation.parameter_tensors()
+            name, offset = allocator.locate(param)
+            for scale in (2, 3):
+                # The client writes the argument into the pool of the server
+                reader.view(name, offset, param.shape, param.dtype, pinned=True)[()] = \
+                    np_x * scale
+                value = allocator.view(name, offset, param.shape, param.dtype)
+                assert is_same_view(param, value)
+                result = computation(value)
+                assert allocator.locate(result) is not None
+                np.testing.assert_allclose(result, np.tanh(np_x * scale) * 0.5 + 1,
+                                           rtol=1e-6)
+
+            # Other transformers of the process keep private pools
+            with closing(ngt.make_transformer_factory('cpu')()) as other:
+                other_computation = other.computation(y, x)
+                other_computation(np_x)
+                param, = other_computation.parameter_tensors()
+                assert allocator.locate(param) is None
+    finally:
+        reader.close()
+        allocator.close()
@@ -16,7 +16,7 @@
 import pytest
 
 import ngraph as ng
-from ngraph.transformers.passes.memlayout import MemoryManager
+from ngraph.transformers.passes.memlayout import MemLayoutPass, MemoryManager
 from ngraph.testing import ExecutorFactory
 
 
@@ -231,3 +231,54 @@ def test_memory_manager_memory_align():
 # test_memory_manager_bad_free()
 # test_memory_manager_align()
 # test_memory_manager_memory_align()
+
+
+class LayoutTensor(object):
+    def __init__(self, size):
+        self.size = size
+        self.buffer_pool_offset = None
+
+
+class LayoutDecl(object):
+    def __init__(self, tensor_decl):
+        self.tensor_decl = tensor_decl
+
+
+class LayoutExOp(object):
+    """
+    The parts of an exop MemLayoutPass.layout_memory_best_fit reads.
+    """
+    def __init__(self, inputs=(), outputs=(), free=(), inplace_inputs=None):
+        self.input_decls = [LayoutDecl(tensor) for tensor in inputs]
+        self.output_decls = [LayoutDecl(tensor) for tensor in outputs]
+        self.liveness_new_list = list(outputs)
+        self.liveness_free_list = list(free)
+        self.inplace_inputs = inplace_inputs or dict()
+        self.packed_inputs = ()
+        self.packed_outputs = ()
+
+
+def test_memory_layout_inplace():
+    a, b, c, d, e, f = [LayoutTensor(16) for _ in range(6)]
+    memlayout = MemLayoutPass()
+    memlayout.byte_alignment = 1
+    memlayout.exop_block = [
+        LayoutExOp(outputs=[a]),
+        # a is dead after this exop, so b takes its buffer
+        LayoutExOp(inputs=[a], outputs=[b], free=[a], inplace_inputs={0: (0,)}),
+        # b is still read later, so c gets its own buffer
+        LayoutExOp(inputs=[b], outputs=[c], inplace_inputs={0: (0,)}),
+        # Both inputs are dead; d takes c, its first choice, and b's buffer is freed
+        LayoutExOp(inputs=[b, c], outputs=[d], free=[b, c], inplace_inputs={0: (1, 0)}),
+        LayoutExOp(inputs=[d], outputs=[e], free=[d]),
+        # c's buffer is freed once, with d
+        LayoutExOp(inputs=[e], outputs=[f], free=[e, f]),
+    ]
+
+    assert memlayout.layout_memory_best_fit() == 32
+    assert (a.buffer_pool_offset, b.buffer_pool_offset) == (0, 0)
+    assert c.buffer_pool_offset == 16
+    assert d.buffer_pool_offset == 16
+    assert e.buffer_pool_offset == 0
+    assert f.buffer_pool_offset == 16
+
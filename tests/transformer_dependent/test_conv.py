@@ -47,13 +47,29 @@ def n4_hw12_c3_5x5(transformer_factory):
     return dict(C=3, N=4, K=8, H=12, W=12, R=5, S=5)
 
 
+@pytest.fixture()
+def n4_dhw6_c3_3x3x3():
+    # 3D with padding and stride: no MKL-DNN primitive, exercises the GEMM fallback
+    return dict(C=3, N=4, K=8, D=6, H=6, W=6, T=3, R=3, S=3,
+                pad_d=1, pad_h=1, pad_w=1, str_d=2, str_h=2, str_w=2)
+
+
 @pytest.fixture()
 def deconv_n4_hw4_c1_5x5():
     return dict(C=1, N=4, K=8, H=4, W=4, R=5, S=5, str_h=2, str_w=2, deconv=True)
 
 
 def test_conv(n64_hw32_c32_3x3):
-    cf = ConvParams(**n64_hw32_c32_3x3)
+    check_conv(n64_hw32_c32_3x3)
+
+
+@pytest.config.flex_disabled(reason="3D convolution is not supported by flex")
+def test_conv_3d_strided(n4_dhw6_c3_3x3x3):
+    check_conv(n4_dhw6_c3_3x3x3)
+
+
+def check_conv(conv_config):
+    cf = ConvParams(**conv_config)
 
     inputs = ng.placeholder(axes=cf.ax_i)
     filters = ng.placeholder(axes=cf.ax_f)
@@ -0,0 +1,871 @@
+# ******************************************************************************
+# Copyright 2017-2018 Intel Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ******************************************************************************
+"""
+Features of the CPU transformer and its MKL-DNN engine.
+"""
+import ctypes as ct
+import functools
+import os
+import struct
+import subprocess
+import threading
+
+import numpy as np
+import pytest
+
+import ngraph as ng
+import ngraph.transformers as ngt
+from ngraph.frontends.neon import BatchNorm
+from ngraph.op_graph.convolution import bprop_conv, update_conv
+from ngraph.transformers.cpu.cpuengine import MklLayoutTensor
+from ngraph.testing import ConvParams, RandomTensorGenerator
+
+pytestmark = [pytest.mark.transformer_dependent, pytest.config.cpu_enabled_only]
+
+rng = RandomTensorGenerator(0, np.float32)
+
+
+def mkl_transformer(transformer_factory):
+    """
+    A CPU transformer with the MKL-DNN engine, or skips the test.
+    """
+    transformer = transformer_factory()
+    if not transformer.mkldnn.enabled:
+        transformer.close()
+        pytest.skip("MKL-DNN engine not available")
+    return transformer
+
+
+def conv_net(cf):
+    """
+    Convolution fprop, relu, bprop and update of ConvParams cf.
+
+    Returns:
+        The outputs and the input, filter and error placeholders.
+    """
+    inputs = ng.placeholder(cf.ax_i)
+    filters = ng.placeholder(cf.ax_f)
+    errors = ng.placeholder(cf.ax_o)
+    output = ng.convolution(cf.conv_params, inputs, filters, axes=cf.ax_o)
+    outputs = [ng.maximum(output, 0), bprop_conv(errors, inputs, filters, output),
+               update_conv(errors, inputs, filters, output)]
+    return outputs, [inputs, filters, errors]
+
+
+def test_compile_cache_warm_start(transformer_factory, monkeypatch, tmpdir):
+    """
+    A second transformer compiling the same graphs loads them from the compile cache
+    and shares variables between the cached computations.
+    """
+    monkeypatch.setenv('NGRAPH_CPU_COMPILE_CACHE_DIR', str(tmpdir))
+
+    def run():
+        C = ng.make_axis(length=3)
+        N = ng.make_axis(length=2)
+        w = ng.variable([C], initial_value=np.array([1, 2, 3], dtype='float32'))
+        x = ng.placeholder([C, N])
+        update = ng.assign(w, w + ng.sum(x, out_axes=[C]))
+        transformer = transformer_factory()
+        try:
+            update_comp = transformer.computation(update, x)
+            eval_comp = transformer.computation(ng.dot(w, x), x)
+            read_comp = transformer.computation(w)
+            x_value = np.arange(6, dtype='float32').reshape(3, 2)
+            update_comp(x_value)
+            return eval_comp(x_value).copy(), read_comp().copy()
+        finally:
+            transformer.close()
+
+    cold = run()
+    artifacts = sorted(os.listdir(str(tmpdir)))
+    assert len(artifacts) == 3
+
+    warm = run()
+    assert sorted(os.listdir(str(tmpdir))) == artifacts
+    for cold_value, warm_value in zip(cold, warm):
+        ng.testing.assert_allclose(warm_value, cold_value)
+    ng.testing.assert_allclose(warm[1], [2, 7, 12])
+
+
+def test_compile_cache_slices(transformer_factory, monkeypatch, tmpdir):
+    """
+    Graphs that only differ in slice offsets get their own cache entries.
+    """
+    monkeypatch.setenv('NGRAPH_CPU_COMPILE_CACHE_DIR', str(tmpdir))
+    x_value = np.arange(6, dtype='float32')
+
+    def run(start, stop):
+        C = ng.make_axis(length=6)
+        x = ng.placeholder([C])
+        transformer = transformer_factory()
+        try:
+            x_slice = ng.tensor_slice(x, [slice(start, stop)])
+            return transformer.computation(x_slice * 2, x)(x_value).copy()
+        finally:
+            transformer.close()
+
+    ng.testing.assert_allclose(run(0, 2), [0, 2])
+    ng.testing.assert_allclose(run(2, 4), [4, 6])
+    assert len(os.listdir(str(tmpdir))) == 2
+    ng.testing.assert_allclose(run(2, 4), [4, 6])
+    assert len(os.listdir(str(tmpdir))) == 2
+
+
+def test_kernel_build_threads(transformer_factory, monkeypatch):
+    """
+    Kernels built on background threads compute what kernels built inline compute.
+    """
+    cf = ConvParams(C=8, N=4, K=8, H=8, W=8, R=3, S=3)
+    values = [rng.uniform(-0.5, 0.5, axes) for axes in (cf.ax_i, cf.ax_f, cf.ax_o)]
+    results = []
+    for build_threads in ('0', '4'):
+        monkeypatch.setenv('NGRAPH_MKL_BUILD_THREADS', build_threads)
+        outputs, placeholders = conv_net(cf)
+        transformer = mkl_transformer(transformer_factory)
+        try:
+            computation = transformer.computation(outputs, *placeholders)
+            computation(*values)
+            results.append([np.array(result) for result in computation(*values)])
+        finally:
+            transformer.close()
+    for inline, threaded in zip(*results):
+        ng.testing.assert_allclose(threaded, inline, rtol=1e-5)
+
+
+def test_conv_autotune_table(transformer_factory, monkeypatch, tmpdir):
+    """
+    Autotuning records a decision per convolution shape in the table, and a later
+    transformer reuses it instead of benchmarking again.
+    """
+    table_path = str(tmpdir.join('autotune.txt'))
+    monkeypatch.setenv('NGRAPH_MKL_CONV_AUTOTUNE', '1')
+    monkeypatch.setenv('NGRAPH_MKL_CONV_AUTOTUNE_CACHE', table_path)
+    cf = ConvParams(C=8, N=4, K=8, H=8, W=8, R=3, S=3)
+    values = [rng.uniform(-0.5, 0.5, axes) for axes in (cf.ax_i, cf.ax_f)]
+
+    def run():
+        inputs = ng.placeholder(cf.ax_i)
+        filters = ng.placeholder(cf.ax_f)
+        output = ng.convolution(cf.conv_params, inputs, filters, axes=cf.ax_o)
+        transformer = mkl_transformer(transformer_factory)
+        try:
+            result = transformer.computation(output, inputs, filters)(*values).copy()
+            impls = set(transformer.mkldnn.kernel_impl_info(name)
+                        for name in transformer.mkldnn.kernels)
+            return result, impls
+        finally:
+            transformer.close()
+
+    tuned, tuned_impls = run()
+    with open(table_path) as f:
+        table = f.read()
+    entries = [line.split() for line in table.splitlines()]
+    assert len(entries) == 1
+    key, algorithm, impl, time_ms = entries[0]
+    assert key.startswith('fwd') and algorithm in ('direct', 'winograd')
+    assert impl in tuned_impls
+
+    reused, reused_impls = run()
+    with open(table_path) as f:
+        assert f.read() == table
+    assert impl in reused_impls
+    ng.testing.assert_allclose(reused, tuned, rtol=1e-5)
+
+    # Transformers opened without NGRAPH_MKL_CONV_AUTOTUNE no longer autotune
+    os.remove(table_path)
+    monkeypatch.delenv('NGRAPH_MKL_CONV_AUTOTUNE')
+    run()
+    assert not os.path.exists(table_path)
+
+
+def test_mkl_layout_assignment(transformer_factory, monkeypatch):
+    """
+    An add of a blocked relu output and a native tensor runs on native tensors,
+    which saves the reorder of its blocked result, and computes what the greedy
+    layouts compute.
+    """
+    cf = ConvParams(C=8, N=4, K=8, H=8, W=8, R=3, S=3)
+    values = [rng.uniform(-0.5, 0.5, axes) for axes in (cf.ax_i, cf.ax_f, cf.ax_o)]
+    nbytes = int(np.prod(cf.ax_o.lengths)) * 4
+    results = []
+    for layout_assign in ('0', '1'):
+        monkeypatch.setenv('NGRAPH_MKL_LAYOUT_ASSIGN', layout_assign)
+        inputs = ng.placeholder(cf.ax_i)
+        filters = ng.placeholder(cf.ax_f)
+        other = ng.placeholder(cf.ax_o)
+        relu = ng.maximum(ng.convolution(cf.conv_params, inputs, filters, axes=cf.ax_o), 0)
+        transformer = mkl_transformer(transformer_factory)
+        try:
+            computation = transformer.computation([relu, relu + other],
+                                                  inputs, filters, other)
+            results.append([np.array(result) for result in computation(*values)])
+            reports = transformer.mkldnn.layout_reports
+        finally:
+            transformer.close()
+
+    # Greedy: the relu and the add output reorders; assigned: only the relu output
+    assert len(reports) == 1
+    report = reports[0]
+    assert report['greedy_reorder_bytes'] == 2 * nbytes
+    assert report['assigned_reorder_bytes'] == nbytes
+    assert report['inserted_reorder_bytes'] == nbytes
+    assert len(report['native_ops']) == 1
+    for greedy, assigned in zip(*results):
+        ng.testing.assert_allclose(assigned, greedy, rtol=1e-5)
+
+
+def test_binary_eltwise_broadcast(transformer_factory):
+    """
+    Binary elementwise ops on a blocked convolution output and a per-channel operand
+    broadcast as numpy does, with the blocked operand on either side.
+    """
+    cf = ConvParams(C=8, N=4, K=16, H=8, W=8, R=3, S=3)
+    values = [rng.uniform(-0.5, 0.5, cf.ax_i), rng.uniform(-0.5, 0.5, cf.ax_f),
+              rng.uniform(1, 2, [cf.ax_o[0]])]
+    inputs = ng.placeholder(cf.ax_i)
+    filters = ng.placeholder(cf.ax_f)
+    channel = ng.placeholder([cf.ax_o[0]])
+    output = ng.convolution(cf.conv_params, inputs, filters, axes=cf.ax_o)
+    ops = [np.add, np.subtract, np.multiply, np.divide]
+    binary = [output + channel, output - channel, output * channel, output / channel,
+              channel + output, channel - output, channel * output, channel / output]
+    transformer = mkl_transformer(transformer_factory)
+    try:
+        computation = transformer.computation([output] + binary, inputs, filters, channel)
+        results = [np.array(result) for result in computation(*values)]
+    finally:
+        transformer.close()
+
+    conv_value = results[0]
+    channel_value = values[2].reshape((-1, 1, 1, 1, 1))
+    expected = [op(conv_value, channel_value) for op in ops] + \
+        [op(channel_value, conv_value) for op in ops]
+    for result, value in zip(results[1:], expected):
+        ng.testing.assert_allclose(result, value, rtol=1e-5)
+
+
+def test_scaled_sum_fusion(transformer_factory):
+    """
+    A tree of adds, subtracts, negations and scalar scales is fused into one sum
+    kernel that honors the sign and scale of every term.
+    """
+    C = ng.make_axis(length=16)
+    N = ng.make_axis(length=8)
+    a, b, c, d = [ng.placeholder([C, N]) for _ in range(4)]
+    values = [rng.uniform(-1, 1, [C, N]) for _ in range(4)]
+    transformer = mkl_transformer(transformer_factory)
+    try:
+        result = transformer.computation(2 * a - (b - 0.5 * c) + -d, a, b, c, d)(*values)
+        sum_kernels = [name for name in transformer.mkldnn.kernels
+                       if name.startswith('ScaledSumOp')]
+    finally:
+        transformer.close()
+
+    assert len(sum_kernels) == 1
+    a_value, b_value, c_value, d_value = values
+    ng.testing.assert_allclose(result, 2 * a_value - b_value + 0.5 * c_value - d_value,
+                               rtol=1e-5)
+
+
+def overlapping_temporaries(computation_decl):
+    """
+    Pairs of temporaries live at the same exop whose buffers overlap, other than an
+    output written over an input that dies at that exop.
+    """
+    overlaps = []
+    for exop in computation_decl.exop_block:
+        donors = set(exop.input_decls[pos].tensor_decl
+                     for positions in exop.inplace_inputs.values() for pos in positions)
+        live = list(exop.liveness_live_list)
+        for i, first in enumerate(live):
+            for second in live[i + 1:]:
+                if first.buffer_pool_offset + first.size <= second.buffer_pool_offset or \
+                        second.buffer_pool_offset + second.size <= first.buffer_pool_offset:
+                    continue
+                if (first in donors or second in donors) and \
+                        (first in exop.liveness_free_list or second in exop.liveness_free_list):
+                    continue
+                overlaps.append((exop, first, second))
+    return overlaps
+
+
+def test_inplace_add_chain(transformer_factory, monkeypatch):
+    """
+    Adds write over an input only once nothing reads it any more: not over a
+    tensor read by a later add, nor over a returned one.
+    """
+    C = ng.make_axis(length=16)
+    N = ng.make_axis(length=8)
+    values = [rng.uniform(-1, 1, [C, N]) for _ in range(3)]
+    results = []
+    temporary_bytes = []
+    for inplace in ('0', '1'):
+        monkeypatch.setenv('NGRAPH_CPU_INPLACE', inplace)
+        x, y, z = [ng.placeholder([C, N]) for _ in range(3)]
+        a = x + y
+        b = a + z
+        c = b + a
+        d = c + z
+        e = d + x
+        transformer = transformer_factory()
+        try:
+            computation = transformer.computation([b, e], x, y, z)
+            results.append([np.array(result) for result in computation(*values)])
+            computation_decl = computation.computation_decl
+            assert overlapping_temporaries(computation_decl) == []
+            temporary_bytes.append(computation_decl.temporary_max_allocated)
+            aliased = [exop for exop in computation_decl.exop_block
+                       for output_pos, positions in exop.inplace_inputs.items()
+                       if any(exop.output_decls[output_pos].tensor_decl.buffer_pool_offset ==
+                              exop.input_decls[pos].tensor_decl.buffer_pool_offset
+                              for pos in positions)]
+        finally:
+            transformer.close()
+
+    # c over a, d over c and e over d; b is read by c and returned
+    assert len(aliased) == 3
+    assert temporary_bytes[1] < temporary_bytes[0]
+    x_value, y_value, z_value = values
+    b_value = x_value + y_value + z_value
+    e_value = b_value + x_value + y_value + z_value + x_value
+    for plain, inplace in zip(*results):
+        ng.testing.assert_allclose(inplace, plain)
+    ng.testing.assert_allclose(results[1][0], b_value, rtol=1e-5)
+    ng.testing.assert_allclose(results[1][1], e_value, rtol=1e-5)
+
+
+def test_roofline_report(transformer_factory, monkeypatch):
+    """
+    Per-primitive counters count the runs since the last reset, and the roofline
+    rows carry the analytical convolution flops.
+    """
+    monkeypatch.setenv('NGRAPH_MKL_PERF_COUNTERS', '1')
+    cf = ConvParams(C=8, N=4, K=8, H=8, W=8, R=3, S=3)
+    values = [rng.uniform(-0.5, 0.5, axes) for axes in (cf.ax_i, cf.ax_f)]
+    inputs = ng.placeholder(cf.ax_i)
+    filters = ng.placeholder(cf.ax_f)
+    output = ng.convolution(cf.conv_params, inputs, filters, axes=cf.ax_o)
+    transformer = mkl_transformer(transformer_factory)
+    try:
+        computation = transformer.computation(ng.maximum(output, 0), inputs, filters)
+        computation(*values)
+        transformer.mkldnn.reset_perf_counters()
+        for _ in range(3):
+            computation(*values)
+
+        mkldnn = transformer.mkldnn
+        conv_names = [name for name in computation.kernel_names()
+                      if name.startswith('ConvolutionOp') and name in mkldnn.kernels]
+        assert len(conv_names) == 1
+        kernel = mkldnn.kernels[conv_names[0]]
+        counters = (ct.c_double * 7)()
+        entry_calls = []
+        while True:
+            calls = mkldnn.query_counters(kernel, len(entry_calls), counters)
+            if calls < 0:
+                break
+            entry_calls.append(calls)
+        assert entry_calls and set(entry_calls) == {3}
+
+        rows = computation.roofline_report(peak_gflops=100.0, peak_gbps=10.0)
+    finally:
+        transformer.close()
+
+    assert rows
+    for row in rows:
+        assert set(row) == {'name', 'kind', 'calls', 'time_ms', 'flops', 'bytes',
+                            'intensity', 'gflops', 'gbps', 'dram_bytes', 'ipc', 'bound',
+                            'efficiency'}
+        assert row['calls'] == 3 and row['kind'] in ('op', 'reorder')
+        assert row['bound'] in ('compute', 'memory') and row['efficiency'] is not None
+    conv_row = [row for row in rows if row['name'] == conv_names[0] and row['kind'] == 'op']
+    C, _, R, S, K = cf.ax_f.lengths
+    N = cf.ax_o.lengths[-1]
+    positions = int(np.prod(cf.ax_o.lengths[1:-1]))
+    assert len(conv_row) == 1
+    assert conv_row[0]['flops'] == 2 * C * R * S * K * N * positions
+    assert conv_row[0]['bytes'] > 0
+    assert len(transformer.mkldnn.format_roofline_report(rows).splitlines()) == len(rows) + 1
+
+
+def test_memory_stats(transformer_factory):
+    """
+    Engine memory accounting rises while a computation exists, keeps its peak and
+    returns to the baseline in every category once the transformer is closed.
+    """
+    cf = ConvParams(C=8, N=4, K=8, H=8, W=8, R=3, S=3)
+    values = [rng.uniform(-0.5, 0.5, axes) for axes in (cf.ax_i, cf.ax_f, cf.ax_o)]
+    outputs, placeholders = conv_net(cf)
+    transformer = mkl_transformer(transformer_factory)
+    mkldnn = transformer.mkldnn
+    try:
+        baseline = mkldnn.memory_stats()
+        computation = transformer.computation(outputs, *placeholders)
+        computation(*values)
+        running = mkldnn.memory_stats()
+        stats = computation.memory_stats()
+    finally:
+        transformer.close()
+    closed = mkldnn.memory_stats()
+
+    assert running['current'] > baseline['current']
+    assert running['peak'] >= running['current']
+    for category in ('temporary', 'persistent'):
+        assert running['categories'][category]['current'] >= \
+            baseline['categories'][category]['current'] + stats[category]
+    assert stats['high_water'] == sum(value for key, value in stats.items()
+                                      if key != 'high_water')
+
+    assert closed['current'] == baseline['current']
+    assert closed['peak'] >= running['current']
+    for category, values in closed['categories'].items():
+        assert values['current'] == baseline['categories'][category]['current']
+        assert values['peak'] >= running['categories'][category]['current']
+
+
+def test_bucketed_computation(transformer_factory):
+    """
+    Arguments are padded up to the smallest bucket that fits, results are sliced
+    back, buckets compile on first use and share variables.
+    """
+    F = ng.make_axis(length=3, name='F')
+    H = ng.make_axis(length=2, name='H')
+    weights_value = rng.uniform(-1, 1, [H, F])
+    weights = ng.variable([H, F], initial_value=weights_value)
+
+    def build(N):
+        x = ng.placeholder([F, ng.make_axis(length=N, name='N')])
+        return [ng.dot(weights, x), ng.sum(x, out_axes=[F])], x
+
+    transformer = transformer_factory()
+    try:
+        bucketed = transformer.bucketed_computation(build, {'N': [2, 4]}, pad_value=1)
+        double = transformer.computation(ng.assign(weights, 2 * weights))
+        x_values = dict((N, rng.uniform(-1, 1, [F, ng.make_axis(length=N)]))
+                        for N in (1, 3, 4))
+
+        dot, row_sum = bucketed(x_values[1])
+        assert sorted(bucketed.computations) == [(2,)]
+        assert dot.shape == (2, 1)
+        ng.testing.assert_allclose(dot, weights_value.dot(x_values[1]), rtol=1e-5)
+        # The reduction over N sees the padding
+        ng.testing.assert_allclose(row_sum, x_values[1].sum(axis=1) + 1, rtol=1e-5)
+
+        for N in (3, 4):
+            dot, row_sum = bucketed(x_values[N])
+            assert dot.shape == (2, N)
+            ng.testing.assert_allclose(dot, weights_value.dot(x_values[N]), rtol=1e-5)
+            ng.testing.assert_allclose(row_sum, x_values[N].sum(axis=1) + 4 - N, rtol=1e-5)
+        assert sorted(bucketed.computations) == [(2,), (4,)]
+
+        with pytest.raises(ValueError):
+            bucketed(rng.uniform(-1, 1, [F, ng.make_axis(length=5)]))
+
+        # Both buckets read the variable the other computation updated
+        double()
+        for N in (1, 3):
+            dot, _ = bucketed(x_values[N])
+            ng.testing.assert_allclose(dot, 2 * weights_value.dot(x_values[N]), rtol=1e-5)
+    finally:
+        transformer.close()
+
+
+def test_bucketed_computation_shares_reorders(transformer_factory):
+    """
+    The convolution kernels of the buckets reorder the filters into one buffer and
+    compute what computations without buckets compute.
+    """
+    def conv(N, filters):
+        cf = ConvParams(C=8, N=N, K=8, H=8, W=8, R=3, S=3)
+        inputs = ng.placeholder(cf.ax_i)
+        return ng.convolution(cf.conv_params, inputs, filters, axes=cf.ax_o), inputs
+
+    ax_f = ConvParams(C=8, K=8, H=8, W=8, R=3, S=3).ax_f
+    filters_value = rng.uniform(-0.5, 0.5, ax_f)
+    values = dict((N, rng.uniform(-0.5, 0.5, ConvParams(C=8, N=N, H=8, W=8).ax_i))
+                  for N in (1, 3, 4))
+    results = []
+    shared = []
+    for bucketed in (True, False):
+        filters = ng.variable(ax_f, initial_value=filters_value)
+        transformer = mkl_transformer(transformer_factory)
+        try:
+            if bucketed:
+                share_reorder = transformer.mkldnn.share_reorder
+
+                def record_share(*args):
+                    shared.append(share_reorder(*args))
+                    return shared[-1]
+
+                transformer.mkldnn.share_reorder = record_share
+                computation = transformer.bucketed_computation(
+                    functools.partial(conv, filters=filters), {'N': [2, 4]})
+                results.append([np.array(computation(values[N])) for N in (1, 3, 4)])
+            else:
+                results.append([np.array(transformer.computation(*conv(N, filters))(values[N]))
+                                for N in (1, 3, 4)])
+        finally:
+            transformer.close()
+
+    # The second bucket's kernel shares the filters reordered by the first
+    assert any(shared)
+    for bucketed, plain in zip(*results):
+        ng.testing.assert_allclose(bucketed, plain, rtol=1e-5)
+
+
+def conv_model(cf, filters_value):
+    """
+    Relu of a convolution with variable filters.
+
+    Returns:
+        The output, the input placeholder and the filter variable.
+    """
+    inputs = ng.placeholder(cf.ax_i)
+    filters = ng.variable(cf.ax_f, initial_value=filters_value)
+    output = ng.convolution(cf.conv_params, inputs, filters, axes=cf.ax_o)
+    return ng.maximum(output, 0), inputs, filters
+
+
+def test_execution_contexts(transformer_factory):
+    """
+    Contexts called from two threads at once compute what the computation computes.
+    """
+    cf = ConvParams(C=8, N=4, K=8, H=8, W=8, R=3, S=3)
+    output, inputs, _ = conv_model(cf, rng.uniform(-0.5, 0.5, cf.ax_f))
+    values = [rng.uniform(-0.5, 0.5, cf.ax_i) for _ in range(4)]
+    transformer = transformer_factory()
+    try:
+        computation = transformer.computation(output, inputs)
+        expected = [np.array(computation(value)) for value in values]
+        contexts = [computation.context() for _ in range(2)]
+        results = [[None] * len(values) for _ in contexts]
+        errors = []
+
+        def run(index):
+            try:
+                for _ in range(10):
+                    for i, value in enumerate(values):
+                        results[index][i] = np.array(contexts[index](value))
+            except Exception as e:
+                errors.append(e)
+
+        threads = [threading.Thread(target=run, args=(index,))
+                   for index in range(len(contexts))]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        for context in contexts:
+            context.close()
+    finally:
+        transformer.close()
+
+    assert errors == []
+    for context_results in results:
+        for result, value in zip(context_results, expected):
+            ng.testing.assert_allclose(result, value, rtol=1e-5)
+
+
+def test_execution_context_reset_weights(transformer_factory):
+    """
+    After the variables change, reset_weights() makes the contexts use the new values.
+    """
+    cf = ConvParams(C=8, N=4, K=8, H=8, W=8, R=3, S=3)
+    filters_value = rng.uniform(-0.5, 0.5, cf.ax_f)
+    output, inputs, filters = conv_model(cf, filters_value)
+    value = rng.uniform(-0.5, 0.5, cf.ax_i)
+    transformer = transformer_factory()
+    try:
+        computation = transformer.computation(output, inputs)
+        negate = transformer.computation(ng.assign(filters, -filters))
+        contexts = [computation.context() for _ in range(2)]
+        before = [np.array(context(value)) for context in contexts]
+
+        negate()
+        contexts[0].reset_weights()
+        after = [np.array(context(value)) for context in contexts]
+        expected = np.array(computation(value))
+        for context in contexts:
+            context.close()
+    finally:
+        transformer.close()
+
+    ng.testing.assert_allclose(before[1], before[0])
+    # relu(-conv) differs from relu(conv) wherever the convolution is not zero
+    assert not np.allclose(expected, before[0])
+    for result in after:
+        ng.testing.assert_allclose(result, expected, rtol=1e-5)
+
+
+def test_mkl_checkpoint_round_trip(transformer_factory, tmpdir):
+    """
+    Filters saved with save_mkl_checkpoint load into another transformer, which then
+    computes what the saving transformer computed. With MKL-DNN, the convolution
+    reads the saved filters in place.
+    """
+    cf = ConvParams(C=8, N=4, K=8, H=8, W=8, R=3, S=3)
+    output, inputs, filters = conv_model(cf, rng.uniform(-0.5, 0.5, cf.ax_f))
+    value = rng.uniform(-0.5, 0.5, cf.ax_i)
+    path = str(tmpdir.join('weights.ckpt'))
+
+    transformer = transformer_factory()
+    try:
+        double = transformer.computation(ng.assign(filters, filters * 2))
+        computation = transformer.computation(output, inputs)
+        read = transformer.computation(filters)
+        double()
+        expected = np.array(computation(value))
+        filters_value = np.array(read())
+        computation.save_mkl_checkpoint(path)
+    finally:
+        transformer.close()
+
+    # Readable like any file the process creates, for other users serving the model
+    umask = os.umask(0)
+    os.umask(umask)
+    assert os.stat(path).st_mode & 0o777 == 0o666 & ~umask
+
+    for native in (False, True):
+        transformer = transformer_factory()
+        try:
+            computation = transformer.computation(output, inputs)
+            read = transformer.computation(filters)
+            stats = computation.load_mkl_checkpoint(path, native=native)
+            assert stats['missing'] == []
+            if transformer.mkldnn.enabled and not native:
+                assert stats['bound_inputs'] > 0
+            else:
+                assert stats['bound_inputs'] == 0
+                # Bound filters are only read by the kernel, the others are loaded
+                ng.testing.assert_allclose(read(), filters_value)
+            ng.testing.assert_allclose(computation(value), expected, rtol=1e-5)
+        finally:
+            transformer.close()
+
+
+def test_lazy_return(transformer_factory):
+    """
+    A result returned in its MKL-DNN layout is used like the ndarray of its value.
+    """
+    cf = ConvParams(C=8, N=4, K=8, H=8, W=8, R=3, S=3)
+    filters_value = rng.uniform(-0.5, 0.5, cf.ax_f)
+    output, inputs, _ = conv_model(cf, filters_value)
+    output.metadata['mkl_lazy_return'] = True
+    plain_output, plain_inputs, _ = conv_model(cf, filters_value)
+    value = rng.uniform(-0.5, 0.5, cf.ax_i)
+    transformer = mkl_transformer(transformer_factory)
+    try:
+        expected = np.array(transformer.computation(plain_output, plain_inputs)(value))
+        result = transformer.computation(output, inputs)(value)
+        # The relu output is blocked, see test_mkl_layout_assignment
+        assert isinstance(result, MklLayoutTensor)
+        copy = result.copy()
+        assert isinstance(copy, np.ndarray)
+        ng.testing.assert_allclose(copy, expected)
+        ng.testing.assert_allclose(result * 2 + 1, expected * 2 + 1)
+        ng.testing.assert_allclose(np.maximum(result, 0.1), np.maximum(expected, 0.1))
+        ng.testing.assert_allclose(result.sum(axis=0), expected.sum(axis=0), rtol=1e-5)
+        assert result.T.shape == expected.T.shape
+    finally:
+        transformer.close()
+
+
+def inference_net(cf):
+    """
+    A convolution and relu, which have MKL-DNN kernels, followed by tanh, minimum and
+    sum, which run with numpy.
+
+    Returns:
+        The output and the input placeholder.
+    """
+    output, inputs, _ = conv_model(cf, rng.uniform(-0.5, 0.5, cf.ax_f))
+    output = ng.minimum(ng.tanh(output), 0.5)
+    return ng.sum(output, reduction_axes=output.axes.sample_axes()), inputs
+
+
+def exportable_factory(transformer_factory):
+    """
+    A factory of transformer_factory's transformers that keep their kernel creation
+    calls for export_inference.
+    """
+    return ngt.make_transformer_factory(transformer_factory.name, exportable=True)
+
+
+def build_inference_runtime():
+    """
+    Builds libngraph_inference.so with make inference_runtime, or skips the test.
+
+    Returns:
+        The loaded library.
+    """
+    if not os.environ.get('MKLDNN_ROOT'):
+        pytest.skip("MKLDNN_ROOT not set")
+    root = os.path.dirname(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+    subprocess.check_call(['make', '-C', root, 'inference_runtime'])
+    lib = ct.CDLL(os.path.join(root, 'build', 'libngraph_inference.so'))
+    lib.load_inference_model.restype = ct.c_void_p
+    lib.load_inference_model.argtypes = [ct.c_char_p]
+    lib.inference_model_error.restype = ct.c_char_p
+    lib.free_inference_model.argtypes = [ct.c_void_p]
+    for function in (lib.inference_input_index, lib.inference_output_index):
+        function.argtypes = [ct.c_void_p, ct.c_char_p]
+    for function in (lib.inference_input_shape, lib.inference_output_shape):
+        function.argtypes = [ct.c_void_p, ct.c_int, ct.POINTER(ct.c_longlong)]
+    for function in (lib.bind_inference_input, lib.fetch_inference_output):
+        function.argtypes = [ct.c_void_p, ct.c_int, ct.c_void_p, ct.c_size_t]
+    lib.run_inference_model.argtypes = [ct.c_void_p]
+    return lib
+
+
+def test_export_inference(transformer_factory, tmpdir):
+    """
+    export_inference writes the runtime file of a computation, with its parameter as
+    the input and its return as the output.
+    """
+    cf = ConvParams(C=8, N=4, K=8, H=8, W=8, R=3, S=3)
+    output, inputs = inference_net(cf)
+    path = str(tmpdir.join('model.ngi'))
+    transformer = mkl_transformer(exportable_factory(transformer_factory))
+    try:
+        transformer.computation(output, inputs).export_inference(path)
+    finally:
+        transformer.close()
+
+    with open(path, 'rb') as f:
+        data = f.read()
+    assert data[:12] == b'NGINFER1' + struct.pack('<I', 1)
+    assert inputs.tensor.name.encode('utf-8') in data
+    assert output.name.encode('utf-8') in data
+
+
+def test_export_inference_not_exportable(transformer_factory, tmpdir):
+    """
+    Transformers not created with exportable=True keep no kernel creation calls and
+    can not export.
+    """
+    cf = ConvParams(C=8, N=4, K=8, H=8, W=8, R=3, S=3)
+    output, inputs = inference_net(cf)
+    transformer = transformer_factory()
+    try:
+        computation = transformer.computation(output, inputs)
+        computation(rng.uniform(-0.5, 0.5, cf.ax_i))
+        assert transformer.mkldnn_records == {}
+        with pytest.raises(ValueError):
+            computation.export_inference(str(tmpdir.join('model.ngi')))
+    finally:
+        transformer.close()
+
+
+def test_inference_runtime(transformer_factory, tmpdir):
+    """
+    libngraph_inference.so runs an exported computation, its MKL-DNN kernels and the
+    unary, binary and reduction steps run with numpy, like the transformer.
+    """
+    cf = ConvParams(C=8, N=4, K=8, H=8, W=8, R=3, S=3)
+    output, inputs = inference_net(cf)
+    value = rng.uniform(-0.5, 0.5, cf.ax_i)
+    path = str(tmpdir.join('model.ngi'))
+    transformer = mkl_transformer(exportable_factory(transformer_factory))
+    try:
+        computation = transformer.computation(output, inputs)
+        expected = np.array(computation(value))
+        computation.export_inference(path)
+    finally:
+        transformer.close()
+
+    lib = build_inference_runtime()
+    model = lib.load_inference_model(path.encode('utf-8'))
+    assert model, lib.inference_model_error()
+    try:
+        assert lib.inference_model_num_inputs(model) == 1
+        assert lib.inference_model_num_outputs(model) == 1
+        input_index = lib.inference_input_index(model, inputs.tensor.name.encode('utf-8'))
+        output_index = lib.inference_output_index(model, output.name.encode('utf-8'))
+        assert input_index == 0 and output_index == 0
+
+        shape = (ct.c_longlong * 8)()
+        ndim = lib.inference_output_shape(model, output_index, shape)
+        assert tuple(shape[:ndim]) == expected.shape
+        value = np.ascontiguousarray(value, dtype=np.float32)
+        assert lib.bind_inference_input(model, input_index, value.ctypes.data,
+                                        value.nbytes) == 0
+        assert lib.run_inference_model(model) == 0
+        result = np.empty(expected.shape, dtype=np.float32)
+        assert lib.fetch_inference_output(model, output_index, result.ctypes.data,
+                                          result.nbytes) == 0
+    finally:
+        lib.free_inference_model(model)
+
+    ng.testing.assert_allclose(result, expected, rtol=1e-5, atol=1e-5)
+
+
+def test_configure_threads(transformer_factory):
+    """
+    configure_threads splits the threads between callers, and thread_stats reports the
+    kernel runs and the idle and wakeup times of the kernel threads.
+    """
+    cf = ConvParams(C=8, N=4, K=8, H=8, W=8, R=3, S=3)
+    output, inputs, _ = conv_model(cf, rng.uniform(-0.5, 0.5, cf.ax_f))
+    transformer = mkl_transformer(transformer_factory)
+    try:
+        config = transformer.mkldnn.configure_threads(num_threads=4, callers=2, spin_us=0)
+        assert config['team_size'] == 2
+        computation = transformer.computation(output, inputs)
+        transformer.mkldnn.reset_thread_stats()
+        computation(rng.uniform(-0.5, 0.5, cf.ax_i))
+        stats = transformer.mkldnn.thread_stats()
+        assert set(stats) == {'idle_ms', 'idle_gaps', 'wakeup_ms', 'wakeups', 'max_wakeup_ms',
+                              'kernel_runs'}
+        assert stats['kernel_runs'] > 0
+        assert stats['idle_ms'] >= 0 and stats['wakeup_ms'] >= 0
+    finally:
+        transformer.close()
+
+
+@pytest.mark.parametrize('variables_first', [False, True])
+def test_batchnorm_fprop_bprop(transformer_factory, variables_first):
+    """
+    Batchnorm fprop and bprop match numpy whether gamma and beta are laid out back to
+    back for the batchnorm kernels or were first laid out by another computation.
+    """
+    ax_i = ConvParams(C=8, N=8, H=4, W=4).ax_i
+    gamma, beta, eps = 0.6, 0.3, 1e-3
+    x = ng.placeholder(ax_i)
+    layer = BatchNorm(rho=0.9, eps=eps, init_gamma=gamma, init_beta=beta)
+    output = layer(x)
+    delta = ng.placeholder(output.axes)
+    grads = [ng.deriv(output, var, delta) for var in (x, layer.gamma, layer.beta)]
+    x_value = rng.uniform(0, 1, ax_i)
+    delta_value = rng.uniform(-0.1, 0.1, ax_i)
+    transformer = transformer_factory()
+    try:
+        if variables_first:
+            transformer.computation([layer.beta, layer.gamma])()
+        computation = transformer.computation([output] + grads, x, delta)
+        results = [np.array(result) for result in computation(x_value, delta_value)]
+    finally:
+        transformer.close()
+
+    red_args = dict(axis=(1, 2, 3, 4), keepdims=True)
+    count = np.prod(x_value.shape[1:])
+    inv_std = 1.0 / np.sqrt(x_value.var(**red_args) + eps)
+    xhat = (x_value - x_value.mean(**red_args)) * inv_std
+    dgamma = np.sum(delta_value * xhat, **red_args)
+    dbeta = np.sum(delta_value, **red_args)
+    dx = gamma * inv_std * (delta_value - (xhat * dgamma + dbeta) / count)
+    expected = [gamma * xhat + beta, dx, dgamma.squeeze(), dbeta.squeeze()]
+    for result, value in zip(results, expected):
+        ng.testing.assert_allclose(result, value, rtol=1e-4, atol=1e-5)
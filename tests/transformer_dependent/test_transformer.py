@@ -79,3 +79,4 @@ def test_execute_non_placeholder():
     with pytest.raises(ValueError):
         with executor(x + y, x, y) as ex:
             ex
+